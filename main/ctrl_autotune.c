@@ -0,0 +1,228 @@
+//Relay feedback speed loop tuning, see ctrl_autotune.h
+
+#include <string.h>
+#include <math.h>
+#include "nvs.h"
+#include "ctrl_autotune.h"
+
+#define ctrl_AUTOTUNE_RELAY_DUTY        (400.0f)    //USERSET: relay d, duty counts either side of the bias
+#define ctrl_AUTOTUNE_HYST_MPH          (0.5f)      //Relay hysteresis on the filtered speed, above the estimate's noise
+#define ctrl_AUTOTUNE_SETTLE_CYCLES     (2)         //Cycles left out while the bias evens out
+#define ctrl_AUTOTUNE_MEASURE_CYCLES    (4)         //Cycles averaged for Ku and Tu
+#define ctrl_AUTOTUNE_BAND_TIMEOUT_MS   (30000)
+#define ctrl_AUTOTUNE_RANGE_MPH         (8.0f)      //Give up if the speed goes this far from the setting once relaying
+#define ctrl_AUTOTUNE_MIN_MPH           (10.0f)     //Same floor as speed control (ctrl_MIN_SPEED_CONTROL_MPH)
+#define ctrl_AUTOTUNE_LAST_BAND_SPAN    (12.0f)     //Width assumed for the top band when picking its test speed
+#define ctrl_AUTOTUNE_TOP_SPEED_SHARE   (0.85f)     //Test speeds stay below this share of the battery's no-load speed
+#define ctrl_AUTOTUNE_STAND_INERTIA_RATIO (24.0f)   //USERSET: car (110 kg with driver) over the wheel's equivalent mass (J/r^2), 1 on the road
+#define ctrl_AUTOTUNE_RESPONSE_S        (1.5f)      //USERSET: closed loop time constant asked of the tuned loop; shorter amplifies estimate noise
+
+#define ctrl_AUTOTUNE_NVS_NAMESPACE     "ctrl"
+#define ctrl_AUTOTUNE_NVS_KEY           "spdgains"
+#define ctrl_AUTOTUNE_NVS_MAGIC         (0x53504731)    //"SPG1", changes with ctrl_speedPiGains_t
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;
+    ctrl_speedPiGains_t gains;
+} ctrl_autotuneStored_t;
+
+float ctrl_autotuneRelayDuty(void)  { return ctrl_AUTOTUNE_RELAY_DUTY; }
+float ctrl_autotuneHysteresis(void) { return ctrl_AUTOTUNE_HYST_MPH; }
+
+void ctrl_autotuneInit(ctrl_autotune_t* at) {
+    memset(at, 0, sizeof(*at));
+}
+
+float ctrl_autotuneBandSpeed(const ctrl_speedPiGains_t* gains, int band) {
+    float top = (band + 1 < ctrl_SPEED_BANDS) ? gains->fromMph[band + 1] : gains->fromMph[band] + ctrl_AUTOTUNE_LAST_BAND_SPAN;
+    float mph = 0.5f * (gains->fromMph[band] + top);
+    return (mph < ctrl_AUTOTUNE_MIN_MPH) ? ctrl_AUTOTUNE_MIN_MPH : mph;
+}
+
+static void ctrl_autotuneBeginBand(ctrl_autotune_t* at, const ctrl_speedPiGains_t* gains, int band, float set_mph) {
+    at->band = (uint8_t) band;
+    at->set_mph = (set_mph > 0.0f) ? set_mph : ctrl_autotuneBandSpeed(gains, band);
+    at->relayStarted = false;
+    at->relayHigh = true;
+    at->bias = -1.0f;       //Set from the back-EMF on the first update
+    at->t_ms = 0;
+    at->cycles = 0;
+    at->sumPeriod_s = 0.0f;
+    at->sumAmp_mph = 0.0f;
+}
+
+uint8_t ctrl_autotuneStart(ctrl_autotune_t* at, const ctrl_speedPiGains_t* gains, float set_mph) {
+    int band = 0;
+    if (set_mph > 0.0f) {
+        if (set_mph < ctrl_AUTOTUNE_MIN_MPH) { return 1; }
+        while ((band + 1 < ctrl_SPEED_BANDS) && (set_mph >= gains->fromMph[band + 1])) { band++; }
+        at->lastBand = (uint8_t) band;
+    } else {
+        at->lastBand = ctrl_SPEED_BANDS - 1;
+    }
+    at->state = ctrl_AUTOTUNE_RUNNING;
+    at->error = ctrl_AUTOTUNE_ERR_NONE;
+    at->firstBand = (uint8_t) band;
+    at->total_ms = 0;
+    memset(at->ku, 0, sizeof(at->ku));
+    memset(at->tu_s, 0, sizeof(at->tu_s));
+    memset(at->amp_mph, 0, sizeof(at->amp_mph));
+    memset(at->tau_s, 0, sizeof(at->tau_s));
+    memset(at->dead_s, 0, sizeof(at->dead_s));
+    memset(at->kp, 0, sizeof(at->kp));
+    memset(at->ki, 0, sizeof(at->ki));
+    memset(at->tuned_ms, 0, sizeof(at->tuned_ms));
+    ctrl_autotuneBeginBand(at, gains, band, set_mph);
+    return 0;
+}
+
+void ctrl_autotuneStop(ctrl_autotune_t* at, uint8_t error) {
+    if (at->state != ctrl_AUTOTUNE_RUNNING) { return; }
+    at->state = ctrl_AUTOTUNE_FAILED;
+    at->error = error;
+}
+
+//Ku/Tu from the measured cycles, a first order plus dead time model from them, then the band's gains.
+//The static gain K (mph per duty count) is known from the learned back-EMF, so the oscillation point gives the rest:
+//  |G(jw)| = K/sqrt(1 + (tau*w)^2) = 1/Ku      and      -w*L - atan(tau*w) = -pi + asin(hyst/a)
+//(the hysteresis moves the relay's phase off -pi). On the road only tau changes, by the inertia ratio. The gains are
+//SIMC's for a closed loop time constant of ctrl_AUTOTUNE_RESPONSE_S rather than Ziegler-Nichols': Ku is far above
+//anything the hall speed estimate's noise would allow, so a response time is the better thing to ask for.
+static bool ctrl_autotuneFinishBand(ctrl_autotune_t* at, const ctrl_speedPi_t* pi, float batVolt) {
+    float a = at->sumAmp_mph / (float) ctrl_AUTOTUNE_MEASURE_CYCLES;
+    float tu = at->sumPeriod_s / (float) ctrl_AUTOTUNE_MEASURE_CYCLES;
+    float h = ctrl_AUTOTUNE_HYST_MPH;
+    float countsPerMph = ctrl_speedPiBackEmfDuty(pi, 1.0f, batVolt);
+    if ((a <= h) || (tu <= 0.0f) || (countsPerMph <= 0.0f)) {
+        ctrl_autotuneStop(at, ctrl_AUTOTUNE_ERR_NO_OSC);
+        return false;
+    }
+    float ku = 4.0f * ctrl_AUTOTUNE_RELAY_DUTY / (3.141592f * a);
+    float w = 2.0f * 3.141592f / tu;
+    float k = 1.0f / countsPerMph;
+    float x = k * ku;
+    float tau = (x > 1.0f) ? sqrtf(x * x - 1.0f) / w : 0.0f;
+    float dead = (3.141592f - asinf(h / a) - atanf(tau * w)) / w;
+    if (dead < 0.0f) { dead = 0.0f; }
+    at->ku[at->band] = ku;
+    at->tu_s[at->band] = tu;
+    at->amp_mph[at->band] = a;
+    at->tau_s[at->band] = tau;
+    at->dead_s[at->band] = dead;
+    at->tuned_ms[at->band] = at->t_ms;
+
+    float tauRoad = tau * ctrl_AUTOTUNE_STAND_INERTIA_RATIO;
+    float kp = tauRoad / (k * (ctrl_AUTOTUNE_RESPONSE_S + dead));
+    float ti = 4.0f * (ctrl_AUTOTUNE_RESPONSE_S + dead);
+    if (tauRoad < ti) { ti = tauRoad; }
+    if (!(kp > 0.0f) || !(ti > 0.0f)) {
+        ctrl_autotuneStop(at, ctrl_AUTOTUNE_ERR_NO_OSC);
+        return false;
+    }
+    at->kp[at->band] = kp;
+    at->ki[at->band] = kp / ti;
+    return true;
+}
+
+float ctrl_autotuneUpdate(ctrl_autotune_t* at, const ctrl_speedPiGains_t* gains, ctrl_speedPi_t* pi, float speed_mph, float batVolt, float dt) {
+    uint32_t dt_ms = (uint32_t) (dt * 1000.0f + 0.5f);
+    float y = ctrl_speedPiFilter(pi, speed_mph, dt);
+    float d = ctrl_AUTOTUNE_RELAY_DUTY;
+    if (at->state != ctrl_AUTOTUNE_RUNNING) { return 0.0f; }
+    at->t_ms += dt_ms;
+    at->total_ms += dt_ms;
+    if (at->bias < 0.0f) {
+        //The top band's test speed may be more than the battery can reach with the relay's d on top
+        float top = ctrl_AUTOTUNE_TOP_SPEED_SHARE * batVolt / pi->bemf_VperMph;
+        if (at->set_mph > top) { at->set_mph = top; }
+        at->bias = ctrl_speedPiBackEmfDuty(pi, at->set_mph, batVolt);
+    }
+
+    if (!at->relayStarted) {
+        //Spin up (or coast down) to the setting first; the relay starts on the crossing
+        at->relayHigh = (y < at->set_mph);
+        if (((at->relayHigh) && (y >= at->set_mph - ctrl_AUTOTUNE_HYST_MPH)) || ((!at->relayHigh) && (y <= at->set_mph + ctrl_AUTOTUNE_HYST_MPH))) {
+            at->relayStarted = true;
+            at->lastUp_ms = at->lastDown_ms = at->t_ms;
+            at->yMax = at->yMin = y;
+        }
+    } else {
+        if (y > at->yMax) { at->yMax = y; }
+        if (y < at->yMin) { at->yMin = y; }
+        if ((at->relayHigh) && (y > at->set_mph + ctrl_AUTOTUNE_HYST_MPH)) {
+            at->relayHigh = false;
+            at->lastDown_ms = at->t_ms;
+        } else if ((!at->relayHigh) && (y < at->set_mph - ctrl_AUTOTUNE_HYST_MPH)) {
+            //Rising edge: one full cycle since the last one
+            float high_s = (float) (at->lastDown_ms - at->lastUp_ms) / 1000.0f;
+            float period_s = (float) (at->t_ms - at->lastUp_ms) / 1000.0f;
+            at->relayHigh = true;
+            if ((at->cycles > 0) && (period_s > 0.0f)) {
+                //Uneven halves mean the bias is off the load: move it half way towards evening them out
+                at->bias += 0.5f * d * (2.0f * high_s - period_s) / period_s;
+                if (at->cycles > ctrl_AUTOTUNE_SETTLE_CYCLES) {
+                    at->sumPeriod_s += period_s;
+                    at->sumAmp_mph += 0.5f * (at->yMax - at->yMin);
+                }
+            }
+            at->cycles++;
+            at->lastUp_ms = at->t_ms;
+            at->yMax = at->yMin = y;
+            if (at->cycles > ctrl_AUTOTUNE_SETTLE_CYCLES + ctrl_AUTOTUNE_MEASURE_CYCLES) {
+                if (!ctrl_autotuneFinishBand(at, pi, batVolt)) { return 0.0f; }
+                if (at->band >= at->lastBand) {
+                    at->state = ctrl_AUTOTUNE_DONE;
+                    return 0.0f;
+                }
+                ctrl_autotuneBeginBand(at, gains, at->band + 1, 0.0f);
+            }
+        }
+        if ((at->relayStarted) && ((y > at->set_mph + ctrl_AUTOTUNE_RANGE_MPH) || (y < at->set_mph - ctrl_AUTOTUNE_RANGE_MPH))) {
+            ctrl_autotuneStop(at, ctrl_AUTOTUNE_ERR_RANGE);
+            return 0.0f;
+        }
+    }
+    if (at->t_ms > ctrl_AUTOTUNE_BAND_TIMEOUT_MS) {
+        ctrl_autotuneStop(at, ctrl_AUTOTUNE_ERR_TIMEOUT);
+        return 0.0f;
+    }
+
+    float out = at->bias + (at->relayHigh ? d : -d);
+    if (out > 4095.0f) { out = 4095.0f; }
+    if (out < 0.0f)    { out = 0.0f; }
+    return out;
+}
+
+//******************************* Non-volatile storage
+//Called from a low priority task (not the control loop): a flash write can stall for milliseconds
+uint8_t ctrl_autotuneSaveGains(const ctrl_speedPiGains_t* gains) {
+    ctrl_autotuneStored_t st;
+    nvs_handle_t h;
+    memset(&st, 0, sizeof(st));
+    st.magic = ctrl_AUTOTUNE_NVS_MAGIC;
+    st.size = sizeof(st);
+    st.gains = *gains;
+    if (nvs_open(ctrl_AUTOTUNE_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) { return 1; }
+    esp_err_t err = nvs_set_blob(h, ctrl_AUTOTUNE_NVS_KEY, &st, sizeof(st));
+    if (err == ESP_OK) { err = nvs_commit(h); }
+    nvs_close(h);
+    return (err == ESP_OK) ? 0 : 2;
+}
+
+uint8_t ctrl_autotuneLoadGains(ctrl_speedPiGains_t* gains) {
+    ctrl_autotuneStored_t st;
+    size_t len = sizeof(st);
+    nvs_handle_t h;
+    int i;
+    if (nvs_open(ctrl_AUTOTUNE_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) { return 1; }
+    esp_err_t err = nvs_get_blob(h, ctrl_AUTOTUNE_NVS_KEY, &st, &len);
+    nvs_close(h);
+    if ((err != ESP_OK) || (len != sizeof(st)) || (st.magic != ctrl_AUTOTUNE_NVS_MAGIC) || (st.size != sizeof(st))) { return 2; }
+    //Anything a tune could not have produced means the blob is bad
+    for (i = 0; i < ctrl_SPEED_BANDS; i++) {
+        if (!(st.gains.kp[i] > 0.0f) || !(st.gains.kp[i] < 1.0e5f) || !(st.gains.ki[i] >= 0.0f) || !(st.gains.ki[i] < 1.0e5f)) { return 3; }
+    }
+    *gains = st.gains;
+    return 0;
+}
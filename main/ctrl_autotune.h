@@ -0,0 +1,67 @@
+#ifndef CTRL_AUTOTUNE_H_
+#define CTRL_AUTOTUNE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ctrl_speed_pi.h"
+
+//Relay feedback tuning of the speed PI (ctrl_speed_pi.h), run by ctrl_speedLoop() in place of the controller.
+//The duty switches between bias+d and bias-d each time the filtered speed crosses the setting (with hysteresis),
+//which makes the speed oscillate at the loop's ultimate period Tu. From the amplitude a of that oscillation the
+//ultimate gain is Ku = 4d/(pi*a). Ku, Tu and the static gain from the learned back-EMF fit a first order plus dead
+//time model (tau, L), and the band's kp/ki come from that model.
+//Meant for the wheel on a stand: the stand only has the wheel's inertia to move, so gains found there are scaled up
+//by the car to wheel inertia ratio (ctrl_AUTOTUNE_STAND_INERTIA_RATIO, 1 when tuning on the road) before they are used.
+
+#define ctrl_AUTOTUNE_IDLE      0
+#define ctrl_AUTOTUNE_RUNNING   1
+#define ctrl_AUTOTUNE_DONE      2
+#define ctrl_AUTOTUNE_FAILED    3
+
+#define ctrl_AUTOTUNE_ERR_NONE      0
+#define ctrl_AUTOTUNE_ERR_STOPPED   1   //Stopped by a command, a fault or leaving gear
+#define ctrl_AUTOTUNE_ERR_TIMEOUT   2   //No usable oscillation in ctrl_AUTOTUNE_BAND_TIMEOUT_MS
+#define ctrl_AUTOTUNE_ERR_RANGE     3   //Speed ran away from the setting
+#define ctrl_AUTOTUNE_ERR_NO_OSC    4   //Oscillation inside the hysteresis, can't size it
+
+typedef struct {
+    uint8_t state;                      //ctrl_AUTOTUNE_*
+    uint8_t error;                      //ctrl_AUTOTUNE_ERR_*
+    uint8_t band;                       //Band being tuned (last one tuned once done)
+    uint8_t firstBand;
+    uint8_t lastBand;                   //Tuning stops after this band
+    bool relayHigh;
+    bool relayStarted;
+    float set_mph;
+    float bias;                         //Duty the relay swings around, evened out cycle by cycle
+    float yMax, yMin;                   //Filtered speed extremes this cycle
+    uint32_t t_ms;                      //Time in the current band
+    uint32_t total_ms;                  //Time since the start
+    uint32_t lastUp_ms, lastDown_ms;    //Relay switch times in the current band
+    uint32_t cycles;                    //Full relay cycles in the current band
+    float sumPeriod_s, sumAmp_mph;      //Over the measured cycles
+    float ku[ctrl_SPEED_BANDS];         //Duty counts per mph, as identified (before the stand scaling)
+    float tu_s[ctrl_SPEED_BANDS];
+    float amp_mph[ctrl_SPEED_BANDS];
+    float tau_s[ctrl_SPEED_BANDS];      //Model time constant where it was tuned (the road's is ctrl_AUTOTUNE_STAND_INERTIA_RATIO times it)
+    float dead_s[ctrl_SPEED_BANDS];     //Model dead time: estimate window, filter and electrical lag together
+    float kp[ctrl_SPEED_BANDS];         //Gains for the road, firstBand to lastBand, to be applied once DONE
+    float ki[ctrl_SPEED_BANDS];
+    uint32_t tuned_ms[ctrl_SPEED_BANDS];    //Time each band took
+} ctrl_autotune_t;
+
+void ctrl_autotuneInit(ctrl_autotune_t* at);
+//set_mph: tune the band holding that speed, 0 tunes every band at its own test speed. Returns 0 on success.
+uint8_t ctrl_autotuneStart(ctrl_autotune_t* at, const ctrl_speedPiGains_t* gains, float set_mph);
+void ctrl_autotuneStop(ctrl_autotune_t* at, uint8_t error);
+//One speed loop period: returns the relay duty. The gains in use are left alone; the results are in at->kp/ki.
+float ctrl_autotuneUpdate(ctrl_autotune_t* at, const ctrl_speedPiGains_t* gains, ctrl_speedPi_t* pi, float speed_mph, float batVolt, float dt);
+float ctrl_autotuneBandSpeed(const ctrl_speedPiGains_t* gains, int band);
+float ctrl_autotuneRelayDuty(void);     //The relay's d, so benches can redo the Ku calculation
+float ctrl_autotuneHysteresis(void);
+
+//Gains in non-volatile storage. Both return 0 on success; load leaves gains alone when nothing valid is stored.
+uint8_t ctrl_autotuneLoadGains(ctrl_speedPiGains_t* gains);
+uint8_t ctrl_autotuneSaveGains(const ctrl_speedPiGains_t* gains);
+
+#endif
@@ -0,0 +1,216 @@
+//Runtime parameter registry, see ctrl_params.h
+
+#include <stddef.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "nvs.h"
+#include "ctrl_params.h"
+
+#define ctrl_PARAMS_NVS_NAMESPACE   "ctrl"
+#define ctrl_PARAMS_NVS_KEY         "params"
+#define ctrl_PARAMS_NVS_MAGIC       (0x50524D31)    //"PRM1"
+#define ctrl_PARAMS_NVS_MAX         (32)            //Values a stored blob may hold, newer builds included
+#define ctrl_CONV_IN_MI             (1.0/63360.0)   //Conversion factor: inches to miles
+#define ctrl_MOTORPHASES_FL         (3.0)           //The number of phases on the BLDC motor to be controlled
+#define ctrl_BEMF_HANDOVER_MIN_MPH  (5.0f)          //Slower than this the back-EMF is too small to find the zero crossings in
+
+#define ctrl_PARAM_ENTRY(name, unit, type, flags, field, min, max, def) \
+    {name, unit, type, flags, (uint16_t) offsetof(ctrl_params_t, field), min, max, def}
+
+//Stored by position: new parameters go at the end
+static const ctrl_paramDesc_t ctrl_param_table[] = {
+    //Calculation of vital parameters
+    ctrl_PARAM_ENTRY("wheel_in",    "in",  ctrl_PARAM_F32, 0, hubDiameter_in,          10.0f, 30.0f,    19.0f),
+    ctrl_PARAM_ENTRY("poles",       "",    ctrl_PARAM_U32, 0, motorPoles,              2.0f,  100.0f,   46.0f),
+    //PWM: 12 bit duty from the 80 MHz APB clock goes up to 19.5 kHz
+    ctrl_PARAM_ENTRY("pwm_hz",      "Hz",  ctrl_PARAM_U32, ctrl_PARAM_AT_BOOT, pwmFreq_hz, 2000.0f, 19000.0f, 10000.0f),
+    //Safety thresholds (exceeding these will cause a safety shutdown)
+    ctrl_PARAM_ENTRY("uv_v",        "V",   ctrl_PARAM_F32, 0, undervolt_V,             20.0f, 60.0f,    38.0f),
+    ctrl_PARAM_ENTRY("ov_v",        "V",   ctrl_PARAM_F32, 0, overvolt_V,              30.0f, 75.0f,    60.0f),
+    ctrl_PARAM_ENTRY("oc_a",        "A",   ctrl_PARAM_F32, 0, overcurrent_A,           5.0f,  60.0f,    35.0f),
+    ctrl_PARAM_ENTRY("ot_f",        "F",   ctrl_PARAM_F32, 0, overtemp_F,              100.0f, 250.0f,  212.0f),
+    ctrl_PARAM_ENTRY("skip_max",    "",    ctrl_PARAM_U32, 0, skippedCommMax,          1.0f,  255.0f,   200.0f),
+    //Torque mode and current limits
+    ctrl_PARAM_ENTRY("tq_full_a",   "A",   ctrl_PARAM_F32, 0, torqueFullThrottle_A,    1.0f,  60.0f,    30.0f),
+    ctrl_PARAM_ENTRY("ph_lim_a",    "A",   ctrl_PARAM_F32, 0, phaseCurrentLimit_A,     1.0f,  60.0f,    30.0f),
+    ctrl_PARAM_ENTRY("bus_lim_w",   "W",   ctrl_PARAM_F32, 0, busPowerLimit_W,         50.0f, 3000.0f,  1500.0f),
+    ctrl_PARAM_ENTRY("curreg_kp",   "",    ctrl_PARAM_F32, 0, curregKp,                0.0f,  1000.0f,  40.0f),
+    ctrl_PARAM_ENTRY("curreg_ki",   "",    ctrl_PARAM_F32, 0, curregKi,                0.0f,  200.0f,   8.0f),
+    //Sensorless commutation from this speed up (0 keeps the halls at every speed)
+    ctrl_PARAM_ENTRY("bemf_mph",    "mph", ctrl_PARAM_F32, 0, bemfHandover_mph,        0.0f,  55.0f,    0.0f),
+    //PWM frequency from half to twice pwm_hz by the modelled switching and ripple loss (0 keeps pwm_hz)
+    ctrl_PARAM_ENTRY("pwm_adapt",   "",    ctrl_PARAM_U32, 0, pwmAdapt,                0.0f,  1.0f,     1.0f),
+    //Winding resistance (phase to phase): back-EMF learning in the speed loop and the PWM loss model
+    ctrl_PARAM_ENTRY("motor_r",     "ohm", ctrl_PARAM_F32, 0, motorR_ohm,              0.05f, 5.0f,     0.8f),
+};
+#define ctrl_PARAM_COUNT ((int) (sizeof(ctrl_param_table)/sizeof(ctrl_param_table[0])))
+
+static ctrl_params_t ctrl_params_buf[2];            //Live one and the one the next swap fills
+static ctrl_params_t ctrl_params_staged;            //Every set so far; only the writers and ctrl_paramsSwap() touch it
+static volatile bool ctrl_params_pending = false;
+static portMUX_TYPE ctrl_params_mux = portMUX_INITIALIZER_UNLOCKED;    //Staged copy only, never the live set
+const ctrl_params_t* volatile ctrl_params = &ctrl_params_buf[0];
+
+static float ctrl_paramRead(const ctrl_params_t* p, const ctrl_paramDesc_t* d) {
+    const uint8_t* field = (const uint8_t*) p + d->offset;
+    if (d->type == ctrl_PARAM_U32) { return (float) *(const uint32_t*) field; }
+    return *(const float*) field;
+}
+
+static void ctrl_paramWrite(ctrl_params_t* p, const ctrl_paramDesc_t* d, float value) {
+    uint8_t* field = (uint8_t*) p + d->offset;
+    if (d->type == ctrl_PARAM_U32) { *(uint32_t*) field = (uint32_t) (value + 0.5f); }
+    else                           { *(float*) field = value; }
+}
+
+//Everything worked out from the settable values, once per change rather than on every use
+static void ctrl_paramsDerive(ctrl_params_t* p) {
+    double circum_mi = 3.141592*((double) p->hubDiameter_in*ctrl_CONV_IN_MI);
+    double distPerCom_mi = circum_mi/((double) p->motorPoles*ctrl_MOTORPHASES_FL);   //Distance travelled during one commutation
+    p->convComPerSecToMph = distPerCom_mi*3600.0;
+    p->totalOvercurrent_A = p->overcurrent_A*2.0f;
+}
+
+//Rules between parameters, checked on the set as it would be after a change
+static bool ctrl_paramsConsistent(const ctrl_params_t* p) {
+    if (p->undervolt_V >= p->overvolt_V) { return false; }
+    if (p->phaseCurrentLimit_A >= p->overcurrent_A) { return false; }   //The regulated limit has to come before the trip
+    if ((p->bemfHandover_mph > 0.0f) && (p->bemfHandover_mph < ctrl_BEMF_HANDOVER_MIN_MPH)) { return false; }
+    return true;
+}
+
+void ctrl_paramsInit(void) {
+    int i;
+    memset(&ctrl_params_staged, 0, sizeof(ctrl_params_staged));
+    for (i = 0; i < ctrl_PARAM_COUNT; i++) { ctrl_paramWrite(&ctrl_params_staged, &ctrl_param_table[i], ctrl_param_table[i].def); }
+    ctrl_paramsDerive(&ctrl_params_staged);
+    ctrl_params_buf[0] = ctrl_params_staged;
+    ctrl_params_buf[1] = ctrl_params_staged;
+    ctrl_params = &ctrl_params_buf[0];
+    ctrl_params_pending = false;
+}
+
+int ctrl_paramCount(void) { return ctrl_PARAM_COUNT; }
+
+const ctrl_paramDesc_t* ctrl_paramDesc(int index) {
+    if ((index < 0) || (index >= ctrl_PARAM_COUNT)) { return NULL; }
+    return &ctrl_param_table[index];
+}
+
+int ctrl_paramFind(const char* name) {
+    int i;
+    for (i = 0; i < ctrl_PARAM_COUNT; i++) {
+        if (strcmp(ctrl_param_table[i].name, name) == 0) { return i; }
+    }
+    return -1;
+}
+
+float ctrl_paramGet(int index) {
+    float value;
+    if ((index < 0) || (index >= ctrl_PARAM_COUNT)) { return 0.0f; }
+    portENTER_CRITICAL_SAFE(&ctrl_params_mux);
+    value = ctrl_paramRead(&ctrl_params_staged, &ctrl_param_table[index]);
+    portEXIT_CRITICAL_SAFE(&ctrl_params_mux);
+    return value;
+}
+
+uint8_t ctrl_paramStage(int index, float value) {
+    ctrl_params_t next;
+    const ctrl_paramDesc_t* d = ctrl_paramDesc(index);
+    if (d == NULL) { return 1; }
+    if (!(value >= d->min) || !(value <= d->max)) { return 2; }
+    //Worked on outside the lock; only the PC link task sets parameters, so nothing else changes the staged copy meanwhile
+    portENTER_CRITICAL_SAFE(&ctrl_params_mux);
+    next = ctrl_params_staged;
+    portEXIT_CRITICAL_SAFE(&ctrl_params_mux);
+    ctrl_paramWrite(&next, d, value);
+    if (!ctrl_paramsConsistent(&next)) { return 3; }
+    ctrl_paramsDerive(&next);
+    portENTER_CRITICAL_SAFE(&ctrl_params_mux);
+    ctrl_params_staged = next;
+    ctrl_params_pending = true;
+    portEXIT_CRITICAL_SAFE(&ctrl_params_mux);
+    return 0;
+}
+
+bool ctrl_paramsPending(void) { return ctrl_params_pending; }
+
+//The buffer filled here stopped being live at the previous swap, at least a tick ago, so no loop run is still
+//reading it: the current loop's runs are a fraction of a tick.
+void ctrl_paramsSwap(void) {
+    if (!ctrl_params_pending) { return; }
+    ctrl_params_t* next = (ctrl_params == &ctrl_params_buf[0]) ? &ctrl_params_buf[1] : &ctrl_params_buf[0];
+    portENTER_CRITICAL_SAFE(&ctrl_params_mux);
+    *next = ctrl_params_staged;
+    ctrl_params_pending = false;
+    portEXIT_CRITICAL_SAFE(&ctrl_params_mux);
+    ctrl_params = next;
+}
+
+//Sets each value that differs, in passes until nothing more goes in: a value may only fit once another has
+//(a higher current limit after a higher trip)
+static void ctrl_paramsApply(const float* value, uint32_t count, uint8_t (*set)(int index, float value)) {
+    bool progress = true;
+    uint32_t i;
+    while (progress) {
+        progress = false;
+        for (i = 0; i < count; i++) {
+            if (ctrl_paramGet((int) i) == value[i]) { continue; }
+            if (set((int) i, value[i]) == 0) { progress = true; }
+        }
+    }
+}
+
+void ctrl_paramsDefaults(uint8_t (*set)(int index, float value)) {
+    float value[ctrl_PARAM_COUNT];
+    int i;
+    for (i = 0; i < ctrl_PARAM_COUNT; i++) { value[i] = ctrl_param_table[i].def; }
+    ctrl_paramsApply(value, ctrl_PARAM_COUNT, set);
+}
+
+//******************************* Non-volatile storage
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    float value[ctrl_PARAMS_NVS_MAX];
+} ctrl_paramsStored_t;
+
+//Called from a low priority task (not the control loop): a flash write can stall for milliseconds
+uint8_t ctrl_paramsSave(void) {
+    ctrl_paramsStored_t st;
+    nvs_handle_t h;
+    int i;
+    memset(&st, 0, sizeof(st));
+    st.magic = ctrl_PARAMS_NVS_MAGIC;
+    st.count = ctrl_PARAM_COUNT;
+    for (i = 0; i < ctrl_PARAM_COUNT; i++) { st.value[i] = ctrl_paramGet(i); }
+    if (nvs_open(ctrl_PARAMS_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) { return 1; }
+    esp_err_t err = nvs_set_blob(h, ctrl_PARAMS_NVS_KEY, &st, 2*sizeof(uint32_t) + st.count*sizeof(float));
+    if (err == ESP_OK) { err = nvs_commit(h); }
+    nvs_close(h);
+    return (err == ESP_OK) ? 0 : 2;
+}
+
+uint8_t ctrl_paramsLoad(uint8_t (*set)(int index, float value)) {
+    ctrl_paramsStored_t st;
+    size_t len = 0;
+    nvs_handle_t h;
+    if (nvs_open(ctrl_PARAMS_NVS_NAMESPACE, NVS_READONLY, &h) != ESP_OK) { return 1; }
+    esp_err_t err = nvs_get_blob(h, ctrl_PARAMS_NVS_KEY, NULL, &len);
+    if ((err == ESP_OK) && (len <= sizeof(st))) { err = nvs_get_blob(h, ctrl_PARAMS_NVS_KEY, &st, &len); }
+    nvs_close(h);
+    if ((err != ESP_OK) || (len < 2*sizeof(uint32_t)) || (len > sizeof(st))) { return 2; }
+    if ((st.magic != ctrl_PARAMS_NVS_MAGIC) || (len != 2*sizeof(uint32_t) + st.count*sizeof(float))) { return 2; }
+    //One that no longer validates (limits tightened since it was stored) keeps its default
+    ctrl_paramsApply(st.value, (st.count < (uint32_t) ctrl_PARAM_COUNT) ? st.count : (uint32_t) ctrl_PARAM_COUNT, set);
+    return 0;
+}
+
+uint8_t ctrl_paramsErase(void) {
+    nvs_handle_t h;
+    if (nvs_open(ctrl_PARAMS_NVS_NAMESPACE, NVS_READWRITE, &h) != ESP_OK) { return 1; }
+    esp_err_t err = nvs_erase_key(h, ctrl_PARAMS_NVS_KEY);
+    if (err == ESP_OK) { err = nvs_commit(h); }
+    nvs_close(h);
+    return ((err == ESP_OK) || (err == ESP_ERR_NVS_NOT_FOUND)) ? 0 : 2;
+}
@@ -0,0 +1,70 @@
+#ifndef CTRL_PARAMS_H_
+#define CTRL_PARAMS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Runtime parameter registry: the vehicle and controller settings that used to be #defines in ctrl_subsystem.c.
+//Each parameter has a name, a type and a min/max (ctrl_paramDesc()); ctrl_subsystem.c's ctrl_setParam() is the setter.
+//Control code reads the live set through ctrl_params, one of two buffers, with no locking. A set goes into a
+//staged copy (derived values recomputed there, once), and ctrl_paramsSwap() copies it into the other buffer and
+//flips the pointer at the start of an operational task tick, so every loop sees one change whole, between its runs.
+//Code that reads several values in one run should load the pointer once. Stored in NVS on "param save".
+
+#define ctrl_PARAM_F32  0
+#define ctrl_PARAM_U32  1
+
+#define ctrl_PARAM_AT_BOOT  0x01    //Sets the hardware up, so a change takes effect at the next boot
+
+typedef struct {
+    //Settable, in ctrl_paramDesc() order
+    float hubDiameter_in;           //Wheel (with tyre) diameter
+    uint32_t motorPoles;
+    uint32_t pwmFreq_hz;
+    float undervolt_V;
+    float overvolt_V;
+    float overcurrent_A;            //Per phase current sensor trip
+    float overtemp_F;
+    uint32_t skippedCommMax;
+    float torqueFullThrottle_A;     //Bus current at full throttle in torque mode
+    float phaseCurrentLimit_A;      //Regulated, under overcurrent_A so the trip stays a backstop
+    float busPowerLimit_W;
+    float curregKp;                 //Duty counts per amp of bus current error
+    float curregKi;                 //Duty counts per amp of bus current error, per current loop period
+    float bemfHandover_mph;         //Sensorless commutation from this speed up, 0 = halls only
+    uint32_t pwmAdapt;              //1: PWM frequency follows the modelled loss (ctrl_pwm.h), 0: pwmFreq_hz throughout
+    float motorR_ohm;               //Winding resistance, the two conducting phases in series
+    //Derived by ctrl_paramsDerive()
+    double convComPerSecToMph;      //Commutations per second to mph
+    float totalOvercurrent_A;       //Sum of the three phase sensors
+} ctrl_params_t;
+
+typedef struct {
+    const char* name;
+    const char* unit;
+    uint8_t type;                   //ctrl_PARAM_F32/U32
+    uint8_t flags;                  //ctrl_PARAM_AT_BOOT
+    uint16_t offset;                //In ctrl_params_t
+    float min, max, def;
+} ctrl_paramDesc_t;
+
+extern const ctrl_params_t* volatile ctrl_params;     //Live set
+
+void ctrl_paramsInit(void);                     //Defaults, live straight away
+int ctrl_paramCount(void);
+const ctrl_paramDesc_t* ctrl_paramDesc(int index);  //NULL past the last one
+int ctrl_paramFind(const char* name);           //-1 if there is none
+float ctrl_paramGet(int index);                 //Latest set value (live from the next tick)
+//Validates and stages. Returns 0 on success, 1 unknown index, 2 out of min/max, 3 conflicts with another parameter.
+uint8_t ctrl_paramStage(int index, float value);
+void ctrl_paramsSwap(void);                     //Operational task, at the start of a tick
+bool ctrl_paramsPending(void);                  //A staged change is waiting for the next tick
+void ctrl_paramsDefaults(uint8_t (*set)(int index, float value));   //Every parameter back to its default, through set
+
+//Non-volatile storage, all return 0 on success. Load stages each stored value it can validate (through set, so a
+//caller can log them); values stored by an older build with fewer parameters keep their defaults.
+uint8_t ctrl_paramsSave(void);
+uint8_t ctrl_paramsLoad(uint8_t (*set)(int index, float value));
+uint8_t ctrl_paramsErase(void);
+
+#endif
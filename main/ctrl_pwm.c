@@ -0,0 +1,90 @@
+//PWM frequency and resolution manager, see ctrl_pwm.h
+
+#include <string.h>
+#include "ctrl_pwm.h"
+
+#define ctrl_PWM_CLOCK_HZ       (80000000ULL)   //APB clock the LEDC timer divides
+#define ctrl_PWM_MIN_BITS       8
+#define ctrl_PWM_MAX_BITS       12              //The duty everywhere else is 12 bit, more would not add anything
+#define ctrl_MOTOR_L_H          (0.0006)        //USERSET: winding inductance of the two conducting phases in series
+#define ctrl_MSFT_SWITCH_S      (100e-9)        //USERSET: high side rise plus fall time at the gate driver's drive
+#define ctrl_MSFT_GATE_J        (0.72e-6)       //USERSET: gate charge x drive volts, per on/off cycle
+#define ctrl_MSFT_QRR_C         (80e-9)         //USERSET: low side body diode reverse recovery charge
+#define ctrl_PWM_HYST           (0.05f)         //A step has to model this share less loss to change to
+#define ctrl_PWM_DWELL_MS       200             //...and the last change has to be this old
+#define ctrl_PWM_AVG_MS         (1000.0f)       //Time constant of the loss averages the choice is made on
+#define ctrl_PWM_PEAK_SHARE     (0.9f)          //Phase current plus half the ripple stays under this share of the trip
+
+//Frequencies as multiples of the pwm_hz parameter (ctrl_PWM_BASE_STEP is 1)
+static const float ctrl_pwm_multiple[ctrl_PWM_STEPS] = {0.5f, 0.7f, 1.0f, 1.4f, 2.0f};
+
+uint8_t ctrl_pwmBits(uint32_t freq_hz) {
+    uint8_t bits = ctrl_PWM_MAX_BITS;
+    while ((bits > ctrl_PWM_MIN_BITS) && (((uint64_t) freq_hz << bits) > ctrl_PWM_CLOCK_HZ)) { bits--; }
+    return bits;
+}
+
+uint32_t ctrl_pwmDivider(const ctrl_pwmStep_t* s) {
+    return (uint32_t) ((ctrl_PWM_CLOCK_HZ << 8) / ((uint64_t) s->freq_hz << s->bits));
+}
+
+void ctrl_pwmInit(ctrl_pwm_t* p, uint32_t base_hz) {
+    int i;
+    memset(p, 0, sizeof(*p));
+    for (i = 0; i < ctrl_PWM_STEPS; i++) {
+        p->steps[i].freq_hz = (uint32_t) (ctrl_pwm_multiple[i] * (float) base_hz + 0.5f);
+        p->steps[i].bits = ctrl_pwmBits(p->steps[i].freq_hz);
+    }
+    p->step = ctrl_PWM_BASE_STEP;
+    p->held_ms = ctrl_PWM_DWELL_MS;
+}
+
+float ctrl_pwmRipple_A(uint32_t freq_hz, float batVolt, float phase_A, float duty) {
+    float ripple = batVolt * duty * (1.0f - duty) / ((float) ctrl_MOTOR_L_H * (float) freq_hz);
+    //No more than twice the average: with less current than that it stops at zero each period
+    if (ripple > 2.0f * phase_A) { ripple = 2.0f * phase_A; }
+    return ripple;
+}
+
+float ctrl_pwmLoss_W(uint32_t freq_hz, float batVolt, float phase_A, float duty, float r_ohm) {
+    if ((duty <= 0.0f) || (phase_A <= 0.0f)) { return 0.0f; }
+    float perPeriod_j = 0.5f * batVolt * phase_A * (float) ctrl_MSFT_SWITCH_S + (float) ctrl_MSFT_GATE_J + (float) ctrl_MSFT_QRR_C * batVolt;
+    float ripple = ctrl_pwmRipple_A(freq_hz, batVolt, phase_A, duty);
+    return perPeriod_j * (float) freq_hz + r_ohm * ripple * ripple / 12.0f;
+}
+
+uint8_t ctrl_pwmUpdate(ctrl_pwm_t* p, bool adapt, float batVolt, float phase_A, float duty, float r_ohm, float trip_A, uint32_t dt_ms) {
+    int i;
+    if (p->held_ms < 0xFFFF0000u) { p->held_ms += dt_ms; }
+    p->loss_W = ctrl_pwmLoss_W(p->steps[p->step].freq_hz, batVolt, phase_A, duty, r_ohm);
+    p->baseLoss_W = ctrl_pwmLoss_W(p->steps[ctrl_PWM_BASE_STEP].freq_hz, batVolt, phase_A, duty, r_ohm);
+    p->loss_j += p->loss_W * (float) dt_ms / 1000.0f;
+    p->baseLoss_j += p->baseLoss_W * (float) dt_ms / 1000.0f;
+
+    uint8_t best = ctrl_PWM_BASE_STEP;
+    if (adapt) {
+        if (p->loss_W <= 0.0f) { return p->step; }     //Not driving: nothing to go on, and nothing switching either
+        float k = (float) dt_ms / ctrl_PWM_AVG_MS;
+        for (i = 0; i < ctrl_PWM_STEPS; i++) {
+            float loss = ctrl_pwmLoss_W(p->steps[i].freq_hz, batVolt, phase_A, duty, r_ohm);
+            p->avgLoss_W[i] = (p->avgLoss_W[i] <= 0.0f) ? loss : p->avgLoss_W[i] + k * (loss - p->avgLoss_W[i]);
+        }
+        //Least average loss among the steps whose ripple peak is under the trip now (the fastest one if none is)
+        float peak_A = ctrl_PWM_PEAK_SHARE * trip_A;
+        float bestLoss = 0.0f;
+        best = ctrl_PWM_STEPS - 1;
+        for (i = 0; i < ctrl_PWM_STEPS; i++) {
+            if (phase_A + 0.5f * ctrl_pwmRipple_A(p->steps[i].freq_hz, batVolt, phase_A, duty) > peak_A) { continue; }
+            if ((bestLoss <= 0.0f) || (p->avgLoss_W[i] < bestLoss)) { best = (uint8_t) i; bestLoss = p->avgLoss_W[i]; }
+        }
+        bool overPeak = (phase_A + 0.5f * ctrl_pwmRipple_A(p->steps[p->step].freq_hz, batVolt, phase_A, duty) > peak_A);
+        //A ripple peak over the trip changes straight away, a saving waits for the dwell and has to clear the hysteresis
+        if ((!overPeak) && ((p->held_ms < ctrl_PWM_DWELL_MS) || (bestLoss > (1.0f - ctrl_PWM_HYST) * p->avgLoss_W[p->step]))) { best = p->step; }
+    }
+    if (best != p->step) {
+        p->step = best;
+        p->held_ms = 0;
+        p->changes++;
+    }
+    return p->step;
+}
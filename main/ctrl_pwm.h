@@ -0,0 +1,52 @@
+#ifndef CTRL_PWM_H_
+#define CTRL_PWM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//PWM frequency and duty resolution picked at run time, for ctrl_subsystem.c. Each PWM period the high side MOSFET
+//switches on and off once, so the switching loss (volts x amps through the transition, gate charge, the freewheeling
+//diode's reverse recovery) goes up with the frequency. The winding current ripple, bus volts x D(1-D) / (L f) peak to
+//peak, goes down with it, and costs copper loss as its RMS. ctrl_pwmUpdate() models both at the operating point
+//(bus volts, phase current, duty: the duty follows speed) for each of ctrl_PWM_STEPS frequencies around the pwm_hz
+//parameter and picks the least loss, averaged over about a second (the speed loop moves the current about faster than
+//that), as long as the ripple's peak stays under the overcurrent trip. High current at low
+//duty (launch) puts the minimum lower, light load at mid duty (cruise) higher.
+//Resolution is the most bits, up to 12, the 80 MHz timer clock gives at a frequency (11 at 20 kHz). Duty is 12 bit
+//everywhere else, ctrl_PWM_DUTY() scales it to the resolution only where it is written to the LEDC.
+
+#define ctrl_PWM_STEPS      5
+#define ctrl_PWM_BASE_STEP  2           //steps[] index of the pwm_hz parameter itself
+
+//12 bit duty (0-4096) to LEDC counts at a resolution
+#define ctrl_PWM_DUTY(duty, bits)   ((((uint32_t) (duty)) << (bits)) >> 12)
+
+typedef struct {
+    uint32_t freq_hz;
+    uint8_t bits;
+} ctrl_pwmStep_t;
+
+typedef struct {
+    ctrl_pwmStep_t steps[ctrl_PWM_STEPS];   //Slowest first
+    uint8_t step;               //Chosen
+    uint32_t held_ms;           //Since the last change
+    uint32_t changes;
+    float avgLoss_W[ctrl_PWM_STEPS];    //Each step's modelled loss while driving, filtered over ctrl_PWM_AVG_MS
+    float loss_W;               //Modelled switching and ripple loss at the chosen step
+    float baseLoss_W;           //...and at the pwm_hz parameter
+    double loss_j;              //Sums of those while driving
+    double baseLoss_j;
+} ctrl_pwm_t;
+
+void ctrl_pwmInit(ctrl_pwm_t* p, uint32_t base_hz);
+uint8_t ctrl_pwmBits(uint32_t freq_hz);
+//LEDC timer clock divider for a step (10.8 fixed point, from the 80 MHz APB clock)
+uint32_t ctrl_pwmDivider(const ctrl_pwmStep_t* s);
+//Modelled loss at freq_hz (W): batVolt bus volts, phase_A winding current, duty 0-1, r_ohm winding resistance
+float ctrl_pwmLoss_W(uint32_t freq_hz, float batVolt, float phase_A, float duty, float r_ohm);
+//Ripple peak to peak (A) at freq_hz
+float ctrl_pwmRipple_A(uint32_t freq_hz, float batVolt, float phase_A, float duty);
+//One update, every dt_ms. adapt false holds the pwm_hz step. trip_A: the phase overcurrent trip. Returns the step to run.
+uint8_t ctrl_pwmUpdate(ctrl_pwm_t* p, bool adapt, float batVolt, float phase_A, float duty, float r_ohm, float trip_A, uint32_t dt_ms);
+
+#endif
@@ -0,0 +1,148 @@
+//Back-EMF zero crossing detection, see ctrl_sensorless.h
+
+#include <string.h>
+#include <math.h>
+#include "ctrl_sensorless.h"
+
+#define ctrl_SENSORLESS_BLANK           (0.3f)      //Share of a sector ignored after a commutation (demagnetisation)
+#define ctrl_SENSORLESS_BLANK_MIN_US    (150.0f)
+#define ctrl_SENSORLESS_CONFIRM         2           //Far side (median) samples a crossing needs
+#define ctrl_SENSORLESS_LATE            (0.25f)     //Share of the driven phases' span under which a first sample already on the
+                                                    //  far side is a crossing hidden by the blanking (a clamp is about half)
+#define ctrl_SENSORLESS_DELAY           (0.5f)      //Commutation after the crossing, in sectors (30 electrical degrees)
+#define ctrl_SENSORLESS_OVERDUE         (1.0f)      //Sectors after a commutation with no crossing before it counts as missed
+                                                    //  (when the commutation itself is due, so carrying on without it is on time)
+#define ctrl_SENSORLESS_FILTER          (0.25f)     //Share of each new crossing interval taken into the sector time
+#define ctrl_SENSORLESS_INTERVAL_MIN    (0.5f)      //Crossing intervals outside these multiples of the sector time are
+#define ctrl_SENSORLESS_INTERVAL_MAX    (2.0f)      //  left out of it (a missed or false crossing)
+#define ctrl_SENSORLESS_REJECT_RESTART  3           //Rejected intervals in a row that restart the sector time
+#define ctrl_SENSORLESS_PREDICT_TOL     (0.15f)     //Hall commutation vs prediction, in sectors, for a sector to count towards lock
+
+//Phases (0 A, 1 B, 2 C) driven high and low by each row of ctrl_output_table; the third one floats
+static const uint8_t ctrl_sensorless_high[6] = {0, 2, 2, 1, 1, 0};
+static const uint8_t ctrl_sensorless_low[6]  = {1, 1, 0, 0, 2, 2};
+
+void ctrl_sensorlessInit(ctrl_sensorless_t* s) {
+    memset(s, 0, sizeof(*s));
+    s->row = 6;
+    s->dir = 1;
+}
+
+void ctrl_sensorlessCommutated(ctrl_sensorless_t* s, uint64_t t_us, uint8_t row, int8_t dir) {
+    //Did this sector's crossing call the commutation?
+    if ((s->predicted_us > 0) && (s->row < 6) && (row != s->row)) {
+        uint64_t err = (t_us > s->predicted_us) ? t_us - s->predicted_us : s->predicted_us - t_us;
+        if (err <= s->predictTol_us) {
+            if (s->good < 0xFFFF) { s->good++; }
+            if ((s->good >= ctrl_SENSORLESS_LOCK_SECTORS) && (err > s->stats.predictErrMax_us)) { s->stats.predictErrMax_us = (uint32_t) err; }
+        } else {
+            s->good = 0;
+        }
+    } else if (row != s->row) {
+        s->good = 0;
+    }
+    if ((row != s->row) && (s->comm_us > 0)) { s->commInterval_us = (uint32_t) (t_us - s->comm_us); }
+    s->row = row;
+    s->dir = dir;
+    s->comm_us = t_us;
+    s->predicted_us = 0;
+    s->done = false;
+    s->overdue = false;
+    s->near = false;
+    s->far = 0;
+    s->samples = 0;
+    if (row < 6) {
+        //The floating phase heads for the rail it is driven to in the next row
+        uint8_t next = (uint8_t) ((row + 6 + dir) % 6);
+        uint8_t floating = (uint8_t) (3 - ctrl_sensorless_high[row] - ctrl_sensorless_low[row]);
+        s->slope = (ctrl_sensorless_high[next] == floating) ? 1 : -1;
+    }
+}
+
+uint8_t ctrl_sensorlessSample(ctrl_sensorless_t* s, const float v[3], bool powered, uint64_t t_us, uint64_t* comm_us) {
+    if ((s->row >= 6) || (s->done)) { return ctrl_SENSORLESS_NONE; }
+    float elapsed = (float) (t_us - s->comm_us);
+    //Blanking from the last sector's length as the commutations had it, so a sector time left over from another speed
+    //can't hide the crossings that would correct it
+    float blank = ctrl_SENSORLESS_BLANK * (((s->sector_us > 0.0f) && (s->sector_us < (float) s->commInterval_us)) ? s->sector_us : (float) s->commInterval_us);
+    if (blank < ctrl_SENSORLESS_BLANK_MIN_US) { blank = ctrl_SENSORLESS_BLANK_MIN_US; }
+    if (elapsed < blank) { return ctrl_SENSORLESS_NONE; }
+    if ((!s->overdue) && (s->sector_us > 0.0f) && (elapsed > ctrl_SENSORLESS_OVERDUE * s->sector_us)) {
+        //Keeps looking: with the halls commutating the crossing may only be late because the speed changed
+        s->overdue = true;
+        s->good = 0;
+        if (s->misses < 0xFF) { s->misses++; }
+        s->stats.missed++;
+        return ctrl_SENSORLESS_MISSED;
+    }
+
+    //Median of the last three samples, which a single spike can't move; on a ramp it is the middle one, so its time is too
+    uint8_t high = ctrl_sensorless_high[s->row], low = ctrl_sensorless_low[s->row];
+    float star = powered ? 0.5f * (v[high] + v[low]) : (v[0] + v[1] + v[2]) / 3.0f;
+    s->raw[0] = s->raw[1];
+    s->raw[1] = s->raw[2];
+    s->raw[2] = ((float) s->slope) * (v[3 - high - low] - star);
+    uint64_t raw1_us = s->raw_us;
+    s->raw_us = t_us;
+    if (s->samples < 3) { s->samples++; }
+    if (s->samples < 3) { return ctrl_SENSORLESS_NONE; }
+    float a = s->raw[0], b = s->raw[1], c = s->raw[2];
+    float err = fmaxf(fminf(a, b), fminf(fmaxf(a, b), c));
+    t_us = raw1_us;
+    if (err <= 0.0f) {
+        s->near = true;
+        s->nearErr = err;
+        s->near_us = t_us;
+        s->far = 0;
+        return ctrl_SENSORLESS_NONE;
+    }
+    if (!s->near) {
+        //Still clamped from the commutation, or the crossing came before the blanking ended: then this sample is
+        //only just past it, and stands in for both sides (the crossing is taken as late as it can have been)
+        if (err >= ctrl_SENSORLESS_LATE * (v[high] - v[low])) { return ctrl_SENSORLESS_NONE; }
+        s->near = true;
+        s->nearErr = 0.0f;
+        s->near_us = t_us;
+    }
+    if (s->far == 0) {
+        s->farErr = err;
+        s->far_us = t_us;
+    }
+    if (++s->far < ctrl_SENSORLESS_CONFIRM) { return ctrl_SENSORLESS_NONE; }
+
+    //Crossing: where the line between the samples either side of zero meets it
+    uint64_t zc = s->near_us + (uint64_t) ((float) (s->far_us - s->near_us) * (-s->nearErr) / (s->farErr - s->nearErr));
+    s->done = true;
+    if (!s->overdue) { s->misses = 0; }
+    s->stats.zeroCrossings++;
+    if (s->zc_us > 0) {
+        float interval = (float) (zc - s->zc_us);
+        if (s->sector_us <= 0.0f) {
+            s->sector_us = interval;
+        } else if ((interval > ctrl_SENSORLESS_INTERVAL_MIN * s->sector_us) && (interval < ctrl_SENSORLESS_INTERVAL_MAX * s->sector_us)) {
+            s->sector_us += ctrl_SENSORLESS_FILTER * (interval - s->sector_us);
+            s->rejectRun = 0;
+        } else {
+            s->stats.rejected++;
+            //Several in a row: the speed has moved on from the sector time (a stop, or a long gap), start again from here
+            if (++s->rejectRun >= ctrl_SENSORLESS_REJECT_RESTART) {
+                s->sector_us = interval;
+                s->rejectRun = 0;
+            }
+        }
+    }
+    s->zc_us = zc;
+    s->predictTol_us = (uint32_t) (ctrl_SENSORLESS_PREDICT_TOL * s->sector_us);
+    if ((s->sector_us <= 0.0f) || (s->overdue)) { return ctrl_SENSORLESS_NONE; }
+    s->predicted_us = zc + (uint64_t) (ctrl_SENSORLESS_DELAY * s->sector_us);
+    *comm_us = s->predicted_us;
+    return ctrl_SENSORLESS_ZC;
+}
+
+bool ctrl_sensorlessLocked(const ctrl_sensorless_t* s) {
+    return (s->good >= ctrl_SENSORLESS_LOCK_SECTORS) && (s->misses == 0);
+}
+
+float ctrl_sensorlessComPerSec(const ctrl_sensorless_t* s) {
+    return (s->sector_us > 0.0f) ? 1000000.0f / s->sector_us : 0.0f;
+}
@@ -0,0 +1,70 @@
+#ifndef CTRL_SENSORLESS_H_
+#define CTRL_SENSORLESS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//Back-EMF zero crossing detection for sensorless six-step commutation, run by ctrl_subsystem.c once per PWM period.
+//In each output table row one phase floats, and its back-EMF ramps from one rail to the other across the sector,
+//crossing the star point half way (30 electrical degrees after the commutation). The three terminal voltages are
+//sampled mid on-time; the floating one is compared with the mean of the two driven ones, which stands in for the
+//star point while the high side switches. With no duty on (coasting, only the low side on) no current flows and the
+//star point is the mean of all three.
+//Samples just after a commutation are ignored (the old phase's current clamps it to a rail while it decays), the
+//rest go through a median of three (single noise spikes don't get through), a crossing needs a sample on the near
+//side of zero followed by ctrl_SENSORLESS_CONFIRM on the far side, and its time is interpolated between the samples
+//either side of zero. A first sample just past zero (not at a rail, so not the clamp) means the blanking hid the
+//crossing, which is then taken at that sample.
+//The next commutation is due half a sector after the crossing, the sector time being the filtered time between
+//crossings. While the halls commutate, each hall commutation is checked against that prediction; lock is a run of
+//ctrl_SENSORLESS_LOCK_SECTORS sectors that got it right.
+
+#define ctrl_SENSORLESS_NONE    0
+#define ctrl_SENSORLESS_ZC      1       //Zero crossing found, commutation due at *comm_us
+#define ctrl_SENSORLESS_MISSED  2       //No crossing yet and the commutation is due (reported once per sector)
+
+#define ctrl_SENSORLESS_LOCK_SECTORS    12      //Two electrical turns
+
+typedef struct {
+    uint32_t zeroCrossings;
+    uint32_t missed;            //Sectors with no crossing before the commutation was overdue
+    uint32_t rejected;          //Crossing intervals too far from the sector time to go into it
+    uint32_t predictErrMax_us;  //Largest hall commutation vs prediction difference while locked
+} ctrl_sensorlessStats_t;
+
+typedef struct {
+    uint8_t row;                //Output table row on since the last commutation (6 = none)
+    int8_t dir;                 //+1 forward (rows go up), -1 backward
+    int8_t slope;               //+1 floating phase rising through the sector, -1 falling
+    uint64_t comm_us;           //Last commutation
+    uint32_t commInterval_us;   //Time between the last two
+    uint64_t predicted_us;      //Commutation due from this sector's crossing (0 until there is one)
+    uint64_t zc_us;             //Last crossing
+    float sector_us;            //Filtered time between crossings, 0 until there have been two
+    uint32_t predictTol_us;     //ctrl_SENSORLESS_PREDICT_TOL of it, for ctrl_sensorlessCommutated()
+    bool done;                  //This sector's crossing is in
+    bool overdue;               //...or should have been: reported missed once
+    bool near;                  //A sample on the near side of zero since the blanking ended
+    uint8_t far;                //Samples on the far side since then
+    float raw[3];               //Last three samples (floating phase minus the star point, sign by slope), oldest first
+    uint64_t raw_us;            //Time of the newest
+    uint8_t samples;            //Taken since the blanking ended, up to 3
+    float nearErr, farErr;      //Floating phase minus the star point (sign by slope) either side of zero
+    uint64_t near_us, far_us;
+    uint16_t good;              //Sectors in a row whose crossing predicted the commutation
+    uint8_t misses;             //Sectors in a row with no crossing in time
+    uint8_t rejectRun;          //Crossing intervals in a row left out of the sector time
+    ctrl_sensorlessStats_t stats;
+} ctrl_sensorless_t;
+
+void ctrl_sensorlessInit(ctrl_sensorless_t* s);
+//A commutation happened (either source) and put row on. dir: +1 forward, -1 backward.
+//Called from the hall ISR, so integer only: the FPU can't be used in an ISR on the ESP32-S3.
+void ctrl_sensorlessCommutated(ctrl_sensorless_t* s, uint64_t t_us, uint8_t row, int8_t dir);
+//One PWM period's sample of the terminal voltages A/B/C, powered: the high side had duty on. Returns ctrl_SENSORLESS_*.
+uint8_t ctrl_sensorlessSample(ctrl_sensorless_t* s, const float v[3], bool powered, uint64_t t_us, uint64_t* comm_us);
+bool ctrl_sensorlessLocked(const ctrl_sensorless_t* s);
+//Speed from the sector time, in commutations per second (0 while unknown)
+float ctrl_sensorlessComPerSec(const ctrl_sensorless_t* s);
+
+#endif
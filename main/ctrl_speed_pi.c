@@ -0,0 +1,102 @@
+//PI speed controller, see ctrl_speed_pi.h
+
+#include <string.h>
+#include "ctrl_speed_pi.h"
+
+#define ctrl_BEMF_V_PER_MPH         (1.37)      //USERSET: starting back-EMF constant (the hub motor: 0.74 V s/rad at the 19" wheel)
+#define ctrl_SPEED_FILTER_TAU_S     (0.05)      //Low pass on the hall edge period speed estimate
+#define ctrl_BEMF_LEARN_TAU_S       (2.0)
+#define ctrl_BEMF_LEARN_MIN_MPH     (5.0)       //Below this the estimate is too coarse to learn from
+#define ctrl_BEMF_LEARN_MIN_A       (1.0)       //With less current the winding may not be conducting all period
+#define ctrl_SPEED_BAND_HYST_MPH    (1.0)       //Band changes need this much past the edge, so noise at an edge doesn't flip gains
+#define ctrl_DUTY_MAX               (4095.0f)
+
+void ctrl_speedPiDefaultGains(ctrl_speedPiGains_t* gains) {
+    //Tuned with "ctrl_bench speed" (tools/host): integral time about the car's ~10 s speed time constant, softer at low
+    //speed where fewer hall edges per filter time constant leave the estimate noisier
+    static const float fromMph[ctrl_SPEED_BANDS] = {0.0f, 15.0f, 30.0f};
+    static const float kp[ctrl_SPEED_BANDS]      = {400.0f, 600.0f, 700.0f};
+    static const float ki[ctrl_SPEED_BANDS]      = {40.0f, 60.0f, 70.0f};
+    memcpy(gains->fromMph, fromMph, sizeof(fromMph));
+    memcpy(gains->kp, kp, sizeof(kp));
+    memcpy(gains->ki, ki, sizeof(ki));
+    gains->ffGain = 1.0f;
+}
+
+void ctrl_speedPiInit(ctrl_speedPi_t* pi) {
+    memset(pi, 0, sizeof(*pi));
+    pi->bemf_VperMph = (float) ctrl_BEMF_V_PER_MPH;
+}
+
+static int ctrl_speedPiBand(const ctrl_speedPiGains_t* gains, float speed_mph) {
+    int band = 0;
+    while ((band + 1 < ctrl_SPEED_BANDS) && (speed_mph >= gains->fromMph[band + 1])) { band++; }
+    return band;
+}
+
+float ctrl_speedPiBackEmfDuty(const ctrl_speedPi_t* pi, float speed_mph, float batVolt) {
+    if (batVolt < 1.0f) { return 0.0f; }
+    return pi->bemf_VperMph * speed_mph / batVolt * 4096.0f;
+}
+
+static float ctrl_speedPiFeedForward(const ctrl_speedPi_t* pi, const ctrl_speedPiGains_t* gains, float set_mph, float batVolt) {
+    return gains->ffGain * ctrl_speedPiBackEmfDuty(pi, set_mph, batVolt);
+}
+
+void ctrl_speedPiEngage(ctrl_speedPi_t* pi, const ctrl_speedPiGains_t* gains, float duty, float set_mph, float speed_mph, float batVolt) {
+    pi->speedFilt_mph = speed_mph;
+    pi->band = ctrl_speedPiBand(gains, speed_mph);
+    pi->integral = duty - ctrl_speedPiFeedForward(pi, gains, set_mph, batVolt) - gains->kp[pi->band] * (set_mph - speed_mph);
+    pi->out = duty;
+    pi->saturated = false;
+}
+
+float ctrl_speedPiFilter(ctrl_speedPi_t* pi, float speed_mph, float dt) {
+    pi->speedFilt_mph += (speed_mph - pi->speedFilt_mph) * dt / ((float) ctrl_SPEED_FILTER_TAU_S + dt);
+    return pi->speedFilt_mph;
+}
+
+float ctrl_speedPiUpdate(ctrl_speedPi_t* pi, const ctrl_speedPiGains_t* gains, float set_mph, float speed_mph, float batVolt, bool limited, float dt) {
+    ctrl_speedPiFilter(pi, speed_mph, dt);
+    float error = set_mph - pi->speedFilt_mph;
+
+    //Gain schedule: keep kp*error + integral where it was across a band change
+    int band = pi->band;
+    if ((band + 1 < ctrl_SPEED_BANDS) && (pi->speedFilt_mph >= gains->fromMph[band + 1] + (float) ctrl_SPEED_BAND_HYST_MPH)) {
+        band = ctrl_speedPiBand(gains, pi->speedFilt_mph);
+    } else if ((band > 0) && (pi->speedFilt_mph < gains->fromMph[band] - (float) ctrl_SPEED_BAND_HYST_MPH)) {
+        band = ctrl_speedPiBand(gains, pi->speedFilt_mph);
+    }
+    if (band != pi->band) {
+        pi->integral += (gains->kp[pi->band] - gains->kp[band]) * error;
+        pi->band = band;
+    }
+
+    //No regen: below the duty that balances the back-EMF the motor just coasts, so that is the bottom of the range
+    float coast = ctrl_speedPiBackEmfDuty(pi, pi->speedFilt_mph, batVolt);
+    if (coast > ctrl_DUTY_MAX) { coast = ctrl_DUTY_MAX; }
+    float ff = ctrl_speedPiFeedForward(pi, gains, set_mph, batVolt);
+    float out = ff + gains->kp[band] * error + pi->integral;
+    //Anti-windup: no integration further into a clamp, including the current limit taking duty off the output
+    bool high = (out >= ctrl_DUTY_MAX) || limited;
+    if (!((high && (error > 0.0f)) || ((out <= coast) && (error < 0.0f)))) {
+        pi->integral += gains->ki[band] * error * dt;
+        if (pi->integral > ctrl_DUTY_MAX)  { pi->integral = ctrl_DUTY_MAX; }
+        if (pi->integral < -ctrl_DUTY_MAX) { pi->integral = -ctrl_DUTY_MAX; }
+        out = ff + gains->kp[band] * error + pi->integral;
+    }
+    pi->saturated = (out > ctrl_DUTY_MAX) || (out < coast);
+    if (out > ctrl_DUTY_MAX) { out = ctrl_DUTY_MAX; }
+    if (out < coast)         { out = coast; }
+    pi->out = out;
+    return out;
+}
+
+void ctrl_speedPiObserve(ctrl_speedPi_t* pi, float duty, float batVolt, float phase_A, float r_ohm, float speed_mph, float dt) {
+    if ((speed_mph < (float) ctrl_BEMF_LEARN_MIN_MPH) || (phase_A < (float) ctrl_BEMF_LEARN_MIN_A) || (duty <= 0.0f)) { return; }
+    float bemf = duty / 4096.0f * batVolt - phase_A * r_ohm;
+    float k = bemf / speed_mph;
+    //Only plausible values: a bad current reading must not take the feed-forward somewhere silly
+    if ((k < 0.5f * (float) ctrl_BEMF_V_PER_MPH) || (k > 2.0f * (float) ctrl_BEMF_V_PER_MPH)) { return; }
+    pi->bemf_VperMph += (k - pi->bemf_VperMph) * dt / ((float) ctrl_BEMF_LEARN_TAU_S + dt);
+}
@@ -0,0 +1,49 @@
+#ifndef CTRL_SPEED_PI_H_
+#define CTRL_SPEED_PI_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//PI speed controller used by ctrl_speedLoop(). The output is the high side duty (0-4095):
+//  duty = feed-forward + kp*error + integral
+//The feed-forward is the duty that balances the motor's back-EMF at the set speed, so the integral only has to
+//cover the road load. The back-EMF constant (volts per mph) starts at ctrl_BEMF_V_PER_MPH and is learned from the
+//terminal voltage and phase current while the motor is driving.
+//Gains come from the speed band the car is in. A band change moves the integral so the output doesn't step, and
+//so does engaging from throttle control (ctrl_speedPiEngage). The integral stops while the output is clamped in the
+//direction of the error (anti-windup). The top clamp is full duty or the current limit; the bottom one is the duty that
+//balances the back-EMF, since there is no regen and anything lower only coasts.
+
+#define ctrl_SPEED_BANDS 3
+
+typedef struct {
+    float fromMph[ctrl_SPEED_BANDS];    //Band i is used from fromMph[i] up to fromMph[i+1] (fromMph[0] is 0)
+    float kp[ctrl_SPEED_BANDS];         //Duty counts per mph of error
+    float ki[ctrl_SPEED_BANDS];         //Duty counts per mph of error per second
+    float ffGain;                       //Share of the back-EMF feed-forward used (0 off, 1 full)
+} ctrl_speedPiGains_t;
+
+typedef struct {
+    float integral;                     //Duty counts
+    float out;
+    float speedFilt_mph;                //Speed estimate after the loop's low pass
+    float bemf_VperMph;
+    int band;
+    bool saturated;                     //Output clamped on the last update
+} ctrl_speedPi_t;
+
+void ctrl_speedPiDefaultGains(ctrl_speedPiGains_t* gains);
+void ctrl_speedPiInit(ctrl_speedPi_t* pi);
+//Takes over from whatever drove the output until now: the next update starts at duty
+void ctrl_speedPiEngage(ctrl_speedPi_t* pi, const ctrl_speedPiGains_t* gains, float duty, float set_mph, float speed_mph, float batVolt);
+//One control period of dt seconds, returns the duty (0-4095). limited: the current loop is holding the output below it
+float ctrl_speedPiUpdate(ctrl_speedPi_t* pi, const ctrl_speedPiGains_t* gains, float set_mph, float speed_mph, float batVolt, bool limited, float dt);
+//Speed low pass alone (ctrl_speedPiUpdate runs it too), for code driving the output instead of the controller
+float ctrl_speedPiFilter(ctrl_speedPi_t* pi, float speed_mph, float dt);
+//Duty that balances the learned back-EMF at a speed: what the motor needs with no load
+float ctrl_speedPiBackEmfDuty(const ctrl_speedPi_t* pi, float speed_mph, float batVolt);
+//Learns the back-EMF constant from the duty on the high side, the battery voltage and the phase current (r_ohm: the
+//winding resistance, the two conducting phases in series)
+void ctrl_speedPiObserve(ctrl_speedPi_t* pi, float duty, float batVolt, float phase_A, float r_ohm, float speed_mph, float dt);
+
+#endif
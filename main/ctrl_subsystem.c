@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -7,8 +8,18 @@
 #include "driver/gpio.h"
 #include "driver/ledc.h"
 
+#include "ctrl_subsystem.h"
+#include "ctrl_speed_pi.h"
+#include "ctrl_autotune.h"
+#include "ctrl_params.h"
+#include "ctrl_sensorless.h"
+#include "ctrl_pwm.h"
 #include "itf_seven_seg.h"
 #include "itf_sd_card_writer.h"
+#include "itf_log_policy.h"
+#include "itf_log_codec.h"
+#include "itf_trace.h"
+#include "esp_cpu.h"
 #include <time.h>
 
 
@@ -23,16 +34,11 @@
 
 
 //******************************************************     GENERAL     ******************************************************
-static const char *TAG_CTRL = "CTRL";       //Classification tag applied to any outgoing serial communication messages from this subsystem.
+//Messages from this subsystem go through the trace log with the "CTRL" tag (itf_trace_ids.h)
 
-//Calculation of vital parameters:
-#define ctrl_HUBDIAMETER_IN (19.0)         //USERSET: The RADIUS of the wheel in inches
-#define ctrl_MOTORPOLES_FL  (46.0)         //USERSET: The number of poles on the BLDC motor to be controlled
-#define ctrl_MOTORPHASES_FL (3.0)          //USERSET: The number of phases on the BLDC motor to be controlled
-#define ctrl_CONV_IN_MI     (1.0/63360.0)  //Conversion factor: inches to miles
-#define ctrl_HUBCIRCUM_MI   (3.141592*(ctrl_HUBDIAMETER_IN*ctrl_CONV_IN_MI))   //Motor hub circumference (including wheel) in miles
-#define ctrl_DIST_PER_COM   (ctrl_HUBCIRCUM_MI/(ctrl_MOTORPOLES_FL*ctrl_MOTORPHASES_FL)) //distance travelled during one commutation
-#define ctrl_CONV_COM_PER_SEC_TO_MPH (ctrl_DIST_PER_COM*3600.0)
+//Wheel size, pole count, PWM frequency, safety thresholds and current loop settings are runtime parameters
+//(ctrl_params.c, "param" on the PC console), read through ctrl_params. Commutations per second to mph is
+//ctrl_params->convComPerSecToMph, worked out once per change.
 
 
 //******************************************************     PINS     ******************************************************
@@ -58,10 +64,39 @@ static const char *TAG_CTRL = "CTRL";       //Classification tag applied to any
 #define ctrl_PWM_CHN_AH LEDC_CHANNEL_0
 #define ctrl_PWM_CHN_BH LEDC_CHANNEL_1
 #define ctrl_PWM_CHN_CH LEDC_CHANNEL_2
-#define ctrl_PWM_FREQ   (10000)             // Frequency in Hertz.
 #define ctrl_MIN_SPEED_CONTROL_MPH      10.0
 #define ctrl_MAX_SPEED_CONTROL_MPH      55.0
-#define ctrl_SPDCTRL_PGAIN              (100.0)      //91.02 gives full range of throttle from 10 to 55 mph
+#define ctrl_SPEED_LOOP_DT_S            (ctrl_SCHED_TICK_PERIOD/1000000.0f)   //ctrl_speedLoop() runs on every base tick
+
+
+
+
+//******************************************************     SCHEDULER     ******************************************************
+//Each loop runs at a rate that suits its dynamics (see ctrl_rates[]). Periods and deadlines in microseconds,
+//deadlines count from the timer release to the end of the run. The current loop runs once per period of the pwm_hz
+//parameter, with half of it as the deadline; both are set at boot and stay put when ctrl_pwmLoop() moves the PWM itself.
+#define ctrl_SCHED_TICK_PERIOD      (1000)                      //Base tick of the operational task, also the speed loop period
+#define ctrl_SPEED_LOOP_DEADLINE    (500)
+#define ctrl_SAFETY_DEADLINE        (2000)                      //Safety, energy and speed estimate run every ctrl_SPEED_CONTROL_UPDATE_PERIOD
+#define ctrl_PWM_DEADLINE           (2000)                      //PWM frequency choice, every ctrl_SPEED_CONTROL_UPDATE_PERIOD
+#define ctrl_LOG_DEADLINE           (5000)                      //So does the log policy, after the speed loop
+#define ctrl_DISPLAY_UPDATE_PERIOD  (100000)
+#define ctrl_DISPLAY_DEADLINE       (50000)
+
+
+
+
+//******************************************************     SENSORLESS     ******************************************************
+//From the bemf_mph parameter up, commutations can come from the back-EMF zero crossings (ctrl_sensorless.h) instead of the
+//hall ISR, which takes the hall wiring and interrupt latency out of the loop at cruise. ctrl_sensorlessLoop() hands over once
+//the zero crossings have been predicting the hall commutations (lock), and hands back under the speed, when they stop
+//coming, or when the motor stops driving. The halls are still read while sensorless, but a hall fault only stops the motor
+//once they commutate again.
+#define ctrl_SENSORLESS_HYST_MPH        (2.0)       //Hand back this far under the bemf_mph parameter
+#define ctrl_SENSORLESS_MAX_MISSES      3           //Sectors in a row without a zero crossing before handing back
+#define ctrl_SENSORLESS_OFF_SLOW        1           //Hand back reasons, in the CTRL_SENSORLESS_OFF trace
+#define ctrl_SENSORLESS_OFF_LOST        2
+#define ctrl_SENSORLESS_OFF_STOPPED     3
 
 
 
@@ -77,14 +112,7 @@ static const char *TAG_CTRL = "CTRL";       //Classification tag applied to any
 #define ctrl_ERROR_BAT_CURRENT            0x07
 #define ctrl_ERROR_OVERHEAT               0x08
 #define ctrl_ERROR_NONZERO_START_THROTTLE 0x09
-
-//Safety thresholds (exceeding these will cause one of the error codes above)
-#define ctrl_UNDERVOLTAGE_THRESHOLD_V      38.0
-#define ctrl_OVERVOLTAGE_THRESHOLD_V       60.0
-#define ctrl_OVERCURRENT_THRESHOLD_A       35.0
-#define ctrl_TOTAL_OVERCURRENT_THRESHOLD_A ctrl_OVERCURRENT_THRESHOLD_A*2.0
-#define ctrl_OVERTEMP_THRESHOLD_F          212.0
-#define ctrl_SKIPPED_COMMUTATIONS_ERROR_THRESHOLD   200
+//The thresholds that raise them are runtime parameters (ctrl_params.h)
 
 
 
@@ -145,16 +173,27 @@ double ctrl_curC = 0;
 double ctrl_tempA = 0;
 double ctrl_tempB = 0;
 double ctrl_tempC = 0;
+double ctrl_phaseVoltA = 0;     //Phase terminal voltages, sampled mid on-time once per PWM period (ctrl_sensorlessLoop())
+double ctrl_phaseVoltB = 0;
+double ctrl_phaseVoltC = 0;
 
 //Motor control and speed variables
 uint8_t  ctrl_direction_command = 0x00;             //00 = NOT RUNNING, 01 = FORWARD, 10 = BACKWARD, 11 = NOT RUNNING
 double   ctrl_speedSetting_mph = 0.0;               //Set to true to use the speed control algorithm. False will use the current hall state only.
 bool     ctrl_mc_armed = false;                     //Set to true after the motor passes startup safety checks (including throttle == 0) AND direction is 0b10 or 0b01
                                                     //Set to false after the direction changes to 0b00 or 0b11
-uint16_t ctrl_speed_control_duty_raw = 2047;        //Raw speed control value. Value from 0 to 4095.
-uint16_t ctrl_speed_control_duty_final = 0;         //Speed control raw value combined with any P or I feedback. 
+uint16_t ctrl_speed_control_duty_final = 0;         //Speed control duty (0 to 4095) from the PI controller in ctrl_speedLoop()
+ctrl_speedPi_t ctrl_speed_pi;                       //Speed controller state (integral, filtered speed, learned back-EMF)
+ctrl_speedPiGains_t ctrl_speed_pi_gains;            //Gain schedule, ctrl_speedPiDefaultGains() until changed at runtime
+bool     ctrl_speed_pi_engage = false;              //Set when speed control takes over, ctrl_speedLoop() hands the current duty to the controller
+ctrl_autotune_t ctrl_autotune;                      //Relay tuning of the speed loop (runs in place of the PI while RUNNING)
+volatile bool ctrl_autotune_save_pending = false;   //Tuned gains waiting for ctrl_serviceAutotune() to store them
+uint8_t  ctrl_autotune_save_result = 0;             //ctrl_autotuneSaveGains() result of the last store
 uint16_t ctrl_throttle = 0;                         //Throttle value can be from 0 to 255. Must be 0 on startup, or motor will not be allowed to start.
 uint8_t  ctrl_safety_shutdown = false;              //This can be set to true from anywhere in the program. Should only ever be set to false within the safety_shutdown task
+uint8_t  ctrl_throttle_mode = ctrl_THROTTLE_MODE_DUTY;  //How ctrl_throttle is read: straight duty, or a bus current target (torque)
+uint16_t ctrl_duty_out = 0;                         //Duty the output stage uses: the command after ctrl_currentLoop()'s regulator and limits
+float    ctrl_curreg_integral = 0.0f;               //Current regulator integrator, in duty counts
 
 //Hall-state and output table tracking:
 uint8_t  ctrl_cur_output_index = 0;                 //Used to keep track of what output (based on the output_table) is being sent to the MOSFET drivers
@@ -176,6 +215,21 @@ uint32_t ctrl_runTime = 0.0;        //Total motor running time in milliseconds
 bool ctrl_usingSpeedControl = false;
 uint32_t ctrl_commutation_counter = 0;
 uint64_t ctrl_commutation_timestamps[3] = {0,0,0};
+ctrl_faultSnapshot_t ctrl_fault_snapshot = {0};   //Filled by ctrl_captureFault() when a new safety shutdown appears
+ctrl_isrStats_t ctrl_hall_isr_stats = {0};        //Updated at the end of every ctrl_hall_isr()
+ctrl_curregStats_t ctrl_curreg_stats = {0};       //Updated by ctrl_currentLoop()
+uint16_t ctrl_applied_duty = 0;                   //Duty last written to the active high side channel
+uint8_t  ctrl_applied_output_index = 6;           //Output table row last written by ctrl_set_MSFTOutput() (6 = all off)
+volatile uint64_t ctrl_sched_release_us = 0;      //Time of the latest base tick, set by ctrl_update_timer_cb()
+portMUX_TYPE ctrl_output_mux = portMUX_INITIALIZER_UNLOCKED;   //Keeps ctrl_currentLoop() from writing a channel a commutation just turned off
+uint8_t ctrl_comm_mode = ctrl_COMM_HALL;          //Which source commutates, switched by ctrl_sensorlessLoop()
+ctrl_sensorless_t ctrl_bemf;                      //Zero crossing detector, fed every PWM period whichever source commutates
+                                                  //  (under ctrl_output_mux: the hall ISR can commutate in the middle of a sample)
+ctrl_commStatus_t ctrl_comm_status = {0};         //Hand over counters (ctrl_getCommStatus() fills in the rest)
+bool ctrl_sensorless_hall_fault = false;          //Hall fault seen while sensorless, until the halls read right again
+ctrl_pwm_t ctrl_pwm;                              //PWM frequency choice (ctrl_pwmLoop()); ctrl_currentLoop() puts it on the output
+uint8_t ctrl_pwm_applied = ctrl_PWM_BASE_STEP;    //ctrl_pwm.steps[] index on the LEDC timer
+uint8_t ctrl_pwm_bits = 12;                       //Its duty resolution, for ctrl_PWM_DUTY() (changes under ctrl_output_mux)
 
 //HANS TEST VAR
 uint64_t intrTime_test = 0;
@@ -204,29 +258,119 @@ bool  ctrl_isArmed(void)                { return ctrl_mc_armed; }
 bool  ctrl_isInSafetyShutdown(void)     { return ((bool)ctrl_safety_shutdown); }    //If safety shutdown is anything except 0, system is in safety shutdown
 uint8_t ctrl_getErrorCode(void)         { return ctrl_safety_shutdown; }            //The value of safety_shutdown IS the error code
 uint64_t ctrl_getTime(void)             { return esp_timer_get_time(); }
+uint8_t ctrl_getDirection(void)         { return ctrl_direction_command; }
+uint8_t ctrl_getSkippedCommutations(void) { return ctrl_skipped_commutations; }
+bool  ctrl_isUsingSpeedControl(void)    { return ctrl_usingSpeedControl; }
+uint16_t ctrl_getDutyCommand(void)      { return (ctrl_usingSpeedControl ? ctrl_speed_control_duty_final : ((ctrl_throttle_mode == ctrl_THROTTLE_MODE_TORQUE) ? ctrl_duty_out : ctrl_throttle)); }
+uint16_t ctrl_getOutputDuty(void)       { return ctrl_duty_out; }
+uint8_t ctrl_getThrottleMode(void)      { return ctrl_throttle_mode; }
+bool  ctrl_isCurrentLimited(void)       { return (ctrl_curreg_stats.limiting != 0); }
+void ctrl_getCurrentRegStats(ctrl_curregStats_t* out) { *out = ctrl_curreg_stats; }
+void ctrl_resetCurrentRegStats(void)    { memset(&ctrl_curreg_stats, 0, sizeof(ctrl_curreg_stats)); }
+const ctrl_faultSnapshot_t* ctrl_getFaultSnapshot(void) { return &ctrl_fault_snapshot; }
+void ctrl_getHallIsrStats(ctrl_isrStats_t* out) { *out = ctrl_hall_isr_stats; }
+void ctrl_getCommStatus(ctrl_commStatus_t* out) {
+    *out = ctrl_comm_status;
+    out->mode = ctrl_comm_mode;
+    portENTER_CRITICAL_SAFE(&ctrl_output_mux);
+    out->locked = ctrl_sensorlessLocked(&ctrl_bemf);
+    float comPerSec = ctrl_sensorlessComPerSec(&ctrl_bemf);
+    out->zc = ctrl_bemf.stats;
+    portEXIT_CRITICAL_SAFE(&ctrl_output_mux);
+    out->speed_mph = (float) (comPerSec * ctrl_params->convComPerSecToMph);
+}
+void ctrl_getPwmStatus(ctrl_pwmStatus_t* out) {
+    const ctrl_pwmStep_t* s = &ctrl_pwm.steps[ctrl_pwm_applied];
+    out->freq_hz = s->freq_hz;
+    out->bits = s->bits;
+    out->changes = ctrl_pwm.changes;
+    out->loss_W = ctrl_pwm.loss_W;
+    out->baseLoss_W = ctrl_pwm.baseLoss_W;
+    out->loss_j = (float) ctrl_pwm.loss_j;
+    out->baseLoss_j = (float) ctrl_pwm.baseLoss_j;
+}
+void ctrl_resetHallIsrStats(void)       { memset(&ctrl_hall_isr_stats, 0, sizeof(ctrl_hall_isr_stats)); }
+
+const char* ctrl_getErrorName(uint8_t error_code) {
+    switch (error_code) {
+        case 0:                                 return "NONE";
+        case ctrl_ERROR_HALL_WIRE:              return "HALL_WIRE";
+        case ctrl_ERROR_HALL_CHANGE:            return "HALL_CHANGE";
+        case ctrl_ERROR_SENSING_TIMEOUT:        return "SENSING_TIMEOUT";
+        case ctrl_ERROR_BAT_UNDERVOLT:          return "BAT_UNDERVOLT";
+        case ctrl_ERROR_BAT_OVERVOLT:           return "BAT_OVERVOLT";
+        case ctrl_ERROR_PHASE_CURRENT:          return "PHASE_CURRENT";
+        case ctrl_ERROR_BAT_CURRENT:            return "BAT_CURRENT";
+        case ctrl_ERROR_OVERHEAT:               return "OVERHEAT";
+        case ctrl_ERROR_NONZERO_START_THROTTLE: return "NONZERO_START_THROTTLE";
+        default:                                return "UNKNOWN";
+    }
+}
+
+void ctrl_getAutotuneStatus(ctrl_autotune_t* out) { *out = ctrl_autotune; }
+void ctrl_getSpeedGains(ctrl_speedPiGains_t* out) { *out = ctrl_speed_pi_gains; }
+uint8_t ctrl_getAutotuneSaveResult(void) { return ctrl_autotune_save_result; }
+
+//Puts a finished tune's gains in use (through the setters, so the log has them) and stores them. Runs from the PC link
+//task (PCComTask), since a flash write would stall the control loop.
+void ctrl_serviceAutotune(void) {
+    ctrl_autotune_t at;
+    ctrl_speedPiGains_t gains;
+    if (!ctrl_autotune_save_pending) { return; }
+    ctrl_autotune_save_pending = false;
+    at = ctrl_autotune;
+    for (int band = at.firstBand; band <= at.lastBand; band++) {
+        ctrl_setSpeedKp(band, at.kp[band]);
+        ctrl_setSpeedKi(band, at.ki[band]);
+    }
+    gains = ctrl_speed_pi_gains;
+    ctrl_autotune_save_result = ctrl_autotuneSaveGains(&gains);
+}
+
+//Ends a running tune; the motor coasts until the next throttle or speed command
+static void ctrl_endAutotune(uint8_t error) {
+    if (ctrl_autotune.state != ctrl_AUTOTUNE_RUNNING) { return; }
+    ctrl_autotuneStop(&ctrl_autotune, error);
+    ctrl_usingSpeedControl = false;
+}
 
 //******************************* SET functions (Return 0 on **SUCCESS**)
-uint8_t ctrl_setSpeedControl(float target_mph) {
+//Every setter call goes to the log as a command record (itf_logPolicyCommand), so logs can be replayed
+static uint8_t ctrl_applySpeedControl(float target_mph) {
     //Reasons this CANNOT be set:
     //      (1) motor is in safety shutdown
     //      (2) motor is NOT armed (has not started)
     //      (3) speed control value is out of operational range (10-55 mph at time this was written)
+    ctrl_endAutotune(ctrl_AUTOTUNE_ERR_STOPPED);     //Any speed command takes over from a running tune
     if          (ctrl_safety_shutdown > 0) { ctrl_usingSpeedControl = false; return 1; }
     else if     (!(ctrl_isArmed())) { ctrl_usingSpeedControl = false; return 2; }
     else if     ((target_mph < ctrl_MIN_SPEED_CONTROL_MPH) || (target_mph > ctrl_MAX_SPEED_CONTROL_MPH)) { ctrl_usingSpeedControl = false; return 3; }
 
     //If execution reaches this point, then the speed control setting may be made:
+    if (!ctrl_usingSpeedControl) {
+        //Bumpless: hold the duty the motor has now until ctrl_speedLoop() hands it to the controller
+        ctrl_speed_control_duty_final = ctrl_duty_out;
+        ctrl_speed_pi_engage = true;
+    }
     ctrl_speedSetting_mph = target_mph;
     ctrl_usingSpeedControl = true;      //Automatically turns on speed control when execution reaches this point
     return 0;    //Success
 }
 
+uint8_t ctrl_setSpeedControl(float target_mph) {
+    uint8_t result = ctrl_applySpeedControl(target_mph);
+    itf_logPolicyCommand(ITF_LOG_CMD_SPEED, (int32_t) (target_mph*100.0f + ((target_mph < 0) ? -0.5f : 0.5f)), result);
+    return result;
+}
+
 uint8_t ctrl_turnOffSpeedControl(void) {
+    ctrl_endAutotune(ctrl_AUTOTUNE_ERR_STOPPED);
     ctrl_usingSpeedControl = false;
+    itf_logPolicyCommand(ITF_LOG_CMD_SPEED, 0, 0);
     return 0;    //Success
 }
 
-uint8_t ctrl_setThrottle(uint16_t desired_throttle) {
+static uint8_t ctrl_applyThrottle(uint16_t desired_throttle) {
     //Reasons this CANNOT be set:
     //      (1) motor is in safety shutdown
     //      (2) throttle value is out of operational range (0-4096) (operational range matches to 12-bit ADC resolution)
@@ -234,15 +378,112 @@ uint8_t ctrl_setThrottle(uint16_t desired_throttle) {
     else if     (desired_throttle > 4096) { return 2; }
 
     //If execution reaches this point, then the new throttle can take effect:
+    if (desired_throttle != 0) { ctrl_endAutotune(ctrl_AUTOTUNE_ERR_STOPPED); }    //The driver takes over
     ctrl_throttle = desired_throttle;
     return 0;    //Success
 }
 
+uint8_t ctrl_setThrottle(uint16_t desired_throttle) {
+    uint8_t result = ctrl_applyThrottle(desired_throttle);
+    itf_logPolicyCommand(ITF_LOG_CMD_THROTTLE, desired_throttle, result);
+    return result;
+}
+
+static uint8_t ctrl_applyThrottleMode(uint8_t new_mode) {
+    //Reasons this CANNOT be set:
+    //      (1) the mode does not exist
+    //      (2) the motor is armed with the throttle open (the same throttle would suddenly mean something else)
+    if          (new_mode > ctrl_THROTTLE_MODE_TORQUE) { return 2; }
+    else if     ((ctrl_mc_armed) && (ctrl_throttle != 0) && (new_mode != ctrl_throttle_mode)) { return 1; }
+
+    ctrl_throttle_mode = new_mode;
+    return 0;    //Success
+}
+
+uint8_t ctrl_setThrottleMode(uint8_t new_mode) {
+    uint8_t result = ctrl_applyThrottleMode(new_mode);
+    itf_logPolicyCommand(ITF_LOG_CMD_THROTTLE_MODE, new_mode, result);
+    return result;
+}
+
+static uint8_t ctrl_applyAutotune(float set_mph) {
+    //Reasons this CANNOT be started:
+    //      (1) motor is in safety shutdown
+    //      (2) motor is NOT armed (has not started)
+    //      (3) throttle is open (the wheel should be on a stand with nobody driving)
+    //      (4) tune speed is out of range (0 = every band, otherwise ctrl_MIN_SPEED_CONTROL_MPH-ctrl_MAX_SPEED_CONTROL_MPH)
+    //      (5) a tune is already running
+    if          (ctrl_safety_shutdown > 0) { return 1; }
+    else if     (!(ctrl_isArmed())) { return 2; }
+    else if     (ctrl_throttle != 0) { return 3; }
+    else if     ((set_mph != 0.0f) && ((set_mph < ctrl_MIN_SPEED_CONTROL_MPH) || (set_mph > ctrl_MAX_SPEED_CONTROL_MPH))) { return 4; }
+    else if     (ctrl_autotune.state == ctrl_AUTOTUNE_RUNNING) { return 5; }
+
+    ctrl_autotuneStart(&ctrl_autotune, &ctrl_speed_pi_gains, set_mph);
+    ctrl_speed_control_duty_final = ctrl_duty_out;
+    ctrl_speedPiEngage(&ctrl_speed_pi, &ctrl_speed_pi_gains, (float) ctrl_duty_out, (float) ctrl_speed_mph, (float) ctrl_speed_mph, (float) ctrl_batVolt);
+    ctrl_usingSpeedControl = true;      //The relay drives ctrl_speed_control_duty_final in place of the PI
+    return 0;    //Success
+}
+
+uint8_t ctrl_startAutotune(float set_mph) {
+    uint8_t result = ctrl_applyAutotune(set_mph);
+    itf_logPolicyCommand(ITF_LOG_CMD_AUTOTUNE, (int32_t) (set_mph*100.0f + 0.5f), result);
+    return result;
+}
+
+uint8_t ctrl_stopAutotune(void) {
+    ctrl_endAutotune(ctrl_AUTOTUNE_ERR_STOPPED);
+    itf_logPolicyCommand(ITF_LOG_CMD_AUTOTUNE, -1, 0);
+    return 0;    //Success
+}
+
+static uint8_t ctrl_applySpeedGain(uint8_t which, uint8_t band, float gain) {
+    //Reasons this CANNOT be set:
+    //      (1) the band does not exist
+    //      (2) the gain is out of range (kp above 0, ki 0 or above, both under 100000)
+    if          (band >= ctrl_SPEED_BANDS) { return 1; }
+    else if     (!(gain >= 0.0f) || (gain >= 100000.0f) || ((which == ITF_LOG_CMD_SPEED_KP) && (gain == 0.0f))) { return 2; }
+
+    if (which == ITF_LOG_CMD_SPEED_KP) { ctrl_speed_pi_gains.kp[band] = gain; }
+    else                               { ctrl_speed_pi_gains.ki[band] = gain; }
+    return 0;    //Success
+}
+
+uint8_t ctrl_setSpeedKp(uint8_t band, float kp) {
+    uint8_t result = ctrl_applySpeedGain(ITF_LOG_CMD_SPEED_KP, band, kp);
+    itf_logPolicyCommand(ITF_LOG_CMD_SPEED_KP, ((int32_t) band << 24) | (int32_t) (kp*100.0f + 0.5f), result);
+    return result;
+}
+
+uint8_t ctrl_setSpeedKi(uint8_t band, float ki) {
+    uint8_t result = ctrl_applySpeedGain(ITF_LOG_CMD_SPEED_KI, band, ki);
+    itf_logPolicyCommand(ITF_LOG_CMD_SPEED_KI, ((int32_t) band << 24) | (int32_t) (ki*100.0f + 0.5f), result);
+    return result;
+}
+
+uint8_t ctrl_setParam(int index, float value) {
+    //Reasons this CANNOT be set:
+    //      (1) there is no such parameter
+    //      (2) the value is outside the parameter's min/max
+    //      (3) the value conflicts with another parameter (undervoltage under overvoltage, current limit under the trip)
+    //Values are kept to hundredths, as the log records them, so a replay sets exactly the same ones
+    int32_t hundredths = 0;
+    if ((value > -80000.0f) && (value < 80000.0f)) {
+        hundredths = (int32_t) (value*100.0f + ((value < 0.0f) ? -0.5f : 0.5f));
+        value = hundredths/100.0f;
+    }
+    uint8_t result = ctrl_paramStage(index, value);
+    itf_logPolicyCommand(ITF_LOG_CMD_PARAM, ((int32_t) (index & 0x7F) << 24) | (hundredths & 0xFFFFFF), result);
+    return result;
+}
+
 uint8_t ctrl_setDirection(uint8_t new_direction) {
     //For the moment, this is allowed to be set under all circumstances (the motor arming sequence should handle
     //      any undesirable situations). However, placing this into a "settter" function in case we find future
     //      cases where logic needs to be applied to avoid issues.
     ctrl_direction_command = new_direction;
+    itf_logPolicyCommand(ITF_LOG_CMD_DIRECTION, new_direction, 0);
     return 0;    //Success
 }
 
@@ -255,42 +496,109 @@ void init_control_subsystem(void);
 
 //ISRs:
 static void ctrl_update_timer_cb(void *arg);    //ctrl_timer_cb() runs whenever the control timer goes off. It unblocks ctrl_operational_task() using an event 
+static void ctrl_current_loop_timer_cb(void *arg);  //ctrl_current_loop_timer_cb() runs the current loop once per PWM period
 static void IRAM_ATTR ctrl_hall_isr(void *args);    //ctrl_hall_isr() runs whenever any hall sensor pin changes state, and handles commutation without applying speed control
+static void ctrl_commutation_timer_cb(void *arg);   //ctrl_commutation_timer_cb() commutates when ctrl_sensorlessLoop() worked out from the last zero crossing
 
 //TASKS:
-void ctrl_operational_task(void *arg);         //ctrl_operational_task() is a task that runs 100 times per second and handles all control subsystem operations.
+void ctrl_operational_task(void *arg);         //ctrl_operational_task() runs the speed loop and housekeeping rates from ctrl_rates[] off a 1 kHz tick
+
+//SCHEDULED LOOPS (one per entry in ctrl_rates[]):
+static void ctrl_currentLoop(void);     //PWM rate: current regulator and limits, puts the duty on the active high side
+static void ctrl_sensorlessLoop(void);  //PWM rate, ahead of the current loop: zero crossings and the hall/sensorless hand over
+static void ctrl_safetyLoop(void);      //100 Hz: arming, safety checks, energy, speed estimate
+static void ctrl_speedLoop(void);       //1 kHz: speed control duty from the hall edge period speed
+static void ctrl_pwmLoop(void);         //100 Hz: PWM frequency from the modelled loss at the operating point
+static void ctrl_logLoop(void);         //100 Hz: log policy (periodic records and triggers)
+static void ctrl_displayLoop(void);     //10 Hz: hex display
 
 //FUNCTIONS:
 void ctrl_alignOutputToHall(void);      //ctrl_alignOutputToHall() aligns the cur_input_index, cur_output_index, and expected_hall_state to match to the most recently read hall_state (also takes direction into account for the expected_hall_state)
 uint8_t ctrl_getHallState(void);           //ctrl_getHallState() reads the hall sensor pins and updates the hall_state variable.
 void ctrl_set_MSFTOutput(uint8_t output_table_index_to_use);    //ctrl_set_MSFTOutput() sets all of the MOSFET output signals to match the given index in the output_table. Also responsible for enforcing safety_shutdown as well as considering whether or not run_motor is good to go
+void ctrl_captureFault(void);           //ctrl_captureFault() copies the controller state into ctrl_fault_snapshot
+static void ctrl_sensorlessCommutate(void);     //ctrl_sensorlessCommutate() moves to the next output table row without the halls
+static void ctrl_pwmSwitch(uint8_t step);       //ctrl_pwmSwitch() puts a ctrl_pwm.steps[] frequency and resolution on the LEDC timer
 
 //SETUP (ONE-TIME) FUNCTIONS:
 void ctrl_setup_Output(void);
 void ctrl_setup_Hall(void);     //ctrl_setup_Hall() sets up the pins and associated interrupts to start monitoring the hall effect sensor states. ALSO: gets the starting hall_state and aligns the output to it
 
 //SPECIAL OBJECTS:
-esp_timer_handle_t ctrl_speed_control_timer;    //The timer handle used to apply speed control at a regular interval
+esp_timer_handle_t ctrl_speed_control_timer;    //The timer handle for the operational task's base tick (ctrl_SCHED_TICK_PERIOD)
+esp_timer_handle_t ctrl_current_loop_timer;     //The timer handle for the current loop (once per pwm_hz period)
+esp_timer_handle_t ctrl_commutation_timer;      //One shot, for each sensorless commutation
 TaskHandle_t ctrl_operational_task_handle;      //Handle for the operational task of the control subsystem
 
+//Static schedule. Rates that come due on the same tick run in table order: the safety checks go ahead of the
+//speed loop, so a fault found on a tick stops that tick's duty update, and logging comes after it. The current
+//loop has its own timer.
+typedef struct {
+    const char* name;
+    uint32_t period_us;
+    uint32_t deadline_us;
+    void (*run)(void);
+} ctrl_rate_t;
+
+static ctrl_rate_t ctrl_rates[ctrl_SCHED_RATES] = {
+    {"current", 0,                                0,                          ctrl_currentLoop},     //From the PWM frequency at boot
+    {"safety",  ctrl_SPEED_CONTROL_UPDATE_PERIOD, ctrl_SAFETY_DEADLINE,       ctrl_safetyLoop},
+    {"speed",   ctrl_SCHED_TICK_PERIOD,           ctrl_SPEED_LOOP_DEADLINE,   ctrl_speedLoop},
+    {"pwm",     ctrl_SPEED_CONTROL_UPDATE_PERIOD, ctrl_PWM_DEADLINE,          ctrl_pwmLoop},
+    {"log",     ctrl_SPEED_CONTROL_UPDATE_PERIOD, ctrl_LOG_DEADLINE,          ctrl_logLoop},
+    {"display", ctrl_DISPLAY_UPDATE_PERIOD,       ctrl_DISPLAY_DEADLINE,      ctrl_displayLoop},
+};
+#define ctrl_RATE_CURRENT 0
+ctrl_rateStats_t ctrl_rate_stats[ctrl_SCHED_RATES] = {0};
+
+int ctrl_getRateStats(int rate, ctrl_rateStats_t* out) {
+    if ((rate < 0) || (rate >= ctrl_SCHED_RATES)) { return 0; }
+    *out = ctrl_rate_stats[rate];
+    out->name = ctrl_rates[rate].name;
+    out->period_us = ctrl_rates[rate].period_us;
+    out->deadline_us = ctrl_rates[rate].deadline_us;
+    return 1;
+}
+
+void ctrl_resetRateStats(void) { memset(ctrl_rate_stats, 0, sizeof(ctrl_rate_stats)); }
+
+//Book-keeping at the end of a run: execution time, response time from the release, deadline and overrun
+static void ctrl_rateDone(int rate, uint64_t release_us, uint32_t startCycles) {
+    ctrl_rateStats_t* st = &ctrl_rate_stats[rate];
+    uint32_t cycles = esp_cpu_get_cycle_count() - startCycles;
+    uint64_t response_us = esp_timer_get_time() - release_us;
+    st->runs++;
+    st->cyclesTotal += cycles;
+    if (cycles > st->cyclesMax) { st->cyclesMax = cycles; }
+    if (response_us > st->responseMax_us) { st->responseMax_us = (uint32_t) response_us; }
+    if (response_us > ctrl_rates[rate].deadline_us) { st->deadlineMisses++; }
+    if (response_us > ctrl_rates[rate].period_us) { st->overruns++; }      //Still running when the next release came
+}
+
 
 
 //******************************************************     PROTOTYPE DEFINITIONS    ******************************************************
 void init_control_subsystem(void) {
     //Setup variables for testing if _CTRL_SYSTEM_TEST_ is defined
+    //Runtime parameters first: everything below reads them. Stored values go through the setter so the log has them.
+    ctrl_paramsInit();
+    ctrl_paramsLoad(ctrl_setParam);
+    ctrl_paramsSwap();
+    ctrl_rates[ctrl_RATE_CURRENT].period_us = 1000000 / ctrl_params->pwmFreq_hz;
+    ctrl_rates[ctrl_RATE_CURRENT].deadline_us = ctrl_rates[ctrl_RATE_CURRENT].period_us / 2;
+
     #ifdef _CTRL_SYSTEM_TEST_
-        ctrl_batVolt    = ctrl_OVERVOLTAGE_THRESHOLD_V-1.0;
-        ctrl_curA       = ctrl_OVERCURRENT_THRESHOLD_A-1.0;
+        ctrl_batVolt    = ctrl_params->overvolt_V-1.0;
+        ctrl_curA       = ctrl_params->overcurrent_A-1.0;
         ctrl_curB       = 0;
         ctrl_curC       = 0;
-        ctrl_tempA      = ctrl_OVERTEMP_THRESHOLD_F-1.0;
-        ctrl_tempB      = ctrl_OVERTEMP_THRESHOLD_F-1.0;
-        ctrl_tempC      = ctrl_OVERTEMP_THRESHOLD_F-1.0;
+        ctrl_tempA      = ctrl_params->overtemp_F-1.0;
+        ctrl_tempB      = ctrl_params->overtemp_F-1.0;
+        ctrl_tempC      = ctrl_params->overtemp_F-1.0;
     
         ctrl_direction_command = 0x01;              //00 = NOT RUNNING, 01 = FORWARD, 10 = BACKWARD, 11 = NOT RUNNING
         ctrl_mc_armed = true;                      //Set to true after the motor passes startup safety checks (including throttle == 0) AND direction is 0b10 or 0b01
                                                     //Set to false after the direction changes to 0b00 or 0b11
-        ctrl_speed_control_duty_raw = 2047;            //2047 = 50%
         ctrl_speedSetting_mph = 22.0;                  //Set to non-zero (and between the min and max thresholds (10-55 mph at time of writing)) to activate speed control.
         ctrl_usingSpeedControl = true;                   
         ctrl_throttle = 1027;                       //Throttle value can be from 0 to 4096. Must be 0 on startup, or motor will not be allowed to start.     
@@ -304,7 +612,22 @@ void init_control_subsystem(void) {
     
     #endif
 
+    ctrl_speedPiInit(&ctrl_speed_pi);
+    ctrl_speedPiDefaultGains(&ctrl_speed_pi_gains);
+    ctrl_speed_pi_engage = ctrl_usingSpeedControl;
+    ctrl_autotuneInit(&ctrl_autotune);
+    //Gains from the last tune, through the setters so the session log has them for replay
+    ctrl_speedPiGains_t stored = ctrl_speed_pi_gains;
+    if (ctrl_autotuneLoadGains(&stored) == 0) {
+        for (int band = 0; band < ctrl_SPEED_BANDS; band++) {
+            ctrl_setSpeedKp(band, stored.kp[band]);
+            ctrl_setSpeedKi(band, stored.ki[band]);
+        }
+    }
+
     //Run initial setup functions for control subsystem:
+    ctrl_sensorlessInit(&ctrl_bemf);
+    ctrl_pwmInit(&ctrl_pwm, ctrl_params->pwmFreq_hz);     //The current loop keeps this period whatever the PWM does
     ctrl_setup_Output();    //Prepare the gate driver control output pins
     ctrl_setup_Hall();      //Prepare the hall sensor input pins and interrupts
 
@@ -314,9 +637,25 @@ void init_control_subsystem(void) {
             .name = "speed_control_timer"
     };
     ESP_ERROR_CHECK(esp_timer_create(&ctrl_speed_control_timer_args, &ctrl_speed_control_timer));
-    ESP_ERROR_CHECK(esp_timer_start_periodic(ctrl_speed_control_timer, ctrl_SPEED_CONTROL_UPDATE_PERIOD)); //period in us
+    ESP_ERROR_CHECK(esp_timer_start_periodic(ctrl_speed_control_timer, ctrl_SCHED_TICK_PERIOD)); //period in us
 
-    //Start the control operational task, which will run 200 times per second
+    //And one at the PWM rate for the current loop. Late alarms are skipped rather than run back to back.
+    const esp_timer_create_args_t ctrl_current_loop_timer_args = {
+            .callback = &ctrl_current_loop_timer_cb,
+            .name = "current_loop_timer",
+            .skip_unhandled_events = true
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&ctrl_current_loop_timer_args, &ctrl_current_loop_timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(ctrl_current_loop_timer, ctrl_rates[ctrl_RATE_CURRENT].period_us));
+
+    //Sensorless commutations are timed off the zero crossings, so this one is started for each of them
+    const esp_timer_create_args_t ctrl_commutation_timer_args = {
+            .callback = &ctrl_commutation_timer_cb,
+            .name = "commutation_timer"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&ctrl_commutation_timer_args, &ctrl_commutation_timer));
+
+    //Start the control operational task, which will run 1000 times per second
     xTaskCreate(ctrl_operational_task, "ctrl_operational_task", ctrl_OPERATIONAL_TASK_STACK_SIZE, NULL, 8, &ctrl_operational_task_handle);
 }
 
@@ -339,9 +678,9 @@ void ctrl_setup_Output(void) {
         ledc_timer_config_t ledc_timer = {
             .speed_mode       = LEDC_LOW_SPEED_MODE,
             .timer_num        = LEDC_TIMER_0,
-            .duty_resolution  = LEDC_TIMER_12_BIT,
-            .freq_hz          = ctrl_PWM_FREQ,  // Set output frequency to 10 kHz
-            .clk_cfg          = LEDC_AUTO_CLK
+            .duty_resolution  = ctrl_pwm.steps[ctrl_PWM_BASE_STEP].bits,
+            .freq_hz          = ctrl_pwm.steps[ctrl_PWM_BASE_STEP].freq_hz,  // Output frequency (the pwm_hz parameter, 10 kHz unless changed)
+            .clk_cfg          = LEDC_USE_APB_CLK      // ctrl_pwmSwitch() works its dividers out from the APB clock
         };
         ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer));
 
@@ -362,6 +701,8 @@ void ctrl_setup_Output(void) {
         MSFT_PWM_CONFIG.channel = (ctrl_PWM_CHN_CH);
         MSFT_PWM_CONFIG.gpio_num = (ctrl_MSFT_CH);
         ESP_ERROR_CHECK(ledc_channel_config(&MSFT_PWM_CONFIG));
+        ctrl_pwm_applied = ctrl_PWM_BASE_STEP;
+        ctrl_pwm_bits = ctrl_pwm.steps[ctrl_PWM_BASE_STEP].bits;
 }
 
 
@@ -400,10 +741,12 @@ uint8_t ctrl_getHallState(void) { ctrl_hall_state = (gpio_get_level(ctrl_HC_IN)
 
 
 void ctrl_set_MSFTOutput(uint8_t output_table_index_to_use) { 
+    portENTER_CRITICAL_SAFE(&ctrl_output_mux);
     if ((ctrl_mc_armed) && (ctrl_safety_shutdown == 0)) {
-        //Determine which duty cycle to apply (throttle or speed control).
-        uint16_t duty = 0;
-        if (ctrl_usingSpeedControl) { duty = ctrl_speed_control_duty_final; } else { duty = ctrl_throttle; }
+        //The duty cycle to apply (throttle, speed control or torque mode, after the current limits) comes from ctrl_currentLoop()
+        uint16_t duty = ctrl_duty_out;
+        ctrl_applied_duty = duty;
+        ctrl_applied_output_index = output_table_index_to_use;
         
         //Set LOWSIDE outputs
         gpio_set_level(ctrl_MSFT_AL, ((ctrl_output_table[output_table_index_to_use] & 0b00000001) >> 0));
@@ -412,7 +755,7 @@ void ctrl_set_MSFTOutput(uint8_t output_table_index_to_use) {
 
         //Set AH output
         if((ctrl_output_table[output_table_index_to_use] & 0b00000010) > 0) { 
-            ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_AH, duty));
+            ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_AH, ctrl_PWM_DUTY(duty, ctrl_pwm_bits)));
             ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_AH));
         } else { 
             ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_AH, 0));
@@ -421,7 +764,7 @@ void ctrl_set_MSFTOutput(uint8_t output_table_index_to_use) {
 
         //Set BH output
         if((ctrl_output_table[output_table_index_to_use] & 0b00001000) > 0) { 
-            ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_BH, duty));
+            ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_BH, ctrl_PWM_DUTY(duty, ctrl_pwm_bits)));
             ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_BH));
         } else { 
             ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_BH, 0));
@@ -430,7 +773,7 @@ void ctrl_set_MSFTOutput(uint8_t output_table_index_to_use) {
 
         //Set CH output
         if((ctrl_output_table[output_table_index_to_use] & 0b00100000) > 0) { 
-            ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_CH, duty));
+            ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_CH, ctrl_PWM_DUTY(duty, ctrl_pwm_bits)));
             ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_CH));
         } else { 
             ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, ctrl_PWM_CHN_CH, 0));
@@ -448,7 +791,10 @@ void ctrl_set_MSFTOutput(uint8_t output_table_index_to_use) {
         gpio_set_level(ctrl_MSFT_AL, 0);
         gpio_set_level(ctrl_MSFT_BL, 0);
         gpio_set_level(ctrl_MSFT_CL, 0);
+        ctrl_applied_duty = 0;
+        ctrl_applied_output_index = 6;
     }
+    portEXIT_CRITICAL_SAFE(&ctrl_output_mux);
 }
 
 
@@ -479,6 +825,9 @@ void ctrl_alignOutputToHall(void) {
         //AND that short can only happen if a commutation state was missed
         //Fix ALL outputs
         ctrl_set_MSFTOutput(ctrl_cur_output_index);
+        portENTER_CRITICAL_SAFE(&ctrl_output_mux);
+        ctrl_sensorlessCommutated(&ctrl_bemf, esp_timer_get_time(), ctrl_cur_output_index, (ctrl_direction_command == 0x02) ? -1 : 1);
+        portEXIT_CRITICAL_SAFE(&ctrl_output_mux);
     }
 }
 
@@ -488,8 +837,66 @@ void ctrl_alignOutputToHall(void) {
 
 
 
+//ctrl_captureFault() copies the controller state into ctrl_fault_snapshot (read back with "dump fault" on the PC console)
+void ctrl_captureFault(void) {
+    ctrl_fault_snapshot.error_code = ctrl_safety_shutdown;
+    ctrl_fault_snapshot.time_us = esp_timer_get_time();
+    ctrl_fault_snapshot.hall_state = ctrl_hall_state;
+    ctrl_fault_snapshot.skipped_commutations = ctrl_skipped_commutations;
+    ctrl_fault_snapshot.using_speed_control = ctrl_usingSpeedControl;
+    ctrl_fault_snapshot.duty = ctrl_getDutyCommand();
+    ctrl_fault_snapshot.speed_mph = ctrl_speed_mph;
+    ctrl_fault_snapshot.batVolt = ctrl_batVolt;
+    ctrl_fault_snapshot.curA = ctrl_curA;
+    ctrl_fault_snapshot.curB = ctrl_curB;
+    ctrl_fault_snapshot.curC = ctrl_curC;
+    ctrl_fault_snapshot.tempA = ctrl_tempA;
+    ctrl_fault_snapshot.tempB = ctrl_tempB;
+    ctrl_fault_snapshot.tempC = ctrl_tempC;
+}
+
+
+
+
 //******************************************************     TASKS     ******************************************************
-//ctrl_operational_task() is a task that runs 100 times per second and handles all control subsystem operations.
+//ctrl_operational_task() is woken by ctrl_update_timer_cb() every ctrl_SCHED_TICK_PERIOD and runs each rate in
+//ctrl_rates[] whose period ended on this tick. A tick that comes while the task is still busy is not lost: the
+//notification count says how many releases there were, the rates they covered run once and the rest count as overruns.
+void ctrl_operational_task(void *arg) {
+    static uint32_t releases;
+    static uint32_t tick = 0;
+    int i;
+    while(1)
+    {
+        if(intrTime_test != intrTime_test_last){
+            //ESP_LOGI("Testmsg","time: %d",(int)intrTime_test);
+            intrTime_test_last = intrTime_test;
+        }
+        //Wake when notified that the update timer has alarmed
+        releases = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if(releases) {
+            uint64_t release_us = ctrl_sched_release_us;
+            ctrl_paramsSwap();      //Parameter changes land between ticks, never part way through one
+            for(i = ctrl_RATE_CURRENT + 1; i < ctrl_SCHED_RATES; i++) {
+                uint32_t ticksPerRun = ctrl_rates[i].period_us / ctrl_SCHED_TICK_PERIOD;
+                uint32_t due = (tick + releases)/ticksPerRun - tick/ticksPerRun;
+                if (due) {
+                    uint32_t startCycles = esp_cpu_get_cycle_count();
+                    ctrl_rates[i].run();
+                    ctrl_rateDone(i, release_us, startCycles);
+                    ctrl_rate_stats[i].overruns += due - 1;
+                }
+            }
+            tick += releases;
+        }
+    }
+}
+
+
+
+
+//******************************************************     SCHEDULED LOOPS     ******************************************************
+//ctrl_safetyLoop() runs every ctrl_SPEED_CONTROL_UPDATE_PERIOD and handles arming, safety checks, energy and speed estimation.
 /*
     SPECIFICALLY:
         Before startup (Startup Section):
@@ -502,158 +909,378 @@ void ctrl_alignOutputToHall(void) {
 
 
 */
-void ctrl_operational_task(void *arg) {
-    static uint32_t update_timer_alarmed;
-    while(1)
-    {
-        if(intrTime_test != intrTime_test_last){
-            //ESP_LOGI("Testmsg","time: %d",(int)intrTime_test);
-            intrTime_test_last = intrTime_test;
+static void ctrl_safetyLoop(void) {
+    static uint8_t last_safety_shutdown = 0;
+    const ctrl_params_t* prm = ctrl_params;
+    //STARTUP SECTION
+    if (!ctrl_mc_armed) {
+        //Check for nonzero starting throttle
+        if (!(ctrl_throttle == 0)) {
+            if (ctrl_safety_shutdown != ctrl_ERROR_NONZERO_START_THROTTLE) { ITF_TRACE1(CTRL_NONZERO_THROTTLE, ctrl_throttle); }
+            ctrl_safety_shutdown = ctrl_ERROR_NONZERO_START_THROTTLE;
+
+        //Check for hall sensor wiring issues
+        } else if (((ctrl_hall_state == 7) || (ctrl_hall_state == 0))) {
+            if (ctrl_safety_shutdown != ctrl_ERROR_HALL_WIRE) { ITF_TRACE1(CTRL_HALL_WIRE_START, ctrl_hall_state); }
+            ctrl_safety_shutdown = ctrl_ERROR_HALL_WIRE;
+
+        //Ensure the battery is neither overvoltage nor undervoltage
+        } else if (ctrl_batVolt < prm->undervolt_V) {
+            ctrl_safety_shutdown = ctrl_ERROR_BAT_UNDERVOLT;
+            ITF_TRACE1(CTRL_UNDERVOLT, itf_traceF(ctrl_batVolt));
+        } else if (ctrl_batVolt > prm->overvolt_V) {
+            ctrl_safety_shutdown = ctrl_ERROR_BAT_OVERVOLT;
+            ITF_TRACE1(CTRL_OVERVOLT, itf_traceF(ctrl_batVolt));
+
+        //If the above tests have passed, then there is no safety issue indicated at this time
+        } else {
+            ctrl_safety_shutdown = 0;                    
+            //If the direction command is in forward or backward state, allow motor to run.
+            if((ctrl_direction_command == 0b01) || (ctrl_direction_command == 0b10)) {
+                ctrl_mc_armed = true;
+                ctrl_alignOutputToHall();   //must align output to hall
+                ITF_TRACE0(CTRL_ARMED);
+            } else {
+                //If this point of execution is reached, the direction bits indicate the motor should not be armed.
+                ctrl_mc_armed = false;
+                //Also: push 0 output to all MOSFET outputs using the set_MSFTOutput() function IMMEDIATELY
+                ctrl_set_MSFTOutput(6);
+            }
         }
-        //Wake when notified that the update timer has alarmed
-        update_timer_alarmed = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-        if(update_timer_alarmed) {
-            //STARTUP SECTION
-            if (!ctrl_mc_armed) {
-                //Check for nonzero starting throttle
-                if (!(ctrl_throttle == 0)) {
-                    if (ctrl_safety_shutdown != ctrl_ERROR_NONZERO_START_THROTTLE) { ESP_LOGE(TAG_CTRL, "ERROR: NONZERO STARTING THROTTLE (%d)", ctrl_throttle); }
-                    ctrl_safety_shutdown = ctrl_ERROR_NONZERO_START_THROTTLE;
-
-                //Check for hall sensor wiring issues
-                } else if (((ctrl_hall_state == 7) || (ctrl_hall_state == 0))) {
-                    if (ctrl_safety_shutdown != ctrl_ERROR_HALL_WIRE) { ESP_LOGE(TAG_CTRL, "ERROR: HALL WIRING ISSUE (digital '000' or '111')(%d)", ctrl_hall_state); }
-                    ctrl_safety_shutdown = ctrl_ERROR_HALL_WIRE;
-
-                //Ensure the battery is neither overvoltage nor undervoltage
-                } else if (ctrl_batVolt < ctrl_UNDERVOLTAGE_THRESHOLD_V) {
-                    ctrl_safety_shutdown = ctrl_ERROR_BAT_UNDERVOLT;
-                    ESP_LOGE(TAG_CTRL, "ERROR: BATTERY UNDERVOLTAGE (%f)", ctrl_batVolt);
-                } else if (ctrl_batVolt > ctrl_OVERVOLTAGE_THRESHOLD_V) {
-                    ctrl_safety_shutdown = ctrl_ERROR_BAT_OVERVOLT;
-                    ESP_LOGE(TAG_CTRL, "ERROR: BATTERY OVERVOLTAGE (%f)", ctrl_batVolt);
-
-                //If the above tests have passed, then there is no safety issue indicated at this time
-                } else {
-                    ctrl_safety_shutdown = 0;                    
-                    //If the direction command is in forward or backward state, allow motor to run.
-                    if((ctrl_direction_command == 0b01) || (ctrl_direction_command == 0b10)) {
-                        ctrl_mc_armed = true;
-                        ctrl_alignOutputToHall();   //must align output to hall
-                        ESP_LOGI(TAG_CTRL, "*****MOTOR ARMED*****");
-                    } else {
-                        //If this point of execution is reached, the direction bits indicate the motor should not be armed.
-                        ctrl_mc_armed = false;
-                        //Also: push 0 output to all MOSFET outputs using the set_MSFTOutput() function IMMEDIATELY
-                        ctrl_set_MSFTOutput(6);
-                    }
-                }
 
 
-            //OPERATIONAL SECTION:
-            } else { 
-                //Ensure hall sensor wiring is valid
-                if ((ctrl_hall_state == 7) || (ctrl_hall_state == 0)) {
-                    ctrl_safety_shutdown = ctrl_ERROR_HALL_WIRE;
-                    ESP_LOGE(TAG_CTRL, "ERROR: HALL WIRING (%d)", ctrl_hall_state);
-                    
-
-                //Ensure that there have not been too many commutation errors (likely indicates wiring issue)
-                } else if (ctrl_skipped_commutations > ctrl_SKIPPED_COMMUTATIONS_ERROR_THRESHOLD) {
-                    ctrl_safety_shutdown = ctrl_ERROR_HALL_CHANGE;
-                    ESP_LOGE(TAG_CTRL, "ERROR: TOO MANY HALL SEQUENCE FAILURES (%d). CHECK WIRING AND RESTART", ctrl_skipped_commutations);
-                    
-
-                //Ensure the battery is neither overvoltage nor undervoltage
-                } else if (ctrl_batVolt < ctrl_UNDERVOLTAGE_THRESHOLD_V) {
-                    ctrl_safety_shutdown = ctrl_ERROR_BAT_UNDERVOLT;
-                    ESP_LOGE(TAG_CTRL, "ERROR: BATTERY UNDERVOLTAGE (%f)", ctrl_batVolt);
-                    
-                } else if (ctrl_batVolt > ctrl_OVERVOLTAGE_THRESHOLD_V) {
-                    ctrl_safety_shutdown = ctrl_ERROR_BAT_OVERVOLT;
-                    ESP_LOGE(TAG_CTRL, "ERROR: BATTERY OVERVOLTAGE (%f)", ctrl_batVolt);
-                    
-
-                //Ensure total current and phase currents have not exceeded safety thresholds
-                } else if ((ctrl_curA + ctrl_curB + ctrl_curC) > ctrl_TOTAL_OVERCURRENT_THRESHOLD_A) {
-                    ctrl_safety_shutdown = ctrl_ERROR_BAT_CURRENT;
-                    ESP_LOGE(TAG_CTRL, "ERROR: BATTERY OVERCURRENT (%f). PHASE CURRENTS WERE: %f\t%f\t%f)", (ctrl_curA + ctrl_curB + ctrl_curC), ctrl_curA, ctrl_curB, ctrl_curC);
-                    
-
-                } else if ((ctrl_curA > ctrl_OVERCURRENT_THRESHOLD_A) || (ctrl_curB > ctrl_OVERCURRENT_THRESHOLD_A) || (ctrl_curC > ctrl_OVERCURRENT_THRESHOLD_A)) {
-                    ctrl_safety_shutdown = ctrl_ERROR_PHASE_CURRENT;
-                    ESP_LOGE(TAG_CTRL, "ERROR: PHASE OVERCURRENT (%f\t%f\t%f)", ctrl_curA, ctrl_curB, ctrl_curC);
-                    
-                
-                //Ensure heat sink temperature has not exceeded safety threshold
-                } else if ((ctrl_tempA > ctrl_OVERTEMP_THRESHOLD_F) || (ctrl_tempB > ctrl_OVERTEMP_THRESHOLD_F) || (ctrl_tempC > ctrl_OVERTEMP_THRESHOLD_F)) {
-                    ctrl_safety_shutdown = ctrl_ERROR_OVERHEAT;
-                    ESP_LOGE(TAG_CTRL, "ERROR: MOSFET OVERHEAT (%f\t%f\t%f)", ctrl_tempA, ctrl_tempB, ctrl_tempC);                    
-                }
+    //OPERATIONAL SECTION:
+    } else { 
+        //While sensorless the halls don't commutate: a fault in them is noted, and stops the motor once they have to again
+        if (ctrl_comm_mode == ctrl_COMM_SENSORLESS) {
+            bool hall_bad = (ctrl_hall_state == 7) || (ctrl_hall_state == 0);
+            if (hall_bad && !ctrl_sensorless_hall_fault) {
+                ctrl_comm_status.hallFaults++;
+                ITF_TRACE1(CTRL_SENSORLESS_HALL, ctrl_hall_state);
+            }
+            ctrl_sensorless_hall_fault = hall_bad;
+        }
 
-                //Now handle any error that occured
-                if (ctrl_safety_shutdown) {
-                    //Push 0 output to all MOSFET outputs using the set_MSFTOutput() function IMMEDIATELY
-                    ctrl_set_MSFTOutput(6);
-                    ESP_LOGI(TAG_CTRL, "*****MOTOR DISARMED (SAFETY)*****");
-
-                //If the direction bits indicate the motor should disengage, do so now
-                } else if ((ctrl_direction_command == 0b00) || (ctrl_direction_command == 0b11)) {
-                    //Also: push 0 output to all MOSFET outputs using the set_MSFTOutput() function IMMEDIATELY
-                    ctrl_set_MSFTOutput(6);
-                    ctrl_mc_armed = false;
-                    ctrl_alignOutputToHall();   //must align output to hall
-                    ESP_LOGI(TAG_CTRL, "*****MOTOR DISARMED (NORMAL)*****");
-
-                } else {
-                    
-                    /* 
-                        If the program reaches this point in execution, we know:
-                            (1) the motor is armed/running and
-                            (2) there are no safety issues present
-                        Therefore it is time to perform updates:
-                            Update the motor runTime
-                            Calculate the instantaneous power usage of the motor
-                            Calculate the total energy consumption of the motor
-                            Checks how many commutations have occured since the last time this block executed (should be approx 5ms prior)
-                                if no commutations were made in that time, look at the time between three most recent commutations
-                                Calculates the current ground speed based on the number of commutations or three commutation times (as applicable)
-                            When speed control setting is valid:
-                                Increases the speed control duty cycle if moving too slow
-                                Reduces the speed control duty cycle if moving too fast
-                    */
-                    ctrl_runTime += ctrl_SPEED_CONTROL_UPDATE_PERIOD_MS;  //Add one timer period to the run time.
-                    float update_period_float = ((float)ctrl_SPEED_CONTROL_UPDATE_PERIOD_MS)/1000.0;
-                    ctrl_instPower = ((ctrl_curA+ctrl_curB+ctrl_curC) * 0.5) * ctrl_batVolt;    //The current at any time should be 1/2 of the sum of all current sensor readings (because both the high phase and low phase share the same current)
-                    
-                    ctrl_totEnergy += update_period_float*ctrl_instPower; //Update the total energy consumption
-                    //Calculate ground speed (from commutation quantity if there is enough)
-                    if (ctrl_commutation_counter >= 4) {
-                        ctrl_speed_mph = (((float)ctrl_commutation_counter)/update_period_float)*ctrl_CONV_COM_PER_SEC_TO_MPH;
-                    //If there have not been enough commutations in the last update period, check if there have been at least three recorded commutation times
-                    //  recently enough that speed can be determined (with 10ms update period, this generally happens when under 8mph)
-                    } else if ((ctrl_commutation_timestamps[0] > 0) && (ctrl_commutation_timestamps[1] > 0) && (ctrl_commutation_timestamps[2] > 0)) {
-                        float ave_time = (((float)(ctrl_commutation_timestamps[0]-ctrl_commutation_timestamps[1])) + ((float)(ctrl_commutation_timestamps[1]-ctrl_commutation_timestamps[2])))/2.0;
-                        ctrl_speed_mph = ((ctrl_CONV_COM_PER_SEC_TO_MPH/ave_time)*1000000.0); //1000000.0 to convert us to s
-                        ctrl_commutation_timestamps[2] = 0; //Setting this equal to 0 ensures that this branch of the if...else will not execute again until another commutation occurs and is stored in the array
-                    } else {
-                        //There haven't been enough commutations to determine speed recently.
-                        ctrl_speed_mph = 0;
-                    }
-                    ctrl_commutation_counter = 0;   //reset commutation counter
-
-                    //Update speed control
-                    if (ctrl_usingSpeedControl) {
-                        double error = ctrl_speedSetting_mph - ctrl_speed_mph;
-                        ctrl_speed_control_duty_final = ctrl_speed_control_duty_raw + ((uint16_t)(error*ctrl_SPDCTRL_PGAIN));
-                        //Perform min/max control
-                        if (ctrl_speed_control_duty_final > 16000)      { ctrl_speed_control_duty_final = 0; }    //Better way to handle uint overflow from substraction
-                        if (ctrl_speed_control_duty_final > 4095)       { ctrl_speed_control_duty_final = 4095; }
-                    }
-                }
+        //Ensure hall sensor wiring is valid
+        if ((ctrl_comm_mode == ctrl_COMM_HALL) && ((ctrl_hall_state == 7) || (ctrl_hall_state == 0))) {
+            ctrl_safety_shutdown = ctrl_ERROR_HALL_WIRE;
+            ITF_TRACE1(CTRL_HALL_WIRE, ctrl_hall_state);
+            
+
+        //Ensure that there have not been too many commutation errors (likely indicates wiring issue)
+        } else if ((ctrl_comm_mode == ctrl_COMM_HALL) && (ctrl_skipped_commutations > prm->skippedCommMax)) {
+            ctrl_safety_shutdown = ctrl_ERROR_HALL_CHANGE;
+            ITF_TRACE1(CTRL_HALL_SEQUENCE, ctrl_skipped_commutations);
+            
+
+        //Ensure the battery is neither overvoltage nor undervoltage
+        } else if (ctrl_batVolt < prm->undervolt_V) {
+            ctrl_safety_shutdown = ctrl_ERROR_BAT_UNDERVOLT;
+            ITF_TRACE1(CTRL_UNDERVOLT, itf_traceF(ctrl_batVolt));
+            
+        } else if (ctrl_batVolt > prm->overvolt_V) {
+            ctrl_safety_shutdown = ctrl_ERROR_BAT_OVERVOLT;
+            ITF_TRACE1(CTRL_OVERVOLT, itf_traceF(ctrl_batVolt));
+            
+
+        //Ensure total current and phase currents have not exceeded safety thresholds
+        } else if ((ctrl_curA + ctrl_curB + ctrl_curC) > prm->totalOvercurrent_A) {
+            ctrl_safety_shutdown = ctrl_ERROR_BAT_CURRENT;
+            ITF_TRACE4(CTRL_BAT_OVERCURRENT, itf_traceF(ctrl_curA + ctrl_curB + ctrl_curC), itf_traceF(ctrl_curA), itf_traceF(ctrl_curB), itf_traceF(ctrl_curC));
+            
+
+        } else if ((ctrl_curA > prm->overcurrent_A) || (ctrl_curB > prm->overcurrent_A) || (ctrl_curC > prm->overcurrent_A)) {
+            ctrl_safety_shutdown = ctrl_ERROR_PHASE_CURRENT;
+            ITF_TRACE3(CTRL_PHASE_OVERCURRENT, itf_traceF(ctrl_curA), itf_traceF(ctrl_curB), itf_traceF(ctrl_curC));
+            
+        
+        //Ensure heat sink temperature has not exceeded safety threshold
+        } else if ((ctrl_tempA > prm->overtemp_F) || (ctrl_tempB > prm->overtemp_F) || (ctrl_tempC > prm->overtemp_F)) {
+            ctrl_safety_shutdown = ctrl_ERROR_OVERHEAT;
+            ITF_TRACE3(CTRL_OVERHEAT, itf_traceF(ctrl_tempA), itf_traceF(ctrl_tempB), itf_traceF(ctrl_tempC));
+        }
+
+        //Now handle any error that occured
+        if (ctrl_safety_shutdown) {
+            //Push 0 output to all MOSFET outputs using the set_MSFTOutput() function IMMEDIATELY
+            ctrl_set_MSFTOutput(6);
+            ITF_TRACE0(CTRL_DISARMED_SAFETY);
+
+        //If the direction bits indicate the motor should disengage, do so now
+        } else if ((ctrl_direction_command == 0b00) || (ctrl_direction_command == 0b11)) {
+            //Also: push 0 output to all MOSFET outputs using the set_MSFTOutput() function IMMEDIATELY
+            ctrl_set_MSFTOutput(6);
+            ctrl_mc_armed = false;
+            ctrl_alignOutputToHall();   //must align output to hall
+            ITF_TRACE0(CTRL_DISARMED_NORMAL);
+
+        } else {
+            
+            /* 
+                If the program reaches this point in execution, we know:
+                    (1) the motor is armed/running and
+                    (2) there are no safety issues present
+                Therefore it is time to perform updates:
+                    Update the motor runTime
+                    Calculate the instantaneous power usage of the motor
+                    Calculate the total energy consumption of the motor
+                    Checks how many commutations have occured since the last time this block executed (ctrl_SPEED_CONTROL_UPDATE_PERIOD prior)
+                        if no commutations were made in that time, look at the time between three most recent commutations
+                        Calculates the current ground speed based on the number of commutations or three commutation times (as applicable)
+                    (the speed control duty itself is updated by ctrl_speedLoop())
+            */
+            ctrl_runTime += ctrl_SPEED_CONTROL_UPDATE_PERIOD_MS;  //Add one timer period to the run time.
+            float update_period_float = ((float)ctrl_SPEED_CONTROL_UPDATE_PERIOD_MS)/1000.0;
+            ctrl_instPower = ((ctrl_curA+ctrl_curB+ctrl_curC) * 0.5) * ctrl_batVolt;    //The current at any time should be 1/2 of the sum of all current sensor readings (because both the high phase and low phase share the same current)
+            
+            ctrl_totEnergy += update_period_float*ctrl_instPower; //Update the total energy consumption
+            //Calculate ground speed (from commutation quantity if there is enough)
+            if (ctrl_commutation_counter >= 4) {
+                ctrl_speed_mph = (((float)ctrl_commutation_counter)/update_period_float)*prm->convComPerSecToMph;
+            //If there have not been enough commutations in the last update period, check if there have been at least three recorded commutation times
+            //  recently enough that speed can be determined (with 10ms update period, this generally happens when under 8mph)
+            } else if ((ctrl_commutation_timestamps[0] > 0) && (ctrl_commutation_timestamps[1] > 0) && (ctrl_commutation_timestamps[2] > 0)) {
+                float ave_time = (((float)(ctrl_commutation_timestamps[0]-ctrl_commutation_timestamps[1])) + ((float)(ctrl_commutation_timestamps[1]-ctrl_commutation_timestamps[2])))/2.0;
+                ctrl_speed_mph = ((prm->convComPerSecToMph/ave_time)*1000000.0); //1000000.0 to convert us to s
+                ctrl_commutation_timestamps[2] = 0; //Setting this equal to 0 ensures that this branch of the if...else will not execute again until another commutation occurs and is stored in the array
+            } else {
+                //There haven't been enough commutations to determine speed recently.
+                ctrl_speed_mph = 0;
             }
-            itf_displayHex(ctrl_safety_shutdown);   //lastly, update the hex display
-        } //END if(update_timer_alarmed)
+            ctrl_commutation_counter = 0;   //reset commutation counter
+        }
+    }
+    //Keep a copy of the state the first time each new fault shows up
+    if ((ctrl_safety_shutdown != 0) && (ctrl_safety_shutdown != last_safety_shutdown)) { ctrl_captureFault(); }
+    last_safety_shutdown = ctrl_safety_shutdown;
+}
+
+
+//Speed from the time between the last two hall edges (or sensorless commutations), fresh on every speed loop run.
+//ctrl_speed_mph only changes with ctrl_safetyLoop(), in steps of one commutation per ctrl_SPEED_CONTROL_UPDATE_PERIOD
+//(about 2.5 mph): too coarse to size the relay oscillation of an auto-tune, and nine speed loop runs in ten would see
+//the same value.
+static float ctrl_hallPeriodSpeed_mph(void) {
+    portENTER_CRITICAL_SAFE(&ctrl_output_mux);
+    uint64_t last = ctrl_commutation_timestamps[0];
+    uint64_t prev = ctrl_commutation_timestamps[1];
+    portEXIT_CRITICAL_SAFE(&ctrl_output_mux);
+    if ((last == 0) || (prev == 0) || (last <= prev)) { return 0.0f; }
+    uint64_t period = last - prev;
+    uint64_t since = esp_timer_get_time() - last;
+    if (since > period) { period = since; }     //Slowing down: the next edge is already later than that
+    return (float) (ctrl_params->convComPerSecToMph * 1000000.0 / (double) period);
+}
+
+
+//ctrl_speedLoop() runs every ctrl_SCHED_TICK_PERIOD on the hall edge period speed, so every run acts on a new estimate, a
+//new speed setting takes effect within a millisecond and ctrl_currentLoop() passes the result on without waiting for a hall edge.
+static void ctrl_speedLoop(void) {
+    //Only while armed, fault free and in gear (the same conditions ctrl_safetyLoop() updates the estimate under)
+    if ((!ctrl_mc_armed) || (ctrl_safety_shutdown) || (ctrl_direction_command == 0b00) || (ctrl_direction_command == 0b11)) {
+        ctrl_endAutotune(ctrl_AUTOTUNE_ERR_STOPPED);
+        return;
+    }
+    float speed_mph = ctrl_hallPeriodSpeed_mph();
+    //The back-EMF estimate keeps learning in throttle mode too, so the feed-forward is ready when speed control engages
+    float phase_A = (float) ((ctrl_curA + ctrl_curB + ctrl_curC) * 0.5);
+    ctrl_speedPiObserve(&ctrl_speed_pi, (float) ctrl_duty_out, (float) ctrl_batVolt, phase_A, ctrl_params->motorR_ohm, speed_mph, ctrl_SPEED_LOOP_DT_S);
+    if (ctrl_autotune.state == ctrl_AUTOTUNE_RUNNING) {
+        float duty = ctrl_autotuneUpdate(&ctrl_autotune, &ctrl_speed_pi_gains, &ctrl_speed_pi, speed_mph, (float) ctrl_batVolt, ctrl_SPEED_LOOP_DT_S);
+        ctrl_speed_control_duty_final = (uint16_t) (duty + 0.5f);
+        if (ctrl_autotune.state != ctrl_AUTOTUNE_RUNNING) {
+            //Finished or gave up: coast, and hand new gains to ctrl_serviceAutotune()
+            ctrl_usingSpeedControl = false;
+            if (ctrl_autotune.state == ctrl_AUTOTUNE_DONE) {
+                ctrl_autotune_save_result = 0xFF;
+                ctrl_autotune_save_pending = true;
+            }
+        }
+    } else if (ctrl_usingSpeedControl) {
+        if (ctrl_speed_pi_engage) {
+            ctrl_speedPiEngage(&ctrl_speed_pi, &ctrl_speed_pi_gains, (float) ctrl_duty_out, (float) ctrl_speedSetting_mph, speed_mph, (float) ctrl_batVolt);
+            ctrl_speed_pi_engage = false;
+        }
+        float duty = ctrl_speedPiUpdate(&ctrl_speed_pi, &ctrl_speed_pi_gains, (float) ctrl_speedSetting_mph, speed_mph, (float) ctrl_batVolt,
+                                        ctrl_isCurrentLimited(), ctrl_SPEED_LOOP_DT_S);
+        ctrl_speed_control_duty_final = (uint16_t) (duty + 0.5f);
+    }
+}
+
+
+//ctrl_pwmLoop() runs every ctrl_SPEED_CONTROL_UPDATE_PERIOD and picks the PWM frequency for the operating point (see ctrl_pwm.h).
+//ctrl_currentLoop() puts a new one on the LEDC timer at its next run. While not driving the last choice stays.
+static void ctrl_pwmLoop(void) {
+    const ctrl_params_t* prm = ctrl_params;
+    bool driving = (ctrl_mc_armed) && (ctrl_safety_shutdown == 0) && ((ctrl_direction_command == 0b01) || (ctrl_direction_command == 0b10));
+    float phase_A = driving ? (float) ((ctrl_curA + ctrl_curB + ctrl_curC) * 0.5) : 0.0f;
+    float duty = driving ? ((float) ctrl_duty_out) / 4096.0f : 0.0f;
+    uint8_t last = ctrl_pwm.step;
+    uint8_t step = ctrl_pwmUpdate(&ctrl_pwm, prm->pwmAdapt != 0, (float) ctrl_batVolt, phase_A, duty, prm->motorR_ohm, prm->overcurrent_A,
+                                 ctrl_SPEED_CONTROL_UPDATE_PERIOD_MS);
+    if (step != last) { ITF_TRACE2(CTRL_PWM_STEP, ctrl_pwm.steps[step].freq_hz, ctrl_pwm.steps[step].bits); }
+}
+
+
+//ctrl_logLoop() runs every ctrl_SPEED_CONTROL_UPDATE_PERIOD, after the speed loop, so long records hold that tick's duty
+static void ctrl_logLoop(void) {
+    itf_logPolicyTick(ctrl_SPEED_CONTROL_UPDATE_PERIOD);    //Periodic log records and log triggers
+}
+
+
+//ctrl_displayLoop() runs every ctrl_DISPLAY_UPDATE_PERIOD
+static void ctrl_displayLoop(void) {
+    itf_displayHex(ctrl_safety_shutdown);
+}
+
+
+//ctrl_currentLoop() runs once per pwm_hz period. It turns the duty command into ctrl_duty_out and puts that on the active high side
+//channel as soon as it changes, instead of waiting for the next hall edge.
+//Torque mode: the throttle is a bus current target (0 to the tq_full_a parameter) and the PI regulator sets the duty to hold it.
+//Other modes: the regulator's output is capped at the throttle or speed control duty, so it passes the command through until the
+//phase current or bus power limit is reached, then holds the current at the limit.
+//The measured currents are ctrl_curA/B/C: the phase current is half their sum (the high and low phase carry the same current) and
+//the bus current is the phase current times the duty.
+static void IRAM_ATTR ctrl_currentLoop(void) {
+    const ctrl_params_t* prm = ctrl_params;     //One set for the whole run, whatever a swap does meanwhile
+    float phase_A = (float) ((ctrl_curA + ctrl_curB + ctrl_curC) * 0.5);
+    float bus_A = phase_A * ((float) ctrl_duty_out) / 4096.0f;
+    bool torque = (ctrl_throttle_mode == ctrl_THROTTLE_MODE_TORQUE) && (!ctrl_usingSpeedControl);
+    float out = 0.0f;
+    ctrl_totCur = bus_A;
+    if (phase_A > ctrl_curreg_stats.phasePeak_A) { ctrl_curreg_stats.phasePeak_A = phase_A; }
+    if (bus_A > ctrl_curreg_stats.busPeak_A) { ctrl_curreg_stats.busPeak_A = bus_A; }
+
+    if ((ctrl_mc_armed) && (ctrl_safety_shutdown == 0) && ((!torque) || (ctrl_throttle > 0))) {
+        float command = torque ? 4095.0f : (float) (ctrl_usingSpeedControl ? ctrl_speed_control_duty_final : ctrl_throttle);
+        float limit_A = (ctrl_batVolt > 1.0) ? (float) (prm->busPowerLimit_W / ctrl_batVolt) : prm->torqueFullThrottle_A;
+        float target_A = torque ? ((float) ctrl_throttle) * prm->torqueFullThrottle_A / 4096.0f : limit_A;
+        bool limited = (torque) && (target_A > limit_A);
+        if (target_A > limit_A) { target_A = limit_A; }
+        //Bus current error, or the phase current headroom if that is smaller (a count of duty moves either by
+        //about the same number of amps except at very low duty, where the phase limit is the one that matters)
+        float error = target_A - bus_A;
+        float headroom = prm->phaseCurrentLimit_A - phase_A;
+        if (headroom < error) { error = headroom; limited = true; }
+
+        //PI with the integrator clamped to the command (anti-windup, and bumpless when a limit lets go)
+        ctrl_curreg_integral += prm->curregKi * error;
+        if (ctrl_curreg_integral > command) { ctrl_curreg_integral = command; }
+        if (ctrl_curreg_integral < 0.0f) { ctrl_curreg_integral = 0.0f; }
+        out = ctrl_curreg_integral + prm->curregKp * error;
+        if (out > command) { out = command; }
+        if (out < 0.0f) { out = 0.0f; }
+        ctrl_curreg_stats.limiting = torque ? limited : (out < command - 0.5f);
+        if (ctrl_curreg_stats.limiting) { ctrl_curreg_stats.limitedPeriods++; }
+    } else {
+        ctrl_curreg_integral = 0.0f;
+        ctrl_curreg_stats.limiting = 0;
+    }
+
+    portENTER_CRITICAL_SAFE(&ctrl_output_mux);
+    ctrl_duty_out = (uint16_t) out;
+    uint16_t duty = ctrl_duty_out;
+    if (ctrl_pwm.step != ctrl_pwm_applied) { ctrl_pwmSwitch(ctrl_pwm.step); }
+    if ((ctrl_mc_armed) && (ctrl_safety_shutdown == 0) && (duty != ctrl_applied_duty) && (ctrl_applied_output_index < 6)) {
+        uint8_t output = ctrl_output_table[ctrl_applied_output_index];
+        ledc_channel_t channel = ctrl_PWM_CHN_CH;
+        if ((output & 0b00000010) > 0)      { channel = ctrl_PWM_CHN_AH; }
+        else if ((output & 0b00001000) > 0) { channel = ctrl_PWM_CHN_BH; }
+        ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, channel, ctrl_PWM_DUTY(duty, ctrl_pwm_bits)));
+        ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, channel));
+        ctrl_applied_duty = duty;
+    }
+    portEXIT_CRITICAL_SAFE(&ctrl_output_mux);
+}
+
+
+//ctrl_pwmSwitch() changes the LEDC timer to ctrl_pwm.steps[step], with ctrl_output_mux held. The timer takes a new divider
+//and resolution at the end of the period it is in, and a channel its new duty the same way, so a period runs either old
+//setting or new but never the new duty count at the old resolution. Going up in resolution the timer goes first (a
+//period at the old duty count and the new resolution is a lower duty), going down the duty goes first (the same count,
+//coming early, is again lower): the worst case is one period under the commanded duty, never over it.
+static void IRAM_ATTR ctrl_pwmSwitch(uint8_t step) {
+    const ctrl_pwmStep_t* s = &ctrl_pwm.steps[step];
+    bool active = (ctrl_mc_armed) && (ctrl_safety_shutdown == 0) && (ctrl_applied_output_index < 6);
+    ledc_channel_t channel = ctrl_PWM_CHN_CH;
+    if (active) {
+        uint8_t output = ctrl_output_table[ctrl_applied_output_index];
+        if ((output & 0b00000010) > 0)      { channel = ctrl_PWM_CHN_AH; }
+        else if ((output & 0b00001000) > 0) { channel = ctrl_PWM_CHN_BH; }
+    }
+    if ((active) && (s->bits < ctrl_pwm_bits)) {
+        ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, channel, ctrl_PWM_DUTY(ctrl_applied_duty, s->bits)));
+        ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, channel));
+    }
+    ESP_ERROR_CHECK(ledc_timer_set(LEDC_LOW_SPEED_MODE, LEDC_TIMER_0, ctrl_pwmDivider(s), s->bits, LEDC_APB_CLK));
+    if ((active) && (s->bits >= ctrl_pwm_bits)) {
+        ESP_ERROR_CHECK(ledc_set_duty(LEDC_LOW_SPEED_MODE, channel, ctrl_PWM_DUTY(ctrl_applied_duty, s->bits)));
+        ESP_ERROR_CHECK(ledc_update_duty(LEDC_LOW_SPEED_MODE, channel));
+    }
+    ctrl_pwm_bits = s->bits;
+    ctrl_pwm_applied = step;
+}
+
+
+//Back to the halls: the output is realigned to them straight away (they agree with the sensorless row unless they are faulty,
+//in which case ctrl_safetyLoop() now sees it)
+static void ctrl_sensorlessHandBack(uint8_t reason, float speed_mph) {
+    esp_timer_stop(ctrl_commutation_timer);
+    ctrl_comm_mode = ctrl_COMM_HALL;
+    ctrl_comm_status.handbacks++;
+    if (reason == ctrl_SENSORLESS_OFF_LOST) { ctrl_comm_status.lockLosses++; }
+    ITF_TRACE2(CTRL_SENSORLESS_OFF, itf_traceF(speed_mph), reason);
+    ctrl_getHallState();
+    if (ctrl_mc_armed) { ctrl_alignOutputToHall(); }
+}
+
+//Sets the commutation off a zero crossing: at once if it is already due, otherwise on the one shot timer
+static void ctrl_sensorlessSchedule(uint64_t comm_us, uint64_t now_us) {
+    if (comm_us <= now_us) {
+        ctrl_sensorlessCommutate();
+    } else {
+        esp_timer_stop(ctrl_commutation_timer);
+        esp_timer_start_once(ctrl_commutation_timer, comm_us - now_us);
+    }
+}
+
+//ctrl_sensorlessLoop() runs once per pwm_hz period, just before ctrl_currentLoop(), on that period's terminal voltage samples.
+//The zero crossing detector sees every period while the motor drives, so lock is known before it is needed. Hand over
+//happens on a zero crossing, so the commutation it calls is the first sensorless one.
+//The detector is sampled with ctrl_output_mux held, so a hall edge can't commutate it half way through a sample (which
+//would carry the old sector's samples and crossing into the new one), and the time is read under it too, so it is
+//never before the last commutation.
+static void IRAM_ATTR ctrl_sensorlessLoop(void) {
+    const ctrl_params_t* prm = ctrl_params;
+    uint64_t comm_us = 0;
+    bool driving = (ctrl_mc_armed) && (ctrl_safety_shutdown == 0) && ((ctrl_direction_command == 0b01) || (ctrl_direction_command == 0b10));
+    float v[3] = {(float) ctrl_phaseVoltA, (float) ctrl_phaseVoltB, (float) ctrl_phaseVoltC};
+    portENTER_CRITICAL_SAFE(&ctrl_output_mux);
+    uint64_t now = esp_timer_get_time();
+    uint8_t result = driving ? ctrl_sensorlessSample(&ctrl_bemf, v, ctrl_applied_duty > 0, now, &comm_us) : ctrl_SENSORLESS_NONE;
+    float comPerSec = ctrl_sensorlessComPerSec(&ctrl_bemf);
+    uint8_t misses = ctrl_bemf.misses;
+    bool locked = ctrl_sensorlessLocked(&ctrl_bemf);
+    portEXIT_CRITICAL_SAFE(&ctrl_output_mux);
+    float speed_mph = (float) (comPerSec * prm->convComPerSecToMph);
+
+    if (ctrl_comm_mode == ctrl_COMM_SENSORLESS) {
+        if ((!driving) || (prm->bemfHandover_mph <= 0.0f)) {
+            ctrl_sensorlessHandBack(ctrl_SENSORLESS_OFF_STOPPED, speed_mph);
+        } else if (misses >= ctrl_SENSORLESS_MAX_MISSES) {
+            ctrl_sensorlessHandBack(ctrl_SENSORLESS_OFF_LOST, speed_mph);
+        } else if (speed_mph < prm->bemfHandover_mph - ctrl_SENSORLESS_HYST_MPH) {
+            ctrl_sensorlessHandBack(ctrl_SENSORLESS_OFF_SLOW, speed_mph);
+        } else if (result == ctrl_SENSORLESS_ZC) {
+            ctrl_sensorlessSchedule(comm_us, now);
+        } else if (result == ctrl_SENSORLESS_MISSED) {
+            ctrl_sensorlessCommutate();     //Carry on at the sector time; ctrl_SENSORLESS_MAX_MISSES of these hand back
+        }
+    } else if ((result == ctrl_SENSORLESS_ZC) && (prm->bemfHandover_mph > 0.0f) && (speed_mph >= prm->bemfHandover_mph) && (locked)) {
+        ctrl_comm_mode = ctrl_COMM_SENSORLESS;
+        ctrl_comm_status.handovers++;
+        ITF_TRACE1(CTRL_SENSORLESS_ON, itf_traceF(speed_mph));
+        ctrl_sensorlessSchedule(comm_us, now);
     }
 }
 
@@ -667,31 +1294,38 @@ static void ctrl_hall_isr(void *args)
     //Find which pin triggered the ISR (may be useful in future)
     //int pinNumber = (int)args;
 
-    //Increment the commutation counter (used for speed control)
-    //uint64_t startTime = esp_timer_get_time();
-    ctrl_commutation_counter++;
-
-    //Record and retain the time information for the three most recent commutations.
-    ctrl_commutation_timestamps[2] = ctrl_commutation_timestamps[1];
-    ctrl_commutation_timestamps[1] = ctrl_commutation_timestamps[0];
-    ctrl_commutation_timestamps[0] = esp_timer_get_time();
-
-    //Update hall state
-    ctrl_getHallState();
+    uint32_t startCycles = esp_cpu_get_cycle_count();
 
-    //Check for skipped commutations
-    if(ctrl_hall_state != ctrl_expected_hall_state) { ctrl_skipped_commutations++; }
+    if (ctrl_comm_mode == ctrl_COMM_SENSORLESS) {
+        //The zero crossings commutate (and count the commutations): just keep the hall state for the safety checks and logs
+        ctrl_getHallState();
+    } else {
+        //Increment the commutation counter (used for speed control)
+        //uint64_t startTime = esp_timer_get_time();
+        ctrl_commutation_counter++;
+
+        //Record and retain the time information for the three most recent commutations.
+        ctrl_commutation_timestamps[2] = ctrl_commutation_timestamps[1];
+        ctrl_commutation_timestamps[1] = ctrl_commutation_timestamps[0];
+        ctrl_commutation_timestamps[0] = esp_timer_get_time();
+
+        //Update hall state
+        ctrl_getHallState();
+
+        //Check for skipped commutations
+        if(ctrl_hall_state != ctrl_expected_hall_state) {
+            ctrl_skipped_commutations++;
+            ITF_TRACE2(CTRL_HALL_SKIP, ctrl_hall_state, ctrl_expected_hall_state);
+        }
 
-    //Update output to match hall input
-    ctrl_alignOutputToHall();
+        //Update output to match hall input
+        ctrl_alignOutputToHall();
+    }
 
 
     //HANS TEST STUFF!!
     
-    itf_addShortData();
-    if(ITF_LONGDATA_FLAG){
-        itf_addLongData();
-    }
+    itf_logPolicyEdge();   //Edge record, if the logging policy wants it
     //uint8_t dataToStore[23];
 
 
@@ -705,12 +1339,57 @@ static void ctrl_hall_isr(void *args)
     //if(ITF_LONGDATA_FLAG){
     //    intrTime_test = endTime - startTime;
     //}
-    ITF_LONGDATA_FLAG = 0;
+
+    //Execution time, read back with "bench trace" on the PC console
+    uint32_t cycles = esp_cpu_get_cycle_count() - startCycles;
+    ctrl_hall_isr_stats.edges++;
+    ctrl_hall_isr_stats.cyclesTotal += cycles;
+    if(cycles > ctrl_hall_isr_stats.cyclesMax) { ctrl_hall_isr_stats.cyclesMax = cycles; }
 }
 
 //ctrl_operational_timer_cb() is used to unblock the control subsystem's operational tasks with precise timing
 static void ctrl_update_timer_cb(void *arg) {
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    ctrl_sched_release_us = esp_timer_get_time();
     vTaskNotifyGiveFromISR(ctrl_operational_task_handle, &xHigherPriorityTaskWoken);
     portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
-}
\ No newline at end of file
+}
+
+//ctrl_sensorlessCommutate() is ctrl_hall_isr()'s commutation for when the zero crossings have it: the next row in the
+//direction of travel, with the same counting and timestamps so the speed estimate doesn't see the change of source
+static void IRAM_ATTR ctrl_sensorlessCommutate(void) {
+    int8_t dir = (ctrl_direction_command == 0x02) ? -1 : 1;
+    uint64_t now = esp_timer_get_time();
+    ctrl_commutation_counter++;
+    ctrl_commutation_timestamps[2] = ctrl_commutation_timestamps[1];
+    ctrl_commutation_timestamps[1] = ctrl_commutation_timestamps[0];
+    ctrl_commutation_timestamps[0] = now;
+    ctrl_cur_output_index = (uint8_t) ((ctrl_cur_output_index + 6 + dir) % 6);
+    ctrl_cur_input_index = (uint8_t) ((ctrl_cur_output_index + 6 - dir) % 6);
+    ctrl_expected_hall_state = ctrl_hall_input_table[ctrl_cur_output_index];
+    ctrl_set_MSFTOutput(ctrl_cur_output_index);
+    portENTER_CRITICAL_SAFE(&ctrl_output_mux);
+    ctrl_sensorlessCommutated(&ctrl_bemf, now, ctrl_cur_output_index, dir);
+    portEXIT_CRITICAL_SAFE(&ctrl_output_mux);
+}
+
+//ctrl_commutation_timer_cb() runs at the commutation time ctrl_sensorlessLoop() worked out from a zero crossing
+static void ctrl_commutation_timer_cb(void *arg) {
+    if (ctrl_comm_mode == ctrl_COMM_SENSORLESS) { ctrl_sensorlessCommutate(); }
+}
+
+//ctrl_current_loop_timer_cb() runs the current loop, with the zero crossing detection ahead of it on the same samples.
+//A gap of two periods or more since the last run means alarms were skipped.
+static void ctrl_current_loop_timer_cb(void *arg) {
+    static uint64_t last_release_us = 0;
+    uint64_t release_us = esp_timer_get_time();
+    uint32_t startCycles = esp_cpu_get_cycle_count();
+    ctrl_sensorlessLoop();
+    ctrl_currentLoop();
+    ctrl_rateDone(ctrl_RATE_CURRENT, release_us, startCycles);
+    uint32_t period_us = ctrl_rates[ctrl_RATE_CURRENT].period_us;
+    if ((last_release_us > 0) && (release_us - last_release_us >= 2*period_us)) {
+        ctrl_rate_stats[ctrl_RATE_CURRENT].overruns += (uint32_t) ((release_us - last_release_us)/period_us) - 1;
+    }
+    last_release_us = release_us;
+}
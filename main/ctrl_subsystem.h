@@ -10,6 +10,8 @@
 #include "driver/gpio.h"
 #include "driver/ledc.h"
 #include "itf_seven_seg.h"
+#include "ctrl_autotune.h"
+#include "ctrl_sensorless.h"
 
 #include <time.h>
 
@@ -23,6 +25,10 @@
 //#define _CTRL_ITF_SYSTEM_TEST_
 
 
+//Throttle modes (ctrl_setThrottleMode)
+#define ctrl_THROTTLE_MODE_DUTY    0    //Throttle (0-4096) is the PWM duty
+#define ctrl_THROTTLE_MODE_TORQUE  1    //Throttle (0-4096) is a bus current target, held by the current loop
+
 //******************************* GET functions
 double ctrl_getSpeed_mph(void);
 double ctrl_getInstPower_W(void);
@@ -42,6 +48,98 @@ bool  ctrl_isArmed(void);
 bool  ctrl_isInSafetyShutdown(void);   //If safety shutdown is anything except 0, system is in safety shutdown
 uint8_t ctrl_getErrorCode(void);           //The value of safety_shutdown IS the error code
 uint64_t ctrl_getTime(void);
+uint8_t ctrl_getDirection(void);           //00 = NOT RUNNING, 01 = FORWARD, 10 = BACKWARD, 11 = NOT RUNNING
+uint8_t ctrl_getSkippedCommutations(void);
+bool  ctrl_isUsingSpeedControl(void);
+uint16_t ctrl_getDutyCommand(void);        //Duty (0-4095) commanded by throttle, speed control or the torque mode regulator
+uint16_t ctrl_getOutputDuty(void);         //Duty actually on the high side, after the current and power limits
+uint8_t ctrl_getThrottleMode(void);        //ctrl_THROTTLE_MODE_*
+bool  ctrl_isCurrentLimited(void);         //True while the phase current or bus power limit holds the duty under the command
+const char* ctrl_getErrorName(uint8_t error_code);
+
+//Copy of the controller state taken on the tick a safety shutdown is first seen
+typedef struct {
+    uint8_t  error_code;        //0 if no fault has happened since boot
+    uint64_t time_us;
+    uint8_t  hall_state;
+    uint8_t  skipped_commutations;
+    bool     using_speed_control;
+    uint16_t duty;
+    double   speed_mph;
+    double   batVolt;
+    double   curA, curB, curC;
+    double   tempA, tempB, tempC;
+} ctrl_faultSnapshot_t;
+const ctrl_faultSnapshot_t* ctrl_getFaultSnapshot(void);
+
+//Time spent in ctrl_hall_isr, in CPU cycles (ns on the host), since boot or the last reset
+typedef struct {
+    uint32_t edges;
+    uint32_t cyclesMax;
+    uint64_t cyclesTotal;
+} ctrl_isrStats_t;
+void ctrl_getHallIsrStats(ctrl_isrStats_t* out);
+void ctrl_resetHallIsrStats(void);
+
+//Current regulator (ctrl_currentLoop), since boot or the last reset
+typedef struct {
+    float phasePeak_A;
+    float busPeak_A;
+    uint32_t limitedPeriods;    //Current loop periods spent holding the duty under the command
+    uint8_t limiting;
+} ctrl_curregStats_t;
+void ctrl_getCurrentRegStats(ctrl_curregStats_t* out);
+void ctrl_resetCurrentRegStats(void);
+
+//Commutation source: the hall ISR, or above the bemf_mph parameter the back-EMF zero crossings (ctrl_sensorless.h)
+#define ctrl_COMM_HALL          0
+#define ctrl_COMM_SENSORLESS    1
+typedef struct {
+    uint8_t mode;               //ctrl_COMM_*
+    bool locked;                //Zero crossings have been calling the commutations right
+    float speed_mph;            //From the zero crossing period
+    uint32_t handovers;         //Hall to sensorless, since boot
+    uint32_t handbacks;
+    uint32_t lockLosses;        //Hand backs for want of zero crossings
+    uint32_t hallFaults;        //Hall wiring faults seen while sensorless (they shut down once the halls are needed again)
+    ctrl_sensorlessStats_t zc;
+} ctrl_commStatus_t;
+void ctrl_getCommStatus(ctrl_commStatus_t* out);
+
+//PWM frequency and resolution, picked by the modelled loss when the pwm_adapt parameter is on (ctrl_pwm.h)
+typedef struct {
+    uint32_t freq_hz;           //On the output now
+    uint8_t bits;
+    uint32_t changes;           //Since boot
+    float loss_W;               //Modelled switching and ripple loss now...
+    float baseLoss_W;           //...and what it would be at the pwm_hz parameter
+    float loss_j;               //Sums of those since boot
+    float baseLoss_j;
+} ctrl_pwmStatus_t;
+void ctrl_getPwmStatus(ctrl_pwmStatus_t* out);
+
+//Per-rate statistics of the control scheduler (ctrl_rates[] in ctrl_subsystem.c), since boot or the last reset.
+//Execution time is in CPU cycles (ns on the host), response time is from the timer release to the end of the run.
+#define ctrl_SCHED_RATES 6
+typedef struct {
+    const char* name;
+    uint32_t period_us;
+    uint32_t deadline_us;
+    uint32_t runs;
+    uint32_t overruns;          //Releases that came before the previous run finished, or were skipped
+    uint32_t deadlineMisses;
+    uint32_t cyclesMax;
+    uint64_t cyclesTotal;
+    uint32_t responseMax_us;
+} ctrl_rateStats_t;
+int ctrl_getRateStats(int rate, ctrl_rateStats_t* out);    //Returns 0 past the last rate
+void ctrl_resetRateStats(void);
+
+//Speed loop relay tuning (ctrl_autotune.h): state, identified Ku/Tu per band, and the gains in use
+void ctrl_getAutotuneStatus(ctrl_autotune_t* out);
+void ctrl_getSpeedGains(ctrl_speedPiGains_t* out);
+uint8_t ctrl_getAutotuneSaveResult(void);          //0 once the last tuned gains are in non-volatile storage, 0xFF before
+void ctrl_serviceAutotune(void);                   //Stores tuned gains; call from a low priority task
 
 //******************************* SET functions (Return 0 on **SUCCESS**)
 uint8_t ctrl_setSpeedControl(float target_mph);
@@ -49,9 +147,16 @@ uint8_t ctrl_setSpeedControl(float target_mph);
 uint8_t ctrl_setThrottle(uint16_t desired_throttle);
 
 uint8_t ctrl_setDirection(uint8_t new_direction);
+uint8_t ctrl_setThrottleMode(uint8_t new_mode);     //ctrl_THROTTLE_MODE_*, only with the throttle closed while armed
 
 uint8_t ctrl_turnOffSpeedControl(void) ;
 
+uint8_t ctrl_startAutotune(float set_mph);      //Wheel on a stand, armed, throttle closed. 0 mph tunes every speed band.
+uint8_t ctrl_stopAutotune(void);
+uint8_t ctrl_setSpeedKp(uint8_t band, float kp);    //Speed PI gains per speed band (ctrl_speed_pi.h)
+uint8_t ctrl_setSpeedKi(uint8_t band, float ki);
+uint8_t ctrl_setParam(int index, float value);      //Runtime parameter (ctrl_params.h), live from the next tick
+
 
 
 //******************************************************     PROTOTYPES    ******************************************************
@@ -63,7 +168,7 @@ static void ctrl_update_timer_cb(void *arg);    //ctrl_timer_cb() runs whenever
 static void IRAM_ATTR ctrl_hall_isr(void *args);    //ctrl_hall_isr() runs whenever any hall sensor pin changes state, and handles commutation without applying speed control
 
 //TASKS:
-void ctrl_operational_task(void *arg);         //ctrl_operational_task() is a task that runs 100 times per second and handles all control subsystem operations.
+void ctrl_operational_task(void *arg);         //ctrl_operational_task() runs the speed loop and housekeeping rates from ctrl_rates[] off a 1 kHz tick
 
 //FUNCTIONS:
 void ctrl_alignOutputToHall(void);      //ctrl_alignOutputToHall() aligns the cur_input_index, cur_output_index, and expected_hall_state to match to the most recently read hall_state (also takes direction into account for the expected_hall_state)
@@ -9,6 +9,11 @@
 #include "ctrl_subsystem.h"
 //#endif
 #include "itf_master_defines.h"
+#include "itf_crc.h"
+#include "itf_console.h"
+#include "itf_log_xfer.h"
+#include "itf_trace.h"
+#include "itf_com_funcs.h"
 
 #ifndef ITF_COM_DEFINES
     #define ITF_TX_PIN_UART1 4
@@ -19,6 +24,8 @@
     #define ITF_TX_BUF_SIZE_UART0 1024
     #define ITF_RX_BUF_SIZE_UART1 1024
     #define ITF_TX_BUF_SIZE_UART1 1024
+    #define ITF_TLM_DEFAULT_PERIOD 10
+    #define ITF_TLM_REFRESH_PERIODS 50
 #endif
 
 //#define COM_PRINT_DEF
@@ -33,6 +40,44 @@ static const int ITF_TX_BUF_SIZE_UART1 = 1024;
 int itf_dirInput0 = -1;
 int itf_dirInput1 = -1;
 int itf_speedLocked = 0;    //CALEB: Could you tell me more about this variable at some point?
+itf_comStats_t itf_comStats = {0};
+
+//Telemetry subscription for the MCU link. Instead of polling packets 4-7 the dashboard sends
+//packet 9 once with a bitmask of the fields it wants (0 = unsubscribe) and optionally packet 10
+//with the push period in 10ms units. MCUTelemetryTask then pushes an update frame every period:
+//  word 0:    0xB000 | (mask of fields in this frame <<4) | CRC4
+//  word 1..n: (12-bit field value <<4) | CRC4, one per set bit, lowest bit first
+//A field is only put in the frame if it moved more than its deadband since it was last sent
+//(or every ITF_TLM_REFRESH_PERIODS periods, so a dropped frame can't leave the dash stale forever)
+#define ITF_TLM_NUM_FIELDS 8
+#define ITF_TLM_PACKET_SUB 9
+#define ITF_TLM_PACKET_PERIOD 10
+#define ITF_TLM_PACKET_FRAME 11
+
+static double itf_tlmGetStatus(void);
+
+typedef struct {
+    double (*get)(void);    //ctrl_get* getter for the field
+    double scale;           //Multiplier applied before the value is clamped into 12 bits
+    int deadband;           //Minimum change (in scaled units) before the field is resent
+} itf_tlmField_t;
+
+static const itf_tlmField_t itf_tlmFields[ITF_TLM_NUM_FIELDS] = {
+    {ctrl_getSpeed_mph,     10.0,  2},  //bit0: speed, 0.1 mph
+    {ctrl_getBatVolts_V,    10.0,  2},  //bit1: battery voltage, 0.1 V
+    {ctrl_getCurrent_A,     10.0,  3},  //bit2: battery current, 0.1 A
+    {ctrl_getPhaseTempA_f,  1.0,   1},  //bit3: temp A, deg F
+    {ctrl_getPhaseTempB_f,  1.0,   1},  //bit4: temp B, deg F
+    {ctrl_getPhaseTempC_f,  1.0,   1},  //bit5: temp C, deg F
+    {ctrl_getThrottle,      1.0,   32}, //bit6: throttle, 0-4095
+    {itf_tlmGetStatus,      1.0,   0},  //bit7: (armed<<8) | error code
+};
+
+static volatile uint8_t itf_tlmMask = 0;
+static volatile uint8_t itf_tlmPeriod = ITF_TLM_DEFAULT_PERIOD;
+static volatile int itf_tlmResync = 0;
+static int itf_tlmLastSent[ITF_TLM_NUM_FIELDS];
+static TaskHandle_t itf_tlmTaskHandle = NULL;
 
 
 int itf_decodePC(uint8_t* str);
@@ -46,6 +91,8 @@ int itf_sendDataMCU(const char* data);
 void itf_dirHandler(void *arg);
 void itf_initDirPins(void);
 int itf_crc4AndSend(int message);
+int itf_sendBytesMCU(const uint8_t* data, int len);
+int itf_setTelemetry(uint8_t mask, uint8_t period);
 
 //Init the UART0 (PC->MCU) with baud rate of 19200
 void itf_init_UART0(void) {
@@ -77,32 +124,20 @@ void itf_init_UART1(void) {
     uart_set_pin(UART_NUM_1, ITF_TX_PIN_UART1, ITF_RX_PIN_UART1, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
 }
 
-//Utils for itf_crc4
-static const uint8_t itf_crc4_tab[] = {
-	0x0, 0x7, 0xe, 0x9, 0xb, 0xc, 0x5, 0x2,
-	0x1, 0x6, 0xf, 0x8, 0xa, 0xd, 0x4, 0x3,
-};
-
-//itf_crc4 function 
-uint8_t itf_crc4(uint8_t c, uint64_t x, int bits)
-{
-	int i;
-	/* mask off anything above the top bit */
-	x &= (1ull << bits) - 1;
-	/* Align to 4-bits */
-	bits = (bits + 3) & ~0x3;
-	/* Calculate itf_crc4 over four-bit nibbles, starting at the MSbit */
-	for (i = bits - 4; i >= 0; i -= 4)
-		c = itf_crc4_tab[c ^ ((x >> i) & 0xf)];
-	return c;
+//Value of one hex digit (either case), -1 if it isn't one
+static int itf_hexDigit(uint8_t c){
+    if(c >= '0' && c <= '9') { return c - '0'; }
+    if(c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+    if(c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+    return -1;
 }
 
-//Decode raw char data in "0xFFFF" format into numbers,return message
+//Decode raw char data in "0xFFFF" format into numbers,return message (-1 if malformed)
 int itf_decodePC(uint8_t* str){
     #ifdef COM_PRINT_DEF
         ESP_LOG_BUFFER_HEXDUMP("EnteredData", str, 7, ESP_LOG_INFO);
     #endif
-    if(!(str[0] == 0x30 && str[1] == 0x78 && str[6]==0x0d)){
+    if(!(str[0] == '0' && (str[1] == 'x' || str[1] == 'X') && str[6] == '\r')){
         #ifdef COM_PRINT_DEF
             ESP_LOGI("PC_ERROR","Problem decoding PC message");
         #endif
@@ -111,44 +146,12 @@ int itf_decodePC(uint8_t* str){
     int i;
     int message=0;
     for(i=0;i<4;i++){
-        int currentChar = str[2+i];
-        int charValue = 0;
-        if(currentChar == 0x30){
-            charValue = 0;
-        }else if(currentChar == 0x31){
-            charValue = 1;
-        }else if(currentChar == 0x32){
-            charValue = 2;
-        }else if(currentChar == 0x33){
-            charValue = 3;
-        }else if(currentChar == 0x34){
-            charValue = 4;
-        }else if(currentChar == 0x35){
-            charValue = 5;
-        }else if(currentChar == 0x36){
-            charValue = 6;
-        }else if(currentChar == 0x37){
-            charValue = 7;
-        }else if(currentChar == 0x38){
-            charValue = 8;
-        }else if(currentChar == 0x39){
-            charValue = 9;
-        }else if(currentChar == 0x41){
-            charValue = 10;
-        }else if(currentChar == 0x42){
-            charValue = 11;
-        }else if(currentChar == 0x43){
-            charValue = 12;
-        }else if(currentChar == 0x44){
-            charValue = 13;
-        }else if(currentChar == 0x45){
-            charValue = 14;
-        }else if(currentChar == 0x46){
-            charValue = 15;
+        int charValue = itf_hexDigit(str[2+i]);
+        if(charValue < 0){
+            return -1;
         }
-        message |= charValue<<(4*(3-i));
+        message = (message<<4) | charValue;
     }
-    //ESP_LOGI("PC","Decoded message '%s' as '%x'",str,message);
     return message;
 }
 
@@ -235,10 +238,8 @@ int itf_actOnMessage(int message,int source){
             temp_DUMMY = temp_DUMMY*1;//CHANGE TO PROPER SCALING
 
             if(source == 0){
-                int message = (packetID << 12) | (temp_DUMMY << 4);
-                message = itf_addCRC(message);
-                uint8_t data[2] = {(uint8_t) ((message & 0xFF00)>>8),(uint8_t) (message & 0x00FF)};
-                itf_sendDataMCU((char*)data);
+                int message = (packetID << 12) | ((temp_DUMMY & 0xFF) << 4);
+                itf_crc4AndSend(message);
             }else{
                 ESP_LOGI(c,"Temp = %d",temp_DUMMY);
             }
@@ -279,14 +280,22 @@ int itf_actOnMessage(int message,int source){
             ctrl_turnOffSpeedControl();
             ESP_LOGI(c,"Speed Control Deactivated.");
             break;
+        case ITF_TLM_PACKET_SUB://Subscribe to telemetry fields (bitmask, 0 = unsubscribe)
+            itf_setTelemetry((uint8_t) packetDATA, itf_tlmPeriod);
+            ESP_LOGI(c,"Telemetry mask = %x, period = %d0 ms",itf_tlmMask,itf_tlmPeriod);
+            break;
+        case ITF_TLM_PACKET_PERIOD://Telemetry push period in 10ms units
+            if(packetDATA > 0){
+                itf_setTelemetry(itf_tlmMask, (uint8_t) packetDATA);
+            }
+            ESP_LOGI(c,"Telemetry mask = %x, period = %d0 ms",itf_tlmMask,itf_tlmPeriod);
+            break;
         case 14://Read Direction request (TEST MSG, DONT USE IN ACTUAL)
             if(source == 0){
                 itf_writeTestMessage("Dir Test Performed via MCU \n");
                 //SEND ADC DATA VIA MCU
                 int message = 0xE000 | itf_dirInput0<<5 | itf_dirInput1<<4;
-                message = itf_addCRC(message);
-                uint8_t data[2] = {(uint8_t) ((message & 0xFF00)>>8),(uint8_t) (message & 0x00FF)};
-                itf_sendDataMCU((char*)data);
+                itf_crc4AndSend(message);
             }else{
                 ESP_LOGI(c,"D0=%d   D1=%d",itf_dirInput0,itf_dirInput1);
                 itf_writeTestMessage("Dir Test Performed via PC \n");
@@ -299,7 +308,7 @@ int itf_actOnMessage(int message,int source){
                 itf_writeTestMessage("Hex Test Performed via PC \n");
             }else{
                 uint8_t data[2] = {0xFA,0x08};
-                itf_sendDataMCU((char*)data);
+                itf_sendBytesMCU(data,2);
                 itf_writeTestMessage("Hex Test Performed via MCU \n");
             }
             break;
@@ -312,7 +321,96 @@ int itf_actOnMessage(int message,int source){
 int itf_crc4AndSend(int message){
     message = itf_addCRC(message);
     uint8_t data[2] = {(uint8_t) ((message & 0xFF00)>>8),(uint8_t) (message & 0x00FF)};
-    return itf_sendDataMCU((char*)data);
+    return itf_sendBytesMCU(data,2);
+}
+
+//Same as itf_sendDataMCU, but for binary data that may contain 0x00 bytes
+int itf_sendBytesMCU(const uint8_t* data, int len)
+{
+    return uart_write_bytes(UART_NUM_1, (const char*) data, len);
+}
+
+//Change the telemetry subscription. Any change forces every subscribed field out on the next frame
+int itf_setTelemetry(uint8_t mask, uint8_t period){
+    if(period == 0){
+        return 0;
+    }
+    itf_tlmPeriod = period;
+    itf_tlmMask = mask;
+    itf_tlmResync = 1;
+    if(itf_tlmTaskHandle != NULL){
+        xTaskNotifyGive(itf_tlmTaskHandle);
+    }
+    return 1;
+}
+
+//Packs armed and the error code into one telemetry field
+static double itf_tlmGetStatus(void){
+    return (double) ((ctrl_isArmed()<<8) | ctrl_getErrorCode());
+}
+
+//Builds one update frame into frame[] (at most 2+2*ITF_TLM_NUM_FIELDS bytes), returns its length
+//or 0 if nothing moved past its deadband
+static int itf_buildTelemetryFrame(uint8_t* frame, uint8_t mask, int sendAll){
+    uint8_t frameMask = 0;
+    int len = 2;
+    int i;
+    for(i=0;i<ITF_TLM_NUM_FIELDS;i++){
+        if(!(mask & (1<<i))){
+            continue;
+        }
+        int value = (int) (itf_tlmFields[i].get()*itf_tlmFields[i].scale);
+        if(value < 0)       { value = 0; }
+        if(value > 0x0FFF)  { value = 0x0FFF; }
+        int delta = value - itf_tlmLastSent[i];
+        if(delta < 0)       { delta = -delta; }
+        if(sendAll || delta > itf_tlmFields[i].deadband){
+            int word = itf_addCRC(value<<4);
+            frame[len++] = (uint8_t) ((word & 0xFF00)>>8);
+            frame[len++] = (uint8_t) (word & 0x00FF);
+            itf_tlmLastSent[i] = value;
+            frameMask |= (1<<i);
+        }
+    }
+    if(frameMask == 0){
+        return 0;
+    }
+    int header = itf_addCRC((ITF_TLM_PACKET_FRAME<<12) | (frameMask<<4));
+    frame[0] = (uint8_t) ((header & 0xFF00)>>8);
+    frame[1] = (uint8_t) (header & 0x00FF);
+    return len;
+}
+
+//Pushes subscribed telemetry to the dashboard MCU. Sleeps on a notification while nothing is subscribed
+void MCUTelemetryTask(void * params){
+    uint8_t frame[2+2*ITF_TLM_NUM_FIELDS];
+    int periodsSinceRefresh = 0;
+    itf_tlmTaskHandle = xTaskGetCurrentTaskHandle();
+    TickType_t lastWake = xTaskGetTickCount();
+
+    while(1){
+        if(itf_tlmMask == 0){
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            lastWake = xTaskGetTickCount();
+            continue;
+        }
+        vTaskDelayUntil(&lastWake, (itf_tlmPeriod*10)/portTICK_PERIOD_MS);
+
+        int sendAll = itf_tlmResync || (periodsSinceRefresh >= ITF_TLM_REFRESH_PERIODS);
+        itf_tlmResync = 0;
+        if(sendAll){
+            periodsSinceRefresh = 0;
+        }else{
+            periodsSinceRefresh++;
+        }
+
+        int len = itf_buildTelemetryFrame(frame, itf_tlmMask, sendAll);
+        if(len > 0){
+            itf_sendBytesMCU(frame, len);
+            itf_comStats.tlmFrames++;
+            itf_comStats.tlmBytes += len;
+        }
+    }
 }
 
 int itf_sendDataMCU(const char* data)
@@ -320,7 +418,7 @@ int itf_sendDataMCU(const char* data)
     const int len = strlen(data);
     //const int len = 2;
     const int txBytes = uart_write_bytes(UART_NUM_1, data, len);
-    ESP_LOGI("logName", "Wrote %d bytes", len);
+    ITF_TRACE1(COM_MCU_TX, len);
     return txBytes;
 }
 
@@ -355,42 +453,26 @@ void itf_dirHandler(void *arg){
     //00 = NOT RUNNING, 01 = FORWARD, 10 = BACKWARD, 11 = NOT RUNNING
     ctrl_setDirection((itf_dirInput0<<1) | itf_dirInput1);
 
-    #ifdef COM_PRINT_DEF
-        ESP_LOGI("itf_dirHandler","Dir0 = %d, Dir1 = %d",itf_dirInput0,itf_dirInput1);
-    #endif
+    ITF_TRACE2(COM_DIR, itf_dirInput0, itf_dirInput1);
     return;
 }
 
+//Reads the PC link and hands the bytes to the line console (itf_console.c).
+//A "log get" takes the link over until the download is done (itf_log_xfer.c).
 void PCComTask(void * params){
     itf_init_UART0();
     itf_initHex();
-    
-    int lastLength = -1;
+    uint8_t data[64];
 
     while(1){
-        int length;
-        uart_get_buffered_data_len(UART_NUM_0,(size_t*) &length);
-           
-        if(lastLength != length){
-            ESP_LOGI("Info:","Data in buffer is %d long",length);
-            lastLength = length;
-        }
-        
-        uint8_t* data = (uint8_t*) malloc(7);
-        const int rxBytes = uart_read_bytes(UART_NUM_0, data, 7, 1000 / portTICK_PERIOD_MS);
+        const int rxBytes = uart_read_bytes(UART_NUM_0, data, sizeof(data), 20 / portTICK_PERIOD_MS);
         if (rxBytes > 0) {
-            data[rxBytes] = 0;
-            ESP_LOGI("RX_TASK_TAG", "Read %d bytes: '%s'", rxBytes, data);
-            int messageVal = itf_decodePC(data);
-            ESP_LOGI("PC","Decoded message %x",messageVal);
-            if(itf_checkCRC(messageVal) != -1){
-                itf_actOnMessage(messageVal,1);
-            }else{
-                u_int messageVal_itf_crc4 = itf_addCRC(messageVal);
-                ESP_LOGI("PC","Correct CRC format would be %x",messageVal_itf_crc4);
-            }
+            itf_consoleFeed(data, rxBytes);
         }
-        vTaskDelay(50/portTICK_PERIOD_MS);
+        if(itf_xferPending()){
+            itf_xferRun();
+        }
+        ctrl_serviceAutotune();     //Tuned speed gains to flash, away from the control loop
     }
 }
 
@@ -405,19 +487,19 @@ void MCUComTask(void * params){
         int length;
         uart_get_buffered_data_len(UART_NUM_1,(size_t*) &length);
         
-        uint8_t* data = (uint8_t*) malloc(2);
+        uint8_t data[3];
         const int rxBytes = uart_read_bytes(UART_NUM_1, data, 2, 1000 / portTICK_PERIOD_MS);
         if (rxBytes > 0) {
             data[rxBytes] = 0;
-            ESP_LOGI("MCU", "Read %d bytes: '%x''%x'", rxBytes, data[0],data[1]);
-            
             int messageVal = (data[0]<<8) | (data[1]);
-            ESP_LOGI("MCU","Decoded message %x",messageVal);
+            ITF_TRACE1(COM_MCU_RX, messageVal);
+            itf_comStats.mcuFrames++;
             if(itf_checkCRC(messageVal) != -1){
                 itf_actOnMessage(messageVal,0);
             }else{
+                itf_comStats.mcuCrcErrors++;
                 u_int messageVal_itf_crc4 = itf_addCRC(messageVal);
-                ESP_LOGI("MCU","Correct CRC format would be %x",messageVal_itf_crc4);
+                ITF_TRACE2(COM_MCU_CRC, messageVal, messageVal_itf_crc4);
             }
         }
         vTaskDelay(50/portTICK_PERIOD_MS);
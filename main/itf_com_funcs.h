@@ -1,6 +1,8 @@
 #ifndef ITF_COM_FUNCS_H_
 #define ITF_COM_FUNCS_H_
 
+#include <stdint.h>
+
 int itf_decodePC(uint8_t* str);
 int itf_checkCRC(int message);
 int itf_addCRC(int message);
@@ -12,9 +14,23 @@ int itf_sendDataMCU(const char* data);
 void itf_dirHandler(void *arg);
 void itf_initDirPins(void);
 int itf_crc4AndSend(int message);
+int itf_sendBytesMCU(const uint8_t* data, int len);
+int itf_setTelemetry(uint8_t mask, uint8_t period);
 void PCComTask(void * params);
 void MCUComTask(void * params);
+void MCUTelemetryTask(void * params);
+
+//Link counters, reported by the console "stats" command
+typedef struct {
+    uint32_t pcLines;
+    uint32_t pcErrors;
+    uint32_t mcuFrames;
+    uint32_t mcuCrcErrors;
+    uint32_t tlmFrames;
+    uint32_t tlmBytes;
+} itf_comStats_t;
 
+extern itf_comStats_t itf_comStats;
 extern int itf_dirInput1;
 extern int itf_dirInput0;
 extern int itf_speedLocked;
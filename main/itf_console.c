@@ -0,0 +1,703 @@
+//Line-oriented command console on the PC link (UART0).
+//Every reply is one line of key=value pairs starting with cmd=<name>, failures add err=<reason>:
+//  > get speed volts; set throttle 1200
+//  cmd=get speed=12.30 volts=48.10
+//  cmd=set throttle=1200
+//Lines are tokenized in place in a static buffer, so nothing is allocated per command.
+//The old "0xFFFF" + CRC messages still work, they are just another command.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include "esp_log.h"
+#include "driver/uart.h"
+#include "ctrl_subsystem.h"
+#include "ctrl_params.h"
+#include "itf_com_funcs.h"
+#include "itf_crc.h"
+#include "itf_sd_ring.h"
+#include "itf_log_codec.h"
+#include "itf_sd_card_writer.h"
+#include "itf_sd_session.h"
+#include "itf_log_policy.h"
+#include "itf_log_xfer.h"
+#include "itf_trace.h"
+#include "itf_master_defines.h"
+#include "itf_console.h"
+
+#ifndef ITF_CONSOLE_DEFINES
+    #define ITF_CONSOLE_LINE_MAX 256
+    #define ITF_CONSOLE_OUT_MAX 512
+    #define ITF_CONSOLE_MAX_ARGS 8
+#endif
+
+typedef int (*itf_consoleHandler_t)(int argc, char** argv);
+
+typedef struct {
+    const char* name;
+    itf_consoleHandler_t fn;
+    const char* help;
+} itf_consoleCmd_t;
+
+typedef struct {
+    const char* key;
+    double (*get)(void);
+    const char* fmt;
+} itf_consoleField_t;
+
+static char itf_consoleLine[ITF_CONSOLE_LINE_MAX];
+static int itf_consoleLineLen = 0;
+static int itf_consoleLineOverflow = 0;
+static char itf_consoleOutBuf[ITF_CONSOLE_OUT_MAX];
+static int itf_consoleOutLen = 0;
+
+void itf_consoleFeed(const uint8_t* data, int len);
+void itf_consoleExecLine(char* line);
+void itf_consoleOut(const char* fmt, ...);
+void itf_consoleFlush(void);
+
+//******************************* Output
+void itf_consoleOut(const char* fmt, ...){
+    va_list args;
+    int space = ITF_CONSOLE_OUT_MAX - itf_consoleOutLen;
+    if(space <= 1){
+        return;
+    }
+    va_start(args, fmt);
+    int n = vsnprintf(itf_consoleOutBuf + itf_consoleOutLen, space, fmt, args);
+    va_end(args);
+    if(n > 0){
+        itf_consoleOutLen += (n < space) ? n : (space - 1);
+    }
+}
+
+void itf_consoleFlush(void){
+    if(itf_consoleOutLen == 0){
+        return;
+    }
+    uart_write_bytes(UART_NUM_0, itf_consoleOutBuf, itf_consoleOutLen);
+    uart_write_bytes(UART_NUM_0, "\r\n", 2);
+    itf_consoleOutLen = 0;
+}
+
+//******************************* Fields for "get"
+static double itf_consoleGetArmed(void)      { return ctrl_isArmed(); }
+static double itf_consoleGetError(void)      { return ctrl_getErrorCode(); }
+static double itf_consoleGetSpeedCtrl(void)  { return ctrl_isUsingSpeedControl(); }
+static double itf_consoleGetDir(void)        { return ctrl_getDirection(); }
+static double itf_consoleGetHall(void)       { return ctrl_getHallState(); }
+static double itf_consoleGetDuty(void)       { return ctrl_getDutyCommand(); }
+static double itf_consoleGetDutyOut(void)    { return ctrl_getOutputDuty(); }
+static double itf_consoleGetTMode(void)      { return ctrl_getThrottleMode(); }
+static double itf_consoleGetLimited(void)    { return ctrl_isCurrentLimited(); }
+static double itf_consoleGetLock(void)       { return itf_speedLocked; }
+static double itf_consoleGetTime(void)       { return (double) ctrl_getTime(); }
+static double itf_consoleGetComm(void)       { ctrl_commStatus_t cs; ctrl_getCommStatus(&cs); return cs.mode; }
+static double itf_consoleGetPwmHz(void)      { ctrl_pwmStatus_t ps; ctrl_getPwmStatus(&ps); return ps.freq_hz; }
+
+static const itf_consoleField_t itf_consoleFields[] = {
+    {"speed",       ctrl_getSpeed_mph,          "%.2f"},
+    {"speed_set",   ctrl_getSpeedSetting_mph,   "%.2f"},
+    {"speed_ctrl",  itf_consoleGetSpeedCtrl,    "%.0f"},
+    {"throttle",    ctrl_getThrottle,           "%.0f"},
+    {"duty",        itf_consoleGetDuty,         "%.0f"},
+    {"duty_out",    itf_consoleGetDutyOut,      "%.0f"},
+    {"tmode",       itf_consoleGetTMode,        "%.0f"},
+    {"cur_limited", itf_consoleGetLimited,      "%.0f"},
+    {"volts",       ctrl_getBatVolts_V,         "%.2f"},
+    {"current",     ctrl_getCurrent_A,          "%.2f"},
+    {"power",       ctrl_getInstPower_W,        "%.1f"},
+    {"power_avg",   ctrl_getAvePower_W,         "%.1f"},
+    {"energy",      ctrl_getTotEnergy_j,        "%.1f"},
+    {"cur_a",       ctrl_getPhaseCurA_A,        "%.2f"},
+    {"cur_b",       ctrl_getPhaseCurB_A,        "%.2f"},
+    {"cur_c",       ctrl_getPhaseCurC_A,        "%.2f"},
+    {"temp_a",      ctrl_getPhaseTempA_f,       "%.1f"},
+    {"temp_b",      ctrl_getPhaseTempB_f,       "%.1f"},
+    {"temp_c",      ctrl_getPhaseTempC_f,       "%.1f"},
+    {"armed",       itf_consoleGetArmed,        "%.0f"},
+    {"error",       itf_consoleGetError,        "%.0f"},
+    {"dir",         itf_consoleGetDir,          "%.0f"},
+    {"hall",        itf_consoleGetHall,         "%.0f"},
+    {"comm",        itf_consoleGetComm,         "%.0f"},
+    {"pwm_hz",      itf_consoleGetPwmHz,        "%.0f"},
+    {"speed_lock",  itf_consoleGetLock,         "%.0f"},
+    {"time_us",     itf_consoleGetTime,         "%.0f"},
+};
+#define ITF_CONSOLE_NUM_FIELDS ((int)(sizeof(itf_consoleFields)/sizeof(itf_consoleFields[0])))
+
+static void itf_consoleOutField(int i){
+    itf_consoleOut(" %s=", itf_consoleFields[i].key);
+    itf_consoleOut(itf_consoleFields[i].fmt, itf_consoleFields[i].get());
+}
+
+//******************************* Command handlers (return 0 on success)
+static int itf_consoleCmdGet(int argc, char** argv){
+    int a, i;
+    if(argc < 2){
+        itf_consoleOut(" err=usage");
+        return 1;
+    }
+    for(a=1;a<argc;a++){
+        if(strcmp(argv[a],"all") == 0){
+            for(i=0;i<ITF_CONSOLE_NUM_FIELDS;i++){
+                itf_consoleOutField(i);
+            }
+            continue;
+        }
+        for(i=0;i<ITF_CONSOLE_NUM_FIELDS;i++){
+            if(strcmp(argv[a],itf_consoleFields[i].key) == 0){
+                break;
+            }
+        }
+        if(i == ITF_CONSOLE_NUM_FIELDS){
+            itf_consoleOut(" err=unknown_field field=%s", argv[a]);
+            return 1;
+        }
+        itf_consoleOutField(i);
+    }
+    return 0;
+}
+
+static int itf_consoleCmdSet(int argc, char** argv){
+    if(argc < 3){
+        itf_consoleOut(" err=usage");
+        return 1;
+    }
+    char* end;
+    double value = strtod(argv[2], &end);
+    if(*end != '\0'){
+        itf_consoleOut(" err=bad_value value=%s", argv[2]);
+        return 1;
+    }
+
+    uint8_t result = 0;
+    if(strcmp(argv[1],"throttle") == 0){
+        if(itf_speedLocked) { itf_consoleOut(" err=speed_locked"); return 1; }
+        result = ctrl_setThrottle((uint16_t) value);
+    }else if(strcmp(argv[1],"speed") == 0){
+        if(itf_speedLocked) { itf_consoleOut(" err=speed_locked"); return 1; }
+        result = (value == 0.0) ? ctrl_turnOffSpeedControl() : ctrl_setSpeedControl((float) value);
+    }else if(strcmp(argv[1],"dir") == 0){
+        if(value < 0 || value > 3) { itf_consoleOut(" err=range"); return 1; }
+        result = ctrl_setDirection((uint8_t) value);
+    }else if(strcmp(argv[1],"tmode") == 0){
+        //0: throttle is duty, 1: throttle is a bus current target (torque)
+        if(itf_speedLocked) { itf_consoleOut(" err=speed_locked"); return 1; }
+        result = ctrl_setThrottleMode((uint8_t) value);
+    }else if(strcmp(argv[1],"lock") == 0){
+        itf_speedLocked = (value > 0);
+    }else if(strcmp(argv[1],"tlm") == 0){
+        //set tlm <field mask> [period in 10ms units]
+        int period = (argc > 3) ? atoi(argv[3]) : ITF_TLM_DEFAULT_PERIOD;
+        if(period < 1 || period > 255) { itf_consoleOut(" err=range"); return 1; }
+        itf_setTelemetry((uint8_t) value, (uint8_t) period);
+    }else{
+        itf_consoleOut(" err=unknown_setting setting=%s", argv[1]);
+        return 1;
+    }
+
+    if(result){
+        itf_consoleOut(" err=rejected code=%d", result);
+        return 1;
+    }
+    itf_consoleOut(" %s=%s", argv[1], argv[2]);
+    return 0;
+}
+
+//"stats" prints the link counters, "stats <group>" one group of the rest. One line holds ITF_CONSOLE_OUT_MAX
+//characters, which all of them together don't fit in once the counters grow.
+static void itf_consoleStatsSd(void){
+    itf_sdRingStats_t sd;
+    itf_sdRingGetStats(&sd);
+    itf_consoleOut(" sd_records=%lu sd_drops=%lu sd_drop_bytes=%lu", (unsigned long) sd.recordsPushed,
+                   (unsigned long) sd.recordsDropped, (unsigned long) sd.bytesDropped);
+    itf_consoleOut(" sd_blocks=%lu sd_written=%lu sd_pending=%d/%d sd_pending_max=%lu", (unsigned long) sd.blocksFilled,
+                   (unsigned long) sd.blocksWritten, itf_sdRingPending(), itf_sdRingBlockCount(), (unsigned long) sd.pendingHighWater);
+    itf_consoleOut(" sd_ring_kb=%d sd_wait_max_ms=%lld sd_stall_survived_ms=%lld", itf_sdRingBlockCount()*itf_sdRingBlockSize()/1024,
+                   (long long) (sd.waitMax_us/1000), (long long) (sd.waitMaxNoLoss_us/1000));
+    itf_consoleOut(" sd_bytes=%llu sd_write_max_us=%lld sd_sync_max_us=%lld sd_syncs=%lu sd_fails=%lu sd_prealloc=%lu",
+                   (unsigned long long) itf_sdWriterStats.bytesWritten, (long long) itf_sdWriterStats.writeMax_us,
+                   (long long) itf_sdWriterStats.syncMax_us, (unsigned long) itf_sdWriterStats.syncs,
+                   (unsigned long) (itf_sdWriterStats.writeFails + itf_sdWriterStats.openFails), (unsigned long) itf_sdWriterStats.preallocBytes);
+    itf_consoleOut(" sd_mount_to_write_ms=%lld sd_wakeups=%lu sd_remounts=%lu", (long long) (itf_sdWriterStats.mountToFirstWrite_us/1000),
+                   (unsigned long) itf_sdWriterStats.wakeups, (unsigned long) itf_sdWriterStats.remounts);
+}
+
+static void itf_consoleStatsLog(void){
+    itf_logPolicyStats_t lp;
+    itf_logPolicyGetStats(&lp);
+    itf_consoleOut(" log_edge_Bps=%lu log_long_Bps=%lu log_triggers=%lu", (unsigned long) lp.stream[ITF_LOG_STREAM_EDGE].bytesPerSec,
+                   (unsigned long) lp.stream[ITF_LOG_STREAM_LONG].bytesPerSec, (unsigned long) lp.triggers);
+}
+
+static void itf_consoleStatsTrace(void){
+    itf_traceStats_t tr;
+    itf_traceGetStats(&tr);
+    itf_consoleOut(" trace_msgs=%lu trace_drops=%lu trace_ring_max=%lu", (unsigned long) tr.put,
+                   (unsigned long) tr.dropped, (unsigned long) tr.highWater);
+}
+
+static void itf_consoleStatsComm(void){
+    ctrl_commStatus_t cs;
+    ctrl_getCommStatus(&cs);
+    itf_consoleOut(" bemf_locked=%d bemf_handovers=%lu bemf_handbacks=%lu bemf_lost=%lu bemf_hall_faults=%lu", cs.locked,
+                   (unsigned long) cs.handovers, (unsigned long) cs.handbacks, (unsigned long) cs.lockLosses, (unsigned long) cs.hallFaults);
+    itf_consoleOut(" bemf_zc=%lu bemf_missed=%lu bemf_rejected=%lu", (unsigned long) cs.zc.zeroCrossings,
+                   (unsigned long) cs.zc.missed, (unsigned long) cs.zc.rejected);
+}
+
+static void itf_consoleStatsPwm(void){
+    ctrl_pwmStatus_t ps;
+    ctrl_getPwmStatus(&ps);
+    itf_consoleOut(" pwm_hz=%lu pwm_bits=%d pwm_changes=%lu pwm_loss_j=%.1f pwm_saved_j=%.1f", (unsigned long) ps.freq_hz, ps.bits,
+                   (unsigned long) ps.changes, ps.loss_j, ps.baseLoss_j - ps.loss_j);
+}
+
+static const struct {
+    const char* name;
+    void (*out)(void);
+} itf_consoleStatsGroups[] = {
+    {"sd",      itf_consoleStatsSd},
+    {"log",     itf_consoleStatsLog},
+    {"trace",   itf_consoleStatsTrace},
+    {"comm",    itf_consoleStatsComm},
+    {"pwm",     itf_consoleStatsPwm},
+};
+#define ITF_CONSOLE_NUM_STATS_GROUPS ((int)(sizeof(itf_consoleStatsGroups)/sizeof(itf_consoleStatsGroups[0])))
+
+static int itf_consoleCmdStats(int argc, char** argv){
+    int i;
+    if(argc >= 2){
+        for(i=0;i<ITF_CONSOLE_NUM_STATS_GROUPS;i++){
+            if(strcmp(argv[1], itf_consoleStatsGroups[i].name) == 0){
+                itf_consoleOut(" what=%s", argv[1]);
+                itf_consoleStatsGroups[i].out();
+                return 0;
+            }
+        }
+        itf_consoleOut(" err=unknown_group group=%s", argv[1]);
+        return 1;
+    }
+    itf_consoleOut(" uptime_ms=%lu", (unsigned long) (ctrl_getTime()/1000));
+    itf_consoleOut(" pc_lines=%lu pc_errors=%lu", (unsigned long) itf_comStats.pcLines, (unsigned long) itf_comStats.pcErrors);
+    itf_consoleOut(" mcu_frames=%lu mcu_crc_errors=%lu", (unsigned long) itf_comStats.mcuFrames, (unsigned long) itf_comStats.mcuCrcErrors);
+    itf_consoleOut(" tlm_frames=%lu tlm_bytes=%lu", (unsigned long) itf_comStats.tlmFrames, (unsigned long) itf_comStats.tlmBytes);
+    itf_consoleOut(" skipped_comm=%d", ctrl_getSkippedCommutations());
+    return 0;
+}
+
+static int itf_consoleCmdDump(int argc, char** argv){
+    if(argc < 2 || strcmp(argv[1],"fault") != 0){
+        itf_consoleOut(" err=usage");
+        return 1;
+    }
+    const ctrl_faultSnapshot_t* f = ctrl_getFaultSnapshot();
+    itf_consoleOut(" what=fault active=%d code=%d name=%s", ctrl_getErrorCode(), f->error_code, ctrl_getErrorName(f->error_code));
+    if(f->error_code == 0){
+        return 0;
+    }
+    itf_consoleOut(" t_us=%llu hall=%d skipped=%d speed_ctrl=%d duty=%d", (unsigned long long) f->time_us, f->hall_state,
+                   f->skipped_commutations, f->using_speed_control, f->duty);
+    itf_consoleOut(" speed=%.2f volts=%.2f cur_a=%.2f cur_b=%.2f cur_c=%.2f", f->speed_mph, f->batVolt, f->curA, f->curB, f->curC);
+    itf_consoleOut(" temp_a=%.1f temp_b=%.1f temp_c=%.1f", f->tempA, f->tempB, f->tempC);
+    return 0;
+}
+
+//"log policy" prints every stream, "log policy <stream> <interval_us> <trig_interval_us> <budget_Bps>" sets one
+static int itf_consoleLogPolicy(int argc, char** argv){
+    itf_logStreamCfg_t cfg;
+    itf_logPolicyStats_t lp;
+    int i;
+    if(argc >= 6){
+        //A typo must not come out as 0, which is no rate limit and no budget
+        uint32_t value[3];
+        for(i=0;i<3;i++){
+            char* end;
+            value[i] = strtoul(argv[3+i], &end, 10);
+            if(end == argv[3+i] || *end != '\0' || argv[3+i][0] == '-'){
+                itf_consoleOut(" err=bad_value value=%s", argv[3+i]);
+                return 1;
+            }
+        }
+        for(i=0;i<ITF_LOG_STREAMS && strcmp(argv[2], itf_logStreamName(i)) != 0;i++);
+        cfg.interval_us = value[0];
+        cfg.trigInterval_us = value[1];
+        cfg.budget_Bps = value[2];
+        if(!itf_logPolicySetStream(i, &cfg)){
+            itf_consoleOut(" err=stream");
+            return 1;
+        }
+    }else if(argc != 2){
+        itf_consoleOut(" err=usage");
+        return 1;
+    }
+    itf_logPolicyGetStats(&lp);
+    itf_consoleOut(" triggers=%lu last_cause=%d active=%d", (unsigned long) lp.triggers, lp.lastCause, lp.active);
+    for(i=0;i<ITF_LOG_STREAMS;i++){
+        const itf_logStreamStats_t* st = &lp.stream[i];
+        itf_logPolicyGetStream(i, &cfg);
+        itf_consoleOut(" %s=%lu/%lu/%lu rec=%lu Bps=%lu peak=%lu rate_skip=%lu budget_skip=%lu drop=%lu pre=%lu", itf_logStreamName(i),
+                       (unsigned long) cfg.interval_us, (unsigned long) cfg.trigInterval_us, (unsigned long) cfg.budget_Bps,
+                       (unsigned long) st->records, (unsigned long) st->bytesPerSec, (unsigned long) st->peakBytesPerSec,
+                       (unsigned long) st->skippedRate, (unsigned long) st->skippedBudget, (unsigned long) st->dropped,
+                       (unsigned long) st->preTrigger);
+    }
+    return 0;
+}
+
+static int itf_consoleCmdLog(int argc, char** argv){
+    if(argc >= 2 && strcmp(argv[1],"flush") == 0){
+        itf_sdRequest(ITF_SD_REQ_FLUSH);
+    }else if(argc >= 2 && strcmp(argv[1],"close") == 0){
+        itf_sdRequest(ITF_SD_REQ_CLOSE);
+    }else if(argc >= 2 && strcmp(argv[1],"ls") == 0){
+        //From the directory cache, newest last. Only the last few fit on one line.
+        uint16_t session;
+        uint8_t part;
+        int i, n = itf_sessionFileCount();
+        int active = itf_sessionCurrent(&session, &part);
+        itf_consoleOut(" files=%d session=%d part=%d scan_us=%lld", n, active ? session : -1, active ? part : -1,
+                       (long long) itf_sessionScanTime_us());
+        for(i=(n > 8) ? n - 8 : 0;i<n;i++){
+            const itf_sessionFile_t* f = itf_sessionFileAt(i);
+            itf_consoleOut(" S%04u_%02u=%lu", f->session, f->part, (unsigned long) f->size);
+        }
+        return 0;
+    }else if(argc >= 3 && strcmp(argv[1],"get") == 0){
+        //The transfer itself starts once this reply is out (itf_log_xfer.c)
+        return !itf_xferRequest(argv[2], (argc >= 4) ? atoi(argv[3]) : 0);
+    }else if(argc >= 2 && strcmp(argv[1],"trigger") == 0){
+        itf_logPolicyTrigger(ITF_LOG_TRIG_MANUAL);
+    }else if(argc >= 2 && strcmp(argv[1],"policy") == 0){
+        return itf_consoleLogPolicy(argc, argv);
+    }else{
+        itf_consoleOut(" err=usage");
+        return 1;
+    }
+    itf_consoleOut(" what=%s queued=1", argv[1]);
+    return 0;
+}
+
+static int itf_consoleCmdBench(int argc, char** argv){
+    if(argc >= 2 && strcmp(argv[1],"crc") == 0){
+        int bytes = (argc >= 3) ? atoi(argv[2]) : 1024*1024;
+        itf_crcBenchmark(bytes);
+        return 0;
+    }
+    if(argc >= 2 && strcmp(argv[1],"log") == 0){
+        int records = (argc >= 3) ? atoi(argv[2]) : 100000;
+        itf_logCodecBenchmark(records);
+        return 0;
+    }
+    if(argc >= 2 && strcmp(argv[1],"trace") == 0){
+        int calls = (argc >= 3) ? atoi(argv[2]) : 100000;
+        itf_traceBenchmark(calls);
+        return 0;
+    }
+    if(argc >= 2 && strcmp(argv[1],"sd") == 0){
+        int bytes = (argc >= 3) ? atoi(argv[2]) : 4*1024*1024;
+        itf_sdBenchmark(bytes);
+        return 0;
+    }
+    if(argc >= 2 && strcmp(argv[1],"sdxfer") == 0){
+        int bytes = (argc >= 3) ? atoi(argv[2]) : 4*1024*1024;
+        itf_sdBenchTransfers(bytes);
+        return 0;
+    }
+    itf_consoleOut(" err=usage");
+    return 1;
+}
+
+//Control scheduler rates: "sched" prints each rate's period/deadline, overruns and deadline misses, "sched <rate>" that
+//rate's full counters (all of them for every rate don't fit in ITF_CONSOLE_OUT_MAX), "sched reset" clears the counters
+static int itf_consoleCmdSched(int argc, char** argv){
+    ctrl_rateStats_t st;
+    const char* only = NULL;
+    int i, shown = 0;
+    if(argc >= 2 && strcmp(argv[1],"reset") == 0){
+        ctrl_resetRateStats();
+    }else if(argc >= 2){
+        only = argv[1];
+    }
+    for(i=0;ctrl_getRateStats(i, &st);i++){
+        if(only == NULL){
+            itf_consoleOut(" %s=%lu/%lu over=%lu miss=%lu", st.name, (unsigned long) st.period_us, (unsigned long) st.deadline_us,
+                           (unsigned long) st.overruns, (unsigned long) st.deadlineMisses);
+        }else if(strcmp(only, st.name) == 0){
+            itf_consoleOut(" %s=%lu/%lu runs=%lu over=%lu miss=%lu cyc_avg=%lu cyc_max=%lu resp_max_us=%lu", st.name,
+                           (unsigned long) st.period_us, (unsigned long) st.deadline_us, (unsigned long) st.runs,
+                           (unsigned long) st.overruns, (unsigned long) st.deadlineMisses,
+                           (unsigned long) (st.runs ? st.cyclesTotal/st.runs : 0), (unsigned long) st.cyclesMax,
+                           (unsigned long) st.responseMax_us);
+        }else{
+            continue;
+        }
+        shown++;
+    }
+    if(shown == 0){
+        itf_consoleOut(" err=unknown_rate");
+        return 1;
+    }
+    return 0;
+}
+
+//Speed loop relay tuning, wheel on a stand: "tune all" tunes every speed band, "tune <mph>" the band holding that
+//speed, "tune stop" ends it, "tune" reports progress, Ku/Tu per tuned band and the gains in use
+static int itf_consoleCmdTune(int argc, char** argv){
+    static const char* states[] = {"idle", "running", "done", "failed"};
+    ctrl_autotune_t at;
+    ctrl_speedPiGains_t gains;
+    uint8_t result = 0;
+    int i;
+    if(argc >= 2 && strcmp(argv[1],"stop") == 0){
+        result = ctrl_stopAutotune();
+    }else if(argc >= 2){
+        double mph = 0.0;       //0: every band
+        if(strcmp(argv[1],"all") != 0){
+            char* end;
+            mph = strtod(argv[1], &end);
+            if(end == argv[1] || *end != '\0' || mph <= 0.0){
+                itf_consoleOut(" err=bad_value value=%s", argv[1]);
+                return 1;
+            }
+        }
+        if(itf_speedLocked) { itf_consoleOut(" err=speed_locked"); return 1; }
+        result = ctrl_startAutotune((float) mph);
+    }
+    if(result){
+        itf_consoleOut(" err=rejected code=%d", result);
+        return 1;
+    }
+    ctrl_getAutotuneStatus(&at);
+    ctrl_getSpeedGains(&gains);
+    itf_consoleOut(" state=%s err=%d band=%d set_mph=%.1f cycles=%lu total_ms=%lu", states[at.state & 3], at.error, at.band,
+                   at.set_mph, (unsigned long) at.cycles, (unsigned long) at.total_ms);
+    for(i=0;i<ctrl_SPEED_BANDS;i++){
+        if(at.tuned_ms[i] > 0){
+            itf_consoleOut(" ku%d=%.1f tu%d=%.3f", i, at.ku[i], i, at.tu_s[i]);
+        }
+        itf_consoleOut(" kp%d=%.1f ki%d=%.1f", i, gains.kp[i], i, gains.ki[i]);
+    }
+    if(at.state == ctrl_AUTOTUNE_DONE){
+        itf_consoleOut(" saved=%d", ctrl_getAutotuneSaveResult() == 0);
+    }
+    return 0;
+}
+
+static void itf_consoleOutParam(int i){
+    const ctrl_paramDesc_t* d = ctrl_paramDesc(i);
+    itf_consoleOut((d->type == ctrl_PARAM_U32) ? " %s=%.0f" : " %s=%.2f", d->name, ctrl_paramGet(i));
+}
+
+//Runtime parameters (ctrl_params.c): "param" lists them, "param <name>" describes one, "param <name> <value>" sets it
+//(live from the next control tick, or the next boot for boot=1 ones), "param save|defaults|erase" for NVS
+static int itf_consoleCmdParam(int argc, char** argv){
+    uint8_t result = 0;
+    int i;
+    if(argc < 2){
+        for(i=0;i<ctrl_paramCount();i++){
+            itf_consoleOutParam(i);
+        }
+        return 0;
+    }
+    if(strcmp(argv[1],"save") == 0){
+        result = ctrl_paramsSave();
+    }else if(strcmp(argv[1],"erase") == 0){
+        result = ctrl_paramsErase();
+    }else if(strcmp(argv[1],"defaults") == 0){
+        ctrl_paramsDefaults(ctrl_setParam);
+    }else{
+        i = ctrl_paramFind(argv[1]);
+        if(i < 0){
+            itf_consoleOut(" err=unknown_param param=%s", argv[1]);
+            return 1;
+        }
+        if(argc >= 3){
+            char* end;
+            double value = strtod(argv[2], &end);
+            if(*end != '\0'){
+                itf_consoleOut(" err=bad_value value=%s", argv[2]);
+                return 1;
+            }
+            result = ctrl_setParam(i, (float) value);
+        }
+        if(result == 0){
+            const ctrl_paramDesc_t* d = ctrl_paramDesc(i);
+            itf_consoleOutParam(i);
+            itf_consoleOut(" unit=%s min=%g max=%g default=%g boot=%d", d->unit, d->min, d->max, d->def, (d->flags & ctrl_PARAM_AT_BOOT) != 0);
+        }
+    }
+    if(result){
+        itf_consoleOut(" err=rejected code=%d", result);
+        return 1;
+    }
+    return 0;
+}
+
+//Where trace messages go: "trace sd|uart|both|off", no argument just reports
+static int itf_consoleCmdTrace(int argc, char** argv){
+    static const char* names[] = {"off", "sd", "uart", "both"};
+    int i;
+    if(argc >= 2){
+        for(i=0;i<4;i++){
+            if(strcmp(argv[1],names[i]) == 0){
+                break;
+            }
+        }
+        if(i == 4){
+            itf_consoleOut(" err=usage");
+            return 1;
+        }
+        itf_traceSetSinks(i);
+    }
+    itf_consoleOut(" sinks=%s", names[itf_traceGetSinks() & 3]);
+    return 0;
+}
+
+//Old PC protocol: "0xFFFF" where the last nibble is the CRC4
+static int itf_consoleCmdRaw(int argc, char** argv){
+    char legacy[7];
+    if(strlen(argv[0]) != 6){
+        itf_consoleOut(" err=bad_message");
+        return 1;
+    }
+    memcpy(legacy, argv[0], 6);
+    legacy[6] = '\r';
+    int messageVal = itf_decodePC((uint8_t*) legacy);
+    if(messageVal < 0){
+        itf_consoleOut(" err=bad_message");
+        return 1;
+    }
+    if(itf_checkCRC(messageVal) == -1){
+        itf_consoleOut(" err=crc expected=0x%04X", itf_addCRC(messageVal));
+        return 1;
+    }
+    itf_actOnMessage(messageVal,1);
+    itf_consoleOut(" msg=0x%04X", messageVal);
+    return 0;
+}
+
+static int itf_consoleCmdHelp(int argc, char** argv);
+
+static const itf_consoleCmd_t itf_consoleCmds[] = {
+    {"get",   itf_consoleCmdGet,   "get <field>...|all"},
+    {"set",   itf_consoleCmdSet,   "set throttle|speed|dir|tmode|lock|tlm <value>"},
+    {"stats", itf_consoleCmdStats, "stats [sd|log|trace|comm|pwm]"},
+    {"dump",  itf_consoleCmdDump,  "dump fault"},
+    {"log",   itf_consoleCmdLog,   "log flush|close|ls|trigger | log get <file> [baud] | log policy [edge|long us trig_us Bps]"},
+    {"trace", itf_consoleCmdTrace, "trace [sd|uart|both|off]"},
+    {"sched", itf_consoleCmdSched, "sched [current|safety|speed|pwm|log|display|reset]"},
+    {"tune",  itf_consoleCmdTune,  "tune [all|<mph>|stop]"},
+    {"param", itf_consoleCmdParam, "param [<name> [value]] | param save|defaults|erase"},
+    {"bench", itf_consoleCmdBench, "bench crc|sd|sdxfer [bytes] | bench log [records] | bench trace [calls]"},
+    {"help",  itf_consoleCmdHelp,  "help [<cmd>]"},
+};
+#define ITF_CONSOLE_NUM_CMDS ((int)(sizeof(itf_consoleCmds)/sizeof(itf_consoleCmds[0])))
+
+//"help" lists the commands, "help <cmd>" gives one's usage (all the usages together don't fit in one reply)
+static int itf_consoleCmdHelp(int argc, char** argv){
+    int i;
+    for(i=0;i<ITF_CONSOLE_NUM_CMDS;i++){
+        if(argc < 2){
+            itf_consoleOut("%s%s", (i == 0) ? " cmds=" : ",", itf_consoleCmds[i].name);
+        }else if(strcmp(argv[1], itf_consoleCmds[i].name) == 0){
+            itf_consoleOut(" %s=\"%s\"", itf_consoleCmds[i].name, itf_consoleCmds[i].help);
+            return 0;
+        }
+    }
+    if(argc >= 2){
+        itf_consoleOut(" err=unknown_command name=%s", argv[1]);
+        return 1;
+    }
+    return 0;
+}
+
+//******************************* Parsing
+//Splits one command on spaces/tabs (in place) and runs it
+static void itf_consoleExecCommand(char* cmd){
+    char* argv[ITF_CONSOLE_MAX_ARGS];
+    int argc = 0;
+    char* p = cmd;
+    int i;
+
+    while(*p != '\0'){
+        while(*p == ' ' || *p == '\t') { *p++ = '\0'; }
+        if(*p == '\0') { break; }
+        if(argc == ITF_CONSOLE_MAX_ARGS){
+            itf_consoleOut("cmd=%s err=too_many_args", argv[0]);
+            itf_comStats.pcErrors++;
+            itf_consoleFlush();
+            return;
+        }
+        argv[argc++] = p;
+        while(*p != '\0' && *p != ' ' && *p != '\t') { p++; }
+    }
+    if(argc == 0){
+        return;
+    }
+
+    int error = 1;
+    if(argv[0][0] == '0' && (argv[0][1] == 'x' || argv[0][1] == 'X')){
+        itf_consoleOut("cmd=raw");
+        error = itf_consoleCmdRaw(argc, argv);
+    }else{
+        for(i=0;i<ITF_CONSOLE_NUM_CMDS;i++){
+            if(strcmp(argv[0],itf_consoleCmds[i].name) == 0){
+                break;
+            }
+        }
+        itf_consoleOut("cmd=%s", argv[0]);
+        if(i == ITF_CONSOLE_NUM_CMDS){
+            itf_consoleOut(" err=unknown_command");
+        }else{
+            error = itf_consoleCmds[i].fn(argc, argv);
+        }
+    }
+    if(error){
+        itf_comStats.pcErrors++;
+    }
+    itf_consoleFlush();
+}
+
+void itf_consoleExecLine(char* line){
+    char* start = line;
+    char* p = line;
+    itf_comStats.pcLines++;
+    while(1){
+        if(*p == ';' || *p == '\0'){
+            int last = (*p == '\0');
+            *p = '\0';
+            itf_consoleExecCommand(start);
+            if(last){
+                break;
+            }
+            start = p + 1;
+        }
+        p++;
+    }
+}
+
+void itf_consoleFeed(const uint8_t* data, int len){
+    int i;
+    for(i=0;i<len;i++){
+        char c = (char) data[i];
+        if(c == '\r' || c == '\n'){
+            if(itf_consoleLineOverflow){
+                itf_consoleOut("cmd=? err=line_too_long");
+                itf_comStats.pcErrors++;
+                itf_consoleFlush();
+            }else if(itf_consoleLineLen > 0){
+                itf_consoleLine[itf_consoleLineLen] = '\0';
+                itf_consoleExecLine(itf_consoleLine);
+            }
+            itf_consoleLineLen = 0;
+            itf_consoleLineOverflow = 0;
+        }else if(itf_consoleLineLen < ITF_CONSOLE_LINE_MAX-1){
+            itf_consoleLine[itf_consoleLineLen++] = c;
+        }else{
+            itf_consoleLineOverflow = 1;
+        }
+    }
+}
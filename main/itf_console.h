@@ -0,0 +1,15 @@
+#ifndef ITF_CONSOLE_H_
+#define ITF_CONSOLE_H_
+
+#include <stdint.h>
+
+//Feed raw bytes from the PC link. Complete lines ('\r' or '\n' terminated) are executed in place.
+void itf_consoleFeed(const uint8_t* data, int len);
+//Run one line, commands separated by ';'. The line is modified (tokenized in place).
+void itf_consoleExecLine(char* line);
+//Append "key=value" text to the reply line that is being built (printf style)
+void itf_consoleOut(const char* fmt, ...);
+//Send the reply line built so far (commands are flushed by the console itself)
+void itf_consoleFlush(void);
+
+#endif
@@ -0,0 +1,217 @@
+//CRC engine shared by the MCU/PC links, the SD log and file transfers.
+//On target itf_crc8/16/32 go to the esp_rom_crc* routines (table code in mask ROM, so no flash
+//cache misses and no RAM tables). The *_sw versions are the portable byte-table implementations
+//used on the host; they give bit-identical results so logs can be checked off the car.
+
+#include <stdio.h>
+#include <string.h>
+#include "itf_crc.h"
+
+#ifdef ESP_PLATFORM
+    #include "esp_rom_crc.h"
+    #include "esp_timer.h"
+#else
+    #include <time.h>
+#endif
+
+//Utils for itf_crc4
+static const uint8_t itf_crc4_tab[] = {
+	0x0, 0x7, 0xe, 0x9, 0xb, 0xc, 0x5, 0x2,
+	0x1, 0x6, 0xf, 0x8, 0xa, 0xd, 0x4, 0x3,
+};
+
+//Two itf_crc4_tab steps folded into one: next crc = itf_crc4_byteTab[(crc<<4) ^ byte]
+static const uint8_t itf_crc4_byteTab[] = {
+	0x0, 0x7, 0xe, 0x9, 0xb, 0xc, 0x5, 0x2, 0x1, 0x6, 0xf, 0x8, 0xa, 0xd, 0x4, 0x3,
+	0x2, 0x5, 0xc, 0xb, 0x9, 0xe, 0x7, 0x0, 0x3, 0x4, 0xd, 0xa, 0x8, 0xf, 0x6, 0x1,
+	0x4, 0x3, 0xa, 0xd, 0xf, 0x8, 0x1, 0x6, 0x5, 0x2, 0xb, 0xc, 0xe, 0x9, 0x0, 0x7,
+	0x6, 0x1, 0x8, 0xf, 0xd, 0xa, 0x3, 0x4, 0x7, 0x0, 0x9, 0xe, 0xc, 0xb, 0x2, 0x5,
+	0x8, 0xf, 0x6, 0x1, 0x3, 0x4, 0xd, 0xa, 0x9, 0xe, 0x7, 0x0, 0x2, 0x5, 0xc, 0xb,
+	0xa, 0xd, 0x4, 0x3, 0x1, 0x6, 0xf, 0x8, 0xb, 0xc, 0x5, 0x2, 0x0, 0x7, 0xe, 0x9,
+	0xc, 0xb, 0x2, 0x5, 0x7, 0x0, 0x9, 0xe, 0xd, 0xa, 0x3, 0x4, 0x6, 0x1, 0x8, 0xf,
+	0xe, 0x9, 0x0, 0x7, 0x5, 0x2, 0xb, 0xc, 0xf, 0x8, 0x1, 0x6, 0x4, 0x3, 0xa, 0xd,
+	0x7, 0x0, 0x9, 0xe, 0xc, 0xb, 0x2, 0x5, 0x6, 0x1, 0x8, 0xf, 0xd, 0xa, 0x3, 0x4,
+	0x5, 0x2, 0xb, 0xc, 0xe, 0x9, 0x0, 0x7, 0x4, 0x3, 0xa, 0xd, 0xf, 0x8, 0x1, 0x6,
+	0x3, 0x4, 0xd, 0xa, 0x8, 0xf, 0x6, 0x1, 0x2, 0x5, 0xc, 0xb, 0x9, 0xe, 0x7, 0x0,
+	0x1, 0x6, 0xf, 0x8, 0xa, 0xd, 0x4, 0x3, 0x0, 0x7, 0xe, 0x9, 0xb, 0xc, 0x5, 0x2,
+	0xf, 0x8, 0x1, 0x6, 0x4, 0x3, 0xa, 0xd, 0xe, 0x9, 0x0, 0x7, 0x5, 0x2, 0xb, 0xc,
+	0xd, 0xa, 0x3, 0x4, 0x6, 0x1, 0x8, 0xf, 0xc, 0xb, 0x2, 0x5, 0x7, 0x0, 0x9, 0xe,
+	0xb, 0xc, 0x5, 0x2, 0x0, 0x7, 0xe, 0x9, 0xa, 0xd, 0x4, 0x3, 0x1, 0x6, 0xf, 0x8,
+	0x9, 0xe, 0x7, 0x0, 0x2, 0x5, 0xc, 0xb, 0x8, 0xf, 0x6, 0x1, 0x3, 0x4, 0xd, 0xa,
+};
+
+//itf_crc4 function, now a byte at a time (one leading nibble step if bits isn't a multiple of 8)
+uint8_t itf_crc4(uint8_t c, uint64_t x, int bits)
+{
+	int i;
+	/* mask off anything above the top bit */
+	x &= (1ull << bits) - 1;
+	/* Align to 4-bits */
+	bits = (bits + 3) & ~0x3;
+	if (bits & 0x4) {
+		bits -= 4;
+		c = itf_crc4_tab[c ^ ((x >> bits) & 0xf)];
+	}
+	/* Calculate itf_crc4 over whole bytes, starting at the MSbit */
+	for (i = bits - 8; i >= 0; i -= 8)
+		c = itf_crc4_byteTab[(c << 4) ^ ((x >> i) & 0xff)];
+	return c;
+}
+
+//******************************* Portable table implementations
+//Tables are built on first use (about 5KB), the values written are always the same so a race is harmless
+static uint8_t  itf_crc8_tab[256];
+static uint16_t itf_crc16_tab[256];
+static uint32_t itf_crc32_tab[4][256];
+static volatile int itf_crcTablesBuilt = 0;
+
+static void itf_crcBuildTables(void){
+    int i, k;
+    for(i=0;i<256;i++){
+        uint8_t c8 = (uint8_t) i;
+        uint16_t c16 = (uint16_t) (i<<8);
+        uint32_t c32 = (uint32_t) i;
+        for(k=0;k<8;k++){
+            c8 = (c8 & 0x80) ? (uint8_t) ((c8<<1) ^ 0x07) : (uint8_t) (c8<<1);
+            c16 = (c16 & 0x8000) ? (uint16_t) ((c16<<1) ^ 0x1021) : (uint16_t) (c16<<1);
+            c32 = (c32 & 1) ? ((c32>>1) ^ 0xEDB88320u) : (c32>>1);
+        }
+        itf_crc8_tab[i] = c8;
+        itf_crc16_tab[i] = c16;
+        itf_crc32_tab[0][i] = c32;
+    }
+    //Slicing tables: tab[n][i] is the CRC of byte i followed by n zero bytes
+    for(i=0;i<256;i++){
+        for(k=1;k<4;k++){
+            uint32_t prev = itf_crc32_tab[k-1][i];
+            itf_crc32_tab[k][i] = (prev>>8) ^ itf_crc32_tab[0][prev & 0xFF];
+        }
+    }
+    itf_crcTablesBuilt = 1;
+}
+
+uint8_t itf_crc8_sw(uint8_t crc, const void* buf, size_t len){
+    const uint8_t* p = (const uint8_t*) buf;
+    if(!itf_crcTablesBuilt) { itf_crcBuildTables(); }
+    while(len--){
+        crc = itf_crc8_tab[crc ^ *p++];
+    }
+    return crc;
+}
+
+uint16_t itf_crc16_sw(uint16_t crc, const void* buf, size_t len){
+    const uint8_t* p = (const uint8_t*) buf;
+    if(!itf_crcTablesBuilt) { itf_crcBuildTables(); }
+    while(len--){
+        crc = (uint16_t) ((crc<<8) ^ itf_crc16_tab[(crc>>8) ^ *p++]);
+    }
+    return crc;
+}
+
+uint32_t itf_crc32_sw_bytewise(uint32_t crc, const void* buf, size_t len){
+    const uint8_t* p = (const uint8_t*) buf;
+    if(!itf_crcTablesBuilt) { itf_crcBuildTables(); }
+    crc = ~crc;
+    while(len--){
+        crc = (crc>>8) ^ itf_crc32_tab[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+//Slicing-by-4: one 32-bit load and four independent lookups per word
+uint32_t itf_crc32_sw(uint32_t crc, const void* buf, size_t len){
+    const uint8_t* p = (const uint8_t*) buf;
+    if(!itf_crcTablesBuilt) { itf_crcBuildTables(); }
+    crc = ~crc;
+    while(len && ((uintptr_t) p & 3)){
+        crc = (crc>>8) ^ itf_crc32_tab[0][(crc ^ *p++) & 0xFF];
+        len--;
+    }
+    while(len >= 4){
+        uint32_t word = (uint32_t) p[0] | ((uint32_t) p[1]<<8) | ((uint32_t) p[2]<<16) | ((uint32_t) p[3]<<24);
+        crc ^= word;
+        crc = itf_crc32_tab[3][crc & 0xFF] ^ itf_crc32_tab[2][(crc>>8) & 0xFF]
+            ^ itf_crc32_tab[1][(crc>>16) & 0xFF] ^ itf_crc32_tab[0][crc>>24];
+        p += 4;
+        len -= 4;
+    }
+    while(len--){
+        crc = (crc>>8) ^ itf_crc32_tab[0][(crc ^ *p++) & 0xFF];
+    }
+    return ~crc;
+}
+
+//******************************* Platform selection
+//The ROM routines invert the crc on the way in and out, so CRC-8/16 (which have no final xor)
+//are wrapped in ~ to keep the running value usable as the next init value
+#ifdef ESP_PLATFORM
+uint8_t  itf_crc8(uint8_t crc, const void* buf, size_t len)   { return (uint8_t) ~esp_rom_crc8_be((uint8_t) ~crc, (const uint8_t*) buf, len); }
+uint16_t itf_crc16(uint16_t crc, const void* buf, size_t len) { return (uint16_t) ~esp_rom_crc16_be((uint16_t) ~crc, (const uint8_t*) buf, len); }
+uint32_t itf_crc32(uint32_t crc, const void* buf, size_t len) { return esp_rom_crc32_le(crc, (const uint8_t*) buf, len); }
+#else
+uint8_t  itf_crc8(uint8_t crc, const void* buf, size_t len)   { return itf_crc8_sw(crc, buf, len); }
+uint16_t itf_crc16(uint16_t crc, const void* buf, size_t len) { return itf_crc16_sw(crc, buf, len); }
+uint32_t itf_crc32(uint32_t crc, const void* buf, size_t len) { return itf_crc32_sw(crc, buf, len); }
+#endif
+
+//******************************* Benchmark
+static int64_t itf_crcNow_us(void){
+    #ifdef ESP_PLATFORM
+        return esp_timer_get_time();
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ((int64_t) ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+    #endif
+}
+
+#define ITF_CRC_BENCH_BUF 4096
+typedef uint32_t (*itf_crcBenchFn_t)(uint32_t crc, const void* buf, size_t len);
+
+static uint32_t itf_crcBench8(uint32_t crc, const void* buf, size_t len)      { return itf_crc8((uint8_t) crc, buf, len); }
+static uint32_t itf_crcBench8sw(uint32_t crc, const void* buf, size_t len)    { return itf_crc8_sw((uint8_t) crc, buf, len); }
+static uint32_t itf_crcBench16(uint32_t crc, const void* buf, size_t len)     { return itf_crc16((uint16_t) crc, buf, len); }
+static uint32_t itf_crcBench16sw(uint32_t crc, const void* buf, size_t len)   { return itf_crc16_sw((uint16_t) crc, buf, len); }
+static uint32_t itf_crcBench4(uint32_t crc, const void* buf, size_t len){
+    const uint8_t* p = (const uint8_t*) buf;
+    size_t i;
+    for(i=0;i+1<len;i+=2){
+        crc = itf_crc4((uint8_t) crc, ((uint16_t) p[i]<<8) | p[i+1], 16);
+    }
+    return crc;
+}
+
+//Prints MB/s of every variant over totalBytes of data (1MB is plenty on target)
+void itf_crcBenchmark(int totalBytes){
+    static uint8_t buf[ITF_CRC_BENCH_BUF];
+    static const struct { const char* name; itf_crcBenchFn_t fn; } variants[] = {
+        {"crc4_msg16",       itf_crcBench4},
+        {"crc8",             itf_crcBench8},
+        {"crc8_sw",          itf_crcBench8sw},
+        {"crc16",            itf_crcBench16},
+        {"crc16_sw",         itf_crcBench16sw},
+        {"crc32",            itf_crc32},
+        {"crc32_sw_bytewise",itf_crc32_sw_bytewise},
+        {"crc32_sw_slice4",  itf_crc32_sw},
+    };
+    int i, v;
+    for(i=0;i<ITF_CRC_BENCH_BUF;i++){
+        buf[i] = (uint8_t) (i*131 + 7);
+    }
+    if(totalBytes < ITF_CRC_BENCH_BUF) { totalBytes = ITF_CRC_BENCH_BUF; }
+
+    for(v=0;v<(int)(sizeof(variants)/sizeof(variants[0]));v++){
+        uint32_t crc = 0;
+        int done = 0;
+        variants[v].fn(crc, buf, ITF_CRC_BENCH_BUF);  //warm up tables/cache
+        int64_t start = itf_crcNow_us();
+        while(done < totalBytes){
+            crc = variants[v].fn(crc, buf, ITF_CRC_BENCH_BUF);
+            done += ITF_CRC_BENCH_BUF;
+        }
+        int64_t elapsed = itf_crcNow_us() - start;
+        if(elapsed < 1) { elapsed = 1; }
+        printf("crc_bench %s bytes=%d us=%lld MBps=%.2f crc=%08lx\n", variants[v].name, done,
+               (long long) elapsed, ((double) done)/((double) elapsed), (unsigned long) crc);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef ITF_CRC_H_
+#define ITF_CRC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Start values. Pass the previous result back in to continue a CRC over several buffers.
+#define ITF_CRC8_INIT  0x00         //CRC-8/SMBUS:        poly 0x07,   not reflected, no final xor
+#define ITF_CRC16_INIT 0xFFFF       //CRC-16/CCITT-FALSE: poly 0x1021, not reflected, no final xor
+#define ITF_CRC32_INIT 0x00000000   //CRC-32 (zlib/PNG):  poly 0x04C11DB7, reflected, result inverted
+
+//Fastest variant for the platform (ROM tables on target, portable tables on the host)
+uint8_t  itf_crc8(uint8_t crc, const void* buf, size_t len);
+uint16_t itf_crc16(uint16_t crc, const void* buf, size_t len);
+uint32_t itf_crc32(uint32_t crc, const void* buf, size_t len);
+
+//Portable byte-table versions (CRC-32 also in slicing-by-4), same results as above
+uint8_t  itf_crc8_sw(uint8_t crc, const void* buf, size_t len);
+uint16_t itf_crc16_sw(uint16_t crc, const void* buf, size_t len);
+uint32_t itf_crc32_sw_bytewise(uint32_t crc, const void* buf, size_t len);
+uint32_t itf_crc32_sw(uint32_t crc, const void* buf, size_t len);
+
+//4-bit CRC used by the 16-bit MCU/PC messages (kept for compatibility)
+uint8_t itf_crc4(uint8_t c, uint64_t x, int bits);
+
+//Prints MB/s of every variant over totalBytes of data
+void itf_crcBenchmark(int totalBytes);
+
+#endif
@@ -0,0 +1,521 @@
+//Encoder and reference decoder for the binary log format described in itf_log_codec.h.
+//The encoder runs in the hall ISR (under the log ring lock), so it only does integer work on
+//the values it is handed. The decoder is used by the host tools.
+
+#include <stdio.h>
+#include <string.h>
+#include "itf_log_codec.h"
+#include "itf_crc.h"
+
+#ifdef ESP_PLATFORM
+    #include "sdkconfig.h"
+    #include "esp_timer.h"
+#else
+    #include <time.h>
+#endif
+
+//Same order as ctrl_hall_input_table, one step per commutation
+static const int8_t itf_logHallIndex[8] = {-1, 0, 2, 1, 4, 5, 3, -1};
+static const uint8_t itf_logHallSeq[6] = {1, 3, 2, 6, 4, 5};
+
+static inline int itf_logPutVarint(uint8_t* out, uint64_t v){
+    int n = 0;
+    while(v >= 0x80){
+        out[n++] = (uint8_t) (v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t) v;
+    return n;
+}
+
+static inline uint64_t itf_logZigzag(int64_t v){
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t itf_logUnzigzag(uint64_t v){
+    return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
+static inline void itf_logPut16(uint8_t* out, uint16_t v){
+    out[0] = (uint8_t) v;
+    out[1] = (uint8_t) (v >> 8);
+}
+
+static inline void itf_logPut32(uint8_t* out, uint32_t v){
+    out[0] = (uint8_t) v;
+    out[1] = (uint8_t) (v >> 8);
+    out[2] = (uint8_t) (v >> 16);
+    out[3] = (uint8_t) (v >> 24);
+}
+
+static inline void itf_logPut64(uint8_t* out, uint64_t v){
+    itf_logPut32(out, (uint32_t) v);
+    itf_logPut32(out + 4, (uint32_t) (v >> 32));
+}
+
+static inline uint16_t itf_logGet16(const uint8_t* p){
+    return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static inline uint32_t itf_logGet32(const uint8_t* p){
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint64_t itf_logGet64(const uint8_t* p){
+    return (uint64_t) itf_logGet32(p) | ((uint64_t) itf_logGet32(p + 4) << 32);
+}
+
+static inline int itf_logPutDt(uint8_t* out, itf_logState_t* st, uint64_t time_us){
+    //Producers on the other core can land slightly out of order, so dt is signed
+    int n = itf_logPutVarint(out, itf_logZigzag((int64_t) (time_us - st->last_us)));
+    st->last_us = time_us;
+    if(time_us > st->max_us){
+        st->max_us = time_us;
+    }
+    st->count++;
+    return n;
+}
+
+//Field schema stored in every file header, so old files stay readable after the format moves on
+const char itf_logSchemaText[] =
+    "schema 3\n"
+    "block ITFB seq:u32 base_us:u64 end_dt_us:u32 count:u16 schema:u16 data_len:u32 crc32:u32\n"
+    "rec 0x80 edge dt_us:zz hall:step2 cur_a:zz:0.01A cur_b:zz:0.01A cur_c:zz:0.01A\n"
+    "rec 0x41 long dt_us:zz speed:zz:0.01mph inst_power:zz:0.1W avg_power:zz:0.1W volts:zz:0.01V "
+        "current:zz:0.01A temp_a:zz:0.01 temp_b:zz:0.01 temp_c:zz:0.01 throttle:zz:1/4096 duty:zz:1/4096\n"
+    "rec 0x42 status dt_us:zz status:u8\n"
+    "rec 0x43 raw dt_us:zz len:varint bytes\n"
+    "rec 0x44 cmd dt_us:zz cmd:u8 result:u8 value:zz\n"
+    "rec 0x45 trace dt_us:zz id:varint n:u8 args:u32[n]\n"
+    "hall_seq 1 3 2 6 4 5\n";
+
+int itf_logEncodeFileHeader(uint8_t* out, int blockSize, uint64_t open_us){
+    int textLen = (int) strlen(itf_logSchemaText);
+    memcpy(out, ITF_LOG_FILE_MAGIC, 8);
+    itf_logPut32(out + 8, (uint32_t) blockSize);
+    itf_logPut16(out + 12, ITF_LOG_SCHEMA_ID);
+    itf_logPut16(out + 14, ITF_LOG_BLOCK_HEADER_LEN);
+    itf_logPut64(out + 16, open_us);
+    itf_logPut32(out + 24, (uint32_t) textLen);
+    memcpy(out + 28, itf_logSchemaText, textLen);
+    itf_logPut32(out + 28 + textLen, itf_crc32(ITF_CRC32_INIT, out, 28 + textLen));
+    return 32 + textLen;
+}
+
+int itf_logParseFileHeader(const uint8_t* buf, int len, itf_logFileInfo_t* info){
+    if(len < 32 || memcmp(buf, ITF_LOG_FILE_MAGIC, 8) != 0){
+        return -1;
+    }
+    uint32_t textLen = itf_logGet32(buf + 24);
+    if(textLen > (uint32_t) (len - 32) || itf_logGet32(buf + 28 + textLen) != itf_crc32(ITF_CRC32_INIT, buf, 28 + textLen)){
+        return -1;
+    }
+    info->blockSize = itf_logGet32(buf + 8);
+    info->schema = itf_logGet16(buf + 12);
+    info->open_us = itf_logGet64(buf + 16);
+    info->schemaText = (const char*) buf + 28;
+    info->schemaLen = (int) textLen;
+    return 0;
+}
+
+int itf_logEncodeBlockHeader(uint8_t* out, itf_logState_t* st, uint64_t base_us, uint32_t seq){
+    memset(out, 0, ITF_LOG_BLOCK_HEADER_LEN);
+    out[0] = 'I'; out[1] = 'T'; out[2] = 'F'; out[3] = 'B';
+    itf_logPut32(out + 4, seq);
+    itf_logPut64(out + 8, base_us);
+    itf_logPut16(out + 22, ITF_LOG_SCHEMA_ID);
+    itf_logPut32(out + 24, ITF_LOG_BLOCK_HEADER_LEN);
+    memset(st, 0, sizeof(*st));
+    st->base_us = base_us;
+    st->last_us = base_us;
+    st->max_us = base_us;
+    st->status = 0xFFFF;
+    return ITF_LOG_BLOCK_HEADER_LEN;
+}
+
+void itf_logFinishRecord(uint8_t* block, const itf_logState_t* st, int used){
+    itf_logPut32(block + 16, (uint32_t) (st->max_us - st->base_us));
+    itf_logPut16(block + 20, st->count);
+    itf_logPut32(block + 24, (uint32_t) used);
+}
+
+void itf_logSealBlock(uint8_t* block){
+    uint32_t used = itf_logGet32(block + 24);
+    itf_logPut32(block + 28, 0);
+    itf_logPut32(block + 28, itf_crc32(ITF_CRC32_INIT, block, used));
+}
+
+uint64_t itf_logBlockBase(const uint8_t* block){
+    return itf_logGet64(block + 8);
+}
+
+int itf_logParseBlockHeader(const uint8_t* block, int len, itf_logBlockInfo_t* info){
+    if(len < ITF_LOG_BLOCK_HEADER_LEN || memcmp(block, "ITFB", 4) != 0){
+        return 0;
+    }
+    uint32_t used = itf_logGet32(block + 24);
+    if(used < ITF_LOG_BLOCK_HEADER_LEN || used > (uint32_t) len){
+        return -1;
+    }
+    uint8_t zero[4] = {0, 0, 0, 0};
+    uint32_t crc = itf_crc32(ITF_CRC32_INIT, block, 28);
+    crc = itf_crc32(crc, zero, 4);
+    crc = itf_crc32(crc, block + ITF_LOG_BLOCK_HEADER_LEN, used - ITF_LOG_BLOCK_HEADER_LEN);
+    if(crc != itf_logGet32(block + 28)){
+        return -1;
+    }
+    info->seq = itf_logGet32(block + 4);
+    info->base_us = itf_logGet64(block + 8);
+    info->end_us = info->base_us + itf_logGet32(block + 16);
+    info->count = itf_logGet16(block + 20);
+    info->schema = itf_logGet16(block + 22);
+    info->dataLen = used - ITF_LOG_BLOCK_HEADER_LEN;
+    return 1;
+}
+
+void itf_logIndexInit(uint8_t* index){
+    memset(index, 0, ITF_LOG_INDEX_HEADER_LEN);
+    index[0] = 'I'; index[1] = 'T'; index[2] = 'F'; index[3] = 'X';
+    itf_logPut32(index + 8, 1);
+}
+
+void itf_logIndexAdd(uint8_t* index, int blockSize, uint32_t blockNo, uint64_t base_us){
+    uint32_t count = itf_logGet32(index + 4);
+    uint32_t stride = itf_logGet32(index + 8);
+    uint32_t maxEntries = (blockSize - ITF_LOG_INDEX_HEADER_LEN)/ITF_LOG_INDEX_ENTRY_LEN;
+    uint8_t* entries = index + ITF_LOG_INDEX_HEADER_LEN;
+
+    itf_logPut32(index + 12, blockNo);
+    if(count > 0 && blockNo < itf_logGet32(entries + (count - 1)*ITF_LOG_INDEX_ENTRY_LEN) + stride){
+        return;
+    }
+    if(count == maxEntries){
+        uint32_t i;
+        for(i=0;i<count/2;i++){
+            memmove(entries + i*ITF_LOG_INDEX_ENTRY_LEN, entries + 2*i*ITF_LOG_INDEX_ENTRY_LEN, ITF_LOG_INDEX_ENTRY_LEN);
+        }
+        count /= 2;
+        stride *= 2;
+        itf_logPut32(index + 8, stride);
+        if(blockNo < itf_logGet32(entries + (count - 1)*ITF_LOG_INDEX_ENTRY_LEN) + stride){
+            itf_logPut32(index + 4, count);
+            return;
+        }
+    }
+    itf_logPut32(entries + count*ITF_LOG_INDEX_ENTRY_LEN, blockNo);
+    itf_logPut64(entries + count*ITF_LOG_INDEX_ENTRY_LEN + 4, base_us);
+    itf_logPut32(index + 4, count + 1);
+}
+
+int itf_logIndexSeal(uint8_t* index){
+    int used = ITF_LOG_INDEX_HEADER_LEN + itf_logGet32(index + 4)*ITF_LOG_INDEX_ENTRY_LEN;
+    itf_logPut32(index + 28, 0);
+    itf_logPut32(index + 28, itf_crc32(ITF_CRC32_INIT, index, used));
+    return used;
+}
+
+int itf_logParseIndex(const uint8_t* index, int len, uint32_t* stride, uint32_t* lastBlock){
+    if(len < ITF_LOG_INDEX_HEADER_LEN || memcmp(index, "ITFX", 4) != 0){
+        return -1;
+    }
+    uint32_t count = itf_logGet32(index + 4);
+    if(count > (uint32_t) (len - ITF_LOG_INDEX_HEADER_LEN)/ITF_LOG_INDEX_ENTRY_LEN){
+        return -1;
+    }
+    uint8_t zero[4] = {0, 0, 0, 0};
+    uint32_t crc = itf_crc32(ITF_CRC32_INIT, index, 28);
+    crc = itf_crc32(crc, zero, 4);
+    crc = itf_crc32(crc, index + ITF_LOG_INDEX_HEADER_LEN, count*ITF_LOG_INDEX_ENTRY_LEN);
+    if(crc != itf_logGet32(index + 28)){
+        return -1;
+    }
+    *stride = itf_logGet32(index + 8);
+    *lastBlock = itf_logGet32(index + 12);
+    return (int) count;
+}
+
+void itf_logIndexEntry(const uint8_t* index, int i, uint32_t* blockNo, uint64_t* base_us){
+    const uint8_t* e = index + ITF_LOG_INDEX_HEADER_LEN + i*ITF_LOG_INDEX_ENTRY_LEN;
+    *blockNo = itf_logGet32(e);
+    *base_us = itf_logGet64(e + 4);
+}
+
+static int itf_logEncodeStatus(uint8_t* out, itf_logState_t* st, uint64_t time_us, uint8_t status){
+    int n = 0;
+    if(st->status == status){
+        return 0;
+    }
+    out[n++] = ITF_LOG_TAG_STATE;
+    n += itf_logPutDt(out + n, st, time_us);
+    out[n++] = status;
+    st->status = status;
+    return n;
+}
+
+int itf_logEncodeEdge(uint8_t* out, itf_logState_t* st, const itf_logEdge_t* e){
+    int n = itf_logEncodeStatus(out, st, e->time_us, e->status);
+    uint8_t* tag = out + n++;
+    int hallCode;
+    int i;
+
+    int8_t prev = itf_logHallIndex[st->hall & 7];
+    if(e->hall == st->hall){
+        hallCode = 0;
+    }else if(prev >= 0 && e->hall == itf_logHallSeq[(prev + 1) % 6]){
+        hallCode = 1;
+    }else if(prev >= 0 && e->hall == itf_logHallSeq[(prev + 5) % 6]){
+        hallCode = 2;
+    }else{
+        hallCode = 3;
+        out[n++] = e->hall;
+    }
+    st->hall = e->hall;
+
+    uint8_t mask = 0;
+    for(i=0;i<3;i++){
+        if(e->cur[i] != st->cur[i]){
+            mask |= 1 << (2 - i);
+        }
+    }
+    *tag = ITF_LOG_TAG_EDGE | (hallCode << 5) | (mask << 2);
+    n += itf_logPutDt(out + n, st, e->time_us);
+    for(i=0;i<3;i++){
+        if(e->cur[i] != st->cur[i]){
+            n += itf_logPutVarint(out + n, itf_logZigzag((int64_t) e->cur[i] - st->cur[i]));
+            st->cur[i] = e->cur[i];
+        }
+    }
+    return n;
+}
+
+int itf_logEncodeLong(uint8_t* out, itf_logState_t* st, const itf_logLong_t* r){
+    int n = itf_logEncodeStatus(out, st, r->time_us, r->status);
+    int i;
+    out[n++] = ITF_LOG_TAG_LONG;
+    n += itf_logPutDt(out + n, st, r->time_us);
+    for(i=0;i<ITF_LOG_LONG_FIELDS;i++){
+        n += itf_logPutVarint(out + n, itf_logZigzag((int64_t) r->v[i] - st->lng[i]));
+        st->lng[i] = r->v[i];
+    }
+    return n;
+}
+
+int itf_logEncodeRaw(uint8_t* out, itf_logState_t* st, uint64_t time_us, const void* data, int len){
+    int n = 0;
+    out[n++] = ITF_LOG_TAG_RAW;
+    n += itf_logPutDt(out + n, st, time_us);
+    n += itf_logPutVarint(out + n, (uint64_t) len);
+    memcpy(out + n, data, len);
+    return n + len;
+}
+
+int itf_logEncodeCommand(uint8_t* out, itf_logState_t* st, uint64_t time_us, uint8_t cmd, uint8_t result, int32_t value){
+    int n = 0;
+    out[n++] = ITF_LOG_TAG_CMD;
+    n += itf_logPutDt(out + n, st, time_us);
+    out[n++] = cmd;
+    out[n++] = result;
+    n += itf_logPutVarint(out + n, itf_logZigzag(value));
+    return n;
+}
+
+int itf_logEncodeTrace(uint8_t* out, itf_logState_t* st, uint64_t time_us, uint16_t id, const uint32_t* args, int n){
+    int len = 0;
+    int i;
+    if(n > 4) { n = 4; }
+    out[len++] = ITF_LOG_TAG_TRACE;
+    len += itf_logPutDt(out + len, st, time_us);
+    len += itf_logPutVarint(out + len, id);
+    out[len++] = (uint8_t) n;
+    for(i=0;i<n;i++){
+        itf_logPut32(out + len, args[i]);
+        len += 4;
+    }
+    return len;
+}
+
+//Returns 0 if the varint runs past end
+static int itf_logGetVarint(const uint8_t** p, const uint8_t* end, uint64_t* v){
+    int shift = 0;
+    *v = 0;
+    while(*p < end && shift < 64){
+        uint8_t b = *(*p)++;
+        *v |= ((uint64_t) (b & 0x7F)) << shift;
+        if((b & 0x80) == 0){
+            return 1;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+int itf_logDecodeBlock(const uint8_t* block, int len, itf_logRecordFn fn, void* ctx){
+    itf_logState_t st;
+    itf_logRecord_t rec;
+    itf_logBlockInfo_t info;
+    uint64_t v;
+    int count = 0;
+    int i;
+
+    if(itf_logParseBlockHeader(block, len, &info) != 1){
+        return -1;
+    }
+    const uint8_t* p = block + ITF_LOG_BLOCK_HEADER_LEN;
+    const uint8_t* end = p + info.dataLen;
+    int longFields = (info.schema < 2) ? ITF_LOG_LONG_FIELDS_V1 : ITF_LOG_LONG_FIELDS;
+    memset(&st, 0, sizeof(st));
+    st.last_us = info.base_us;
+    memset(&rec, 0, sizeof(rec));
+
+    while(p < end && *p != ITF_LOG_TAG_END){
+        uint8_t tag = *p++;
+        rec.raw = NULL;
+        rec.rawLen = 0;
+        if(tag & ITF_LOG_TAG_EDGE){
+            int hallCode = (tag >> 5) & 3;
+            int8_t prev = itf_logHallIndex[st.hall & 7];
+            if(hallCode == 3){
+                if(p >= end) return -1;
+                st.hall = *p++;
+            }else if(hallCode != 0){
+                if(prev < 0) return -1;
+                st.hall = itf_logHallSeq[(prev + ((hallCode == 1) ? 1 : 5)) % 6];
+            }
+            if(!itf_logGetVarint(&p, end, &v)) return -1;
+            st.last_us += itf_logUnzigzag(v);
+            for(i=0;i<3;i++){
+                if(tag & (1 << (4 - i))){
+                    if(!itf_logGetVarint(&p, end, &v)) return -1;
+                    st.cur[i] += (int32_t) itf_logUnzigzag(v);
+                }
+            }
+            tag = ITF_LOG_TAG_EDGE;
+        }else if(tag == ITF_LOG_TAG_LONG || tag == ITF_LOG_TAG_STATE || tag == ITF_LOG_TAG_RAW || tag == ITF_LOG_TAG_CMD || tag == ITF_LOG_TAG_TRACE){
+            if(!itf_logGetVarint(&p, end, &v)) return -1;
+            st.last_us += itf_logUnzigzag(v);
+            if(tag == ITF_LOG_TAG_LONG){
+                for(i=0;i<longFields;i++){
+                    if(!itf_logGetVarint(&p, end, &v)) return -1;
+                    st.lng[i] += (int32_t) itf_logUnzigzag(v);
+                }
+            }else if(tag == ITF_LOG_TAG_STATE){
+                if(p >= end) return -1;
+                st.status = *p++;
+            }else if(tag == ITF_LOG_TAG_CMD){
+                if(end - p < 2) return -1;
+                rec.cmd = *p++;
+                rec.cmdResult = *p++;
+                if(!itf_logGetVarint(&p, end, &v)) return -1;
+                rec.cmdValue = (int32_t) itf_logUnzigzag(v);
+            }else if(tag == ITF_LOG_TAG_TRACE){
+                if(!itf_logGetVarint(&p, end, &v) || p >= end) return -1;
+                rec.traceId = (uint16_t) v;
+                v = 4*(uint64_t) *p++;
+                if(v > (uint64_t) (end - p)) return -1;
+                rec.raw = p;
+                rec.rawLen = (int) v;
+                p += v;
+            }else{
+                if(!itf_logGetVarint(&p, end, &v) || v > (uint64_t) (end - p)) return -1;
+                rec.raw = p;
+                rec.rawLen = (int) v;
+                p += v;
+            }
+        }else{
+            return -1;
+        }
+        rec.tag = tag;
+        rec.time_us = st.last_us;
+        rec.hall = st.hall;
+        rec.status = (uint8_t) st.status;
+        memcpy(rec.cur, st.cur, sizeof(rec.cur));
+        memcpy(rec.lng, st.lng, sizeof(rec.lng));
+        if(fn != NULL){
+            fn(&rec, ctx);
+        }
+        count++;
+    }
+    return count;
+}
+
+static int64_t itf_logNow_us(void){
+    #ifdef ESP_PLATFORM
+        return esp_timer_get_time();
+    #else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ((int64_t) ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+    #endif
+}
+
+#define ITF_LOG_BENCH_BLOCK (16*1024)
+
+//Synthetic drive: ~1500 edges/s with noisy 20 A phase currents and a long record every 100 ms.
+//Prints encode time per record, bytes per edge (old format: 16) and bytes per minute at that rate.
+void itf_logCodecBenchmark(int records){
+    static uint8_t block[ITF_LOG_BENCH_BLOCK];
+    itf_logState_t st;
+    itf_logEdge_t e;
+    itf_logLong_t l;
+    uint64_t t = 0;
+    uint32_t seed = 12345;
+    int used = 0, hallIdx = 0, edges = 0, longs = 0, blocks = 1;
+    uint64_t bytes = 0, edgeBytes = 0, nextLong = 0;
+    int i;
+
+    memset(&e, 0, sizeof(e));
+    memset(&l, 0, sizeof(l));
+    used = itf_logEncodeBlockHeader(block, &st, t, 0);
+    int64_t start = itf_logNow_us();
+    for(i=0;i<records;i++){
+        seed = seed*1103515245u + 12345u;
+        if(used + ITF_LOG_LONG_MAX > ITF_LOG_BENCH_BLOCK){
+            itf_logSealBlock(block);
+            bytes += used;
+            used = itf_logEncodeBlockHeader(block, &st, t, blocks);
+            blocks++;
+        }
+        if(t >= nextLong){
+            nextLong += 100000;
+            l.time_us = t;
+            l.v[ITF_LOG_LONG_SPEED] = 2000 + (seed>>28);
+            l.v[ITF_LOG_LONG_INST_POWER] = 3000 + (seed>>24);
+            l.v[ITF_LOG_LONG_AVG_POWER] = 3000;
+            l.v[ITF_LOG_LONG_VOLTS] = 4800 - (seed>>29);
+            l.v[ITF_LOG_LONG_CURRENT] = 600 + (seed>>26);
+            l.v[ITF_LOG_LONG_THROTTLE] = 2048;
+            l.v[ITF_LOG_LONG_DUTY] = 2048;
+            used += itf_logEncodeLong(block + used, &st, &l);
+            itf_logFinishRecord(block, &st, used);
+            longs++;
+        }else{
+            t += 600 + (seed>>27);
+            hallIdx = (hallIdx + 1) % 6;
+            e.time_us = t;
+            e.hall = itf_logHallSeq[hallIdx];
+            e.cur[0] = 2000 + (int32_t) ((seed>>8) & 63) - 32;
+            e.cur[1] = -1000 + (int32_t) ((seed>>14) & 63) - 32;
+            e.cur[2] = -1000 + (int32_t) ((seed>>20) & 63) - 32;
+            int n = itf_logEncodeEdge(block + used, &st, &e);
+            used += n;
+            itf_logFinishRecord(block, &st, used);
+            edgeBytes += n;
+            edges++;
+        }
+    }
+    itf_logSealBlock(block);
+    int64_t elapsed = itf_logNow_us() - start;
+    bytes += used;
+    if(elapsed < 1) { elapsed = 1; }
+    if(edges < 1) { edges = 1; }
+    double bytesPerMin = ((double) bytes)*60e6/((double) t + 1);
+    #ifdef ESP_PLATFORM
+        printf("log_bench records=%d edges=%d longs=%d blocks=%d bytes=%llu us=%lld cycles_per_record=%.0f\n", records, edges, longs,
+               blocks, (unsigned long long) bytes, (long long) elapsed, ((double) elapsed)*CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ/records);
+    #else
+        printf("log_bench records=%d edges=%d longs=%d blocks=%d bytes=%llu us=%lld ns_per_record=%.1f\n", records, edges, longs,
+               blocks, (unsigned long long) bytes, (long long) elapsed, ((double) elapsed)*1000.0/records);
+    #endif
+    printf("log_bench bytes_per_edge=%.2f old_bytes_per_edge=16 bytes_per_min=%.0f old_bytes_per_min=%.0f\n",
+           ((double) edgeBytes)/edges, bytesPerMin, (16.0*edges + 25.0*longs)*60e6/((double) t + 1));
+}
@@ -0,0 +1,180 @@
+#ifndef ITF_LOG_CODEC_H_
+#define ITF_LOG_CODEC_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Binary log container (the S<session>_<part>.BIN files, see itf_sd_session.h). The file is a run of fixed size blocks (ITF_SD_BLOCK_SIZE):
+//  block 0        file header: "ITFLOGv1", block size, schema ID, open time, the field schema as
+//                 text (itf_logSchemaText) and a CRC-32 over all of it
+//  blocks 1..n    data blocks, each a 32 byte header then whole records, zero padded
+//  last block     time index, written when the file is closed (missing after a power cut)
+//
+//Data block header (little endian):
+//  "ITFB", seq u32, base time u64 (us since boot), end time offset u32, record count u16,
+//  schema ID u16, data length u32, CRC-32 u32 (over the header with this field zero, then the data)
+//Each data block decodes on its own: the delta state is reset at the header, so a damaged block
+//costs only its own records.
+//
+//Record tag byte:
+//  1 hh ccc 00   Hall edge. hh: 0 same hall state, 1 one step forward, 2 one step back, 3 explicit
+//                (hall byte follows). ccc: phase A/B/C current changed (delta follows).
+//                Then zig-zag varint dt, then a zig-zag varint delta per changed current (10 mA).
+//  0x41          Long record: dt, then a zig-zag varint delta for each ITF_LOG_LONG_* field.
+//  0x42          Status change: dt, then (shutdown<<7)|error. Only written when it changes, so
+//                edges and long records don't repeat it.
+//  0x43          Raw bytes from itf_addToSD: varint length, then the bytes.
+//  0x44          Command (schema 2): dt, command byte (ITF_LOG_CMD_*), setter result, zig-zag varint value.
+//  0x45          Trace message (schema 3, itf_trace.h): dt, varint message ID, argument count, then
+//                the argument words as u32. The formats are in itf_trace_ids.h, not in the file.
+//dt is the time since the previous record in the block (the base time for the first one).
+//
+//Index block: "ITFX", entry count u32, stride u32, last data block u32, 12 reserved bytes,
+//CRC-32 u32, then entries of {block number u32, base time u64}, one every stride data blocks.
+
+#define ITF_LOG_SCHEMA_ID 3            //1: no duty field in long records, no command records. 2: no trace records
+#define ITF_LOG_FILE_MAGIC "ITFLOGv1"
+#define ITF_LOG_BLOCK_HEADER_LEN 32
+#define ITF_LOG_INDEX_HEADER_LEN 32
+#define ITF_LOG_INDEX_ENTRY_LEN 12
+#define ITF_LOG_EDGE_MAX 40         //Including a status change record
+#define ITF_LOG_LONG_MAX 72
+#define ITF_LOG_RAW_OVERHEAD 16    //Tag, dt and length
+#define ITF_LOG_CMD_MAX 20
+#define ITF_LOG_TRACE_MAX 32        //Four argument words
+
+#define ITF_LOG_TAG_END   0x00
+#define ITF_LOG_TAG_EDGE  0x80
+#define ITF_LOG_TAG_LONG  0x41
+#define ITF_LOG_TAG_STATE 0x42
+#define ITF_LOG_TAG_RAW   0x43
+#define ITF_LOG_TAG_CMD   0x44
+#define ITF_LOG_TAG_TRACE 0x45
+
+//Command records: what the setters in ctrl_subsystem.c were asked to do, so a log can be replayed
+#define ITF_LOG_CMD_THROTTLE  'T'  //ctrl_setThrottle, 0-4096
+#define ITF_LOG_CMD_SPEED     'S'  //ctrl_setSpeedControl, mph x100 (0: ctrl_turnOffSpeedControl)
+#define ITF_LOG_CMD_DIRECTION 'D'  //ctrl_setDirection
+#define ITF_LOG_CMD_THROTTLE_MODE 'M'  //ctrl_setThrottleMode, ctrl_THROTTLE_MODE_*
+#define ITF_LOG_CMD_AUTOTUNE  'A'  //ctrl_startAutotune, mph x100 (0: every band), -1: ctrl_stopAutotune
+#define ITF_LOG_CMD_SPEED_KP  'P'  //ctrl_setSpeedKp, band << 24 | kp x100
+#define ITF_LOG_CMD_SPEED_KI  'I'  //ctrl_setSpeedKi, band << 24 | ki x100
+#define ITF_LOG_CMD_PARAM     'R'  //ctrl_setParam, index << 24 | value x100
+
+//Long record fields, same scaling as the old 25 byte record
+enum {
+    ITF_LOG_LONG_SPEED = 0,     //mph x100
+    ITF_LOG_LONG_INST_POWER,    //W x10
+    ITF_LOG_LONG_AVG_POWER,     //W x10
+    ITF_LOG_LONG_VOLTS,         //V x100
+    ITF_LOG_LONG_CURRENT,       //A x100
+    ITF_LOG_LONG_TEMP_A,        //x100
+    ITF_LOG_LONG_TEMP_B,
+    ITF_LOG_LONG_TEMP_C,
+    ITF_LOG_LONG_THROTTLE,      //0-4096
+    ITF_LOG_LONG_DUTY,          //ctrl_getDutyCommand(), 0-4095 (schema 2)
+    ITF_LOG_LONG_FIELDS
+};
+#define ITF_LOG_LONG_FIELDS_V1 9    //Schema 1 long records end at the throttle
+
+typedef struct {
+    uint64_t time_us;
+    uint8_t hall;
+    uint8_t status;             //(shutdown<<7) | error code
+    int32_t cur[3];             //Phase currents, 10 mA
+} itf_logEdge_t;
+
+typedef struct {
+    uint64_t time_us;
+    uint8_t status;
+    int32_t v[ITF_LOG_LONG_FIELDS];
+} itf_logLong_t;
+
+//Delta state shared by the encoder and the decoder (reset at every block header)
+typedef struct {
+    uint64_t base_us;
+    uint64_t last_us;
+    uint64_t max_us;
+    uint16_t count;             //Records in the block so far
+    uint8_t hall;
+    uint16_t status;            //0xFFFF until the first status record of the block
+    int32_t cur[3];
+    int32_t lng[ITF_LOG_LONG_FIELDS];
+} itf_logState_t;
+
+extern const char itf_logSchemaText[];
+
+//Fills out (one whole block, zeroed by the caller) with the file header, returns the bytes used
+int itf_logEncodeFileHeader(uint8_t* out, int blockSize, uint64_t open_us);
+
+//Encoders write at most the *_MAX size and return the number of bytes written
+int itf_logEncodeBlockHeader(uint8_t* out, itf_logState_t* st, uint64_t base_us, uint32_t seq);
+int itf_logEncodeEdge(uint8_t* out, itf_logState_t* st, const itf_logEdge_t* e);
+int itf_logEncodeLong(uint8_t* out, itf_logState_t* st, const itf_logLong_t* r);
+int itf_logEncodeRaw(uint8_t* out, itf_logState_t* st, uint64_t time_us, const void* data, int len);
+int itf_logEncodeCommand(uint8_t* out, itf_logState_t* st, uint64_t time_us, uint8_t cmd, uint8_t result, int32_t value);
+int itf_logEncodeTrace(uint8_t* out, itf_logState_t* st, uint64_t time_us, uint16_t id, const uint32_t* args, int n);
+//After each record: stores count, end time and data length (block bytes used) in the header
+void itf_logFinishRecord(uint8_t* block, const itf_logState_t* st, int used);
+//Once the block is complete: fills in the CRC
+void itf_logSealBlock(uint8_t* block);
+uint64_t itf_logBlockBase(const uint8_t* block);
+
+typedef struct {
+    uint32_t seq;
+    uint64_t base_us;
+    uint64_t end_us;
+    uint16_t count;
+    uint16_t schema;
+    uint32_t dataLen;
+} itf_logBlockInfo_t;
+
+typedef struct {
+    uint32_t blockSize;
+    uint16_t schema;
+    uint64_t open_us;
+    const char* schemaText;
+    int schemaLen;
+} itf_logFileInfo_t;
+
+//1 for a good data block, 0 if it isn't one, -1 if the header looks right but the CRC fails
+int itf_logParseBlockHeader(const uint8_t* block, int len, itf_logBlockInfo_t* info);
+//0 for a good file header, -1 otherwise
+int itf_logParseFileHeader(const uint8_t* buf, int len, itf_logFileInfo_t* info);
+
+//Index block, built up in RAM while the file is written. When it fills, every other entry is
+//dropped and the stride doubles, so it always covers the whole file.
+void itf_logIndexInit(uint8_t* index);
+void itf_logIndexAdd(uint8_t* index, int blockSize, uint32_t blockNo, uint64_t base_us);
+int itf_logIndexSeal(uint8_t* index);                //Returns the bytes used
+//Entry count if index is a good index block, -1 otherwise
+int itf_logParseIndex(const uint8_t* index, int len, uint32_t* stride, uint32_t* lastBlock);
+void itf_logIndexEntry(const uint8_t* index, int i, uint32_t* blockNo, uint64_t* base_us);
+
+//One decoded record. Edge, long and status records carry the full current state.
+typedef struct {
+    uint8_t tag;
+    uint64_t time_us;
+    uint8_t hall;
+    uint8_t status;
+    int32_t cur[3];
+    int32_t lng[ITF_LOG_LONG_FIELDS];
+    const uint8_t* raw;
+    int rawLen;
+    uint8_t cmd;                //Command records only
+    uint8_t cmdResult;
+    int32_t cmdValue;
+    uint16_t traceId;           //Trace records only: the argument words are in raw (rawLen = 4 per word)
+} itf_logRecord_t;
+
+typedef void (*itf_logRecordFn)(const itf_logRecord_t* rec, void* ctx);
+
+//Decodes one data block, calling fn for every record. Returns the record count, or -1 if the block
+//isn't a good data block (bad CRC included) or a record runs past the data (records before that
+//are still reported).
+int itf_logDecodeBlock(const uint8_t* block, int len, itf_logRecordFn fn, void* ctx);
+
+//Prints encode time per record and bytes per edge for a synthetic drive
+void itf_logCodecBenchmark(int records);
+
+#endif
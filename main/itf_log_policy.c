@@ -0,0 +1,328 @@
+//Logging policy: which records go to the SD log ring, and when.
+//
+//Edges are decided in the hall ISR, the long record on the control tick. Both streams share one
+//short critical section for their counters and budgets; the records themselves are encoded outside it.
+//Budgets are token buckets refilled on the tick: a record is let through while the bucket is above
+//zero and its real encoded size is taken off afterwards, so a stream can overshoot by one record.
+//
+//Pre-trigger capture: samples that were skipped because of the normal rate or the budget are kept
+//in two small rings (ITF_LOG_PRETRIG_MS deep). When a trigger fires they are written with their own
+//timestamps, so in the file they follow records that are newer than them (the decoder sorts by time).
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "ctrl_subsystem.h"
+#include "itf_log_codec.h"
+#include "itf_log_policy.h"
+#include "itf_sd_card_writer.h"
+#include "itf_master_defines.h"
+
+#ifndef ITF_SD_DEFINES
+    #define ITF_LOG_EDGE_INTERVAL_US 0
+    #define ITF_LOG_EDGE_TRIG_INTERVAL_US 0
+    #define ITF_LOG_EDGE_BUDGET_BPS (32*1024)
+    #define ITF_LOG_LONG_INTERVAL_US 100000
+    #define ITF_LOG_LONG_TRIG_INTERVAL_US 10000
+    #define ITF_LOG_LONG_BUDGET_BPS (4*1024)
+    #define ITF_LOG_TRIGGER_HOLD_MS 2000
+    #define ITF_LOG_PRETRIG_MS 500
+    #define ITF_LOG_PRETRIG_EDGES 64
+    #define ITF_LOG_PRETRIG_LONGS 50
+    #define ITF_LOG_THROTTLE_STEP 512
+#endif
+
+typedef struct {
+    itf_logStreamCfg_t cfg;
+    itf_logStreamStats_t stats;
+    int32_t tokens;                 //Bytes left in the budget
+    uint64_t last_us;               //Last record written
+    uint64_t windowBytes;           //stats.bytes at the start of the bandwidth window
+} itf_logStreamState_t;
+
+static portMUX_TYPE itf_logPolicyMux = portMUX_INITIALIZER_UNLOCKED;
+
+static itf_logStreamState_t itf_logStreams[ITF_LOG_STREAMS] = {
+    [ITF_LOG_STREAM_EDGE] = { .cfg = { ITF_LOG_EDGE_INTERVAL_US, ITF_LOG_EDGE_TRIG_INTERVAL_US, ITF_LOG_EDGE_BUDGET_BPS },
+                              .tokens = ITF_LOG_EDGE_BUDGET_BPS },
+    [ITF_LOG_STREAM_LONG] = { .cfg = { ITF_LOG_LONG_INTERVAL_US, ITF_LOG_LONG_TRIG_INTERVAL_US, ITF_LOG_LONG_BUDGET_BPS },
+                              .tokens = ITF_LOG_LONG_BUDGET_BPS },
+};
+
+static uint64_t itf_logTrigUntil_us = 0;
+static uint32_t itf_logTriggers = 0;
+static uint8_t itf_logLastCause = ITF_LOG_TRIG_NONE;
+static uint64_t itf_logLastTrigger_us = 0;
+static uint64_t itf_logWindow_us = 0;       //Time into the current 1 s bandwidth window
+static volatile uint8_t itf_logTrigPending = ITF_LOG_TRIG_NONE;    //From itf_logPolicyTrigger, fired on the next tick
+
+//Held back samples, oldest at tail. Edges are added from the ISR, so they are under the lock.
+static itf_logEdge_t itf_logPreEdge[ITF_LOG_PRETRIG_EDGES];
+static int itf_logPreEdgeHead = 0, itf_logPreEdgeCount = 0;
+static itf_logLong_t itf_logPreLong[ITF_LOG_PRETRIG_LONGS];
+static int itf_logPreLongHead = 0, itf_logPreLongCount = 0;
+static uint64_t itf_logLongNext_us = 0;     //When the next trigger rate long sample is due
+
+//Last command logged per ITF_LOG_CMD_* letter, so repeats of the same setter call are skipped
+static int32_t itf_logCmdValue['Z' - 'A' + 1];
+static int16_t itf_logCmdResult['Z' - 'A' + 1];
+
+//Trigger detection state (control task only)
+static uint8_t itf_logLastError = 0;
+static uint16_t itf_logLastThrottle = 0;
+static int itf_logLastSpeedCtrl = 0;
+static int itf_logLastArmed = 0;
+
+const char* itf_logStreamName(int stream){
+    switch(stream){
+        case ITF_LOG_STREAM_EDGE: return "edge";
+        case ITF_LOG_STREAM_LONG: return "long";
+        default:                  return "?";
+    }
+}
+
+//Call with the lock held. Returns 1 if a record is due now and fits the budget.
+static int itf_logAdmit(itf_logStreamState_t* s, uint64_t now, int active){
+    uint32_t interval = active ? s->cfg.trigInterval_us : s->cfg.interval_us;
+    if(interval != 0 && s->stats.records != 0 && now - s->last_us < interval){
+        s->stats.skippedRate++;
+        return 0;
+    }
+    if(s->cfg.budget_Bps != 0 && s->tokens <= 0){
+        s->stats.skippedBudget++;
+        return 0;
+    }
+    return 1;
+}
+
+//Call with the lock held, after the record went to the ring (bytes 0: the ring dropped it)
+static void itf_logAccount(itf_logStreamState_t* s, uint64_t now, int bytes){
+    if(bytes <= 0){
+        s->stats.dropped++;
+        return;
+    }
+    s->stats.records++;
+    s->stats.bytes += bytes;
+    s->tokens -= bytes;
+    s->last_us = now;
+}
+
+void itf_logPolicyEdge(void){
+    itf_logEdge_t e;
+    itf_logStreamState_t* s = &itf_logStreams[ITF_LOG_STREAM_EDGE];
+
+    itf_captureShortData(&e);
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    int active = e.time_us < itf_logTrigUntil_us;
+    if(!itf_logAdmit(s, e.time_us, active)){
+        if(!active){
+            itf_logPreEdge[itf_logPreEdgeHead] = e;
+            itf_logPreEdgeHead = (itf_logPreEdgeHead + 1) % ITF_LOG_PRETRIG_EDGES;
+            if(itf_logPreEdgeCount < ITF_LOG_PRETRIG_EDGES){
+                itf_logPreEdgeCount++;
+            }
+        }
+        portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+        return;
+    }
+    s->last_us = e.time_us;     //Claim the slot before unlocking so a nested edge sees it
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+
+    int bytes = itf_logEdgeRecord(&e);
+
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    itf_logAccount(s, e.time_us, bytes);
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+}
+
+//Writes the held back samples no older than ITF_LOG_PRETRIG_MS, oldest first
+static void itf_logWritePreTrigger(uint64_t now){
+    static itf_logEdge_t edges[ITF_LOG_PRETRIG_EDGES];
+    int i, n, bytes;
+    uint64_t oldest = (now > ITF_LOG_PRETRIG_MS*1000ULL) ? now - ITF_LOG_PRETRIG_MS*1000ULL : 0;
+
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    n = itf_logPreEdgeCount;
+    for(i=0;i<n;i++){
+        edges[i] = itf_logPreEdge[(itf_logPreEdgeHead + ITF_LOG_PRETRIG_EDGES - n + i) % ITF_LOG_PRETRIG_EDGES];
+    }
+    itf_logPreEdgeCount = 0;
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+
+    for(i=0;i<n;i++){
+        if(edges[i].time_us >= oldest){
+            bytes = itf_logEdgeRecord(&edges[i]);
+            portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+            itf_logStreams[ITF_LOG_STREAM_EDGE].stats.preTrigger += (bytes > 0);
+            itf_logStreams[ITF_LOG_STREAM_EDGE].stats.bytes += bytes;
+            itf_logStreams[ITF_LOG_STREAM_EDGE].tokens -= bytes;
+            portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+        }
+    }
+
+    n = itf_logPreLongCount;
+    for(i=0;i<n;i++){
+        itf_logLong_t* r = &itf_logPreLong[(itf_logPreLongHead + ITF_LOG_PRETRIG_LONGS - n + i) % ITF_LOG_PRETRIG_LONGS];
+        if(r->time_us >= oldest){
+            bytes = itf_logLongRecord(r);
+            portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+            itf_logStreams[ITF_LOG_STREAM_LONG].stats.preTrigger += (bytes > 0);
+            itf_logStreams[ITF_LOG_STREAM_LONG].stats.bytes += bytes;
+            itf_logStreams[ITF_LOG_STREAM_LONG].tokens -= bytes;
+            portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+        }
+    }
+    itf_logPreLongCount = 0;
+}
+
+void itf_logPolicyCommand(uint8_t cmd, int32_t value, uint8_t result){
+    int i = cmd - 'A', log;
+    if(i < 0 || i > 'Z' - 'A'){
+        return;
+    }
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    //Results are kept +1, so 0 means nothing logged yet
+    log = (itf_logCmdResult[i] != result + 1) || (itf_logCmdValue[i] != value);
+    itf_logCmdResult[i] = result + 1;
+    itf_logCmdValue[i] = value;
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+    if(log && itf_logCommandRecord(ctrl_getTime(), cmd, result, value) == 0){
+        itf_logCmdResult[i] = 0;    //Dropped by a full ring: log the next call again
+    }
+}
+
+void itf_logPolicyTrigger(uint8_t cause){
+    itf_logTrigPending = cause;
+}
+
+static void itf_logFire(uint8_t cause, uint64_t now){
+    uint8_t marker[4] = { 'T', 'R', 'G', cause };
+    int wasActive = now < itf_logTrigUntil_us;
+
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    itf_logTrigUntil_us = now + ITF_LOG_TRIGGER_HOLD_MS*1000ULL;
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+    itf_logTriggers++;
+    itf_logLastCause = cause;
+    itf_logLastTrigger_us = now;
+    itf_addToSD((char*) marker, sizeof(marker));
+    //While a trigger is active nothing is held back, so only the first one has anything to write
+    if(!wasActive){
+        itf_logWritePreTrigger(now);
+    }
+}
+
+//Long record: sampled at the trigger rate all the time, written at the rate that applies now
+static void itf_logPolicyLong(uint64_t now, int active){
+    itf_logStreamState_t* s = &itf_logStreams[ITF_LOG_STREAM_LONG];
+    itf_logLong_t r;
+
+    if(now < itf_logLongNext_us){
+        return;
+    }
+    itf_logLongNext_us = now + s->cfg.trigInterval_us;
+    itf_captureLongData(&r);
+
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    int admit = itf_logAdmit(s, now, active);
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+    if(!admit){
+        if(!active){
+            itf_logPreLong[itf_logPreLongHead] = r;
+            itf_logPreLongHead = (itf_logPreLongHead + 1) % ITF_LOG_PRETRIG_LONGS;
+            if(itf_logPreLongCount < ITF_LOG_PRETRIG_LONGS){
+                itf_logPreLongCount++;
+            }
+        }
+        return;
+    }
+    int bytes = itf_logLongRecord(&r);
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    itf_logAccount(s, now, bytes);
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+}
+
+void itf_logPolicyTick(uint32_t tick_us){
+    uint64_t now = ctrl_getTime();
+    int i;
+
+    //Triggers
+    uint8_t error = ctrl_getErrorCode();
+    uint16_t throttle = (uint16_t) ctrl_getThrottle();
+    int speedCtrl = ctrl_isUsingSpeedControl();
+    if(error != 0 && error != itf_logLastError){
+        itf_logFire(ITF_LOG_TRIG_FAULT, now);
+    }else if(speedCtrl != itf_logLastSpeedCtrl){
+        itf_logFire(ITF_LOG_TRIG_SPEED_CTRL, now);
+    }else if(throttle >= itf_logLastThrottle + ITF_LOG_THROTTLE_STEP || throttle + ITF_LOG_THROTTLE_STEP <= itf_logLastThrottle){
+        itf_logFire(ITF_LOG_TRIG_THROTTLE, now);
+    }else if(itf_logTrigPending != ITF_LOG_TRIG_NONE){
+        itf_logFire(itf_logTrigPending, now);
+    }
+    itf_logTrigPending = ITF_LOG_TRIG_NONE;
+    itf_logLastError = error;
+    itf_logLastThrottle = throttle;
+    itf_logLastSpeedCtrl = speedCtrl;
+
+    //Each run gets its own session files
+    int armed = ctrl_isArmed();
+    if(armed && !itf_logLastArmed){
+        itf_sdRequest(ITF_SD_REQ_SESSION);
+    }
+    itf_logLastArmed = armed;
+
+    itf_logPolicyLong(now, now < itf_logTrigUntil_us);
+
+    //Budgets and bandwidth
+    itf_logWindow_us += tick_us;
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    for(i=0;i<ITF_LOG_STREAMS;i++){
+        itf_logStreamState_t* s = &itf_logStreams[i];
+        if(s->cfg.budget_Bps != 0){
+            s->tokens += (int32_t) (((uint64_t) s->cfg.budget_Bps*tick_us)/1000000);
+            if(s->tokens > (int32_t) s->cfg.budget_Bps){
+                s->tokens = s->cfg.budget_Bps;
+            }
+        }
+        if(itf_logWindow_us >= 1000000){
+            s->stats.bytesPerSec = (uint32_t) ((s->stats.bytes - s->windowBytes)*1000000/itf_logWindow_us);
+            s->windowBytes = s->stats.bytes;
+            if(s->stats.bytesPerSec > s->stats.peakBytesPerSec){
+                s->stats.peakBytesPerSec = s->stats.bytesPerSec;
+            }
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+    if(itf_logWindow_us >= 1000000){
+        itf_logWindow_us = 0;
+    }
+}
+
+int itf_logPolicySetStream(int stream, const itf_logStreamCfg_t* cfg){
+    if(stream < 0 || stream >= ITF_LOG_STREAMS){
+        return 0;
+    }
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    itf_logStreams[stream].cfg = *cfg;
+    itf_logStreams[stream].tokens = cfg->budget_Bps;
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+    return 1;
+}
+
+void itf_logPolicyGetStream(int stream, itf_logStreamCfg_t* cfg){
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    *cfg = itf_logStreams[stream].cfg;
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+}
+
+void itf_logPolicyGetStats(itf_logPolicyStats_t* stats){
+    int i;
+    portENTER_CRITICAL_SAFE(&itf_logPolicyMux);
+    for(i=0;i<ITF_LOG_STREAMS;i++){
+        stats->stream[i] = itf_logStreams[i].stats;
+    }
+    portEXIT_CRITICAL_SAFE(&itf_logPolicyMux);
+    stats->triggers = itf_logTriggers;
+    stats->lastCause = itf_logLastCause;
+    stats->lastTrigger_us = itf_logLastTrigger_us;
+    stats->active = ctrl_getTime() < itf_logTrigUntil_us;
+}
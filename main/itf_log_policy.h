@@ -0,0 +1,65 @@
+#ifndef ITF_LOG_POLICY_H_
+#define ITF_LOG_POLICY_H_
+
+#include <stdint.h>
+
+//Decides what goes in the SD log and how often. Hall edges are offered by ctrl_hall_isr, the slow
+//values are sampled on the control tick (so they keep logging with the wheel stopped). Each stream
+//has a normal interval, a faster one while a trigger is active, and a byte budget. When a trigger
+//fires (fault, throttle step, speed control on/off) the samples held back just before it are written too.
+
+typedef enum {
+    ITF_LOG_STREAM_EDGE = 0,        //One record per hall edge
+    ITF_LOG_STREAM_LONG,            //Speed, power, volts, temps, throttle
+    ITF_LOG_STREAMS
+} itf_logStream_t;
+
+enum {
+    ITF_LOG_TRIG_NONE = 0,
+    ITF_LOG_TRIG_FAULT,
+    ITF_LOG_TRIG_THROTTLE,          //Throttle moved ITF_LOG_THROTTLE_STEP or more in one tick
+    ITF_LOG_TRIG_SPEED_CTRL,        //Speed control turned on or off
+    ITF_LOG_TRIG_MANUAL             //"log trigger" on the PC console
+};
+
+typedef struct {
+    uint32_t interval_us;           //Shortest time between records (0: every edge / every tick)
+    uint32_t trigInterval_us;       //Same, while a trigger is active
+    uint32_t budget_Bps;            //Bytes per second the stream may average (0: no limit), 1 s burst
+} itf_logStreamCfg_t;
+
+typedef struct {
+    uint32_t records;
+    uint64_t bytes;
+    uint32_t skippedRate;           //Not due yet
+    uint32_t skippedBudget;         //Due, but the stream was out of budget
+    uint32_t dropped;               //Accepted by the policy, dropped by a full log ring
+    uint32_t preTrigger;            //Held back samples written when a trigger fired
+    uint32_t bytesPerSec;           //Over the last whole second
+    uint32_t peakBytesPerSec;
+} itf_logStreamStats_t;
+
+typedef struct {
+    itf_logStreamStats_t stream[ITF_LOG_STREAMS];
+    uint32_t triggers;
+    uint8_t lastCause;
+    uint64_t lastTrigger_us;
+    int active;                     //A trigger is holding the fast rates right now
+} itf_logPolicyStats_t;
+
+//From ctrl_hall_isr on every edge
+void itf_logPolicyEdge(void);
+//From the control task once per tick, armed or not
+void itf_logPolicyTick(uint32_t tick_us);
+//From the ctrl_subsystem.c setters (any task, or the direction switch ISR). Every call that changes the
+//value or the result is logged, whatever the stream budgets, so the log can be replayed (tools/host/log_replay.c).
+void itf_logPolicyCommand(uint8_t cmd, int32_t value, uint8_t result);
+//Raises the rates for ITF_LOG_TRIGGER_HOLD_MS and writes the pre-trigger samples on the next tick
+void itf_logPolicyTrigger(uint8_t cause);
+
+int itf_logPolicySetStream(int stream, const itf_logStreamCfg_t* cfg);
+void itf_logPolicyGetStream(int stream, itf_logStreamCfg_t* cfg);
+void itf_logPolicyGetStats(itf_logPolicyStats_t* stats);
+const char* itf_logStreamName(int stream);
+
+#endif
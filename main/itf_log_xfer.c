@@ -0,0 +1,418 @@
+//Log file download over UART0, frame format in itf_log_xfer.h.
+//
+//Two tasks share the chunk buffers: the reader task reads chunk n into slot n % ITF_XFER_BUFS as long
+//as the slot's old chunk has been acknowledged, the PC link task sends whatever has been read and
+//fits the window. Only the two counters (read so far, acknowledged) are shared, under one spinlock.
+//Acknowledgements are cumulative; a 'N' resends that one chunk, and without any progress for
+//ITF_XFER_RESEND_MS the oldest unacknowledged chunk goes out again (lost 'A', or the tail of the file).
+//Anything else printed on UART0 meanwhile just costs a resend; trace lines are held back (they
+//stay in the session log if that sink is on).
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "itf_crc.h"
+#include "itf_storage.h"
+#include "itf_sd_card_writer.h"
+#include "itf_console.h"
+#include "itf_trace.h"
+#include "itf_master_defines.h"
+#include "itf_log_xfer.h"
+
+#ifndef ITF_XFER_DEFINES
+    #define ITF_XFER_CHUNK 1024
+    #define ITF_XFER_WINDOW 8
+    #define ITF_XFER_BUFS 16
+    #define ITF_XFER_DEFAULT_BAUD 921600
+    #define ITF_XFER_MAX_BAUD 3000000
+    #define ITF_XFER_READY_MS 1000
+    #define ITF_XFER_RESEND_MS 250
+    #define ITF_XFER_IDLE_MS 3000
+#endif
+
+#define ITF_XFER_NAME_MAX 13        //8.3 name plus terminator
+#define ITF_XFER_END_TRIES 5
+
+static portMUX_TYPE itf_xferMux = portMUX_INITIALIZER_UNLOCKED;
+
+//Set up by itf_xferRequest, used by both tasks during the transfer
+static char itf_xferName[ITF_XFER_NAME_MAX];
+static itf_storageFile_t* itf_xferFile = NULL;
+static uint8_t* itf_xferBufs = NULL;
+static uint32_t itf_xferSize = 0;
+static uint32_t itf_xferChunks = 0;
+static int itf_xferBaud = 0;
+static int itf_xferArmed = 0;
+
+static volatile uint32_t itf_xferFilled = 0;    //Chunks read (reader task)
+static volatile uint32_t itf_xferAcked = 0;     //Chunks the PC has, their slots are free (PC link task)
+static volatile int itf_xferReading = 0;        //Reader may run; cleared to stop it
+static volatile int itf_xferReaderBusy = 0;     //Set when a transfer starts, cleared by the reader once it is off the file
+static volatile int itf_xferReadFailed = 0;
+static TaskHandle_t itf_xferReader = NULL;
+
+//PC link task state
+static uint32_t itf_xferNext = 0;               //Next chunk that hasn't been sent yet
+static int64_t itf_xferProgress_us = 0;         //Last time the window moved (or the resend timer restarted)
+static int64_t itf_xferHeard_us = 0;            //Last good frame from the PC
+static int itf_xferReady = 0;
+static int itf_xferEndAcked = 0;
+static int itf_xferAborted = 0;
+static uint8_t itf_xferTx[ITF_XFER_CHUNK + ITF_XFER_OVERHEAD];
+static uint8_t itf_xferRx[4*ITF_XFER_OVERHEAD];
+static int itf_xferRxLen = 0;
+
+static itf_xferStats_t itf_xferStats;
+
+static void itf_xferPut16(uint8_t* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void itf_xferPut32(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+static uint32_t itf_xferGet32(const uint8_t* p)   { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24); }
+
+//******************************* Frames
+int itf_xferFrame(uint8_t* out, uint8_t type, uint32_t seq, const void* payload, int len){
+    out[0] = ITF_XFER_MAGIC;
+    out[1] = type;
+    itf_xferPut32(out + 2, seq);
+    itf_xferPut16(out + 6, (uint16_t) len);
+    if(len > 0){
+        memcpy(out + ITF_XFER_HEADER_LEN, payload, len);
+    }
+    itf_xferPut32(out + ITF_XFER_HEADER_LEN + len, itf_crc32(ITF_CRC32_INIT, out + 1, ITF_XFER_HEADER_LEN - 1 + len));
+    return ITF_XFER_HEADER_LEN + len + 4;
+}
+
+int itf_xferScan(const uint8_t* buf, int len, int maxPayload, itf_xferFrame_t* frame, int* used){
+    int i;
+    if(len == 0){
+        *used = 0;
+        return 0;
+    }
+    if(buf[0] != ITF_XFER_MAGIC){
+        for(i=1;i<len && buf[i] != ITF_XFER_MAGIC;i++);
+        *used = i;
+        return -1;
+    }
+    if(len < ITF_XFER_HEADER_LEN){
+        return 0;
+    }
+    //A magic byte inside a payload (after a lost byte) rarely has a sensible header behind it
+    int plen = buf[6] | (buf[7] << 8);
+    *used = 1;
+    if(strchr("IDERANX", buf[1]) == NULL || buf[1] == '\0' || plen > maxPayload){
+        return -1;
+    }
+    if(len < ITF_XFER_OVERHEAD + plen){
+        return 0;
+    }
+    if(itf_crc32(ITF_CRC32_INIT, buf + 1, ITF_XFER_HEADER_LEN - 1 + plen) != itf_xferGet32(buf + ITF_XFER_HEADER_LEN + plen)){
+        return -2;
+    }
+    frame->type = buf[1];
+    frame->seq = itf_xferGet32(buf + 2);
+    frame->len = (uint16_t) plen;
+    frame->payload = buf + ITF_XFER_HEADER_LEN;
+    *used = ITF_XFER_OVERHEAD + plen;
+    return 1;
+}
+
+//******************************* Reader task
+static int itf_xferChunkLen(uint32_t seq){
+    uint32_t left = itf_xferSize - seq*ITF_XFER_CHUNK;
+    return (left < ITF_XFER_CHUNK) ? (int) left : ITF_XFER_CHUNK;
+}
+
+//Sleeps between transfers. Reads run at a lower priority than the SD writer, and FatFs serializes
+//them with its block writes, so the log keeps going at full rate during a download.
+static void itf_xferReadTask(void* params){
+    while(1){
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        if(!itf_xferReading){
+            continue;
+        }
+        while(itf_xferReading){
+            portENTER_CRITICAL(&itf_xferMux);
+            uint32_t seq = itf_xferFilled;
+            int room = (seq < itf_xferAcked + ITF_XFER_BUFS);
+            portEXIT_CRITICAL(&itf_xferMux);
+            if(seq == itf_xferChunks){
+                break;
+            }
+            if(!room){
+                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+                continue;
+            }
+            if(!itf_storage->read(itf_xferFile, itf_xferBufs + (seq % ITF_XFER_BUFS)*ITF_XFER_CHUNK, itf_xferChunkLen(seq))){
+                itf_xferReadFailed = 1;
+                break;
+            }
+            portENTER_CRITICAL(&itf_xferMux);
+            itf_xferFilled = seq + 1;
+            portEXIT_CRITICAL(&itf_xferMux);
+        }
+        itf_xferReaderBusy = 0;
+    }
+}
+
+//******************************* Console side
+int itf_xferRequest(const char* name, int baud){
+    uint32_t size;
+    int live;
+    if(itf_storage == NULL || !itf_storage->mounted()){
+        itf_consoleOut(" err=no_card");
+        return 0;
+    }
+    if(baud == 0){
+        baud = ITF_XFER_DEFAULT_BAUD;
+    }
+    if(baud < 9600 || baud > ITF_XFER_MAX_BAUD){
+        itf_consoleOut(" err=bad_baud max=%d", ITF_XFER_MAX_BAUD);
+        return 0;
+    }
+    int n = snprintf(itf_xferName, sizeof(itf_xferName), strchr(name, '.') ? "%s" : "%s.BIN", name);
+    if(n <= 0 || n >= (int) sizeof(itf_xferName)){
+        itf_consoleOut(" err=bad_name");
+        return 0;
+    }
+    itf_xferFile = itf_storage->openRead(itf_xferName);
+    if(itf_xferFile == NULL){
+        itf_consoleOut(" err=not_found name=%s", itf_xferName);
+        return 0;
+    }
+    //The file being written is preallocated, only what was synced is worth sending
+    live = itf_logLiveSize(itf_xferName, &size);
+    if(!live){
+        size = (uint32_t) itf_storage->size(itf_xferFile);
+    }
+    itf_xferBufs = heap_caps_malloc(ITF_XFER_BUFS*ITF_XFER_CHUNK, MALLOC_CAP_DMA);
+    if(itf_xferBufs == NULL){
+        itf_storage->close(itf_xferFile);
+        itf_xferFile = NULL;
+        itf_consoleOut(" err=no_mem");
+        return 0;
+    }
+    itf_xferSize = size;
+    itf_xferChunks = (size + ITF_XFER_CHUNK - 1)/ITF_XFER_CHUNK;
+    itf_xferBaud = baud;
+    itf_xferArmed = 1;
+    itf_consoleOut(" what=get name=%s size=%lu live=%d chunk=%d window=%d baud=%d", itf_xferName, (unsigned long) size,
+                   live, ITF_XFER_CHUNK, ITF_XFER_WINDOW, baud);
+    return 1;
+}
+
+int itf_xferPending(void){
+    return itf_xferArmed;
+}
+
+void itf_xferGetStats(itf_xferStats_t* stats){
+    *stats = itf_xferStats;
+}
+
+//******************************* PC link side
+static void itf_xferSendInfo(void){
+    uint8_t info[7 + ITF_XFER_NAME_MAX];
+    int nameLen = strlen(itf_xferName);
+    itf_xferPut32(info, itf_xferSize);
+    itf_xferPut16(info + 4, ITF_XFER_CHUNK);
+    info[6] = ITF_XFER_WINDOW;
+    memcpy(info + 7, itf_xferName, nameLen);
+    uart_write_bytes(UART_NUM_0, itf_xferTx, itf_xferFrame(itf_xferTx, ITF_XFER_INFO, 0, info, 7 + nameLen));
+}
+
+//seq must be acknowledged-or-later and already read (its slot still holds it)
+static void itf_xferSendData(uint32_t seq){
+    int len = itf_xferFrame(itf_xferTx, ITF_XFER_DATA, seq, itf_xferBufs + (seq % ITF_XFER_BUFS)*ITF_XFER_CHUNK, itf_xferChunkLen(seq));
+    uart_write_bytes(UART_NUM_0, itf_xferTx, len);
+}
+
+static void itf_xferHandle(const itf_xferFrame_t* f){
+    int64_t now = esp_timer_get_time();
+    itf_xferHeard_us = now;
+    switch(f->type){
+        case ITF_XFER_READY:
+            //Repeated until the info arrives, so a lost one is covered too
+            itf_xferReady = 1;
+            itf_xferSendInfo();
+            break;
+        case ITF_XFER_ACK:
+            if(f->seq == itf_xferChunks + 1){
+                itf_xferEndAcked = 1;
+            }else if(f->seq > itf_xferAcked && f->seq <= itf_xferNext){
+                portENTER_CRITICAL(&itf_xferMux);
+                itf_xferAcked = f->seq;
+                portEXIT_CRITICAL(&itf_xferMux);
+                itf_xferProgress_us = now;
+                xTaskNotifyGive(itf_xferReader);
+            }
+            break;
+        case ITF_XFER_NAK:
+            itf_xferStats.naks++;
+            if(f->seq >= itf_xferAcked && f->seq < itf_xferNext){
+                itf_xferSendData(f->seq);
+                itf_xferStats.resent++;
+            }
+            break;
+        case ITF_XFER_ABORT:
+            itf_xferAborted = 1;
+            break;
+    }
+}
+
+//Takes what the PC sent and acts on every complete frame. With wait > 0 it returns as soon as
+//one frame's worth of bytes is in.
+static void itf_xferPoll(TickType_t wait){
+    itf_xferFrame_t f;
+    int used, r;
+    int want = (wait > 0) ? ITF_XFER_OVERHEAD : (int) sizeof(itf_xferRx) - itf_xferRxLen;
+    if(want > (int) sizeof(itf_xferRx) - itf_xferRxLen){
+        want = (int) sizeof(itf_xferRx) - itf_xferRxLen;
+    }
+    int n = uart_read_bytes(UART_NUM_0, itf_xferRx + itf_xferRxLen, want, wait);
+    if(n > 0){
+        itf_xferRxLen += n;
+    }
+    while((r = itf_xferScan(itf_xferRx, itf_xferRxLen, 0, &f, &used)) != 0){
+        if(r > 0){
+            itf_xferHandle(&f);
+        }else if(r == -2){
+            itf_xferStats.badFrames++;
+        }
+        itf_xferRxLen -= used;
+        memmove(itf_xferRx, itf_xferRx + used, itf_xferRxLen);
+    }
+}
+
+//Keeps the window full until the PC has every chunk. Returns 0 on abort, read error or silence.
+static int itf_xferSendAll(void){
+    int stalled = 0;
+    itf_xferProgress_us = esp_timer_get_time();
+    while(itf_xferAcked < itf_xferChunks){
+        int64_t now;
+        int sent = 0;
+        if(itf_xferAborted || itf_xferReadFailed){
+            return 0;
+        }
+        portENTER_CRITICAL(&itf_xferMux);
+        uint32_t filled = itf_xferFilled;
+        portEXIT_CRITICAL(&itf_xferMux);
+        if(itf_xferNext < itf_xferAcked + ITF_XFER_WINDOW && itf_xferNext < itf_xferChunks){
+            if(itf_xferNext < filled){
+                if(itf_xferNext == itf_xferAcked){
+                    //Nothing was outstanding, so the PC had nothing to answer until now
+                    itf_xferProgress_us = itf_xferHeard_us = esp_timer_get_time();
+                }
+                itf_xferSendData(itf_xferNext++);
+                sent = 1;
+                stalled = 0;
+            }else if(!stalled){
+                itf_xferStats.readStalls++;
+                stalled = 1;
+            }
+        }
+        itf_xferPoll(sent ? 0 : 1);
+        now = esp_timer_get_time();
+        if(itf_xferNext > itf_xferAcked){
+            if(now - itf_xferHeard_us > ITF_XFER_IDLE_MS*1000LL){
+                return 0;
+            }
+            if(now - itf_xferProgress_us > ITF_XFER_RESEND_MS*1000LL){
+                itf_xferSendData(itf_xferAcked);
+                itf_xferStats.resent++;
+                itf_xferProgress_us = now;
+            }
+        }
+    }
+    return 1;
+}
+
+void itf_xferRun(void){
+    uint32_t oldBaud = 0;
+    int64_t start_us = 0;
+    int traceSinks = itf_traceGetSinks();
+    int i;
+    itf_xferArmed = 0;
+    itf_traceSetSinks(traceSinks & ~ITF_TRACE_SINK_UART);
+    memset(&itf_xferStats, 0, sizeof(itf_xferStats));
+    itf_xferStats.bytes = itf_xferSize;
+    itf_xferStats.chunks = itf_xferChunks;
+    itf_xferNext = 0;
+    itf_xferReady = itf_xferEndAcked = itf_xferAborted = 0;
+    itf_xferRxLen = 0;
+
+    //The reader fills the buffers while the PC switches baud
+    itf_xferFilled = 0;
+    itf_xferAcked = 0;
+    itf_xferReadFailed = 0;
+    itf_xferReaderBusy = 1;
+    itf_xferReading = 1;
+    if(itf_xferReader == NULL){
+        xTaskCreate(itf_xferReadTask, "XferTask", 1024*4, NULL, configMAX_PRIORITIES-3, &itf_xferReader);
+    }
+    xTaskNotifyGive(itf_xferReader);
+
+    uart_get_baudrate(UART_NUM_0, &oldBaud);
+    uart_wait_tx_done(UART_NUM_0, pdMS_TO_TICKS(100));
+    uart_set_baudrate(UART_NUM_0, itf_xferBaud);
+    uart_flush_input(UART_NUM_0);
+
+    itf_xferHeard_us = esp_timer_get_time();
+    while(!itf_xferReady && esp_timer_get_time() - itf_xferHeard_us < ITF_XFER_READY_MS*1000LL){
+        itf_xferPoll(1);
+    }
+    if(itf_xferReady){
+        start_us = esp_timer_get_time();
+        itf_xferStats.ok = itf_xferSendAll();
+    }
+    if(itf_xferStats.ok){
+        uint8_t end[16];
+        itf_xferStats.elapsed_us = (uint32_t) (esp_timer_get_time() - start_us);
+        itf_xferStats.bytesPerSec = (itf_xferStats.elapsed_us > 0) ?
+                                    (uint32_t) ((uint64_t) itf_xferSize*1000000/itf_xferStats.elapsed_us) : 0;
+        itf_xferPut32(end, itf_xferSize);
+        itf_xferPut32(end + 4, itf_xferStats.elapsed_us);
+        itf_xferPut32(end + 8, itf_xferStats.bytesPerSec);
+        itf_xferPut32(end + 12, itf_xferStats.resent);
+        for(i=0;i<ITF_XFER_END_TRIES && !itf_xferEndAcked && !itf_xferAborted;i++){
+            uart_write_bytes(UART_NUM_0, itf_xferTx, itf_xferFrame(itf_xferTx, ITF_XFER_END, itf_xferChunks, end, sizeof(end)));
+            int64_t sent_us = esp_timer_get_time();
+            while(!itf_xferEndAcked && !itf_xferAborted && esp_timer_get_time() - sent_us < ITF_XFER_RESEND_MS*1000LL){
+                itf_xferPoll(1);
+            }
+        }
+    }else if(itf_xferReady && !itf_xferAborted){
+        uart_write_bytes(UART_NUM_0, itf_xferTx, itf_xferFrame(itf_xferTx, ITF_XFER_ABORT, itf_xferNext, NULL, 0));
+    }
+
+    //Reader off the file before it is closed and the buffers go
+    itf_xferReading = 0;
+    xTaskNotifyGive(itf_xferReader);
+    while(itf_xferReaderBusy){
+        vTaskDelay(1);
+    }
+    itf_storage->close(itf_xferFile);
+    itf_xferFile = NULL;
+    heap_caps_free(itf_xferBufs);
+    itf_xferBufs = NULL;
+
+    uart_wait_tx_done(UART_NUM_0, pdMS_TO_TICKS(100));
+    uart_set_baudrate(UART_NUM_0, oldBaud);
+    uart_flush_input(UART_NUM_0);
+    itf_traceSetSinks(traceSinks);
+
+    itf_consoleOut("cmd=log what=get name=%s done=%d", itf_xferName, itf_xferStats.ok);
+    if(!itf_xferReady){
+        itf_consoleOut(" err=no_ready baud=%d", itf_xferBaud);
+    }else if(!itf_xferStats.ok){
+        itf_consoleOut(" err=%s", itf_xferAborted ? "aborted" : itf_xferReadFailed ? "read_failed" : "timeout");
+    }
+    itf_consoleOut(" bytes=%lu elapsed_ms=%lu Bps=%lu baud=%d resent=%lu naks=%lu bad_frames=%lu read_stalls=%lu",
+                   (unsigned long) itf_xferSize, (unsigned long) (itf_xferStats.elapsed_us/1000),
+                   (unsigned long) itf_xferStats.bytesPerSec, itf_xferBaud, (unsigned long) itf_xferStats.resent,
+                   (unsigned long) itf_xferStats.naks, (unsigned long) itf_xferStats.badFrames,
+                   (unsigned long) itf_xferStats.readStalls);
+    itf_consoleFlush();
+}
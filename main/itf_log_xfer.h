@@ -0,0 +1,69 @@
+#ifndef ITF_LOG_XFER_H_
+#define ITF_LOG_XFER_H_
+
+#include <stdint.h>
+
+//Log file download over the PC link (UART0), so logs can be pulled without taking the card out.
+//"log get <file> [baud]" answers with one console line, then UART0 switches to baud and carries
+//binary frames until the file is through, then goes back to the console baud:
+//  0xA5 type:u8 seq:u32 len:u16 payload crc:u32      little endian, CRC-32 over type..payload
+//Board -> PC
+//  'I' seq 0        size:u32 chunk:u16 window:u8 name    answer to 'R', the new baud works both ways
+//  'D' seq n        file bytes n*chunk .. n*chunk+len
+//  'E' seq chunks   bytes:u32 elapsed_us:u32 bytes_per_s:u32 resent:u32
+//PC -> board
+//  'R' seq 0        ready at the new baud (repeated until the 'I' arrives)
+//  'A' seq n        every chunk below n arrived; seq chunks+1 acknowledges the 'E'
+//  'N' seq n        chunk n is missing or arrived corrupted, send it again
+//  'X'              abort
+//At most ITF_XFER_WINDOW data frames are unacknowledged. A reader task keeps up to ITF_XFER_BUFS
+//chunks read ahead from the card, so a slow card access (the writer keeps logging meanwhile)
+//doesn't leave the wire idle.
+
+#define ITF_XFER_MAGIC        0xA5
+#define ITF_XFER_HEADER_LEN   8
+#define ITF_XFER_OVERHEAD     (ITF_XFER_HEADER_LEN + 4)
+#define ITF_XFER_INFO         'I'
+#define ITF_XFER_DATA         'D'
+#define ITF_XFER_END          'E'
+#define ITF_XFER_READY        'R'
+#define ITF_XFER_ACK          'A'
+#define ITF_XFER_NAK          'N'
+#define ITF_XFER_ABORT        'X'
+
+typedef struct {
+    uint8_t type;
+    uint32_t seq;
+    uint16_t len;
+    const uint8_t* payload;     //Points into the scanned buffer
+} itf_xferFrame_t;
+
+//Result of the last download, also sent in the 'E' frame and the closing console line
+typedef struct {
+    uint32_t bytes;
+    uint32_t chunks;
+    uint32_t elapsed_us;
+    uint32_t bytesPerSec;
+    uint32_t resent;            //Data frames sent more than once
+    uint32_t naks;
+    uint32_t badFrames;         //Corrupted frames from the PC
+    uint32_t readStalls;        //Times the wire waited for the card
+    int ok;
+} itf_xferStats_t;
+
+//Builds one frame in out (room for len + ITF_XFER_OVERHEAD). Returns its length.
+int itf_xferFrame(uint8_t* out, uint8_t type, uint32_t seq, const void* payload, int len);
+//Looks for a frame at the start of buf. Returns 1 with the frame (used = its length), 0 if more
+//bytes are needed, -1 if buf doesn't start with a frame or -2 if it starts with a damaged one
+//(used = bytes to drop before the next try).
+int itf_xferScan(const uint8_t* buf, int len, int maxPayload, itf_xferFrame_t* frame, int* used);
+
+//Console side: checks the file and baud and arms the transfer (it starts after the reply line is
+//out). name may leave out ".BIN". Returns 1 if armed, else 0 with err=<reason> on the reply line.
+int itf_xferRequest(const char* name, int baud);
+int itf_xferPending(void);
+//Runs an armed transfer to the end, in the PC link task (it owns UART0 meanwhile)
+void itf_xferRun(void);
+void itf_xferGetStats(itf_xferStats_t* stats);
+
+#endif
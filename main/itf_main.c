@@ -115,7 +115,7 @@ void forceBufferTestTask(void * params){
     static char *str1 = "ForceBufferTest \n";
     while(1){
         itf_addToSD(str1,17);
-        itf_forceWriteBuffers_FLAG =1;
+        itf_sdRequest(ITF_SD_REQ_FLUSH);
         vTaskDelay(5000/portTICK_PERIOD_MS);
     }
 }
@@ -12,6 +12,15 @@
 #define ITF_TX_BUF_SIZE_UART0 1024
 #define ITF_RX_BUF_SIZE_UART1 1024
 #define ITF_TX_BUF_SIZE_UART1 1024
+#define ITF_TLM_DEFAULT_PERIOD 10   //Telemetry push period in 10ms units (10 = 100ms)
+#define ITF_TLM_REFRESH_PERIODS 50  //Resend every subscribed field at least this often (in push periods)
+
+//PC console defines
+#define ITF_CONSOLE_DEFINES 1
+
+#define ITF_CONSOLE_LINE_MAX 256    //Longest accepted input line (several ';' separated commands)
+#define ITF_CONSOLE_OUT_MAX 512     //Longest reply line
+#define ITF_CONSOLE_MAX_ARGS 8
 
 //SD card setup defines
 #define ITF_SD_DEFINES 1
@@ -22,7 +31,53 @@
 #define ITF_SD_MOSI_PIN  35
 #define ITF_SD_CLK_PIN   36
 #define ITF_SD_CS_PIN    38
-#define ITF_SD_BUFFER_SIZE ITF_SD_WRITE_SIZE*20
+#define ITF_SD_USE_SDMMC 0 //1: SDMMC peripheral, 4-bit bus (CMD on MOSI, D0 on MISO, D3 on CS, plus D1/D2), 0: SPI
+#define ITF_SD_D1_PIN    39 //Only used with ITF_SD_USE_SDMMC
+#define ITF_SD_D2_PIN    40
+#define ITF_SD_SPI_FREQ_KHZ 20000
+#define ITF_SD_SDMMC_FREQ_KHZ 40000 //SDMMC_FREQ_HIGHSPEED, the card has to support high speed mode
+#define ITF_SD_ALLOC_UNIT_SIZE (16*1024) //FAT cluster size used when formatting the card
+#define ITF_SD_BLOCK_SIZE ITF_SD_ALLOC_UNIT_SIZE //One log ring block = one cluster
+#define ITF_SD_RING_BLOCKS 4       //Blocks in the log ring (internal DMA capable RAM)
+#define ITF_SD_RING_MAX_BLOCKS 256
+#define ITF_SD_USE_PSRAM 0         //1: log ring in PSRAM (needs CONFIG_SPIRAM), internal blocks become the DMA bounce
+#define ITF_SD_PSRAM_RING_BLOCKS 128 //2 MB, about 20 s of full rate hall edge logging with the card stalled
+#define ITF_SD_PREALLOC_SIZE (64*1024*1024) //Contiguous clusters reserved for each log file at open
+#define ITF_SD_ROTATE_SIZE ITF_SD_PREALLOC_SIZE //Log files are closed and a new part started at this size
+#define ITF_SD_DIR_CACHE_MAX 256 //Log files remembered from the directory scan at mount
+#define ITF_SD_SYNC_PERIOD_MS 1000 //Longest time written blocks sit without a directory update
+#define ITF_SD_RETRY_MIN_MS 100    //First remount retry after a card error, doubling each time
+#define ITF_SD_RETRY_MAX_MS 10000
+//Logging policy (itf_log_policy.c), intervals in us, budgets in bytes per second (0: no limit)
+#define ITF_LOG_EDGE_INTERVAL_US 0          //0: every hall edge
+#define ITF_LOG_EDGE_TRIG_INTERVAL_US 0
+#define ITF_LOG_EDGE_BUDGET_BPS (32*1024)
+#define ITF_LOG_LONG_INTERVAL_US 100000     //Sampled on the control tick, so it logs with the wheel stopped too
+#define ITF_LOG_LONG_TRIG_INTERVAL_US 10000
+#define ITF_LOG_LONG_BUDGET_BPS (4*1024)
+#define ITF_LOG_TRIGGER_HOLD_MS 2000        //Fast rates last this long after a fault, throttle step or speed control change
+#define ITF_LOG_PRETRIG_MS 500              //Held back samples up to this old are written when a trigger fires
+#define ITF_LOG_PRETRIG_EDGES 64
+#define ITF_LOG_PRETRIG_LONGS 50
+#define ITF_LOG_THROTTLE_STEP 512           //Throttle change within one tick that counts as a step
+
+//Log download over UART0 (itf_log_xfer.c)
+#define ITF_XFER_DEFINES 1
+#define ITF_XFER_CHUNK 1024                 //File bytes per data frame
+#define ITF_XFER_WINDOW 8                   //Data frames on the wire before the oldest has to be acknowledged
+#define ITF_XFER_BUFS 16                    //Chunks held (unacknowledged + read ahead from the card), >= window
+#define ITF_XFER_DEFAULT_BAUD 921600
+#define ITF_XFER_MAX_BAUD 3000000
+#define ITF_XFER_READY_MS 1000              //Back to the console baud if the PC isn't heard at the new one by then
+#define ITF_XFER_RESEND_MS 250              //Oldest unacknowledged frame is resent after this long without progress
+#define ITF_XFER_IDLE_MS 3000               //Transfer abandoned after this long without a frame from the PC
+
+//Binary trace log (itf_trace.c)
+#define ITF_TRACE_DEFINES 1
+#define ITF_TRACE_ENABLE 1                  //0: the ITF_TRACE macros compile to nothing
+#define ITF_TRACE_SLOTS 256                 //Messages the ring holds between drains, power of 2 (32 bytes each)
+#define ITF_TRACE_DRAIN_MS 50
+#define ITF_TRACE_SINKS (ITF_TRACE_SINK_SD | ITF_TRACE_SINK_UART)   //Where the drain task sends messages at boot
 
 //SD card wrting defines
 #define ITF_HEX_DEFINES 1
@@ -1,5 +1,6 @@
 /* SD card and FAT filesystem example.
-   This example uses SPI peripheral to communicate with SD card.
+   This example uses SPI peripheral to communicate with SD card
+   (or the SDMMC peripheral in 4-bit mode with ITF_SD_USE_SDMMC).
 
    This example code is in the Public Domain (or CC0 licensed, at your option.)
 
@@ -13,6 +14,10 @@
 #include <sys/stat.h>
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
+#include "driver/sdmmc_host.h"
+#include "ff.h"
+#include "diskio_impl.h"
+#include "diskio_sdmmc.h"
 #include "itf_master_defines.h"
 
 static const char *TAG = "SD_Setup";
@@ -20,13 +25,21 @@ static const char *TAG = "SD_Setup";
 #ifndef ITF_SD_DEFINES
     #define ITF_MOUNT_POINT_DEF "/sdcard"
     #define ITF_SD_WRITE_SIZE 1024 //Power of 2 Pref (1024, 512, ect)
+    #define ITF_SD_ALLOC_UNIT_SIZE (16*1024)
 
     #define ITF_SD_MISO_PIN  37
     #define ITF_SD_MOSI_PIN  35
     #define ITF_SD_CLK_PIN   36
     #define ITF_SD_CS_PIN    38
+    #define ITF_SD_USE_SDMMC 0
+    #define ITF_SD_D1_PIN    39
+    #define ITF_SD_D2_PIN    40
+    #define ITF_SD_SPI_FREQ_KHZ 20000
+    #define ITF_SD_SDMMC_FREQ_KHZ SDMMC_FREQ_HIGHSPEED
 #endif
 
+//In 4-bit mode the SPI lines keep their jobs: MOSI is CMD, MISO is D0, CS is D3
+
 //#define SD_PRINTS_DEF in main to enable prints
 
 //Return 0 If success
@@ -38,11 +51,16 @@ int itf_mountinit = 0;
 
 void itf_turnoffSD(void);
 int itf_initSD(void);
+int itf_getSDDrive(void);
 
 //Does all the mounting of the filesystem and stuff for SD
 int itf_initSD(void){
 
-    sdmmc_host_t host2 = SDSPI_HOST_DEFAULT();
+    #if ITF_SD_USE_SDMMC
+        sdmmc_host_t host2 = SDMMC_HOST_DEFAULT();
+    #else
+        sdmmc_host_t host2 = SDSPI_HOST_DEFAULT();
+    #endif
     host = host2;
 
      esp_vfs_fat_sdmmc_mount_config_t mount_config = {
@@ -52,7 +70,7 @@ int itf_initSD(void){
                 .format_if_mount_failed = false,
         #endif // EXAMPLE_FORMAT_IF_MOUNT_FAILED
                 .max_files = 5,
-                .allocation_unit_size = 16 * 1024
+                .allocation_unit_size = ITF_SD_ALLOC_UNIT_SIZE
     };
     esp_err_t ret;
     #ifdef SD_PRINTS_DEF
@@ -62,11 +80,29 @@ int itf_initSD(void){
     // Note: esp_vfs_fat_sdmmc/sdspi_mount is all-in-one convenience functions.
     // Please check its source code and implement error recovery when developing
     // production applications.
+#if ITF_SD_USE_SDMMC
+    #ifdef SD_PRINTS_DEF
+        ESP_LOGI(TAG, "Using SDMMC peripheral");
+    #endif
+    host.flags = SDMMC_HOST_FLAG_4BIT;
+    host.max_freq_khz = ITF_SD_SDMMC_FREQ_KHZ;
+    //The S3 routes the SDMMC signals through the GPIO matrix, so any pins work.
+    //The internal pull-ups are weak; the board still needs 10k pull-ups on CMD and D0-D3.
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot_config.width = 4;
+    slot_config.clk = ITF_SD_CLK_PIN;
+    slot_config.cmd = ITF_SD_MOSI_PIN;
+    slot_config.d0 = ITF_SD_MISO_PIN;
+    slot_config.d1 = ITF_SD_D1_PIN;
+    slot_config.d2 = ITF_SD_D2_PIN;
+    slot_config.d3 = ITF_SD_CS_PIN;
+    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+#else
     #ifdef SD_PRINTS_DEF
         ESP_LOGI(TAG, "Using SPI peripheral");
     #endif
     //host = SDSPI_HOST_DEFAULT();
-    host.max_freq_khz = 20000;
+    host.max_freq_khz = ITF_SD_SPI_FREQ_KHZ;
     spi_bus_config_t bus_cfg = {
         .mosi_io_num = ITF_SD_MOSI_PIN,
         .miso_io_num = ITF_SD_MISO_PIN,
@@ -93,6 +129,7 @@ int itf_initSD(void){
     sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
     slot_config.gpio_cs = ITF_SD_CS_PIN;
     slot_config.host_id = host.slot;
+#endif
 
     if(itf_mountinit == 1){
         esp_vfs_fat_sdcard_unmount(ITF_MOUNT_POINT, card);
@@ -101,7 +138,11 @@ int itf_initSD(void){
     #ifdef SD_PRINTS_DEF
         ESP_LOGI(TAG, "Mounting filesystem");
     #endif
-    ret = esp_vfs_fat_sdspi_mount(ITF_MOUNT_POINT, &host, &slot_config, &mount_config, &card);
+    #if ITF_SD_USE_SDMMC
+        ret = esp_vfs_fat_sdmmc_mount(ITF_MOUNT_POINT, &host, &slot_config, &mount_config, &card);
+    #else
+        ret = esp_vfs_fat_sdspi_mount(ITF_MOUNT_POINT, &host, &slot_config, &mount_config, &card);
+    #endif
 
     if (ret != ESP_OK) {
         #ifdef SD_PRINTS_DEF
@@ -127,14 +168,26 @@ int itf_initSD(void){
     return 1;
 }
 
-//Unmount card and free SPI port
+//Unmount card and free SPI port (the SDMMC host is released by the unmount)
 void itf_turnoffSD(void){
     esp_vfs_fat_sdcard_unmount(ITF_MOUNT_POINT, card);
+    itf_mountinit = 0;
     #ifdef SD_PRINTS_DEF
         ESP_LOGI(TAG, "Card unmounted");
     #endif
 
-    //deinitialize the bus after all devices are removed
-    spi_bus_free(host.slot);
-    itf_businit = 0;
-}
\ No newline at end of file
+    #if !ITF_SD_USE_SDMMC
+        //deinitialize the bus after all devices are removed
+        spi_bus_free(host.slot);
+        itf_businit = 0;
+    #endif
+}
+
+//FatFs drive number of the mounted card (for "0:/..." paths), -1 if not mounted
+int itf_getSDDrive(void){
+    if(itf_mountinit == 0){
+        return -1;
+    }
+    BYTE pdrv = ff_diskio_get_pdrv_card(card);
+    return (pdrv == 0xFF) ? -1 : (int) pdrv;
+}
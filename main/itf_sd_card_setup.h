@@ -3,5 +3,6 @@
 
 void itf_turnoffSD(void);
 int itf_initSD(void);
+int itf_getSDDrive(void);
 
 #endif
@@ -8,13 +8,23 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/unistd.h>
 #include <sys/stat.h>
-#include "esp_vfs_fat.h"
-#include "sdmmc_cmd.h"
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
-#include "itf_sd_card_setup.h"
+#include "itf_storage.h"
+#include "itf_sd_card_writer.h"
+#include "itf_sd_ring.h"
+#include "itf_log_codec.h"
+#include "itf_sd_session.h"
 #include "ctrl_subsystem.h"
 #include "itf_master_defines.h"
 
@@ -22,226 +32,438 @@ static const char *TAGW = "Writer:";
 
 #ifndef ITF_SD_DEFINES
     #define ITF_MOUNT_POINT_DEF "/sdcard"
-    #define ITF_SD_WRITE_SIZE 1024 //Power of 2 Pref (1024, 512, ect)
-    #define ITF_SD_BUFFER_SIZE ITF_SD_WRITE_SIZE*20
+    #define ITF_SD_BLOCK_SIZE (16*1024)
+    #define ITF_SD_RING_BLOCKS 4
+    #define ITF_SD_USE_PSRAM 0
+    #define ITF_SD_PSRAM_RING_BLOCKS 128
+    #define ITF_SD_PREALLOC_SIZE (64*1024*1024)
+    #define ITF_SD_SYNC_PERIOD_MS 1000
+    #define ITF_SD_ROTATE_SIZE ITF_SD_PREALLOC_SIZE
+    #define ITF_SD_RETRY_MIN_MS 100
+    #define ITF_SD_RETRY_MAX_MS 10000
 #endif
 
 //#define SD_WRITE_PRINTS_DEF in main to enable prints
 
-int SD_buffer0_index = 0;
-int SD_buffer1_index = 0;
+//Backing memory for the log ring. DMA capable so the SPI driver can send straight out of it.
+//With the ring in PSRAM the first block is the bounce buffer instead (the SPI DMA can't read PSRAM).
+static DMA_ATTR uint8_t itf_sdRingPool[ITF_SD_RING_BLOCKS][ITF_SD_BLOCK_SIZE];
+static uint8_t* itf_sdBounce = NULL;
+
+//Delta state of the block being filled. Only touched with the ring locked (itf_logBegin .. itf_logEnd).
+static itf_logState_t itf_logEnc;
+static uint32_t itf_logSeq = 0;
+
+//Time index of the open log file, written as its last block at close
+static DMA_ATTR uint8_t itf_logIndex[ITF_SD_BLOCK_SIZE];
+static int itf_logIndexStarted = 0;
+
+//The writer task sleeps until itf_sdRequest() sets one of the ITF_SD_REQ_* bits in its notification
+//value (the ring does it for every full block), or until written blocks are due a sync.
+static TaskHandle_t itf_sdWriterTask = NULL;
+
+itf_sdWriterStats_t itf_sdWriterStats;
+
+//Each log file (see itf_sd_session.h) stays open from its first block until the card fails,
+//it reaches ITF_SD_ROTATE_SIZE, the motor is armed or itf_closeLogFile() is called.
+//It is preallocated as one contiguous run of clusters, every write is one whole ring block
+//(one cluster) straight from the DMA capable pool, and the directory entry is only updated
+//every ITF_SD_SYNC_PERIOD_MS. After a power cut the file keeps its preallocated size, so
+//anything past the last record is whatever was on the card before.
+const itf_storageOps_t* itf_storage = NULL;
+static itf_storageFile_t* itf_logFile = NULL;   //NULL while closed
+static uint64_t itf_logPos = 0;           //Where the next block goes
+static int itf_logPosValid = 0;           //itf_logPos is from this boot (reopen after a card error)
+static int64_t itf_logLastSync_us = 0;
+static int itf_logUnsynced = 0;
+static char itf_logPath[24];
+static int itf_logNextFile = 1;           //The next open starts a new file instead of reopening itf_logPath
+static int itf_logNewSession = 1;         //... and that file starts a new session (boot, arm)
+static int64_t itf_logFileStart_us = 0;
+static double itf_logFileEnergy_j = 0;    //ctrl_getTotEnergy_j() when the file was started
+static int itf_logScanned = 0;            //Directory cache is valid for the current mount
+static int64_t itf_logMount_us = -1;      //When the card was last mounted, until the first block lands
+static uint64_t itf_logOpenTime_us = 0;   //Base time of the block that opens the next file
+
+//The file being written as other tasks may read it (log download): its name and how much of it the
+//directory entry covered at the last sync (0 until the first). Cleared at close, after which the
+//file's own size is right.
+static portMUX_TYPE itf_logLiveMux = portMUX_INITIALIZER_UNLOCKED;
+static char itf_logLiveName[sizeof(itf_logPath)];
+static uint32_t itf_logLiveBytes = 0;
+
+static void itf_sdBlockReady(void);
+
+//Must run before anything calls itf_addToSD (records pushed before this are counted as drops).
+//storage is &itf_storageSD on the board.
+void itf_initSDLogging(const itf_storageOps_t* storage){
+    itf_storage = storage;
+    uint8_t* pool = &itf_sdRingPool[0][0];
+    int blocks = ITF_SD_RING_BLOCKS;
+    #if ITF_SD_USE_PSRAM && CONFIG_SPIRAM
+        uint8_t* deep = heap_caps_malloc((size_t) ITF_SD_PSRAM_RING_BLOCKS*ITF_SD_BLOCK_SIZE, MALLOC_CAP_SPIRAM);
+        if(deep != NULL){
+            pool = deep;
+            blocks = ITF_SD_PSRAM_RING_BLOCKS;
+            itf_sdBounce = &itf_sdRingPool[0][0];
+        }else{
+            ESP_LOGE(TAGW, "No PSRAM for the log ring, using %d internal blocks", ITF_SD_RING_BLOCKS);
+        }
+    #endif
+    itf_sdRingInit(pool, ITF_SD_BLOCK_SIZE, blocks);
+    itf_sdRingSetNotify(itf_sdBlockReady);
+}
 
-char SD_buffer0[ITF_SD_BUFFER_SIZE];
-char SD_buffer1[ITF_SD_BUFFER_SIZE];
+//Starts the next session file, or after a card error reopens the one that was being written.
+//The name comes from the directory cache, so this is a single open.
+static int itf_openLogFile(void){
+    int fresh = itf_logNextFile;
+    if(!itf_storage->mounted() || !itf_logScanned){
+        return 0;
+    }
+    if(fresh){
+        itf_sessionNextFile(itf_logNewSession, itf_logPath, sizeof(itf_logPath));
+        itf_logNewSession = 0;
+        itf_logNextFile = 0;
+        itf_logPos = 0;
+        itf_logIndexStarted = 0;
+        itf_logFileStart_us = esp_timer_get_time();
+        itf_logFileEnergy_j = ctrl_getTotEnergy_j();
+    }
+    itf_logFile = itf_storage->open(itf_logPath, fresh);
+    if(itf_logFile == NULL){
+        itf_sdWriterStats.openFails++;
+        return 0;
+    }
+    uint64_t size = itf_storage->size(itf_logFile);
+    if(size == 0){
+        //Ask for the full size, settle for less if the free space is fragmented
+        uint64_t want = (ITF_SD_PREALLOC_SIZE < ITF_SD_ROTATE_SIZE) ? ITF_SD_PREALLOC_SIZE : ITF_SD_ROTATE_SIZE;
+        while(want >= 64*ITF_SD_BLOCK_SIZE && !itf_storage->expand(itf_logFile, want)){
+            want /= 2;
+        }
+        itf_sdWriterStats.preallocBytes = (want >= 64*ITF_SD_BLOCK_SIZE) ? want : 0;
+        //Block 0 is the file header with the field schema. Its open time is the first block's
+        //base time, so the same records always give the same file.
+        uint8_t* header = heap_caps_calloc(1, ITF_SD_BLOCK_SIZE, MALLOC_CAP_DMA);
+        int ok = 0;
+        if(header != NULL){
+            itf_logEncodeFileHeader(header, ITF_SD_BLOCK_SIZE, itf_logOpenTime_us);
+            ok = itf_storage->write(itf_logFile, header, ITF_SD_BLOCK_SIZE);
+            heap_caps_free(header);
+        }
+        if(!ok){
+            itf_storage->close(itf_logFile);
+            itf_logFile = NULL;
+            itf_sdWriterStats.openFails++;
+            return 0;
+        }
+        itf_logPos = ITF_SD_BLOCK_SIZE;
+    }else if(!itf_logPosValid || itf_logPos > size){
+        //Data from an earlier boot: start on the next block boundary after it
+        itf_logPos = ((size + ITF_SD_BLOCK_SIZE - 1)/ITF_SD_BLOCK_SIZE)*ITF_SD_BLOCK_SIZE;
+    }
+    if(!itf_storage->seek(itf_logFile, itf_logPos)){
+        itf_storage->close(itf_logFile);
+        itf_logFile = NULL;
+        itf_sdWriterStats.openFails++;
+        return 0;
+    }
+    if(!itf_logIndexStarted){
+        itf_logIndexInit(itf_logIndex);
+        itf_logIndexStarted = 1;
+    }
+    portENTER_CRITICAL(&itf_logLiveMux);
+    if(strcmp(itf_logLiveName, itf_logPath) != 0){
+        snprintf(itf_logLiveName, sizeof(itf_logLiveName), "%s", itf_logPath);
+        itf_logLiveBytes = 0;
+    }
+    portEXIT_CRITICAL(&itf_logLiveMux);
+    itf_logPosValid = 1;
+    itf_logUnsynced = 0;
+    itf_logLastSync_us = esp_timer_get_time();
+    return 1;
+}
+
+//Writes the time index as the last block, gives back the unused preallocation, closes the file
+//and adds it to SESSIONS.CSV. The next block starts a new part of the same session.
+//If this fails the file is reopened and closed again after the remount.
+//Safe to call when the file isn't open.
+int itf_closeLogFile(void){
+    int ok = 1;
+    if(itf_logFile != NULL){
+        int used = itf_logIndexSeal(itf_logIndex);
+        memset(itf_logIndex + used, 0, ITF_SD_BLOCK_SIZE - used);
+        ok = itf_storage->write(itf_logFile, itf_logIndex, ITF_SD_BLOCK_SIZE);
+        ok &= itf_storage->truncate(itf_logFile);
+        ok &= itf_storage->close(itf_logFile);
+        itf_logFile = NULL;
+        portENTER_CRITICAL(&itf_logLiveMux);
+        itf_logLiveName[0] = '\0';
+        portEXIT_CRITICAL(&itf_logLiveMux);
+        if(ok){
+            itf_sessionFileClosed(itf_logFileStart_us, esp_timer_get_time(),
+                                  ctrl_getTotEnergy_j() - itf_logFileEnergy_j, (uint32_t) itf_logPos + ITF_SD_BLOCK_SIZE);
+            itf_logNextFile = 1;
+        }
+    }
+    return ok;
+}
 
-static int bufferInUse = 0;
-static int SDbufferMaxed = 0;
+static void itf_syncLogFile(int force){
+    int64_t now = esp_timer_get_time();
+    if(itf_logFile == NULL || itf_logUnsynced == 0){
+        return;
+    }
+    if(!force && now - itf_logLastSync_us < ITF_SD_SYNC_PERIOD_MS*1000LL){
+        return;
+    }
+    if(itf_storage->sync(itf_logFile)){
+        portENTER_CRITICAL(&itf_logLiveMux);
+        itf_logLiveBytes = (uint32_t) itf_logPos;
+        portEXIT_CRITICAL(&itf_logLiveMux);
+    }
+    int64_t end = esp_timer_get_time();
+    if(end - now > itf_sdWriterStats.syncMax_us){
+        itf_sdWriterStats.syncMax_us = end - now;
+    }
+    itf_sdWriterStats.syncs++;
+    itf_logUnsynced = 0;
+    itf_logLastSync_us = end;
+}
 
-//Set to 1 to force write the buffers to data out
-int itf_forceWriteBuffers_FLAG = 0;
+int itf_logLiveSize(const char* name, uint32_t* bytes){
+    int live;
+    portENTER_CRITICAL(&itf_logLiveMux);
+    live = (itf_logLiveName[0] != '\0' && strcmp(name, itf_logLiveName) == 0);
+    if(live){
+        *bytes = itf_logLiveBytes;
+    }
+    portEXIT_CRITICAL(&itf_logLiveMux);
+    return live;
+}
 
-int ITF_LONGDATA_FLAG = 0;
+//Drain callback: finish the block header and note it in the time index, then write it out
+static int itf_writeLogBlock(uint8_t* block, int length){
+    itf_logSealBlock(block);
+    itf_logOpenTime_us = itf_logBlockBase(block);
+    if(itf_writeFileFromBuffer(block, length) == 0){
+        return 0;
+    }
+    //itf_logPos is now just past this block (the first write also opens the file)
+    itf_logIndexAdd(itf_logIndex, ITF_SD_BLOCK_SIZE, (uint32_t) (itf_logPos/ITF_SD_BLOCK_SIZE) - 1, itf_logBlockBase(block));
+    if(itf_logPos + ITF_SD_BLOCK_SIZE >= ITF_SD_ROTATE_SIZE){
+        return itf_closeLogFile();
+    }
+    return 1;
+}
 
-int itf_forceWriteBuffers(void);
-void itf_writeTestMessage(char *str);
-int itf_writeFileFromBuffer(int bufferNum);
-int itf_addToSD(char *toStore,int length);
-int itf_addTestToSD(int testNum);
-int itf_initSD(void);
-int itf_addLongData(void);
-int itf_addShortData(void);
+//Writes every block the producers have finished. Returns 0 if the card failed (block stays queued).
+static int itf_writePendingBlocks(void){
+    if(itf_sdRingDrain(itf_writeLogBlock, itf_sdBounce) == 0){
+        return 0;
+    }
+    itf_syncLogFile(0);
+    return 1;
+}
 
-//A simple task for writing to the SD when buffers fill up
+//Reads the directory once per mount so opening files never has to stat the card
+static int itf_logMounted(void){
+    itf_logMount_us = esp_timer_get_time();
+    itf_logScanned = itf_sessionScan();
+    return itf_logScanned;
+}
+
+//Wakes the writer task for the ITF_SD_REQ_* bits in what. Requests made before it runs again are
+//merged into one, so flushing from several places costs one flush. Safe from any task or an ISR.
+void itf_sdRequest(uint32_t what){
+    if(itf_sdWriterTask == NULL){
+        return;
+    }
+    if(xPortInIsrContext()){
+        BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+        xTaskNotifyFromISR(itf_sdWriterTask, what, eSetBits, &xHigherPriorityTaskWoken);
+        portYIELD_FROM_ISR(xHigherPriorityTaskWoken);
+    }else{
+        xTaskNotify(itf_sdWriterTask, what, eSetBits);
+    }
+}
+
+static void itf_sdBlockReady(void){
+    itf_sdRequest(ITF_SD_REQ_BLOCK);
+}
+
+//How long the writer may sleep: forever unless written blocks are waiting for a sync
+static TickType_t itf_sdIdleTimeout(void){
+    if(itf_logFile == NULL || itf_logUnsynced == 0){
+        return portMAX_DELAY;
+    }
+    int64_t due_us = itf_logLastSync_us + ITF_SD_SYNC_PERIOD_MS*1000LL - esp_timer_get_time();
+    return (due_us <= 0) ? 0 : pdMS_TO_TICKS(due_us/1000) + 1;
+}
+
+//Writes full blocks as soon as the ring hands them over. When the card fails, the remount is
+//retried after ITF_SD_RETRY_MIN_MS, doubling up to ITF_SD_RETRY_MAX_MS, while the ring keeps
+//logging; requests that arrive meanwhile are carried out after the remount.
 void itf_writeSD_task(void * params)
 {
-    int error = 1;
-    error = itf_initSD();
+    uint32_t pending = 0;
+    uint32_t what;
+    uint32_t backoff_ms = ITF_SD_RETRY_MIN_MS;
+    int ok;
+
+    itf_sdWriterTask = xTaskGetCurrentTaskHandle();
+    ok = itf_storage->mount() && itf_logMounted();
 
     while(1){
-        if(error==0){
-            //itf_turnoffSD();
-            if(itf_initSD()==1){
-                error = 1;
+        if(!ok){
+            vTaskDelay(pdMS_TO_TICKS(backoff_ms));
+            backoff_ms = (backoff_ms*2 > ITF_SD_RETRY_MAX_MS) ? ITF_SD_RETRY_MAX_MS : backoff_ms*2;
+            itf_sdWriterStats.remounts++;
+            itf_logScanned = 0;
+            ok = itf_storage->mount() && itf_logMounted();
+            continue;
+        }
+        backoff_ms = ITF_SD_RETRY_MIN_MS;
+
+        what = 0;
+        //Work left over from before a remount (a request, or blocks the ring is full of) goes on without waiting:
+        //a full ring may never notify again
+        xTaskNotifyWait(0, UINT32_MAX, &what, (pending != 0 || itf_sdRingPending() > 0) ? 0 : itf_sdIdleTimeout());
+        itf_sdWriterStats.wakeups++;
+        pending |= what;
+
+        if(pending & ITF_SD_REQ_SESSION){
+            //Everything up to the arm goes in the old session, the run gets its own files
+            itf_logNewSession = 1;
+            pending = (pending & ~ITF_SD_REQ_SESSION) | ITF_SD_REQ_CLOSE;
+        }
+        if(pending & (ITF_SD_REQ_FLUSH | ITF_SD_REQ_CLOSE)){
+            ok = itf_forceWriteBuffers();
+            if(ok && (pending & ITF_SD_REQ_CLOSE)){
+                ok = itf_closeLogFile();
             }
         }else{
-            if(itf_forceWriteBuffers_FLAG){
-                error = itf_forceWriteBuffers();
-                itf_forceWriteBuffers_FLAG = 0;
-            }
-            if(SD_buffer0_index >= ITF_SD_BUFFER_SIZE){
-                error = itf_writeFileFromBuffer(0);
-                if(error)
-                    SD_buffer0_index = 0;
-            }
-            if(SD_buffer1_index >= ITF_SD_BUFFER_SIZE){
-                error = itf_writeFileFromBuffer(1);
-                if(error)
-                    SD_buffer1_index = 0;
-            }
+            ok = itf_writePendingBlocks();
+        }
+        if(ok){
+            pending = 0;
         }
-        ITF_LONGDATA_FLAG = 1;
-        
-        vTaskDelay(100/portTICK_PERIOD_MS);
     }
-    itf_turnoffSD();
+    itf_storage->unmount();
 }
 
-int itf_addShortData(void){
-    char dataToStore[16];
-    //"Unique" segment 
-    dataToStore[0] = 0xBA;
-    dataToStore[1] = 0xDF;
-    dataToStore[2] = 0xAD;
-    dataToStore[3] = 0xE5;
-
-    //Hall state 1
-    dataToStore[4] = ctrl_getHallState();
-
-    //Error state + shutdown (1)
-    int shutDown = (ctrl_isInSafetyShutdown() > 0);
-    dataToStore[5] = (shutDown<<7) | (ctrl_getErrorCode());
-
-    //currA (2)
-    int phaseCurrA = (int) (ctrl_getPhaseCurA_A()*100.0);
-    //ESP_LOGE("Phase test:","%d",phaseCurrA);
-    if(phaseCurrA < 0){
-        dataToStore[6] = (1<<7);
-        phaseCurrA = -1*phaseCurrA;
-    }else{
-        dataToStore[6] = 0;
+//Reserves room for one encoded record (plus a block header if it opens a new block).
+//On success the ring is locked until itf_logEnd().
+static uint8_t* itf_logBegin(int maxLen, uint64_t time_us, int* offset, int* used){
+    uint8_t* p = itf_sdRingBegin(maxLen + ITF_LOG_BLOCK_HEADER_LEN, offset);
+    if(p == NULL){
+        return NULL;
     }
-    dataToStore[6] = (char) ((phaseCurrA & 0xFF00)>>8);
-    dataToStore[7] = (char) (phaseCurrA & 0x00FF);
-
-    //currB (2)
-    int phaseCurrB = (int) (ctrl_getPhaseCurB_A()*100.0);
-    if(phaseCurrB < 0){
-        dataToStore[8] = (1<<7);
-        phaseCurrB = -1*phaseCurrB;
-    }else{
-        dataToStore[8] = 0;
+    *used = 0;
+    if(*offset == 0){
+        *used = itf_logEncodeBlockHeader(p, &itf_logEnc, time_us, itf_logSeq++);
     }
-    dataToStore[8] |= (char) ((phaseCurrB & 0xFF00)>>8);
-    dataToStore[9] = (char) (phaseCurrB & 0x00FF);
+    return p;
+}
 
-    //currC (2)
-    int phaseCurrC = (int) (ctrl_getPhaseCurC_A()*100.0);
-    if(phaseCurrC < 0){
-        dataToStore[10] = (1<<7);
-        phaseCurrC = -1*phaseCurrC;
-    }else{
-        dataToStore[10] = 0;
-    }
-    dataToStore[10] |= (char) ((phaseCurrC & 0xFF00)>>8);
-    dataToStore[11] = (char) (phaseCurrC & 0x00FF);
+static void itf_logEnd(uint8_t* p, int offset, int used){
+    itf_logFinishRecord(p - offset, &itf_logEnc, offset + used);
+    itf_sdRingEnd(used);
+}
 
-    //Time (4)
-    uint64_t time = ctrl_getTime();
-    dataToStore[12] = (char) ((time & 0xFF000000)>>24);
-    dataToStore[13] = (char) ((time & 0x00FF0000)>>16);
-    dataToStore[14] = (char) ((time & 0x0000FF00)>>8);
-    dataToStore[15] = (char) ((time & 0x000000FF)>>0);
+//Hall edge sample (from ctrl_hall_isr, through itf_logPolicyEdge)
+void itf_captureShortData(itf_logEdge_t* e){
+    e->time_us = ctrl_getTime();
+    e->hall = ctrl_getHallState();
+    e->status = ((ctrl_isInSafetyShutdown() > 0)<<7) | ctrl_getErrorCode();
+    e->cur[0] = (int32_t) (ctrl_getPhaseCurA_A()*100.0);
+    e->cur[1] = (int32_t) (ctrl_getPhaseCurB_A()*100.0);
+    e->cur[2] = (int32_t) (ctrl_getPhaseCurC_A()*100.0);
+}
 
-    return itf_addToSD(dataToStore,16);
+//Encodes one edge into the log ring. Returns the bytes it took, 0 if the ring dropped it.
+int itf_logEdgeRecord(const itf_logEdge_t* e){
+    int offset, used;
+    uint8_t* p = itf_logBegin(ITF_LOG_EDGE_MAX, e->time_us, &offset, &used);
+    if(p == NULL){
+        return 0;
+    }
+    used += itf_logEncodeEdge(p + used, &itf_logEnc, e);
+    itf_logEnd(p, offset, used);
+    return used;
 }
 
-int itf_addLongData(void){
-    
-    char dataToStore[25];
-    //"Unique" segment 
-    dataToStore[0] = 0xDE;
-    dataToStore[1] = 0xAD;
-    dataToStore[2] = 0xBE;
-    dataToStore[3] = 0xEF;
-
-    //Speed (1)
-    dataToStore[4] = (char) ctrl_getSpeed_mph();
-
-    //InstPower (2)
-    int iPower = (int) (ctrl_getInstPower_W()*10);
-    dataToStore[5] = (char) ((iPower & 0xFF00)>>8);
-    dataToStore[6] = (char) (iPower & 0x00FF);
-
-    //AvgPower (2)
-    int aPower = (int) (ctrl_getAvePower_W()*10);
-    dataToStore[7] = (char) ((aPower & 0xFF00)>>8);
-    dataToStore[8] = (char) (aPower & 0x00FF);
-
-    //Volts (1)
-    int batVolts = (int) (ctrl_getBatVolts_V()*100);
-    dataToStore[9] = (char) ((batVolts & 0xFF00)>>8);
-    dataToStore[10] = (char) (batVolts & 0x00FF);
-
-    //CurrA (1)
-    int batCurr = (int) (ctrl_getCurrent_A()*100);
-    dataToStore[11] = (char) ((batCurr & 0xFF00)>>8);
-    dataToStore[12] = (char) (batCurr & 0x00FF);
-
-    //TempA (2)
-    int tempA = (int) (ctrl_getPhaseTempA_f()*100);
-    dataToStore[13] = (char) ((tempA & 0xFF00)>>8);
-    dataToStore[14] = (char) (tempA & 0x00FF);
-
-    //TempB (2)
-    int tempB = (int) (ctrl_getPhaseTempB_f()*100);
-    dataToStore[15] = (char) ((tempB & 0xFF00)>>8);
-    dataToStore[16] = (char) (tempB & 0x00FF);
-
-    //TempC (2)
-    int tempC = (int) (ctrl_getPhaseTempC_f()*100);
-    dataToStore[17] = (char) ((tempC & 0xFF00)>>8);
-    dataToStore[18] = (char) (tempC & 0x00FF);
-
-    //Error + Shutdown (1)
-    int shutDown = (ctrl_isInSafetyShutdown() > 0);
-    dataToStore[19] = (shutDown<<7) | (ctrl_getErrorCode());
-
-    //Throttle (1)
-    dataToStore[20] = (char) (((int) ctrl_getThrottle())>>4);
-
-    //Time (4)
-    uint64_t time = ctrl_getTime();
-    dataToStore[21] = (char) ((time & 0xFF000000)>>24);
-    dataToStore[22] = (char) ((time & 0x00FF0000)>>16);
-    dataToStore[23] = (char) ((time & 0x0000FF00)>>8);
-    dataToStore[24] = (char) ((time & 0x000000FF)>>0);
-
-    return itf_addToSD(dataToStore,25);
-    
-   //return 1;
-}
-
-//Use itf_forceWriteBuffers_FLAG var to trigger this
-int itf_forceWriteBuffers(void){
-    const char *file_hello = ITF_MOUNT_POINT_DEF"/data.txt";
-    #ifdef SD_WRITE_PRINTS_DEF
-        ESP_LOGI("ForceWriteBuffers", "Opening file %s", file_hello);
-    #endif
-    FILE *f = fopen(file_hello, "a");
+int itf_addShortData(void){
+    itf_logEdge_t e;
+    itf_captureShortData(&e);
+    return itf_logEdgeRecord(&e);
+}
 
-    if (f == NULL) {
-        #ifdef SD_WRITE_PRINTS_DEF
-            ESP_LOGE("ForceWriteBuffers", "Failed to open file for writing");
-        #endif
+//Slow changing values (sampled on the control tick by itf_logPolicyTick)
+void itf_captureLongData(itf_logLong_t* r){
+    r->time_us = ctrl_getTime();
+    r->status = ((ctrl_isInSafetyShutdown() > 0)<<7) | ctrl_getErrorCode();
+    r->v[ITF_LOG_LONG_SPEED] = (int32_t) (ctrl_getSpeed_mph()*100);
+    r->v[ITF_LOG_LONG_INST_POWER] = (int32_t) (ctrl_getInstPower_W()*10);
+    r->v[ITF_LOG_LONG_AVG_POWER] = (int32_t) (ctrl_getAvePower_W()*10);
+    r->v[ITF_LOG_LONG_VOLTS] = (int32_t) (ctrl_getBatVolts_V()*100);
+    r->v[ITF_LOG_LONG_CURRENT] = (int32_t) (ctrl_getCurrent_A()*100);
+    r->v[ITF_LOG_LONG_TEMP_A] = (int32_t) (ctrl_getPhaseTempA_f()*100);
+    r->v[ITF_LOG_LONG_TEMP_B] = (int32_t) (ctrl_getPhaseTempB_f()*100);
+    r->v[ITF_LOG_LONG_TEMP_C] = (int32_t) (ctrl_getPhaseTempC_f()*100);
+    r->v[ITF_LOG_LONG_THROTTLE] = (int32_t) ctrl_getThrottle();
+    r->v[ITF_LOG_LONG_DUTY] = (int32_t) ctrl_getDutyCommand();
+}
+
+int itf_logLongRecord(const itf_logLong_t* r){
+    int offset, used;
+    uint8_t* p = itf_logBegin(ITF_LOG_LONG_MAX, r->time_us, &offset, &used);
+    if(p == NULL){
         return 0;
     }
-    char data_to_send[1];
-    int i;
-    for(i=0;i<SD_buffer0_index;i++){
-        data_to_send[1] = SD_buffer0[i];
-        fwrite(data_to_send,1,1,f);
+    used += itf_logEncodeLong(p + used, &itf_logEnc, r);
+    itf_logEnd(p, offset, used);
+    return used;
+}
+
+//Setter call (through itf_logPolicyCommand)
+int itf_logCommandRecord(uint64_t time_us, uint8_t cmd, uint8_t result, int32_t value){
+    int offset, used;
+    uint8_t* p = itf_logBegin(ITF_LOG_CMD_MAX, time_us, &offset, &used);
+    if(p == NULL){
+        return 0;
     }
-    SD_buffer0_index = 0;
+    used += itf_logEncodeCommand(p + used, &itf_logEnc, time_us, cmd, result, value);
+    itf_logEnd(p, offset, used);
+    return used;
+}
 
-    for(i=0;i<SD_buffer1_index;i++){
-        data_to_send[1] = SD_buffer1[i];
-        fwrite(data_to_send,1,1,f);
+//Trace messages from itf_trace.c's drain task (the formats stay on the host)
+int itf_addTraceToSD(uint64_t time_us, uint16_t id, const uint32_t* args, int n){
+    int offset, used;
+    uint8_t* p = itf_logBegin(ITF_LOG_TRACE_MAX, time_us, &offset, &used);
+    if(p == NULL){
+        return 0;
     }
-    SD_buffer1_index = 0;
+    used += itf_logEncodeTrace(p + used, &itf_logEnc, time_us, id, args, n);
+    itf_logEnd(p, offset, used);
+    return used;
+}
 
-    fclose(f);
+int itf_addLongData(void){
+    itf_logLong_t r;
+    itf_captureLongData(&r);
+    return itf_logLongRecord(&r);
+}
 
-    return 1;
+//Use itf_sdRequest(ITF_SD_REQ_FLUSH) to trigger this. Closes the partly filled
+//block, writes everything that is queued to the log file and syncs it.
+int itf_forceWriteBuffers(void){
+    itf_sdRingFlush();
+    int ok = itf_writePendingBlocks();
+    itf_syncLogFile(1);
+    return ok;
 }
 
 //Writes to test document, dont use unless you ARENT using other write funcs
@@ -250,7 +472,7 @@ void itf_writeTestMessage(char *str){
         return;
     #endif
 
-    itf_initSD();
+    itf_storage->mount();
 
     const char *file_hello = ITF_MOUNT_POINT_DEF"/Tests.txt";
     #ifdef SD_WRITE_PRINTS_DEF
@@ -270,98 +492,230 @@ void itf_writeTestMessage(char *str){
     return;
 }
 
-//Write all the bytes in specified buffer number to data.txt, this takes 
-//hundreds of ms, so be careful when calling
-int itf_writeFileFromBuffer(int bufferNum){
-    int startTime = esp_log_timestamp();
-    const char *file_hello = ITF_MOUNT_POINT_DEF"/data.bin";
-    int startTime2 = 0;
-    int endTime2 = 0;
-    #ifdef SD_WRITE_PRINTS_DEF
-        ESP_LOGI("itf_writeFileFromBuffer", "Opening file %s", file_hello);
-    #endif
-    FILE *f = fopen(file_hello, "a");
-    if (f == NULL) {
+//Append length bytes (a multiple of ITF_SD_BLOCK_SIZE) to the log file. data must be DMA capable
+//or the driver bounces it through a 512 byte buffer one sector at a time.
+int itf_writeFileFromBuffer(const uint8_t *data,int length){
+    if(itf_logFile == NULL && !itf_openLogFile()){
         #ifdef SD_WRITE_PRINTS_DEF
-            ESP_LOGE("itf_writeFileFromBuffer", "Failed to open file for writing");
+            ESP_LOGE("itf_writeFileFromBuffer", "Failed to open %s", itf_logPath);
         #endif
         return 0;
     }
-
-    int i = 0;
-    char data_to_send[ITF_SD_WRITE_SIZE];
-
-    if(bufferNum == 0){
-        startTime2 = esp_log_timestamp();
-        for(i=0;i<ITF_SD_BUFFER_SIZE;i+=ITF_SD_WRITE_SIZE){
-            int k;
-            for(k=0;k<ITF_SD_WRITE_SIZE;k++){
-                data_to_send[k] = SD_buffer0[i+k];
-            }
-            fwrite(data_to_send,1,ITF_SD_WRITE_SIZE,f);
-        }
-    }else{
-        startTime2= esp_log_timestamp();
-        for(i=0;i<ITF_SD_BUFFER_SIZE;i+=ITF_SD_WRITE_SIZE){
-            int k;
-            for(k=0;k<ITF_SD_WRITE_SIZE;k++){
-                data_to_send[k] = SD_buffer1[i+k];
-            }
-            fwrite(data_to_send,1,ITF_SD_WRITE_SIZE,f);
-        }
+    int64_t startTime = esp_timer_get_time();
+    int ok = itf_storage->write(itf_logFile, data, length);
+    int64_t timeTotal = esp_timer_get_time() - startTime;
+
+    if(!ok){
+        //The mount is about to be redone, so drop the handle; the block stays queued
+        itf_storage->close(itf_logFile);
+        itf_logFile = NULL;
+        itf_sdWriterStats.writeFails++;
+        #ifdef SD_WRITE_PRINTS_DEF
+            ESP_LOGE("itf_writeFileFromBuffer", "Write to %s failed", itf_logPath);
+        #endif
+        return 0;
+    }
+    itf_logPos += length;
+    itf_logUnsynced++;
+    if(itf_logMount_us >= 0){
+        itf_sdWriterStats.mountToFirstWrite_us = esp_timer_get_time() - itf_logMount_us;
+        itf_logMount_us = -1;
+    }
+    itf_sdWriterStats.bytesWritten += length;
+    itf_sdWriterStats.writeLast_us = timeTotal;
+    if(timeTotal > itf_sdWriterStats.writeMax_us){
+        itf_sdWriterStats.writeMax_us = timeTotal;
     }
-    endTime2 = esp_log_timestamp();
-    fclose(f);
-    int endTime = esp_log_timestamp();
-    int timeTotal = endTime - startTime;
-    int timeTotal2 = endTime2 - startTime2;
     #ifdef SD_WRITE_PRINTS_DEF
-        ESP_LOGI(TAGW, "Time to open/write bufferNum %d was %d",bufferNum,timeTotal);
-        ESP_LOGI(TAGW, "Time to write bufferNum %d was %d",bufferNum,timeTotal2);
+        ESP_LOGI(TAGW, "Time to write %d bytes was %lld us",length,timeTotal);
     #endif
     return 1;
 }
 
 //Put a byte array in and specify length, and this func will 
-//handle all the buffering and deciding when to send data to the SD
+//handle all the buffering and deciding when to send data to the SD.
+//The bytes are stored as a raw record so they don't break the binary log.
+//Safe from any task or ISR. Returns 0 if the record was dropped because the writer is behind.
 int itf_addToSD(char *toStore,int length){
-    int i;
-
-    if((ITF_SD_BUFFER_SIZE < SD_buffer0_index + length) && (ITF_SD_BUFFER_SIZE < SD_buffer1_index + length)){
+    int offset, used;
+    uint64_t now = ctrl_getTime();
+    uint8_t* p = itf_logBegin(length + ITF_LOG_RAW_OVERHEAD, now, &offset, &used);
+    if(p == NULL){
         #ifdef SD_WRITE_PRINTS_DEF
-        ESP_LOGE("itf_addToSD","BUFFERS ARE MAXED, AHHHHHHHH");
+            ESP_LOGE("itf_addToSD","LOG RING FULL, record dropped");
         #endif
         return 0;
     }
+    used += itf_logEncodeRaw(p + used, &itf_logEnc, now, toStore, length);
+    itf_logEnd(p, offset, used);
+    return 1;
+}
+
+//WIP, dont use 
+int itf_addTestToSD(int testNum){
+    return -1;
+}
 
-    for(i=0;i<length;i++){
-        if(bufferInUse == 0 && SDbufferMaxed){
-            bufferInUse = 1;
-            SDbufferMaxed = 0;
+//Old path: reopen data.bin in append mode for every 20 KB buffer and copy it through a 1 KB stack array
+static int itf_sdBenchLegacy(const char* path, const uint8_t* src, int chunk, int totalBytes, int64_t* maxUs){
+    char data_to_send[1024];
+    int done;
+    for(done=0;done<totalBytes;done+=chunk){
+        int64_t t0 = esp_timer_get_time();
+        FILE *f = fopen(path, "a");
+        if(f == NULL){
+            return -1;
         }
-        if(bufferInUse == 1 && SDbufferMaxed){
-            bufferInUse = 0;
-            SDbufferMaxed = 0;
+        int i,k;
+        for(i=0;i<chunk;i+=1024){
+            for(k=0;k<1024;k++){
+                data_to_send[k] = src[(i+k) % ITF_SD_BLOCK_SIZE];
+            }
+            fwrite(data_to_send,1,1024,f);
         }
-        if(bufferInUse == 0){
-            SD_buffer0[SD_buffer0_index] = toStore[i];
-            SD_buffer0_index++;
-            if(SD_buffer0_index >=ITF_SD_BUFFER_SIZE)
-                SDbufferMaxed = 1;
-        }else if(bufferInUse == 1){
-            SD_buffer1[SD_buffer1_index] = toStore[i];
-            SD_buffer1_index++;
-            if(SD_buffer1_index >=ITF_SD_BUFFER_SIZE)
-                SDbufferMaxed = 1;
+        fclose(f);
+        int64_t dt = esp_timer_get_time() - t0;
+        if(dt > *maxUs){
+            *maxUs = dt;
         }
     }
-    #ifdef SD_WRITE_PRINTS_DEF
-        ESP_LOGI("BufferStatus","Buffer0: %d   Buffer1: %d",SD_buffer0_index,SD_buffer1_index);
-    #endif
-    return 1;
+    return done;
 }
 
-//WIP, dont use 
-int itf_addTestToSD(int testNum){
-    return -1;
-}
\ No newline at end of file
+//New path: one open file, preallocated, whole clusters from a DMA buffer, periodic sync
+static int itf_sdBenchDirect(const char* name, const uint8_t* src, int totalBytes, int64_t* maxUs){
+    int done;
+    int64_t lastSync = esp_timer_get_time();
+    itf_storageFile_t* f = itf_storage->open(name, 1);
+    if(f == NULL){
+        return -1;
+    }
+    itf_storage->expand(f, totalBytes);
+    for(done=0;done<totalBytes;done+=ITF_SD_BLOCK_SIZE){
+        int64_t t0 = esp_timer_get_time();
+        if(!itf_storage->write(f, src, ITF_SD_BLOCK_SIZE)){
+            itf_storage->close(f);
+            return -1;
+        }
+        if(t0 - lastSync >= ITF_SD_SYNC_PERIOD_MS*1000LL){
+            itf_storage->sync(f);
+            lastSync = esp_timer_get_time();
+        }
+        int64_t dt = esp_timer_get_time() - t0;
+        if(dt > *maxUs){
+            *maxUs = dt;
+        }
+    }
+    itf_storage->close(f);
+    return done;
+}
+
+//Writes totalBytes through the old and the new write path and prints MB/s and the slowest single write.
+//Uses its own files next to the session files and removes them afterwards; logging keeps running meanwhile.
+void itf_sdBenchmark(int totalBytes){
+    if(!itf_storage->mounted()){
+        printf("sd_bench err=not_mounted\n");
+        return;
+    }
+    uint8_t* src = heap_caps_malloc(ITF_SD_BLOCK_SIZE, MALLOC_CAP_DMA);
+    if(src == NULL){
+        printf("sd_bench err=no_mem\n");
+        return;
+    }
+    int i;
+    for(i=0;i<ITF_SD_BLOCK_SIZE;i++){
+        src[i] = (uint8_t) (i*31 + 7);
+    }
+    //Whole number of old 20 KB buffers and of 16 KB blocks
+    if(totalBytes < 80*1024){
+        totalBytes = 80*1024;
+    }
+    totalBytes -= totalBytes % (80*1024);
+
+    int v;
+    for(v=0;v<2;v++){
+        int64_t maxUs = 0;
+        int done;
+        int64_t start = esp_timer_get_time();
+        if(v == 0){
+            remove(ITF_MOUNT_POINT_DEF"/BENCH.BIN");
+            done = itf_sdBenchLegacy(ITF_MOUNT_POINT_DEF"/BENCH.BIN", src, 20*1024, totalBytes, &maxUs);
+        }else{
+            done = itf_sdBenchDirect("BENCH.BIN", src, totalBytes, &maxUs);
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        if(elapsed < 1) { elapsed = 1; }
+        if(done < 0){
+            printf("sd_bench %s err=write_failed\n", (v == 0) ? "legacy" : "direct");
+        }else{
+            printf("sd_bench %s bytes=%d us=%lld MBps=%.2f max_write_us=%lld\n", (v == 0) ? "legacy" : "direct", done,
+                   (long long) elapsed, ((double) done)/((double) elapsed), (long long) maxUs);
+        }
+        remove(ITF_MOUNT_POINT_DEF"/BENCH.BIN");
+    }
+    heap_caps_free(src);
+}
+
+static int itf_sdBenchCompare(const void* a, const void* b){
+    int32_t x = *(const int32_t*) a, y = *(const int32_t*) b;
+    return (x > y) - (x < y);
+}
+
+//Writes the same totalBytes with 512 B, 4 KB, 16 KB and 64 KB f_write calls on the backend this build
+//uses (ITF_SD_USE_SDMMC, reported as the storage name) and prints MB/s and the p99 and worst single write. Flash once per backend
+//to compare them. Uses BENCH.BIN, preallocated so cluster allocation isn't part of the timing.
+void itf_sdBenchTransfers(int totalBytes){
+    static const int sizes[] = { 512, 4*1024, 16*1024, 64*1024 };
+    int i, k;
+    if(!itf_storage->mounted()){
+        printf("sd_xfer err=not_mounted\n");
+        return;
+    }
+    if(totalBytes < 64*1024){
+        totalBytes = 64*1024;
+    }
+    totalBytes -= totalBytes % (64*1024);
+    uint8_t* src = heap_caps_malloc(64*1024, MALLOC_CAP_DMA);
+    int32_t* lat = malloc((totalBytes/512)*sizeof(int32_t));
+    if(src == NULL || lat == NULL){
+        printf("sd_xfer err=no_mem\n");
+        heap_caps_free(src);
+        free(lat);
+        return;
+    }
+    for(i=0;i<64*1024;i++){
+        src[i] = (uint8_t) (i*31 + 7);
+    }
+
+    for(k=0;k<(int) (sizeof(sizes)/sizeof(sizes[0]));k++){
+        int n = totalBytes/sizes[k];
+        itf_storageFile_t* f = itf_storage->open("BENCH.BIN", 1);
+        int ok = (f != NULL);
+        if(ok){
+            itf_storage->expand(f, totalBytes);
+        }
+        int64_t start = esp_timer_get_time();
+        for(i=0;ok && i<n;i++){
+            int64_t t0 = esp_timer_get_time();
+            ok = itf_storage->write(f, src, sizes[k]);
+            lat[i] = (int32_t) (esp_timer_get_time() - t0);
+        }
+        if(ok){
+            ok = itf_storage->sync(f);
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        if(f != NULL){
+            itf_storage->close(f);
+        }
+        if(!ok){
+            printf("sd_xfer backend=%s size=%d err=write_failed\n", itf_storage->name, sizes[k]);
+            continue;
+        }
+        qsort(lat, n, sizeof(int32_t), itf_sdBenchCompare);
+        printf("sd_xfer backend=%s size=%d bytes=%d MBps=%.2f p99_us=%ld max_us=%ld\n", itf_storage->name, sizes[k],
+               totalBytes, ((double) totalBytes)/((double) (elapsed > 0 ? elapsed : 1)), (long) lat[(n*99)/100], (long) lat[n-1]);
+    }
+    itf_storage->remove("BENCH.BIN");
+    heap_caps_free(src);
+    free(lat);
+}
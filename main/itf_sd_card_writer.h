@@ -1,15 +1,55 @@
 #ifndef ITF_SD_CARD_WRITER_H_
 #define ITF_SD_CARD_WRITER_H_
 
-int itf_writeFileFromBuffer(int bufferNum);
+#include <stdint.h>
+#include "itf_log_codec.h"
+#include "itf_storage.h"
+
+//Card side of the log pipeline (block counts and drops are in itf_sdRingStats_t)
+typedef struct {
+    uint64_t bytesWritten;
+    int64_t writeLast_us;
+    int64_t writeMax_us;        //Slowest single block write
+    int64_t syncMax_us;
+    uint32_t syncs;
+    uint32_t writeFails;
+    uint32_t openFails;
+    uint32_t preallocBytes;     //Contiguous space reserved when the current log file was created
+    int64_t mountToFirstWrite_us;   //Last mount to the first block on the card
+    uint32_t wakeups;           //Writer task wakeups (zero while idle)
+    uint32_t remounts;          //Remount attempts after a card error
+} itf_sdWriterStats_t;
+
+extern itf_sdWriterStats_t itf_sdWriterStats;
+
+//Requests for the writer task (bits, several may be combined)
+#define ITF_SD_REQ_BLOCK   0x01     //A ring block is full (sent by the ring)
+#define ITF_SD_REQ_FLUSH   0x02     //Write the partly filled block too and sync
+#define ITF_SD_REQ_CLOSE   0x04     //Flush, add the time index and close the file (the next block starts a new part)
+#define ITF_SD_REQ_SESSION 0x08     //Close and start a new session (sent on arm)
+
+void itf_initSDLogging(const itf_storageOps_t* storage);
+void itf_sdRequest(uint32_t what);
+int itf_writeFileFromBuffer(const uint8_t *data,int length);
 int itf_addToSD(char *toStore,int length);
 int itf_addTestToSD(int testNum);
 void itf_writeSD_task(void * params);
 int itf_forceWriteBuffers(void);
+int itf_closeLogFile(void);
+//If name is the file being written: 1, with the bytes that can be read meanwhile (up to its last sync)
+int itf_logLiveSize(const char* name, uint32_t* bytes);
+void itf_sdBenchmark(int totalBytes);
+void itf_sdBenchTransfers(int totalBytes);
 void itf_writeTestMessage(char *str);
+//Record producers. The add functions sample and log in one go (bypassing itf_log_policy);
+//the record functions return the bytes used, 0 if the ring dropped the record.
+void itf_captureShortData(itf_logEdge_t* e);
+void itf_captureLongData(itf_logLong_t* r);
+int itf_logEdgeRecord(const itf_logEdge_t* e);
+int itf_logLongRecord(const itf_logLong_t* r);
+int itf_logCommandRecord(uint64_t time_us, uint8_t cmd, uint8_t result, int32_t value);
+int itf_addTraceToSD(uint64_t time_us, uint16_t id, const uint32_t* args, int n);
 int itf_addLongData(void);
 int itf_addShortData(void);
-extern int itf_forceWriteBuffers_FLAG;
-extern int ITF_LONGDATA_FLAG;
 
 #endif
@@ -0,0 +1,214 @@
+//Multi-block ring buffer between everything that logs and itf_writeSD_task.
+//Producers fill the block at head; once a record doesn't fit, the block is published by bumping head
+//and the next free block is started. The writer works through blocks from tail to head while the
+//producers keep filling, so the card write and the logging never touch the same memory.
+//
+//head is only written by producers (serialized by a short critical section, which is safe from the
+//hall ISR and from tasks on either core) and tail only by the writer. Both are atomics so the
+//writer never needs the lock: publishing a block is a release store of head, freeing one is a
+//release store of tail.
+
+#include <string.h>
+#include <stdatomic.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "itf_sd_ring.h"
+#include "itf_master_defines.h"
+
+#ifndef ITF_SD_DEFINES
+    #define ITF_SD_RING_MAX_BLOCKS 256
+#endif
+
+static portMUX_TYPE itf_sdRingMux = portMUX_INITIALIZER_UNLOCKED;
+
+static uint8_t* itf_sdRingPool = NULL;
+static int itf_sdRingBlockBytes = 0;
+static int itf_sdRingBlocks = 0;
+static int itf_sdRingLen[ITF_SD_RING_MAX_BLOCKS];  //Bytes used in each published block
+static int64_t itf_sdRingPubTime[ITF_SD_RING_MAX_BLOCKS];    //When each block was published
+static uint32_t itf_sdRingPubDrops[ITF_SD_RING_MAX_BLOCKS];  //recordsDropped at that time
+static int itf_sdRingFill = 0;                      //Bytes used in the block at head
+
+static _Atomic uint32_t itf_sdRingHead = 0;         //Blocks published (free-running)
+static _Atomic uint32_t itf_sdRingTail = 0;         //Blocks released by the writer (free-running)
+
+static itf_sdRingStats_t itf_sdRingStats;
+static itf_sdRingNotifyFn itf_sdRingNotify = NULL;
+static int itf_sdRingWake = 0;                      //A block was published under the lock, notify once it's released
+static int itf_sdRingDropWoke = 0;                  //The writer was woken for a full ring since it last freed a block
+
+void itf_sdRingSetNotify(itf_sdRingNotifyFn notify){
+    itf_sdRingNotify = notify;
+}
+
+//Call right after releasing the lock
+static void itf_sdRingWakeWriter(int wake){
+    if(wake && itf_sdRingNotify != NULL){
+        itf_sdRingNotify();
+    }
+}
+
+void itf_sdRingInit(uint8_t* pool, int blockSize, int blockCount){
+    if(blockCount > ITF_SD_RING_MAX_BLOCKS){
+        blockCount = ITF_SD_RING_MAX_BLOCKS;
+    }
+    portENTER_CRITICAL_SAFE(&itf_sdRingMux);
+    itf_sdRingPool = pool;
+    itf_sdRingBlockBytes = blockSize;
+    itf_sdRingBlocks = blockCount;
+    itf_sdRingFill = 0;
+    atomic_store(&itf_sdRingHead, 0);
+    atomic_store(&itf_sdRingTail, 0);
+    memset(&itf_sdRingStats, 0, sizeof(itf_sdRingStats));
+    portEXIT_CRITICAL_SAFE(&itf_sdRingMux);
+}
+
+//Caller holds the lock
+static void itf_sdRingPublish(void){
+    uint32_t head = atomic_load_explicit(&itf_sdRingHead, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&itf_sdRingTail, memory_order_acquire);
+    itf_sdRingLen[head % itf_sdRingBlocks] = itf_sdRingFill;
+    itf_sdRingPubTime[head % itf_sdRingBlocks] = esp_timer_get_time();
+    itf_sdRingPubDrops[head % itf_sdRingBlocks] = itf_sdRingStats.recordsDropped;
+    atomic_store_explicit(&itf_sdRingHead, head + 1, memory_order_release);
+    itf_sdRingFill = 0;
+    itf_sdRingWake = 1;
+    itf_sdRingStats.blocksFilled++;
+    if(head + 1 - tail > itf_sdRingStats.pendingHighWater){
+        itf_sdRingStats.pendingHighWater = head + 1 - tail;
+    }
+}
+
+uint8_t* itf_sdRingBegin(int maxLen, int* offset){
+    portENTER_CRITICAL_SAFE(&itf_sdRingMux);
+    if(itf_sdRingBlocks > 0 && maxLen <= itf_sdRingBlockBytes){
+        if(itf_sdRingFill + maxLen > itf_sdRingBlockBytes){
+            itf_sdRingPublish();
+        }
+        uint32_t head = atomic_load_explicit(&itf_sdRingHead, memory_order_relaxed);
+        uint32_t tail = atomic_load_explicit(&itf_sdRingTail, memory_order_acquire);
+        //The block at head is only ours if the writer is done with it
+        if(head - tail < (uint32_t) itf_sdRingBlocks){
+            *offset = itf_sdRingFill;
+            return itf_sdRingPool + (head % itf_sdRingBlocks)*itf_sdRingBlockBytes + itf_sdRingFill;
+        }
+    }
+    itf_sdRingStats.recordsDropped++;
+    itf_sdRingStats.bytesDropped += maxLen;
+    //Full: a full ring publishes nothing, so this is the only thing that can get a stopped writer going again
+    if(!itf_sdRingDropWoke){
+        itf_sdRingDropWoke = 1;
+        itf_sdRingWake = 1;
+    }
+    int wake = itf_sdRingWake;
+    itf_sdRingWake = 0;
+    portEXIT_CRITICAL_SAFE(&itf_sdRingMux);
+    itf_sdRingWakeWriter(wake);
+    return NULL;
+}
+
+void itf_sdRingEnd(int len){
+    itf_sdRingFill += len;
+    itf_sdRingStats.recordsPushed++;
+    if(itf_sdRingFill == itf_sdRingBlockBytes){
+        itf_sdRingPublish();
+    }
+    int wake = itf_sdRingWake;
+    itf_sdRingWake = 0;
+    portEXIT_CRITICAL_SAFE(&itf_sdRingMux);
+    itf_sdRingWakeWriter(wake);
+}
+
+int itf_sdRingPush(const void* data, int len){
+    int offset;
+    if(len <= 0){
+        return 1;
+    }
+    uint8_t* p = itf_sdRingBegin(len, &offset);
+    if(p == NULL){
+        return 0;
+    }
+    memcpy(p, data, len);
+    itf_sdRingEnd(len);
+    return 1;
+}
+
+void itf_sdRingFlush(void){
+    portENTER_CRITICAL_SAFE(&itf_sdRingMux);
+    uint32_t head = atomic_load_explicit(&itf_sdRingHead, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&itf_sdRingTail, memory_order_acquire);
+    if(itf_sdRingFill > 0 && head - tail < (uint32_t) itf_sdRingBlocks){
+        itf_sdRingPublish();
+    }
+    int wake = itf_sdRingWake;
+    itf_sdRingWake = 0;
+    portEXIT_CRITICAL_SAFE(&itf_sdRingMux);
+    itf_sdRingWakeWriter(wake);
+}
+
+uint8_t* itf_sdRingPeek(int* len){
+    uint32_t tail = atomic_load_explicit(&itf_sdRingTail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&itf_sdRingHead, memory_order_acquire);
+    if(itf_sdRingBlocks == 0 || tail == head){
+        return NULL;
+    }
+    *len = itf_sdRingLen[tail % itf_sdRingBlocks];
+    return itf_sdRingPool + (tail % itf_sdRingBlocks)*itf_sdRingBlockBytes;
+}
+
+void itf_sdRingRelease(void){
+    uint32_t tail = atomic_load_explicit(&itf_sdRingTail, memory_order_relaxed);
+    int64_t wait = esp_timer_get_time() - itf_sdRingPubTime[tail % itf_sdRingBlocks];
+    uint32_t pubDrops = itf_sdRingPubDrops[tail % itf_sdRingBlocks];
+    atomic_store_explicit(&itf_sdRingTail, tail + 1, memory_order_release);
+    //The statistics are the producers' too (and the 64-bit waits are read from the other core), so under the lock
+    portENTER_CRITICAL_SAFE(&itf_sdRingMux);
+    itf_sdRingDropWoke = 0;
+    itf_sdRingStats.blocksWritten++;
+    if(wait > itf_sdRingStats.waitMax_us){
+        itf_sdRingStats.waitMax_us = wait;
+    }
+    //Nothing dropped between this block filling and now: the ring rode out the whole wait
+    if(itf_sdRingStats.recordsDropped == pubDrops && wait > itf_sdRingStats.waitMaxNoLoss_us){
+        itf_sdRingStats.waitMaxNoLoss_us = wait;
+    }
+    portEXIT_CRITICAL_SAFE(&itf_sdRingMux);
+}
+
+int itf_sdRingDrain(itf_sdRingWriteFn write, uint8_t* bounce){
+    int len;
+    uint8_t* block;
+    while((block = itf_sdRingPeek(&len)) != NULL){
+        if(bounce != NULL){
+            memcpy(bounce, block, len);
+            block = bounce;
+        }
+        //Short blocks (from a flush) are zero padded so every write is one whole block
+        if(len < itf_sdRingBlockBytes){
+            memset(block + len, 0, itf_sdRingBlockBytes - len);
+        }
+        if(write(block, itf_sdRingBlockBytes) == 0){
+            return 0;
+        }
+        itf_sdRingRelease();
+    }
+    return 1;
+}
+
+int itf_sdRingPending(void){
+    return (int) (atomic_load(&itf_sdRingHead) - atomic_load(&itf_sdRingTail));
+}
+
+int itf_sdRingBlockCount(void){
+    return itf_sdRingBlocks;
+}
+
+int itf_sdRingBlockSize(void){
+    return itf_sdRingBlockBytes;
+}
+
+void itf_sdRingGetStats(itf_sdRingStats_t* out){
+    portENTER_CRITICAL_SAFE(&itf_sdRingMux);
+    *out = itf_sdRingStats;
+    portEXIT_CRITICAL_SAFE(&itf_sdRingMux);
+}
@@ -0,0 +1,49 @@
+#ifndef ITF_SD_RING_H_
+#define ITF_SD_RING_H_
+
+#include <stdint.h>
+
+//Counters for the SD log ring (reported by the console "stats sd" command)
+typedef struct {
+    uint32_t recordsPushed;
+    uint32_t recordsDropped;        //Records thrown away because every block was waiting for the writer
+    uint32_t bytesDropped;
+    uint32_t blocksFilled;          //Blocks handed to the writer
+    uint32_t blocksWritten;         //Blocks the writer has released
+    uint32_t pendingHighWater;      //Most blocks that were ever waiting for the writer at once
+    int64_t waitMax_us;             //Longest a full block waited for the writer
+    int64_t waitMaxNoLoss_us;       //Longest wait during which nothing was dropped (stall survived)
+} itf_sdRingStats_t;
+
+//Storage write used by itf_sdRingDrain: returns 1 once all len bytes are stored. The block belongs
+//to the writer until then, so it may be finished off in place (e.g. a CRC) before it is stored.
+typedef int (*itf_sdRingWriteFn)(uint8_t* data, int len);
+
+//Called (outside the ring lock, possibly from an ISR) every time a block is handed to the writer
+typedef void (*itf_sdRingNotifyFn)(void);
+
+//pool holds blockCount blocks of blockSize bytes. Records are never split across blocks.
+void itf_sdRingInit(uint8_t* pool, int blockSize, int blockCount);
+void itf_sdRingSetNotify(itf_sdRingNotifyFn notify);
+//Producer side (any task, any core, or an ISR). Returns 1 if stored, 0 if dropped.
+int itf_sdRingPush(const void* data, int len);
+//Encode in place: Begin reserves maxLen bytes and returns where to write them (offset 0 means a
+//fresh block), or NULL if the record has to be dropped. On success the ring stays locked until
+//End(len) commits the bytes actually used, so keep the work in between short.
+uint8_t* itf_sdRingBegin(int maxLen, int* offset);
+void itf_sdRingEnd(int len);
+//Hands the partly filled block to the writer (if it has anything in it)
+void itf_sdRingFlush(void);
+//Writer side (one task only): oldest full block or NULL, then release it once it is on the card
+uint8_t* itf_sdRingPeek(int* len);
+void itf_sdRingRelease(void);
+//Writes out every full block with write(), zero padding short ones to the block size. If bounce is
+//given (one block, e.g. internal DMA capable RAM) each block is copied there first.
+//Returns 0 if write() failed; that block stays queued.
+int itf_sdRingDrain(itf_sdRingWriteFn write, uint8_t* bounce);
+int itf_sdRingPending(void);        //Blocks waiting for the writer
+int itf_sdRingBlockCount(void);
+int itf_sdRingBlockSize(void);
+void itf_sdRingGetStats(itf_sdRingStats_t* out);
+
+#endif
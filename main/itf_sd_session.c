@@ -0,0 +1,138 @@
+//Session file naming, the directory cache and SESSIONS.CSV.
+//The root directory is read once per mount; after that every name we need comes from the cache,
+//so starting a file costs one f_open no matter how many old runs are on the card.
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_timer.h"
+#include "itf_sd_session.h"
+#include "itf_storage.h"
+#include "itf_master_defines.h"
+
+#ifndef ITF_SD_DEFINES
+    #define ITF_SD_DIR_CACHE_MAX 256
+#endif
+
+static itf_sessionFile_t itf_sessionFiles[ITF_SD_DIR_CACHE_MAX];
+static int itf_sessionCount = 0;
+static int itf_sessionScanned = 0;
+static uint16_t itf_sessionMax = 0;         //Highest session number on the card
+static uint16_t itf_sessionNow = 0;         //0 until the first file of this boot
+static uint8_t itf_sessionPart = 0;
+static uint64_t itf_sessionBytes = 0;       //Bytes in the earlier parts of this session
+static int64_t itf_sessionScan_us = 0;
+
+//"S0012_03.BIN" -> 12, 3
+static int itf_sessionParseName(const char* name, uint16_t* session, uint8_t* part){
+    int s, p;
+    char tail[8];
+    if(name[0] != 'S' || strlen(name) != 12 || sscanf(name, "S%4d_%2d.%3s", &s, &p, tail) != 3 || strcmp(tail, "BIN") != 0){
+        return 0;
+    }
+    *session = (uint16_t) s;
+    *part = (uint8_t) p;
+    return 1;
+}
+
+//When the cache is full the oldest session drops out (it is only used for listings)
+static void itf_sessionCacheAdd(uint16_t session, uint8_t part, uint32_t size){
+    int i, oldest = 0;
+    if(itf_sessionCount == ITF_SD_DIR_CACHE_MAX){
+        for(i=1;i<itf_sessionCount;i++){
+            if(itf_sessionFiles[i].session < itf_sessionFiles[oldest].session ||
+               (itf_sessionFiles[i].session == itf_sessionFiles[oldest].session && itf_sessionFiles[i].part < itf_sessionFiles[oldest].part)){
+                oldest = i;
+            }
+        }
+        itf_sessionFiles[oldest] = itf_sessionFiles[--itf_sessionCount];
+    }
+    itf_sessionFiles[itf_sessionCount].session = session;
+    itf_sessionFiles[itf_sessionCount].part = part;
+    itf_sessionFiles[itf_sessionCount].size = size;
+    itf_sessionCount++;
+    if(session > itf_sessionMax){
+        itf_sessionMax = session;
+    }
+}
+
+static void itf_sessionScanFile(const char* name, uint64_t size, void* ctx){
+    uint16_t session;
+    uint8_t part;
+    if(itf_sessionParseName(name, &session, &part)){
+        itf_sessionCacheAdd(session, part, (uint32_t) size);
+    }
+}
+
+int itf_sessionScan(void){
+    int64_t start = esp_timer_get_time();
+
+    itf_sessionCount = 0;
+    if(!itf_storage->list(itf_sessionScanFile, NULL)){
+        return 0;
+    }
+    itf_sessionScanned = 1;
+    itf_sessionScan_us = esp_timer_get_time() - start;
+    return 1;
+}
+
+int itf_sessionNextFile(int newSession, char* name, int nameLen){
+    if(!itf_sessionScanned){
+        return 0;
+    }
+    if(newSession || itf_sessionNow == 0 || itf_sessionPart == 99){
+        itf_sessionNow = (itf_sessionMax >= 9999) ? 1 : itf_sessionMax + 1;
+        itf_sessionPart = 0;
+        itf_sessionBytes = 0;
+    }else{
+        itf_sessionPart++;
+    }
+    itf_sessionCacheAdd(itf_sessionNow, itf_sessionPart, 0);
+    snprintf(name, nameLen, "S%04d_%02d.BIN", itf_sessionNow, itf_sessionPart);
+    return 1;
+}
+
+int itf_sessionFileClosed(uint64_t start_us, uint64_t end_us, double energy_j, uint32_t bytes){
+    itf_storageFile_t* f;
+    char line[160];
+    int i, n, ok;
+
+    for(i=0;i<itf_sessionCount;i++){
+        if(itf_sessionFiles[i].session == itf_sessionNow && itf_sessionFiles[i].part == itf_sessionPart){
+            itf_sessionFiles[i].size = bytes;
+        }
+    }
+    f = itf_storage->open("SESSIONS.CSV", 0);
+    if(f == NULL){
+        return 0;
+    }
+    ok = itf_storage->seek(f, itf_storage->size(f));
+    if(ok && itf_storage->size(f) == 0){
+        n = snprintf(line, sizeof(line), "session,part,file,start_us,duration_ms,energy_j,session_byte_first,session_byte_last\n");
+        ok = itf_storage->write(f, line, n);
+    }
+    n = snprintf(line, sizeof(line), "%u,%u,S%04u_%02u.BIN,%llu,%llu,%.1f,%llu,%llu\n", itf_sessionNow, itf_sessionPart,
+                 itf_sessionNow, itf_sessionPart, (unsigned long long) start_us, (unsigned long long) ((end_us - start_us)/1000),
+                 energy_j, (unsigned long long) itf_sessionBytes, (unsigned long long) (itf_sessionBytes + bytes - 1));
+    itf_sessionBytes += bytes;
+    ok = ok && itf_storage->write(f, line, n);
+    ok &= itf_storage->close(f);
+    return ok;
+}
+
+int itf_sessionCurrent(uint16_t* session, uint8_t* part){
+    *session = itf_sessionNow;
+    *part = itf_sessionPart;
+    return itf_sessionNow != 0;
+}
+
+int itf_sessionFileCount(void){
+    return itf_sessionCount;
+}
+
+const itf_sessionFile_t* itf_sessionFileAt(int i){
+    return (i >= 0 && i < itf_sessionCount) ? &itf_sessionFiles[i] : NULL;
+}
+
+int64_t itf_sessionScanTime_us(void){
+    return itf_sessionScan_us;
+}
@@ -0,0 +1,28 @@
+#ifndef ITF_SD_SESSION_H_
+#define ITF_SD_SESSION_H_
+
+#include <stdint.h>
+
+//Log files are S<session>_<part>.BIN (8.3 names): a new session at every boot and every arm,
+//a new part when a file reaches ITF_SD_ROTATE_SIZE. SESSIONS.CSV gets one line per closed file.
+
+typedef struct {
+    uint16_t session;
+    uint8_t part;
+    uint32_t size;              //At the directory scan, or at close for files written since
+} itf_sessionFile_t;
+
+//Reads the root directory of itf_storage once into the cache. Call after every mount.
+int itf_sessionScan(void);
+//Picks the name for the next log file (new session or next part of the current one) and adds it
+//to the cache, so opening it never needs a stat. Returns 0 if the scan hasn't been done.
+int itf_sessionNextFile(int newSession, char* name, int nameLen);
+//Appends the just closed file to SESSIONS.CSV and updates its cached size
+int itf_sessionFileClosed(uint64_t start_us, uint64_t end_us, double energy_j, uint32_t bytes);
+
+int itf_sessionCurrent(uint16_t* session, uint8_t* part);
+int itf_sessionFileCount(void);
+const itf_sessionFile_t* itf_sessionFileAt(int i);
+int64_t itf_sessionScanTime_us(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef ITF_STORAGE_H_
+#define ITF_STORAGE_H_
+
+#include <stdint.h>
+
+//What the SD writer and the session files need from the storage underneath them.
+//On the board that is FatFs on the SD card (itf_storageSD, itf_storage_sd.c); the host tools
+//plug in a directory or a RAM disk with injected latency and errors (tools/host/host_storage.c).
+//Names are plain 8.3 file names in the root directory. Everything returns 1 on success, 0 on failure.
+
+typedef struct itf_storageFile itf_storageFile_t;     //Defined by each backend
+typedef void (*itf_storageListFn)(const char* name, uint64_t size, void* ctx);
+
+typedef struct {
+    const char* name;
+    int (*mount)(void);
+    void (*unmount)(void);
+    int (*mounted)(void);
+    //create: new empty file (replacing any old one), otherwise open it, creating it if missing. NULL on failure.
+    itf_storageFile_t* (*open)(const char* name, int create);
+    //Existing file, read only. One at a time, on its own handle so it can be used from another
+    //task while the writer has files open (even the same file).
+    itf_storageFile_t* (*openRead)(const char* name);
+    uint64_t (*size)(itf_storageFile_t* f);
+    //Reserve bytes of contiguous space for an empty file; the size stays until truncate
+    int (*expand)(itf_storageFile_t* f, uint64_t bytes);
+    int (*seek)(itf_storageFile_t* f, uint64_t pos);
+    int (*write)(itf_storageFile_t* f, const void* data, int len);
+    int (*read)(itf_storageFile_t* f, void* data, int len);    //All len bytes or failure
+    int (*sync)(itf_storageFile_t* f);
+    int (*truncate)(itf_storageFile_t* f);      //Cut the file at the current position
+    int (*close)(itf_storageFile_t* f);
+    int (*list)(itf_storageListFn fn, void* ctx);
+    int (*remove)(const char* name);
+} itf_storageOps_t;
+
+//The storage the log is written to, set by itf_initSDLogging()
+extern const itf_storageOps_t* itf_storage;
+
+extern const itf_storageOps_t itf_storageSD;
+
+#endif
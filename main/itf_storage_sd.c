@@ -0,0 +1,158 @@
+//itf_storage backend for the SD card: FatFs calls on the drive itf_initSD() mounted.
+//Paths are "<drive>:/<name>" so nothing goes through the VFS layer.
+
+#include <stdio.h>
+#include <string.h>
+#include "ff.h"
+#include "itf_sd_card_setup.h"
+#include "itf_storage.h"
+#include "itf_master_defines.h"
+
+#ifndef ITF_SD_DEFINES
+    #define ITF_SD_USE_SDMMC 0
+#endif
+
+#define ITF_STORAGE_SD_FILES 3     //Log file, SESSIONS.CSV, benchmark file
+
+struct itf_storageFile {
+    FIL fil;
+    int used;
+};
+
+static struct itf_storageFile itf_storageSDFiles[ITF_STORAGE_SD_FILES];
+static struct itf_storageFile itf_storageSDReadFile;    //Only openRead uses it, so no slot race with the writer
+
+static int itf_storageSDPath(char* path, int len, const char* name){
+    int drive = itf_getSDDrive();
+    if(drive < 0){
+        return 0;
+    }
+    snprintf(path, len, "%d:/%s", drive, name);
+    return 1;
+}
+
+static int itf_storageSDMount(void){
+    return itf_initSD();
+}
+
+static int itf_storageSDMounted(void){
+    return itf_getSDDrive() >= 0;
+}
+
+static itf_storageFile_t* itf_storageSDOpen(const char* name, int create){
+    char path[24];
+    int i;
+    if(!itf_storageSDPath(path, sizeof(path), name)){
+        return NULL;
+    }
+    for(i=0;i<ITF_STORAGE_SD_FILES && itf_storageSDFiles[i].used;i++);
+    if(i == ITF_STORAGE_SD_FILES){
+        return NULL;
+    }
+    if(f_open(&itf_storageSDFiles[i].fil, path, FA_WRITE | (create ? FA_CREATE_ALWAYS : FA_OPEN_ALWAYS)) != FR_OK){
+        return NULL;
+    }
+    itf_storageSDFiles[i].used = 1;
+    return &itf_storageSDFiles[i];
+}
+
+//FatFs is built reentrant (one lock per volume), so reads from another task just wait for the
+//writer's current call. FF_FS_LOCK is off (CONFIG_FATFS_FS_LOCK 0), so the file being written can
+//be opened again; the directory entry only points at what was there at its last sync.
+static itf_storageFile_t* itf_storageSDOpenRead(const char* name){
+    char path[24];
+    if(itf_storageSDReadFile.used || !itf_storageSDPath(path, sizeof(path), name)){
+        return NULL;
+    }
+    if(f_open(&itf_storageSDReadFile.fil, path, FA_READ | FA_OPEN_EXISTING) != FR_OK){
+        return NULL;
+    }
+    itf_storageSDReadFile.used = 1;
+    return &itf_storageSDReadFile;
+}
+
+static uint64_t itf_storageSDSize(itf_storageFile_t* f){
+    return f_size(&f->fil);
+}
+
+static int itf_storageSDExpand(itf_storageFile_t* f, uint64_t bytes){
+    #if FF_USE_EXPAND
+        return f_expand(&f->fil, (FSIZE_t) bytes, 1) == FR_OK;
+    #else
+        return 0;
+    #endif
+}
+
+static int itf_storageSDSeek(itf_storageFile_t* f, uint64_t pos){
+    return f_lseek(&f->fil, (FSIZE_t) pos) == FR_OK;
+}
+
+static int itf_storageSDWrite(itf_storageFile_t* f, const void* data, int len){
+    UINT written = 0;
+    return f_write(&f->fil, data, len, &written) == FR_OK && written == (UINT) len;
+}
+
+static int itf_storageSDRead(itf_storageFile_t* f, void* data, int len){
+    UINT got = 0;
+    return f_read(&f->fil, data, len, &got) == FR_OK && got == (UINT) len;
+}
+
+static int itf_storageSDSync(itf_storageFile_t* f){
+    return f_sync(&f->fil) == FR_OK;
+}
+
+static int itf_storageSDTruncate(itf_storageFile_t* f){
+    return f_truncate(&f->fil) == FR_OK;
+}
+
+//The slot is given back even if the close fails (the mount is redone after an error anyway)
+static int itf_storageSDClose(itf_storageFile_t* f){
+    int ok = (f_close(&f->fil) == FR_OK);
+    f->used = 0;
+    return ok;
+}
+
+static int itf_storageSDList(itf_storageListFn fn, void* ctx){
+    DIR dir;
+    FILINFO fno;
+    char path[4];
+    int drive = itf_getSDDrive();
+    if(drive < 0){
+        return 0;
+    }
+    snprintf(path, sizeof(path), "%d:", drive);
+    if(f_opendir(&dir, path) != FR_OK){
+        return 0;
+    }
+    while(f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != 0){
+        if(!(fno.fattrib & AM_DIR)){
+            fn(fno.fname, fno.fsize, ctx);
+        }
+    }
+    f_closedir(&dir);
+    return 1;
+}
+
+static int itf_storageSDRemove(const char* name){
+    char path[24];
+    return itf_storageSDPath(path, sizeof(path), name) && f_unlink(path) == FR_OK;
+}
+
+const itf_storageOps_t itf_storageSD = {
+    .name = ITF_SD_USE_SDMMC ? "sdmmc4" : "spi",
+    .mount = itf_storageSDMount,
+    .unmount = itf_turnoffSD,
+    .mounted = itf_storageSDMounted,
+    .open = itf_storageSDOpen,
+    .openRead = itf_storageSDOpenRead,
+    .size = itf_storageSDSize,
+    .expand = itf_storageSDExpand,
+    .seek = itf_storageSDSeek,
+    .write = itf_storageSDWrite,
+    .read = itf_storageSDRead,
+    .sync = itf_storageSDSync,
+    .truncate = itf_storageSDTruncate,
+    .close = itf_storageSDClose,
+    .list = itf_storageSDList,
+    .remove = itf_storageSDRemove,
+};
@@ -0,0 +1,231 @@
+//Binary trace log, see itf_trace.h.
+//The ring is a bounded multi-producer queue: a producer claims a slot by moving the head with a
+//compare-and-swap, fills it, then publishes it through the slot's sequence word. The drain task
+//only ever touches the tail. There is no lock, so an ISR can trace while a task on the same core
+//is in the middle of its own message (the drain just waits for that slot to be published).
+//Sequence words are kept relative to the lap (pos & ~mask), so the all-zero .bss ring is already
+//valid and messages traced before itf_trace_task starts are kept.
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include "esp_attr.h"
+#include "driver/uart.h"
+#include "ctrl_subsystem.h"
+#include "itf_sd_card_writer.h"
+#include "itf_master_defines.h"
+#include "itf_trace.h"
+
+#define ITF_TRACE_LINE_MAX 80
+#define ITF_TRACE_BENCH_SLOTS 64
+
+typedef struct {
+    volatile uint32_t seq;      //lap: free for the producer at pos, lap+1: published
+    uint16_t id;
+    uint8_t n;
+    uint8_t spare;
+    uint64_t time_us;
+    uint32_t args[ITF_TRACE_MAX_ARGS];
+} itf_traceSlot_t;
+
+typedef struct {
+    uint32_t head;              //Next position to claim (producers)
+    uint32_t tail;              //Next position to drain (drain task)
+    uint32_t mask;
+    itf_traceSlot_t* slots;
+} itf_traceRing_t;
+
+static itf_traceSlot_t itf_traceSlots[ITF_TRACE_SLOTS];
+static itf_traceRing_t itf_traceRing = {0, 0, ITF_TRACE_SLOTS - 1, itf_traceSlots};
+static itf_traceStats_t itf_traceStats;
+static volatile int itf_traceSinks = ITF_TRACE_SINKS;
+static uint32_t itf_traceDropsReported = 0;
+
+//******************************* Ring
+static inline int itf_traceRingPut(itf_traceRing_t* r, uint64_t now, uint16_t id, int n,
+                                   uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3){
+    uint32_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    itf_traceSlot_t* s;
+    while(1){
+        s = &r->slots[pos & r->mask];
+        int32_t diff = (int32_t) (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) - (pos & ~r->mask));
+        if(diff == 0){
+            if(__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+                break;
+            }
+        }else if(diff < 0){
+            return 0;           //Slot still holds last lap's message: ring full
+        }else{
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+    s->id = id;
+    s->n = (uint8_t) n;
+    s->time_us = now;
+    s->args[0] = a0;
+    s->args[1] = a1;
+    s->args[2] = a2;
+    s->args[3] = a3;
+    __atomic_store_n(&s->seq, (pos & ~r->mask) + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline int itf_traceRingGet(itf_traceRing_t* r, itf_traceMsg_t* msg){
+    uint32_t pos = r->tail;
+    itf_traceSlot_t* s = &r->slots[pos & r->mask];
+    if(__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != (pos & ~r->mask) + 1){
+        return 0;
+    }
+    msg->id = s->id;
+    msg->n = (s->n <= ITF_TRACE_MAX_ARGS) ? s->n : ITF_TRACE_MAX_ARGS;
+    msg->time_us = s->time_us;
+    memcpy(msg->args, s->args, sizeof(msg->args));
+    __atomic_store_n(&s->seq, (pos & ~r->mask) + r->mask + 1, __ATOMIC_RELEASE);
+    r->tail = pos + 1;
+    return 1;
+}
+
+void IRAM_ATTR itf_tracePut(uint16_t id, int n, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3){
+    if(itf_traceRingPut(&itf_traceRing, esp_timer_get_time(), id, n, a0, a1, a2, a3)){
+        __atomic_fetch_add(&itf_traceStats.put, 1, __ATOMIC_RELAXED);
+    }else{
+        __atomic_fetch_add(&itf_traceStats.dropped, 1, __ATOMIC_RELAXED);
+    }
+}
+
+int itf_traceGet(itf_traceMsg_t* msg){
+    return itf_traceRingGet(&itf_traceRing, msg);
+}
+
+//******************************* Drain
+int itf_traceFormatLine(char* out, int size, const itf_traceMsg_t* msg){
+    int len = snprintf(out, size, "trc %llu %u", (unsigned long long) msg->time_us, (unsigned) msg->id);
+    int i;
+    for(i=0;i<msg->n && len < size;i++){
+        len += snprintf(out + len, size - len, " %lx", (unsigned long) msg->args[i]);
+    }
+    return (len < size) ? len : size - 1;
+}
+
+static void itf_traceSend(const itf_traceMsg_t* msg, int sinks){
+    if(sinks & ITF_TRACE_SINK_SD){
+        itf_addTraceToSD(msg->time_us, msg->id, msg->args, msg->n);
+    }
+    if(sinks & ITF_TRACE_SINK_UART){
+        char line[ITF_TRACE_LINE_MAX];
+        int len = itf_traceFormatLine(line, sizeof(line) - 2, msg);
+        line[len++] = '\r';
+        line[len++] = '\n';
+        uart_write_bytes(UART_NUM_0, line, len);
+    }
+}
+
+void itf_traceDrain(void){
+    itf_traceMsg_t msg;
+    int sinks = itf_traceSinks;
+    uint32_t waiting = __atomic_load_n(&itf_traceRing.head, __ATOMIC_RELAXED) - itf_traceRing.tail;
+    if(waiting > itf_traceStats.highWater){
+        itf_traceStats.highWater = waiting;
+    }
+    while(itf_traceGet(&msg)){
+        itf_traceStats.drained++;
+        itf_traceSend(&msg, sinks);
+    }
+    //Drops are reported after the messages that made it, so they land where the gap was
+    uint32_t dropped = __atomic_load_n(&itf_traceStats.dropped, __ATOMIC_RELAXED);
+    if(dropped != itf_traceDropsReported){
+        memset(&msg, 0, sizeof(msg));
+        msg.time_us = esp_timer_get_time();
+        msg.id = ITF_TRC_TRACE_DROPPED;
+        msg.n = 1;
+        msg.args[0] = dropped - itf_traceDropsReported;
+        itf_traceDropsReported = dropped;
+        itf_traceSend(&msg, sinks);
+    }
+}
+
+void itf_trace_task(void* params){
+    while(1){
+        vTaskDelay(pdMS_TO_TICKS(ITF_TRACE_DRAIN_MS));
+        itf_traceDrain();
+    }
+}
+
+void itf_traceSetSinks(int sinks){
+    itf_traceSinks = sinks;
+}
+
+int itf_traceGetSinks(void){
+    return itf_traceSinks;
+}
+
+void itf_traceGetStats(itf_traceStats_t* stats){
+    *stats = itf_traceStats;
+}
+
+//******************************* Benchmark
+//Runs on a private ring, so nothing reaches the sinks. Timestamps are taken per call like
+//itf_tracePut does. snprintf stands in for what ESP_LOGE spent formatting the same message
+//before it even reached the UART.
+void itf_traceBenchmark(int calls){
+    static itf_traceSlot_t slots[ITF_TRACE_BENCH_SLOTS];
+    itf_traceRing_t ring = {0, 0, ITF_TRACE_BENCH_SLOTS - 1, slots};
+    itf_traceMsg_t msg;
+    char line[128];
+    float cur[3] = {41.5f, 12.25f, 0.75f};
+    uint64_t t0, t1, t4, tf;
+    int i;
+
+    if(calls < ITF_TRACE_BENCH_SLOTS) { calls = ITF_TRACE_BENCH_SLOTS; }
+    calls -= calls % ITF_TRACE_BENCH_SLOTS;
+    memset(slots, 0, sizeof(slots));
+
+    t0 = t1 = t4 = tf = 0;
+    for(i=0;i<calls;i++){
+        uint32_t a = esp_cpu_get_cycle_count();
+        itf_traceRingPut(&ring, esp_timer_get_time(), ITF_TRC_CTRL_ARMED, 0, 0, 0, 0, 0);
+        uint32_t b = esp_cpu_get_cycle_count();
+        itf_traceRingPut(&ring, esp_timer_get_time(), ITF_TRC_CTRL_BAT_OVERCURRENT, 4, itf_traceF(cur[0]+cur[1]+cur[2]),
+                         itf_traceF(cur[0]), itf_traceF(cur[1]), itf_traceF(cur[2]));
+        uint32_t c = esp_cpu_get_cycle_count();
+        t0 += b - a;
+        t4 += c - b;
+        if((i % (ITF_TRACE_BENCH_SLOTS/4)) == (ITF_TRACE_BENCH_SLOTS/4) - 1){   //Two messages per loop
+            while(itf_traceRingGet(&ring, &msg)) { }
+        }
+    }
+    //Empty loop cost, so the numbers are the calls alone
+    for(i=0;i<calls;i++){
+        uint32_t a = esp_cpu_get_cycle_count();
+        uint32_t b = esp_cpu_get_cycle_count();
+        t1 += b - a;
+    }
+    for(i=0;i<calls/16;i++){
+        uint32_t a = esp_cpu_get_cycle_count();
+        snprintf(line, sizeof(line), "ERROR: BATTERY OVERCURRENT (%f). PHASE CURRENTS WERE: %f\t%f\t%f)",
+                 (double) (cur[0]+cur[1]+cur[2]), (double) cur[0], (double) cur[1], (double) cur[2]);
+        tf += esp_cpu_get_cycle_count() - a;
+    }
+    double overhead = ((double) t1)/calls;
+    double put0 = ((double) t0)/calls - overhead;
+    double put4 = ((double) t4)/calls - overhead;
+    double fmt4 = ((double) tf)/(calls/16) - overhead;
+
+    ctrl_isrStats_t isr;
+    ctrl_getHallIsrStats(&isr);
+    double isrAvg = (isr.edges > 0) ? ((double) isr.cyclesTotal)/isr.edges : 0.0;
+    #ifdef ESP_PLATFORM
+        printf("trace_bench calls=%d put0_cycles=%.1f put4_cycles=%.1f snprintf4_cycles=%.0f speedup=%.0fx\n",
+               calls, put0, put4, fmt4, fmt4/(put4 > 1.0 ? put4 : 1.0));
+        printf("trace_bench hall_isr_edges=%lu isr_avg_cycles=%.0f isr_max_cycles=%lu isr_max_us=%.2f\n",
+               (unsigned long) isr.edges, isrAvg, (unsigned long) isr.cyclesMax, ((double) isr.cyclesMax)/CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ);
+    #else
+        printf("trace_bench calls=%d put0_ns=%.1f put4_ns=%.1f snprintf4_ns=%.0f speedup=%.0fx\n",
+               calls, put0, put4, fmt4, fmt4/(put4 > 1.0 ? put4 : 1.0));
+        printf("trace_bench hall_isr_edges=%lu isr_avg_ns=%.0f isr_max_ns=%lu\n",
+               (unsigned long) isr.edges, isrAvg, (unsigned long) isr.cyclesMax);
+    #endif
+}
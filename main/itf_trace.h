@@ -0,0 +1,80 @@
+#ifndef ITF_TRACE_H_
+#define ITF_TRACE_H_
+
+#include <stdint.h>
+#include "itf_master_defines.h"
+#include "itf_trace_ids.h"
+
+//Binary trace log for the hot paths (control task safety branches, ISRs, the MCU link).
+//A call site stores a message ID from itf_trace_ids.h, a timestamp and up to ITF_TRACE_MAX_ARGS raw
+//argument words in a lock-free ring; nothing is formatted on the board:
+//  ITF_TRACE1(CTRL_UNDERVOLT, itf_traceF(ctrl_batVolt));
+//itf_trace_task (low priority) drains the ring to the session log (trace records, see
+//itf_log_codec.h) and/or UART0 as one "trc <time_us> <id> <hex words>" line per message.
+//tools/host/trace_decode.c turns either back into text.
+//Safe from any task, either core or an ISR. A full ring drops the message (counted, and reported
+//by a TRACE_DROPPED message once there is room again).
+
+#ifndef ITF_TRACE_DEFINES
+    #define ITF_TRACE_ENABLE 1
+    #define ITF_TRACE_SLOTS 256
+    #define ITF_TRACE_DRAIN_MS 50
+    #define ITF_TRACE_SINKS (ITF_TRACE_SINK_SD | ITF_TRACE_SINK_UART)
+#endif
+
+#define ITF_TRACE_MAX_ARGS 4
+#define ITF_TRACE_SINK_SD   1
+#define ITF_TRACE_SINK_UART 2
+
+typedef struct {
+    uint64_t time_us;
+    uint16_t id;
+    uint8_t n;
+    uint32_t args[ITF_TRACE_MAX_ARGS];
+} itf_traceMsg_t;
+
+typedef struct {
+    uint32_t put;               //Messages stored
+    uint32_t dropped;           //Messages lost to a full ring
+    uint32_t drained;
+    uint32_t highWater;         //Most messages ever waiting at a drain
+} itf_traceStats_t;
+
+static inline uint32_t itf_traceF(float f){
+    union { float f; uint32_t u; } v;
+    v.f = f;
+    return v.u;
+}
+#define ITF_TRACE_I(x) ((uint32_t) (int32_t) (x))
+
+void itf_tracePut(uint16_t id, int n, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3);
+
+#if ITF_TRACE_ENABLE
+    #define ITF_TRACE0(id)              itf_tracePut(ITF_TRC_##id, 0, 0, 0, 0, 0)
+    #define ITF_TRACE1(id, a)           itf_tracePut(ITF_TRC_##id, 1, (a), 0, 0, 0)
+    #define ITF_TRACE2(id, a, b)        itf_tracePut(ITF_TRC_##id, 2, (a), (b), 0, 0)
+    #define ITF_TRACE3(id, a, b, c)     itf_tracePut(ITF_TRC_##id, 3, (a), (b), (c), 0)
+    #define ITF_TRACE4(id, a, b, c, d)  itf_tracePut(ITF_TRC_##id, 4, (a), (b), (c), (d))
+#else
+    #define ITF_TRACE0(id)              ((void) 0)
+    #define ITF_TRACE1(id, a)           ((void) 0)
+    #define ITF_TRACE2(id, a, b)        ((void) 0)
+    #define ITF_TRACE3(id, a, b, c)     ((void) 0)
+    #define ITF_TRACE4(id, a, b, c, d)  ((void) 0)
+#endif
+
+//Drain side (one task only): oldest message, 1 if there was one
+int itf_traceGet(itf_traceMsg_t* msg);
+//Passes everything waiting to the enabled sinks. Called by itf_trace_task.
+void itf_traceDrain(void);
+void itf_trace_task(void* params);
+void itf_traceSetSinks(int sinks);
+int itf_traceGetSinks(void);
+void itf_traceGetStats(itf_traceStats_t* stats);
+//"trc ..." line for the UART sink, returns its length (no line end)
+int itf_traceFormatLine(char* out, int size, const itf_traceMsg_t* msg);
+
+//Prints the cost of a trace call next to formatting the same message, and the hall ISR times
+void itf_traceBenchmark(int calls);
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef ITF_TRACE_IDS_H_
+#define ITF_TRACE_IDS_H_
+
+//Trace message table (see itf_trace.h). The firmware only ever stores a message's ID and its
+//argument words; the tag, level and format are here for the host decoder, tools/host/trace_decode.c,
+//which builds its string table from this list ("trace_decode --table" prints it).
+//IDs are positions in the list: only append, and leave retired messages where they are, so logs
+//written by older firmware still decode.
+//Every conversion takes one argument word: %d %i (int32), %u %x %X (uint32), %c, %f %e %g (float,
+//pass it through itf_traceF()).
+//X(name, tag, level, format)      level: 'E' error, 'W' warning, 'I' info
+#define ITF_TRACE_TABLE(X) \
+    X(TRACE_DROPPED,          "TRACE",  'W', "%u trace messages dropped (ring full)") \
+    X(CTRL_NONZERO_THROTTLE,  "CTRL",   'E', "ERROR: NONZERO STARTING THROTTLE (%d)") \
+    X(CTRL_HALL_WIRE_START,   "CTRL",   'E', "ERROR: HALL WIRING ISSUE (digital '000' or '111')(%d)") \
+    X(CTRL_UNDERVOLT,         "CTRL",   'E', "ERROR: BATTERY UNDERVOLTAGE (%f)") \
+    X(CTRL_OVERVOLT,          "CTRL",   'E', "ERROR: BATTERY OVERVOLTAGE (%f)") \
+    X(CTRL_ARMED,             "CTRL",   'I', "*****MOTOR ARMED*****") \
+    X(CTRL_HALL_WIRE,         "CTRL",   'E', "ERROR: HALL WIRING (%d)") \
+    X(CTRL_HALL_SEQUENCE,     "CTRL",   'E', "ERROR: TOO MANY HALL SEQUENCE FAILURES (%d). CHECK WIRING AND RESTART") \
+    X(CTRL_BAT_OVERCURRENT,   "CTRL",   'E', "ERROR: BATTERY OVERCURRENT (%f). PHASE CURRENTS WERE: %f\t%f\t%f)") \
+    X(CTRL_PHASE_OVERCURRENT, "CTRL",   'E', "ERROR: PHASE OVERCURRENT (%f\t%f\t%f)") \
+    X(CTRL_OVERHEAT,          "CTRL",   'E', "ERROR: MOSFET OVERHEAT (%f\t%f\t%f)") \
+    X(CTRL_DISARMED_SAFETY,   "CTRL",   'I', "*****MOTOR DISARMED (SAFETY)*****") \
+    X(CTRL_DISARMED_NORMAL,   "CTRL",   'I', "*****MOTOR DISARMED (NORMAL)*****") \
+    X(CTRL_HALL_SKIP,         "CTRL",   'W', "Skipped commutation: hall %d, expected %d") \
+    X(COM_MCU_TX,             "COM",    'I', "Wrote %d bytes") \
+    X(COM_MCU_RX,             "MCU",    'I', "Decoded message %x") \
+    X(COM_MCU_CRC,            "MCU",    'W', "CRC mismatch on %x, correct CRC format would be %x") \
+    X(COM_DIR,                "itf_dirHandler", 'I', "Dir0 = %d, Dir1 = %d") \
+    X(CTRL_SENSORLESS_ON,     "CTRL",   'I', "Sensorless commutation at %f mph") \
+    X(CTRL_SENSORLESS_OFF,    "CTRL",   'I', "Hall commutation at %f mph (reason %d)") \
+    X(CTRL_SENSORLESS_HALL,   "CTRL",   'W', "Hall fault while sensorless (%d), halls are needed again under the handover speed") \
+    X(CTRL_PWM_STEP,          "CTRL",   'I', "PWM %d Hz, %d bit")
+
+#define ITF_TRACE_ENUM(name, tag, level, fmt) ITF_TRC_##name,
+enum {
+    ITF_TRACE_TABLE(ITF_TRACE_ENUM)
+    ITF_TRC_COUNT
+};
+#undef ITF_TRACE_ENUM
+
+#endif
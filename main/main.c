@@ -10,6 +10,7 @@
 #include "freertos/task.h"
 #include "esp_chip_info.h"
 #include "esp_flash.h"
+#include "nvs_flash.h"
 
 
 #include "ctrl_subsystem.h"
@@ -17,6 +18,7 @@
 #include "itf_com_funcs.h"
 #include "itf_sd_card_writer.h"
 #include "itf_sd_card_setup.h"
+#include "itf_trace.h"
 
 //#ifndef CTRL_SUBSYSTEM_H_
 //#include "ctrl_subsystem.h"
@@ -33,13 +35,24 @@
 
 void app_main(void)
 {
+    //Non-volatile storage holds the tuned speed gains (ctrl_autotune.c)
+    esp_err_t nvsErr = nvs_flash_init();
+    if (nvsErr == ESP_ERR_NVS_NO_FREE_PAGES || nvsErr == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        nvsErr = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(nvsErr);
+
     itf_initDirPins();
     itf_initHex();
+    itf_initSDLogging(&itf_storageSD);
     init_control_subsystem();
     
     xTaskCreate(PCComTask,"PCTask",1024*20,NULL,configMAX_PRIORITIES-1,NULL);
     xTaskCreate(MCUComTask,"MCUTask",1024*20,NULL,configMAX_PRIORITIES,NULL);
+    xTaskCreate(MCUTelemetryTask,"TlmTask",1024*4,NULL,configMAX_PRIORITIES-1,NULL);
     xTaskCreatePinnedToCore(itf_writeSD_task,"SDTask",1024*50,NULL,configMAX_PRIORITIES-2,NULL,0);
+    xTaskCreate(itf_trace_task,"TraceTask",1024*4,NULL,tskIDLE_PRIORITY+1,NULL);
 
     //init_control_subsystem();   //Single line to initialize and run the control subsystem. Comment out when not needed.
 }
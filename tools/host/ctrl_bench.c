@@ -0,0 +1,1160 @@
+//Closed loop benches for the motor controller: the real ctrl_subsystem.c on virtual time against the car, motor and
+//battery in plant_sim.c. Every PWM period the plant's currents and battery voltage go into ctrl_curA/B/C and
+//ctrl_batVolt and the current loop timer fires; every ctrl_SCHED_TICK_PERIOD the operational task runs a tick;
+//hall edges go through the hall ISR as the plant crosses them. The duty the plant sees is what the LEDC shim holds,
+//so it is the output stage's view, after every limit.
+//
+//Build from the repo root:
+//  gcc -O2 -Wall -Wno-format -pthread -Itools/host/shim -Itools/host -Imain -o ctrl_bench
+//      tools/host/ctrl_bench.c tools/host/plant_sim.c tools/host/shim/host_hal.c tools/host/shim/host_sd_stub.c
+//      main/ctrl_subsystem.c main/ctrl_speed_pi.c main/ctrl_autotune.c main/ctrl_params.c main/ctrl_sensorless.c main/ctrl_pwm.c
+//      main/itf_seven_seg.c main/itf_log_policy.c main/itf_log_codec.c main/itf_crc.c main/itf_sd_ring.c main/itf_trace.c -lm
+//
+//  ./ctrl_bench torque [--laps n] [--burn-a A]    duty vs torque throttle: launch current, step overshoot, energy per lap
+//  ./ctrl_bench speed                             PI vs the old P speed control: engage bump, settling, energy per step
+//  ./ctrl_bench tune                              relay tune on a stand: Ku/Tu against the true speed, time to tune,
+//                                                 gains kept over a reboot, then the speed steps with the tuned gains
+//  ./ctrl_bench param                             live parameter changes: tick boundary swap, derived values, limits,
+//                                                 rejected sets, NVS over a reboot
+//  ./ctrl_bench bemf [--noise V] [--spikes share] [--hall-lag us]
+//                                                 sensorless commutation on noisy terminal voltages: hand over and back,
+//                                                 commutation angle vs the halls, halls unplugged at cruise
+//  ./ctrl_bench pwm                               PWM frequency from the loss model vs pwm_hz throughout, over a drive
+//                                                 cycle: switching and ripple loss, ripple peak, duty at each resolution
+//Exit status is 1 if a bench's pass condition fails, 2 on bad arguments.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "host_hal.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ctrl_subsystem.h"
+#include "ctrl_speed_pi.h"
+#include "ctrl_params.h"
+#include "plant_sim.h"
+
+//Controller internals the bench drives directly (sensor inputs) or needs for stepping
+extern double ctrl_batVolt, ctrl_curA, ctrl_curB, ctrl_curC, ctrl_tempA, ctrl_tempB, ctrl_tempC;
+extern double ctrl_phaseVoltA, ctrl_phaseVoltB, ctrl_phaseVoltC;
+extern const uint8_t ctrl_hall_input_table[6];
+extern esp_timer_handle_t ctrl_speed_control_timer;
+extern esp_timer_handle_t ctrl_current_loop_timer;
+extern esp_timer_handle_t ctrl_commutation_timer;
+extern TaskHandle_t ctrl_operational_task_handle;
+extern ctrl_speedPi_t ctrl_speed_pi;
+extern const char* host_nvsPath;
+
+#define PWM_US 100                  //1000000/pwm_hz (ctrl_params.c default)
+#define BASE_TICK_US 1000           //ctrl_SCHED_TICK_PERIOD
+#define HALL_PIN_A 42
+#define HALL_PIN_B 41
+#define HALL_PIN_C 40
+#define LOW_PIN_A 4                 //Low side gate outputs (ctrl_MSFT_AL/BL/CL)
+#define LOW_PIN_B 6
+#define LOW_PIN_C 15
+
+static int64_t wall_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+//---------------------------------------------------------------- Virtual time and stepping
+
+static uint64_t vt_us = 0;
+static int64_t virtualTime(void) { return (int64_t) vt_us; }
+
+static plant_t plant;
+static uint8_t gpioHall = 0;
+
+static void setHall(uint8_t hall){
+    uint8_t changed = (uint8_t) (hall ^ gpioHall);
+    host_gpioLevel[HALL_PIN_A] = hall & 1;
+    host_gpioLevel[HALL_PIN_B] = (hall >> 1) & 1;
+    host_gpioLevel[HALL_PIN_C] = (hall >> 2) & 1;
+    gpioHall = hall;
+    if(changed){
+        host_gpioTriggerIsr((changed & 2) ? HALL_PIN_B : (changed & 4) ? HALL_PIN_C : HALL_PIN_A);
+    }
+}
+
+//What the sensors read: the conducting high and low phase both carry the phase current
+static void sensors(void){
+    ctrl_curA = plant.i_ph;
+    ctrl_curB = plant.i_ph;
+    ctrl_curC = 0;
+    ctrl_batVolt = plant.vbat;
+    ctrl_tempA = ctrl_tempB = ctrl_tempC = 120.0;
+}
+
+//High side duty (0-1) as the LEDC shim has it: only one high side is on at a time
+static double outputDuty(void){
+    uint32_t d = host_ledcDuty[0];
+    int bits = (host_ledcResolution > 0) ? host_ledcResolution : 12;
+    if(host_ledcDuty[1] > d) { d = host_ledcDuty[1]; }
+    if(host_ledcDuty[2] > d) { d = host_ledcDuty[2]; }
+    return ((double) d)/(double) (1u << bits);
+}
+
+static void startController(const plant_cfg_t* cfg){
+    vt_us = 0;
+    host_timeSource_us = virtualTime;
+    host_timerManual = 1;
+    host_logLevel = -1;
+    plant_init(&plant, cfg);
+    gpioHall = ctrl_hall_input_table[0];
+    host_gpioLevel[HALL_PIN_A] = gpioHall & 1;
+    host_gpioLevel[HALL_PIN_B] = (gpioHall >> 1) & 1;
+    host_gpioLevel[HALL_PIN_C] = (gpioHall >> 2) & 1;
+    sensors();
+    init_control_subsystem();
+    host_taskWaitIdle(ctrl_operational_task_handle);
+    //Off the test presets: throttle control from zero, going forward
+    ctrl_turnOffSpeedControl();
+    ctrl_setThrottle(0);
+    ctrl_setDirection(1);
+}
+
+//One PWM period: current loop, plant, hall edges, and the base tick when one is due
+static void stepPwm(void){
+    double frac = 0;
+    uint64_t t0 = vt_us;
+    sensors();
+    host_timerFire(ctrl_current_loop_timer);
+    plant.pwm_hz = host_ledcFreq;       //For the switching and ripple losses; the current loop keeps PWM_US
+    int edges = plant_step(&plant, outputDuty(), PWM_US/1e6, &frac);
+    while(edges-- > 0){
+        vt_us = t0 + (uint64_t) (frac*PWM_US);
+        plant.hallIdx = (plant.hallIdx + 1) % 6;
+        setHall(ctrl_hall_input_table[plant.hallIdx]);
+    }
+    vt_us = t0 + PWM_US;
+    if(vt_us % BASE_TICK_US == 0){
+        sensors();
+        host_timerFire(ctrl_speed_control_timer);
+        host_taskWaitIdle(ctrl_operational_task_handle);
+    }
+}
+
+//Each scenario gets a fresh controller in its own process (the firmware has no way to stop its tasks).
+//Results come back through memory shared with the parent.
+static void* sharedAlloc(size_t size){
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED){
+        perror("mmap");
+        exit(2);
+    }
+    memset(p, 0, size);
+    return p;
+}
+
+static int runScenario(int (*fn)(void* ctx), void* ctx){
+    int status = 0;
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid == 0){
+        int rc = fn(ctx);
+        fflush(stdout);
+        _exit(rc);
+    }
+    if(pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status)){
+        return 1;
+    }
+    return WEXITSTATUS(status);
+}
+
+static void runFor(double s){
+    uint64_t end = vt_us + (uint64_t) (s*1e6);
+    while(vt_us < end){
+        stepPwm();
+    }
+}
+
+//---------------------------------------------------------------- torque: duty vs torque throttle
+
+#define TQ_FULL_THROTTLE_A 30.0     //tq_full_a parameter
+#define TQ_PHASE_LIMIT_A   30.0     //ph_lim_a parameter
+#define TQ_BURN_S 20.0
+#define TQ_LAP_S 60.0
+
+typedef struct {
+    double phasePeak, busPeak;
+    double energy_j, dist_m;
+    double limited_s;
+} lapStats_t;
+
+//One burn and coast lap: throttle held for TQ_BURN_S, then closed
+static void lap(uint16_t throttle, lapStats_t* st){
+    double e0 = plant.energy_j, d0 = plant.dist_m;
+    uint64_t end = vt_us + (uint64_t) (TQ_LAP_S*1e6), burnEnd = vt_us + (uint64_t) (TQ_BURN_S*1e6);
+    memset(st, 0, sizeof(*st));
+    ctrl_setThrottle(throttle);
+    while(vt_us < end){
+        if(vt_us == burnEnd){
+            ctrl_setThrottle(0);
+        }
+        stepPwm();
+        if(plant.i_ph > st->phasePeak) { st->phasePeak = plant.i_ph; }
+        if(plant.i_bus > st->busPeak) { st->busPeak = plant.i_bus; }
+        if(ctrl_isCurrentLimited()) { st->limited_s += PWM_US/1e6; }
+    }
+    st->energy_j = plant.energy_j - e0;
+    st->dist_m = plant.dist_m - d0;
+}
+
+//Throttle step in torque mode while rolling: bus current overshoot over the new target and 2% settling time.
+//The bus current is averaged over 1 ms, what a current sensor with a sensible filter would show.
+static void torqueStep(uint16_t from, uint16_t to, double* overshootPct, double* settle_ms){
+    double target = to*TQ_FULL_THROTTLE_A/4096.0, avg = 0, peak = 0;
+    uint64_t t0, lastOut = 0;
+    int n = 0;
+    ctrl_setThrottle(from);
+    runFor(2.0);
+    t0 = vt_us;
+    ctrl_setThrottle(to);
+    while(vt_us < t0 + 300000){
+        stepPwm();
+        avg += plant.i_bus;
+        if(++n == BASE_TICK_US/PWM_US){
+            avg /= n;
+            if(avg > peak) { peak = avg; }
+            if(fabs(avg - target) > 0.02*target) { lastOut = vt_us; }
+            avg = 0;
+            n = 0;
+        }
+    }
+    *overshootPct = (peak > target) ? (peak - target)/target*100.0 : 0.0;
+    *settle_ms = (lastOut > t0) ? (lastOut - t0)/1000.0 : 0.0;
+}
+
+typedef struct {
+    int mode;
+    int laps;
+    lapStats_t sum;
+    double overshootPct, settle_ms, speed_mph;
+} torqueRun_t;
+
+#define TQ_DUTY_THROTTLE 2400       //What a driver holds for a burn in duty mode
+static double tqBurn_A = 6.0;       //Torque mode burn current (--burn-a): about the lap distance duty mode makes
+
+static int torqueLaps(void* ctx){
+    torqueRun_t* r = (torqueRun_t*) ctx;
+    lapStats_t st;
+    int i;
+    startController(NULL);
+    ctrl_setThrottleMode(r->mode);
+    runFor(0.05);
+    for(i=0;i<r->laps;i++){
+        lap(r->mode ? (uint16_t) (tqBurn_A/TQ_FULL_THROTTLE_A*4096.0) : TQ_DUTY_THROTTLE, &st);
+        printf("torque_bench mode=%s lap=%d phase_peak_A=%.1f bus_peak_A=%.1f limited_s=%.2f energy_kJ=%.2f dist_m=%.0f Wh_per_km=%.2f\n",
+               r->mode ? "torque" : "duty", i + 1, st.phasePeak, st.busPeak, st.limited_s, st.energy_j/1000.0, st.dist_m,
+               (st.dist_m > 0) ? st.energy_j/3.6/st.dist_m : 0.0);
+        if(st.phasePeak > r->sum.phasePeak) { r->sum.phasePeak = st.phasePeak; }
+        if(st.busPeak > r->sum.busPeak) { r->sum.busPeak = st.busPeak; }
+        r->sum.energy_j += st.energy_j;
+        r->sum.dist_m += st.dist_m;
+        r->sum.limited_s += st.limited_s;
+    }
+    if(ctrl_isInSafetyShutdown()){
+        printf("torque_bench mode=%s fault=%s\n", r->mode ? "torque" : "duty", ctrl_getErrorName(ctrl_getErrorCode()));
+        return 1;
+    }
+    return 0;
+}
+
+//Step response in torque mode, rolling at cruise
+static int torqueStepRun(void* ctx){
+    torqueRun_t* r = (torqueRun_t*) ctx;
+    startController(NULL);
+    ctrl_setThrottleMode(ctrl_THROTTLE_MODE_TORQUE);
+    runFor(0.05);
+    ctrl_setThrottle((uint16_t) (tqBurn_A/TQ_FULL_THROTTLE_A*4096.0));
+    runFor(15.0);
+    torqueStep((uint16_t) (10.0/TQ_FULL_THROTTLE_A*4096.0), (uint16_t) (20.0/TQ_FULL_THROTTLE_A*4096.0), &r->overshootPct, &r->settle_ms);
+    r->speed_mph = plant_speed_mph(&plant);
+    return 0;
+}
+
+static int benchTorque(int laps){
+    torqueRun_t* runs = (torqueRun_t*) sharedAlloc(3*sizeof(torqueRun_t));
+    int mode, fail = 0;
+    int64_t start = wall_us();
+
+    for(mode=0;mode<2;mode++){
+        runs[mode].mode = mode ? ctrl_THROTTLE_MODE_TORQUE : ctrl_THROTTLE_MODE_DUTY;
+        runs[mode].laps = laps;
+        fail |= runScenario(torqueLaps, &runs[mode]);
+    }
+    fail |= runScenario(torqueStepRun, &runs[2]);
+    printf("torque_bench step=10A->20A speed_mph=%.1f overshoot_pct=%.1f settle_ms=%.1f\n", runs[2].speed_mph,
+           runs[2].overshootPct, runs[2].settle_ms);
+    for(mode=0;mode<2;mode++){
+        const lapStats_t* sum = &runs[mode].sum;
+        printf("torque_bench summary mode=%s phase_peak_A=%.1f bus_peak_A=%.1f limited_s=%.2f energy_per_lap_kJ=%.2f dist_per_lap_m=%.0f Wh_per_km=%.2f\n",
+               mode ? "torque" : "duty", sum->phasePeak, sum->busPeak, sum->limited_s/laps, sum->energy_j/laps/1000.0,
+               sum->dist_m/laps, (sum->dist_m > 0) ? sum->energy_j/3.6/sum->dist_m : 0.0);
+    }
+    //The regulated limit may be passed by a little on the period it is reached, never by much
+    fail |= runs[0].sum.phasePeak > TQ_PHASE_LIMIT_A*1.1 || runs[1].sum.phasePeak > TQ_PHASE_LIMIT_A*1.1 || runs[2].overshootPct > 10.0;
+    printf("torque_bench wall_s=%.2f result=%s\n", (wall_us() - start)/1e6, fail ? "FAIL" : "ok");
+    return fail;
+}
+
+//---------------------------------------------------------------- speed: PI vs the old P speed control
+
+#define SP_SETTLE_BAND_MPH 0.5      //Settled once the car stays this close to the setting
+#define SP_SS_WINDOW_S 3.0          //Steady state error: mean over the end of each step
+#define SP_OLD_BASE 2047            //The old law: duty = 2047 + 100*(setting - speed)
+#define SP_OLD_PGAIN 100.0
+
+typedef struct {
+    const char* name;
+    double from_mph, to_mph;
+    double grade_n;                 //Road load step instead of a setting step (to_mph == from_mph)
+    double hold_s;
+} speedStep_t;
+
+//Up steps are limited by the phase current limit, down steps by coasting (no regen), so they get longer
+static const speedStep_t speedSteps[] = {
+    {"15->20",      15.0, 20.0,  0.0, 30.0},
+    {"20->25",      20.0, 25.0,  0.0, 30.0},
+    {"25->30",      25.0, 30.0,  0.0, 30.0},
+    {"30->20",      30.0, 20.0,  0.0, 80.0},
+    {"hill_20N@20", 20.0, 20.0, 20.0, 30.0},
+};
+#define SP_STEPS ((int) (sizeof(speedSteps)/sizeof(speedSteps[0])))
+
+typedef struct {
+    double settle_s;                //-1 if never settled
+    double overshoot_mph;
+    double ssError_mph;
+    double energy_j;
+} speedStepStats_t;
+
+typedef struct {
+    int old;                        //1: the old P law, run by the bench through the throttle
+    double engageBump;              //Duty change over the first 10 ms after speed control engages
+    speedStepStats_t st[SP_STEPS];
+} speedRun_t;
+
+static double spSetting = 0;
+
+//The old P law ran in the speed loop on the same estimate, so the bench runs it once per base tick
+static void speedStepPwm(const speedRun_t* r){
+    stepPwm();
+    if(r->old && vt_us % BASE_TICK_US == 0){
+        double d = SP_OLD_BASE + (spSetting - ctrl_getSpeed_mph())*SP_OLD_PGAIN;
+        ctrl_setThrottle((uint16_t) ((d < 0) ? 0 : (d > 4095) ? 4095 : d));
+    }
+}
+
+static void speedSet(const speedRun_t* r, double mph){
+    spSetting = mph;
+    if(!r->old){
+        ctrl_setSpeedControl((float) mph);
+    }
+}
+
+static void speedHold(const speedRun_t* r, double s, double set, speedStepStats_t* st){
+    uint64_t t0 = vt_us, end = vt_us + (uint64_t) (s*1e6), ssStart = end - (uint64_t) (SP_SS_WINDOW_S*1e6);
+    uint64_t lastOut = t0;
+    double e0 = plant.energy_j, ssSum = 0, from = plant_speed_mph(&plant), peak = 0;
+    long ssN = 0;
+    while(vt_us < end){
+        speedStepPwm(r);
+        double v = plant_speed_mph(&plant), past = (set >= from) ? v - set : set - v;
+        if(past > peak) { peak = past; }
+        if(fabs(v - set) > SP_SETTLE_BAND_MPH) { lastOut = vt_us; }
+        if(vt_us >= ssStart){
+            ssSum += v - set;
+            ssN++;
+        }
+    }
+    if(st != NULL){
+        st->settle_s = (lastOut >= ssStart) ? -1.0 : (lastOut - t0)/1e6;
+        st->overshoot_mph = peak;
+        st->ssError_mph = ssN ? ssSum/ssN : 0;
+        st->energy_j = plant.energy_j - e0;
+    }
+}
+
+static int speedRun(void* ctx){
+    speedRun_t* r = (speedRun_t*) ctx;
+    int i;
+    startController(NULL);
+    runFor(0.05);
+    //Throttle up to the first setting and engage there, the way a driver would
+    ctrl_setThrottle(TQ_DUTY_THROTTLE);
+    while(plant_speed_mph(&plant) < speedSteps[0].from_mph){
+        stepPwm();
+    }
+    if(r->old){
+        spSetting = speedSteps[0].from_mph;
+        speedStepPwm(r);
+    }else{
+        uint16_t before = ctrl_getOutputDuty(), peak = 0;
+        speedSet(r, speedSteps[0].from_mph);
+        for(i=0;i<10*BASE_TICK_US/PWM_US;i++){
+            stepPwm();
+            uint16_t d = ctrl_getOutputDuty();
+            uint16_t bump = (uint16_t) ((d > before) ? d - before : before - d);
+            if(bump > peak) { peak = bump; }
+        }
+        r->engageBump = peak;
+    }
+    speedHold(r, 30.0, speedSteps[0].from_mph, NULL);
+    for(i=0;i<SP_STEPS;i++){
+        const speedStep_t* s = &speedSteps[i];
+        plant.grade_n = s->grade_n;
+        speedSet(r, s->to_mph);
+        speedHold(r, s->hold_s, s->to_mph, &r->st[i]);
+        plant.grade_n = 0;
+    }
+    if(ctrl_isInSafetyShutdown()){
+        printf("speed_bench ctrl=%s fault=%s\n", r->old ? "p_old" : "pi", ctrl_getErrorName(ctrl_getErrorCode()));
+        return 1;
+    }
+    if(!r->old){
+        printf("speed_bench ctrl=pi bemf_V_per_mph=%.3f (plant %.3f)\n", ctrl_speed_pi.bemf_VperMph,
+               plant.cfg.ke/plant.cfg.wheel_r_m*0.44704);
+    }
+    return 0;
+}
+
+static int benchSpeed(void){
+    speedRun_t* runs = (speedRun_t*) sharedAlloc(2*sizeof(speedRun_t));
+    int c, i, fail = 0;
+    int64_t start = wall_us();
+
+    for(c=0;c<2;c++){
+        runs[c].old = c;
+        fail |= runScenario(speedRun, &runs[c]);
+    }
+    for(i=0;i<SP_STEPS;i++){
+        for(c=0;c<2;c++){
+            const speedStepStats_t* st = &runs[c].st[i];
+            printf("speed_bench ctrl=%s step=%s settle_s=%.2f overshoot_mph=%.2f ss_error_mph=%.2f energy_kJ=%.2f\n",
+                   c ? "p_old" : "pi", speedSteps[i].name, st->settle_s, st->overshoot_mph, st->ssError_mph, st->energy_j/1000.0);
+        }
+        //The PI must settle every step without steady state error
+        fail |= runs[0].st[i].settle_s < 0 || fabs(runs[0].st[i].ssError_mph) > 0.2;
+    }
+    printf("speed_bench ctrl=pi engage_bump_duty=%.0f\n", runs[0].engageBump);
+    fail |= runs[0].engageBump > 100;
+    printf("speed_bench wall_s=%.2f result=%s\n", (wall_us() - start)/1e6, fail ? "FAIL" : "ok");
+    return fail;
+}
+
+//---------------------------------------------------------------- tune: relay feedback tuning on a stand
+
+#define TU_SETTLE_CYCLES 2          //ctrl_AUTOTUNE_SETTLE_CYCLES
+#define TU_MEASURE_CYCLES 4         //ctrl_AUTOTUNE_MEASURE_CYCLES
+#define TU_LIMIT_S 200.0
+#define TU_WHEEL_MASS_KG 4.5        //Hub motor wheel's J/r^2, the only inertia on the stand
+#define TU_WHEEL_DRAG_N 5.0         //No-load losses: about 0.6 A at 10 mph, all that slows the wheel with no regen
+
+typedef struct {
+    int state, error, saved;
+    double total_s;
+    double tuned_s[ctrl_SPEED_BANDS];
+    double ku[ctrl_SPEED_BANDS], tu[ctrl_SPEED_BANDS], amp[ctrl_SPEED_BANDS];
+    double trueKu[ctrl_SPEED_BANDS], trueTu[ctrl_SPEED_BANDS], trueAmp[ctrl_SPEED_BANDS];
+    double tau[ctrl_SPEED_BANDS], dead[ctrl_SPEED_BANDS];
+    ctrl_speedPiGains_t gains;      //After the tune
+    ctrl_speedPiGains_t reloaded;   //After a reboot
+} tuneRun_t;
+
+//Wheel in the air: its own inertia, the motor's losses, a little windage
+static void standPlant(plant_cfg_t* cfg){
+    plant_defaults(cfg);
+    cfg->mass_kg = TU_WHEEL_MASS_KG;
+    cfg->drag_n = TU_WHEEL_DRAG_N;
+    cfg->cda_m2 = 0.01;
+}
+
+//The same relay cycles the firmware measures, sized on the plant's true speed instead of the filtered hall estimate
+static int tuneRun(void* ctx){
+    tuneRun_t* r = (tuneRun_t*) ctx;
+    plant_cfg_t cfg;
+    ctrl_autotune_t at;
+    uint32_t lastCycles = 0;
+    int lastBand = -1, band;
+    double vMax = 0, vMin = 1e9, sumAmp[ctrl_SPEED_BANDS] = {0}, sumPeriod[ctrl_SPEED_BANDS] = {0};
+    uint64_t lastUp = 0, end;
+    double d = ctrl_autotuneRelayDuty(), h = ctrl_autotuneHysteresis();
+
+    standPlant(&cfg);
+    startController(&cfg);
+    runFor(0.05);
+    if(ctrl_startAutotune(0.0f) != 0){
+        printf("tune_bench start rejected\n");
+        return 1;
+    }
+    ctrl_getAutotuneStatus(&at);
+    end = vt_us + (uint64_t) (TU_LIMIT_S*1e6);
+    do{
+        stepPwm();
+        double v = plant_speed_mph(&plant);
+        if(v > vMax) { vMax = v; }
+        if(v < vMin) { vMin = v; }
+        if(vt_us % BASE_TICK_US != 0){
+            continue;
+        }
+        ctrl_getAutotuneStatus(&at);
+        band = at.band;
+        if(band != lastBand || at.cycles != lastCycles){
+            //The firmware counts the cycle that just ended when it had seen more than the settling ones. The last
+            //one of a band ends with the move to the next band.
+            if(lastBand >= 0 && lastCycles > TU_SETTLE_CYCLES && lastCycles <= TU_SETTLE_CYCLES + TU_MEASURE_CYCLES){
+                sumAmp[lastBand] += 0.5*(vMax - vMin);
+                sumPeriod[lastBand] += (vt_us - lastUp)/1e6;
+            }
+            lastBand = band;
+            lastCycles = at.cycles;
+            lastUp = vt_us;
+            vMax = 0;
+            vMin = 1e9;
+        }
+    }while(at.state == ctrl_AUTOTUNE_RUNNING && vt_us < end);
+
+    ctrl_serviceAutotune();     //What PCComTask does on the car
+    r->state = at.state;
+    r->error = at.error;
+    r->saved = (at.state == ctrl_AUTOTUNE_DONE) && (ctrl_getAutotuneSaveResult() == 0);
+    r->total_s = at.total_ms/1000.0;
+    for(band=0;band<ctrl_SPEED_BANDS;band++){
+        double a = sumAmp[band]/TU_MEASURE_CYCLES;
+        r->tuned_s[band] = at.tuned_ms[band]/1000.0;
+        r->ku[band] = at.ku[band];
+        r->tu[band] = at.tu_s[band];
+        r->amp[band] = at.amp_mph[band];
+        r->trueAmp[band] = a;
+        r->trueTu[band] = sumPeriod[band]/TU_MEASURE_CYCLES;
+        r->trueKu[band] = (a > h) ? 4.0*d/(M_PI*a) : 0.0;
+        r->tau[band] = at.tau_s[band];
+        r->dead[band] = at.dead_s[band];
+    }
+    ctrl_getSpeedGains(&r->gains);
+    return (at.state == ctrl_AUTOTUNE_DONE) ? 0 : 1;
+}
+
+static int tuneReboot(void* ctx){
+    tuneRun_t* r = (tuneRun_t*) ctx;
+    startController(NULL);
+    ctrl_getSpeedGains(&r->reloaded);
+    return 0;
+}
+
+static double pctErr(double measured, double truth){
+    return (truth != 0) ? (measured - truth)/truth*100.0 : 0.0;
+}
+
+static int benchTune(void){
+    static const char* nvsFile = "ctrl_bench_nvs.bin";
+    tuneRun_t* tr = (tuneRun_t*) sharedAlloc(sizeof(tuneRun_t));
+    speedRun_t* runs = (speedRun_t*) sharedAlloc(2*sizeof(speedRun_t));
+    int band, i, c, fail = 0;
+    int64_t start = wall_us();
+
+    unlink(nvsFile);
+    host_nvsPath = nvsFile;     //Inherited by every scenario: the stand run stores, the later ones boot from it
+    fail |= runScenario(tuneRun, tr);
+    printf("tune_bench state=%d err=%d total_s=%.1f saved=%d\n", tr->state, tr->error, tr->total_s, tr->saved);
+    for(band=0;band<ctrl_SPEED_BANDS;band++){
+        printf("tune_bench band=%d time_s=%.1f amp_mph=%.2f (true %.2f) tu_s=%.3f (true %.3f, %+.1f%%) ku=%.1f (true %.1f, %+.1f%%) kp=%.1f ki=%.1f\n",
+               band, tr->tuned_s[band], tr->amp[band], tr->trueAmp[band], tr->tu[band], tr->trueTu[band],
+               pctErr(tr->tu[band], tr->trueTu[band]), tr->ku[band], tr->trueKu[band], pctErr(tr->ku[band], tr->trueKu[band]),
+               tr->gains.kp[band], tr->gains.ki[band]);
+        printf("tune_bench band=%d model tau_s=%.3f dead_s=%.3f\n", band, tr->tau[band], tr->dead[band]);
+    }
+    fail |= runScenario(tuneReboot, tr);
+    c = memcmp(tr->gains.kp, tr->reloaded.kp, sizeof(tr->gains.kp)) == 0 && memcmp(tr->gains.ki, tr->reloaded.ki, sizeof(tr->gains.ki)) == 0;
+    printf("tune_bench reboot gains_kept=%d\n", c);
+    fail |= !c || !tr->saved;
+
+    //On the road: the tuned gains (from storage) against the defaults
+    fail |= runScenario(speedRun, &runs[0]);
+    host_nvsPath = NULL;
+    fail |= runScenario(speedRun, &runs[1]);
+    for(i=0;i<SP_STEPS;i++){
+        for(c=0;c<2;c++){
+            const speedStepStats_t* st = &runs[c].st[i];
+            printf("tune_bench gains=%s step=%s settle_s=%.2f overshoot_mph=%.2f ss_error_mph=%.2f energy_kJ=%.2f\n",
+                   c ? "default" : "tuned", speedSteps[i].name, st->settle_s, st->overshoot_mph, st->ssError_mph, st->energy_j/1000.0);
+        }
+        fail |= runs[0].st[i].settle_s < 0 || fabs(runs[0].st[i].ssError_mph) > 0.2;
+    }
+    unlink(nvsFile);
+    printf("tune_bench wall_s=%.2f result=%s\n", (wall_us() - start)/1e6, fail ? "FAIL" : "ok");
+    return fail;
+}
+
+//---------------------------------------------------------------- param: live parameter changes
+
+#define PR_WHEEL_SCALE 1.1
+#define PR_PHASE_LIMIT_A 12.0
+
+typedef struct {
+    int stagedHidden;           //A set is not live before the next tick
+    int liveNextTick;           //...and is on the one after
+    double convRatio;           //Derived constant after/before the wheel change
+    double estRatio;            //Speed estimate over true speed, after/before
+    double phasePeak;           //Phase current after the limit came down
+    int rejects[4];             //Results of four bad sets: unknown, out of range, two conflicts
+    int saved;
+    double wheelReloaded, limitReloaded;
+    double setCost_us;          //Wall time of one ctrl_setParam (validation, derived values, log record)
+} paramRun_t;
+
+//Mean of speed estimate over true speed across s seconds
+static double estimateRatio(double s){
+    uint64_t end = vt_us + (uint64_t) (s*1e6);
+    double sum = 0;
+    int n = 0;
+    while(vt_us < end){
+        stepPwm();
+        if(vt_us % BASE_TICK_US == 0 && plant_speed_mph(&plant) > 1.0){
+            sum += ctrl_getSpeed_mph()/plant_speed_mph(&plant);
+            n++;
+        }
+    }
+    return n ? sum/n : 0.0;
+}
+
+static int paramRun(void* ctx){
+    paramRun_t* r = (paramRun_t*) ctx;
+    int wheel = ctrl_paramFind("wheel_in"), limit = ctrl_paramFind("ph_lim_a");
+    int i, n = 1000;
+    startController(NULL);
+    ctrl_setThrottle(1500);
+    runFor(10.0);
+    double est0 = estimateRatio(1.0);
+    double conv0 = ctrl_params->convComPerSecToMph;
+    double wheel0 = ctrl_params->hubDiameter_in;
+
+    //Between ticks: staged, not live; one tick later: live, derived value already worked out
+    while(vt_us % BASE_TICK_US != PWM_US) { stepPwm(); }
+    ctrl_setParam(wheel, (float) (wheel0*PR_WHEEL_SCALE));
+    r->stagedHidden = ctrl_paramsPending() && ctrl_params->hubDiameter_in == wheel0;
+    while(vt_us % BASE_TICK_US != 0) { stepPwm(); }
+    r->liveNextTick = !ctrl_paramsPending() && fabs(ctrl_params->hubDiameter_in - wheel0*PR_WHEEL_SCALE) < 0.01;
+    r->convRatio = ctrl_params->convComPerSecToMph/conv0;
+    runFor(0.1);
+    r->estRatio = estimateRatio(1.0)/est0;
+
+    //Current limit down, then full throttle
+    ctrl_setParam(limit, (float) PR_PHASE_LIMIT_A);
+    runFor(0.01);
+    ctrl_setThrottle(4095);
+    for(i=0;i<20000;i++){
+        stepPwm();
+        if(plant.i_ph > r->phasePeak) { r->phasePeak = plant.i_ph; }
+    }
+    ctrl_setThrottle(0);
+
+    r->rejects[0] = ctrl_setParam(ctrl_paramCount(), 1.0f);
+    r->rejects[1] = ctrl_setParam(ctrl_paramFind("poles"), 1.0f);
+    r->rejects[2] = ctrl_setParam(ctrl_paramFind("uv_v"), 60.0f);        //Not under ov_v
+    r->rejects[3] = ctrl_setParam(limit, 40.0f);                         //Not under oc_a
+
+    int64_t t0 = wall_us();
+    for(i=0;i<n;i++){
+        ctrl_setParam(ctrl_paramFind("bus_lim_w"), (i & 1) ? 1500.0f : 1400.0f);
+    }
+    r->setCost_us = (double) (wall_us() - t0)/n;
+    ctrl_setParam(ctrl_paramFind("bus_lim_w"), 1500.0f);
+    r->saved = (ctrl_paramsSave() == 0);
+    return 0;
+}
+
+static int paramReboot(void* ctx){
+    paramRun_t* r = (paramRun_t*) ctx;
+    startController(NULL);
+    r->wheelReloaded = ctrl_params->hubDiameter_in;
+    r->limitReloaded = ctrl_params->phaseCurrentLimit_A;
+    return 0;
+}
+
+static int benchParam(void){
+    static const char* nvsFile = "ctrl_bench_params.bin";
+    paramRun_t* r = (paramRun_t*) sharedAlloc(sizeof(paramRun_t));
+    int fail = 0;
+    int64_t start = wall_us();
+
+    unlink(nvsFile);
+    host_nvsPath = nvsFile;
+    fail |= runScenario(paramRun, r);
+    fail |= runScenario(paramReboot, r);
+    unlink(nvsFile);
+    printf("param_bench staged_hidden=%d live_next_tick=%d conv_ratio=%.4f est_ratio=%.3f (wheel x%.2f)\n",
+           r->stagedHidden, r->liveNextTick, r->convRatio, r->estRatio, PR_WHEEL_SCALE);
+    printf("param_bench phase_limit_A=%.1f phase_peak_A=%.2f\n", PR_PHASE_LIMIT_A, r->phasePeak);
+    printf("param_bench rejects unknown=%d range=%d uv_over_ov=%d limit_over_trip=%d\n", r->rejects[0], r->rejects[1], r->rejects[2], r->rejects[3]);
+    printf("param_bench set_cost_us=%.2f saved=%d reloaded wheel_in=%.2f ph_lim_a=%.2f\n", r->setCost_us, r->saved, r->wheelReloaded, r->limitReloaded);
+    fail |= !r->stagedHidden || !r->liveNextTick;
+    fail |= fabs(r->convRatio - PR_WHEEL_SCALE) > 1e-4 || fabs(r->estRatio - PR_WHEEL_SCALE) > 0.02;
+    fail |= r->phasePeak > PR_PHASE_LIMIT_A*1.15;
+    fail |= r->rejects[0] != 1 || r->rejects[1] != 2 || r->rejects[2] != 3 || r->rejects[3] != 3;
+    fail |= !r->saved || fabs(r->wheelReloaded - 19.0*PR_WHEEL_SCALE) > 0.01 || fabs(r->limitReloaded - PR_PHASE_LIMIT_A) > 0.01;
+    printf("param_bench wall_s=%.2f result=%s\n", (wall_us() - start)/1e6, fail ? "FAIL" : "ok");
+    return fail;
+}
+
+//---------------------------------------------------------------- bemf: sensorless commutation
+
+//The plant runs with its commutation model (plant_sim.h) in steps of a tenth of a PWM period, so commutations from the
+//hall ISR and the commutation timer land within 10 us. Each PWM period the terminal voltages are worked out for the
+//middle of the on-time from the driven phases and the back-EMF, with what the real ones carry on top: the newly
+//floating phase clamped to a rail while its current decays, gaussian noise, and spikes. Hall interrupts come late by
+//a random 0 to --hall-lag us.
+#define BM_SUB 10
+#define BM_HANDOVER_MPH 12.0
+#define BM_CRUISE_MPH 20.0
+#define BM_LAUNCH_THROTTLE 2800     //Up to the cruise speed in throttle mode, so speed control takes over near its setting
+#define BM_CLIMB_N 40.0             //Road load on the coast down, so it gets under the handover speed in good time
+
+static double bmNoise_V = 0.5;      //--noise
+static double bmSpikes = 0.02;      //--spikes: share of samples with a half battery voltage spike
+static double bmHallLag_us = 60.0;  //--hall-lag
+
+typedef struct {
+    double sumSq, maxAbs;
+    uint32_t n;
+} angleStats_t;
+
+typedef struct {
+    float handover_mph;             //bemf_mph parameter, 0 for halls only
+    int hallFail;                   //Unplug the halls half way through the cruise
+    angleStats_t angle[2];          //Commutation angle error (electrical degrees, late positive) per ctrl_COMM_*
+    double ktAmps[2], amps[2];      //Current weighted torque share per ctrl_COMM_*
+    double handoverAt_mph, handbackAt_mph;
+    double cruiseErr_mph;           //Mean speed error over the cruise
+    double failHeld_s;              //Time driven with the halls unplugged
+    uint8_t fault;
+    double fault_mph;
+    double energy_j, dist_m;
+    ctrl_commStatus_t comm;
+} bemfRun_t;
+
+static uint32_t bmRng = 0x2545F491;
+static double bmUniform(void){
+    bmRng ^= bmRng << 13;
+    bmRng ^= bmRng >> 17;
+    bmRng ^= bmRng << 5;
+    return (bmRng & 0xFFFFFF)/16777216.0;
+}
+
+static double bmGauss(void){
+    return sqrt(-2.0*log(bmUniform() + 1e-9))*cos(2.0*M_PI*bmUniform());
+}
+
+static bemfRun_t* bmRun;
+static int bmHi = -1, bmLo = -1;
+static uint64_t bmDemagEnd_us = 0;
+static int bmDemagPhase = -1;
+static double bmDemagLevel = 0;
+static int bmHallsDead = 0;
+static uint64_t bmHallDue[8];
+static int bmHallIdx[8];
+static int bmHallN = 0;
+
+//Driven phases as the output stage has them: the high side with duty on it, the low side gate that is on
+static void bmDriven(int* hi, int* lo){
+    static const int lowPins[3] = {LOW_PIN_A, LOW_PIN_B, LOW_PIN_C};
+    int i;
+    *hi = -1;
+    *lo = -1;
+    for(i=0;i<3;i++){
+        if(host_ledcDuty[i] > 0) { *hi = i; }
+        if(host_gpioLevel[lowPins[i]]) { *lo = i; }
+    }
+}
+
+//Picks up output changes at rotor position pos: the commutation angle error, and the rail the phase that stopped
+//being driven sits on while its current dies away
+static void bmOutputs(double pos){
+    int hi, lo, mode;
+    bmDriven(&hi, &lo);
+    if(hi == bmHi && lo == bmLo){
+        return;
+    }
+    if(hi >= 0 && lo >= 0 && bmHi >= 0 && bmLo >= 0){
+        ctrl_commStatus_t cs;
+        ctrl_getCommStatus(&cs);
+        mode = cs.mode;
+        double err = (pos - floor(pos + 0.5))*60.0;
+        angleStats_t* a = &bmRun->angle[mode];
+        a->sumSq += err*err;
+        a->n++;
+        if(fabs(err) > a->maxAbs) { a->maxAbs = fabs(err); }
+        //Only one phase changes per commutation: the one that now floats was high (its current goes on through the low
+        //side diode) or low (through the high side diode)
+        bmDemagPhase = (hi != bmHi) ? bmHi : bmLo;
+        bmDemagLevel = (hi != bmHi) ? 0.0 : plant.vbat;
+        bmDemagEnd_us = vt_us + (uint64_t) (plant.cfg.l_h*plant.i_ph/plant.vbat*1e6);
+    }
+    bmHi = hi;
+    bmLo = lo;
+    plant.hi = hi;
+    plant.lo = lo;
+}
+
+//Terminal voltages for the middle of the on-time (all open but the low side when no duty is on)
+static void bmSample(void){
+    double e[3], v[3];
+    int i;
+    plant_phaseEmf(&plant, e);
+    if(bmLo < 0){
+        for(i=0;i<3;i++) { v[i] = 0.5*plant.vbat + e[i]; }
+    }else if(bmHi < 0){
+        for(i=0;i<3;i++) { v[i] = e[i] - e[bmLo]; }
+    }else{
+        int fl = 3 - bmHi - bmLo;
+        double vn = 0.5*(plant.vbat - e[bmHi] - e[bmLo]);
+        v[bmHi] = plant.vbat;
+        v[bmLo] = 0.0;
+        v[fl] = (vt_us < bmDemagEnd_us && fl == bmDemagPhase) ? bmDemagLevel : vn + e[fl];
+    }
+    for(i=0;i<3;i++){
+        v[i] += bmNoise_V*bmGauss();
+        if(bmUniform() < bmSpikes) { v[i] += (bmUniform() < 0.5 ? -0.5 : 0.5)*plant.vbat; }
+        if(v[i] < 0) { v[i] = 0; }
+        if(v[i] > plant.vbat) { v[i] = plant.vbat; }
+    }
+    ctrl_phaseVoltA = v[0];
+    ctrl_phaseVoltB = v[1];
+    ctrl_phaseVoltC = v[2];
+}
+
+//One PWM period in BM_SUB plant steps, with hall interrupts and the commutation timer run at their times
+static void bmStep(void){
+    uint64_t t0 = vt_us;
+    int k, mode;
+    sensors();
+    bmSample();
+    host_timerFire(ctrl_current_loop_timer);
+    for(k=0;k<BM_SUB;k++){
+        uint64_t tStart = vt_us, tEnd = t0 + (uint64_t) ((k + 1)*PWM_US/BM_SUB);
+        double posStart = plant.pos, frac = 0;
+        bmOutputs(plant.pos);
+        int edges = plant_step(&plant, outputDuty(), (tEnd - tStart)/1e6, &frac);
+        while(edges-- > 0){
+            plant.hallIdx = (plant.hallIdx + 1) % 6;
+            if(!bmHallsDead && bmHallN < 8){
+                bmHallDue[bmHallN] = tStart + (uint64_t) (frac*(tEnd - tStart) + bmUniform()*bmHallLag_us);
+                bmHallIdx[bmHallN++] = plant.hallIdx;
+            }
+        }
+        //Interrupts due by the end of this step, in time order
+        while(1){
+            int64_t comm = host_timerDue(ctrl_commutation_timer);
+            uint64_t t = tEnd + 1;
+            int which = -1;
+            if(comm >= 0 && (uint64_t) comm <= tEnd) { t = (uint64_t) comm; which = 0; }
+            if(bmHallN > 0 && bmHallDue[0] <= tEnd && bmHallDue[0] < t) { t = bmHallDue[0]; which = 1; }
+            if(which < 0) { break; }
+            vt_us = (t > tStart) ? t : tStart;
+            if(which == 0){
+                host_timerFire(ctrl_commutation_timer);
+            }else{
+                setHall(ctrl_hall_input_table[bmHallIdx[0]]);
+                memmove(bmHallDue, bmHallDue + 1, (bmHallN - 1)*sizeof(bmHallDue[0]));
+                memmove(bmHallIdx, bmHallIdx + 1, (bmHallN - 1)*sizeof(bmHallIdx[0]));
+                bmHallN--;
+            }
+            bmOutputs(posStart + (plant.pos - posStart)*(double) (vt_us - tStart)/(double) (tEnd - tStart));
+        }
+        vt_us = tEnd;
+        ctrl_commStatus_t cs;
+        ctrl_getCommStatus(&cs);
+        mode = cs.mode;
+        bmRun->ktAmps[mode] += plant.kt*plant.i_ph;
+        bmRun->amps[mode] += plant.i_ph;
+    }
+    if(vt_us % BASE_TICK_US == 0){
+        sensors();
+        host_timerFire(ctrl_speed_control_timer);
+        host_taskWaitIdle(ctrl_operational_task_handle);
+    }
+}
+
+static void bmRunFor(double s){
+    uint64_t end = vt_us + (uint64_t) (s*1e6);
+    while(vt_us < end){
+        bmStep();
+    }
+}
+
+//Launch on the throttle up to the cruise speed, hold it on speed control, then coast down a climb under the handover speed
+static int bemfDrive(void* ctx){
+    bemfRun_t* r = (bemfRun_t*) ctx;
+    double err = 0;
+    int n = 0;
+    uint64_t end;
+    bmRun = r;
+    startController(NULL);
+    plant.commModel = 1;
+    bmOutputs(plant.pos);
+    ctrl_setParam(ctrl_paramFind("bemf_mph"), r->handover_mph);
+    ctrl_setThrottle(BM_LAUNCH_THROTTLE);
+    end = vt_us + 40000000;
+    while(vt_us < end && plant_speed_mph(&plant) < BM_CRUISE_MPH - 0.5){
+        bmStep();
+    }
+    ctrl_setSpeedControl(BM_CRUISE_MPH);
+    bmRunFor(10.0);
+    end = vt_us + 10000000;
+    while(vt_us < end && !ctrl_isInSafetyShutdown()){
+        if(r->hallFail && !bmHallsDead && vt_us >= end - 5000000){
+            bmHallsDead = 1;
+            bmHallN = 0;
+            setHall(7);         //Connector off: the pull-ups read 111
+        }
+        bmStep();
+        if(bmHallsDead) { r->failHeld_s += PWM_US/1e6; }
+        if(vt_us % BASE_TICK_US == 0){
+            err += fabs(plant_speed_mph(&plant) - BM_CRUISE_MPH);
+            n++;
+        }
+    }
+    r->cruiseErr_mph = n ? err/n : 0.0;
+    ctrl_turnOffSpeedControl();
+    ctrl_setThrottle(0);
+    plant.grade_n = BM_CLIMB_N;
+    end = vt_us + 60000000;
+    while(vt_us < end && !ctrl_isInSafetyShutdown() && plant_speed_mph(&plant) > BM_HANDOVER_MPH - 4.0){
+        bmStep();
+        if(bmHallsDead) { r->failHeld_s += PWM_US/1e6; }
+    }
+    ctrl_getCommStatus(&r->comm);
+    r->fault = ctrl_getErrorCode();
+    if(r->fault) { r->fault_mph = plant_speed_mph(&plant); }
+    r->energy_j = plant.energy_j;
+    r->dist_m = plant.dist_m;
+    return 0;
+}
+
+static void bemfReport(const char* name, const bemfRun_t* r){
+    int m;
+    printf("bemf_bench run=%s handovers=%lu handbacks=%lu lost=%lu zc=%lu missed=%lu rejected=%lu predict_err_max_us=%lu hall_faults=%lu\n",
+           name, (unsigned long) r->comm.handovers, (unsigned long) r->comm.handbacks, (unsigned long) r->comm.lockLosses,
+           (unsigned long) r->comm.zc.zeroCrossings, (unsigned long) r->comm.zc.missed, (unsigned long) r->comm.zc.rejected,
+           (unsigned long) r->comm.zc.predictErrMax_us, (unsigned long) r->comm.hallFaults);
+    for(m=0;m<2;m++){
+        const angleStats_t* a = &r->angle[m];
+        if(a->n == 0){
+            continue;
+        }
+        printf("bemf_bench run=%s source=%s commutations=%lu angle_rms_deg=%.2f angle_max_deg=%.1f torque_share=%.4f\n", name,
+               m ? "bemf" : "hall", (unsigned long) a->n, sqrt(a->sumSq/a->n), a->maxAbs, r->amps[m] > 0 ? r->ktAmps[m]/r->amps[m] : 0.0);
+    }
+    printf("bemf_bench run=%s cruise_err_mph=%.3f halls_off_s=%.1f fault=%s fault_mph=%.1f Wh_per_km=%.3f\n", name, r->cruiseErr_mph,
+           r->failHeld_s, ctrl_getErrorName(r->fault), r->fault_mph, r->dist_m > 0 ? r->energy_j/3.6/r->dist_m : 0.0);
+}
+
+static int benchBemf(void){
+    bemfRun_t* hall = (bemfRun_t*) sharedAlloc(sizeof(bemfRun_t));
+    bemfRun_t* bemf = (bemfRun_t*) sharedAlloc(sizeof(bemfRun_t));
+    bemfRun_t* fail = (bemfRun_t*) sharedAlloc(sizeof(bemfRun_t));
+    int bad = 0;
+    int64_t start = wall_us();
+    printf("bemf_bench noise_V=%.2f spikes=%.3f hall_lag_us=%.0f handover_mph=%.1f\n", bmNoise_V, bmSpikes, bmHallLag_us, BM_HANDOVER_MPH);
+    bemf->handover_mph = fail->handover_mph = (float) BM_HANDOVER_MPH;
+    hall->hallFail = fail->hallFail = 1;
+    bad |= runScenario(bemfDrive, hall);
+    bad |= runScenario(bemfDrive, bemf);
+    bad |= runScenario(bemfDrive, fail);
+    bemfReport("halls", hall);
+    bemfReport("sensorless", bemf);
+    bemfReport("sensorless_halls_off", fail);
+
+    //Halls only: unplugging them ends the run. Sensorless: hands over and back cleanly, commutates at least as close to the
+    //right angle as the halls do, and rides out the unplugged halls until it has to hand back to them.
+    bad |= hall->fault != 0x01 || hall->failHeld_s > 0.1;
+    bad |= bemf->fault != 0 || bemf->comm.handovers < 1 || bemf->comm.handbacks < 1 || bemf->comm.lockLosses != 0;
+    bad |= bemf->angle[ctrl_COMM_SENSORLESS].n == 0;
+    bad |= sqrt(bemf->angle[ctrl_COMM_SENSORLESS].sumSq/(bemf->angle[ctrl_COMM_SENSORLESS].n + 1e-9)) >
+           sqrt(hall->angle[ctrl_COMM_HALL].sumSq/(hall->angle[ctrl_COMM_HALL].n + 1e-9)) + 1.0;
+    bad |= bemf->cruiseErr_mph > hall->cruiseErr_mph + 0.1;
+    bad |= fail->failHeld_s < 4.9 || fail->fault != 0x01 || fail->fault_mph > BM_HANDOVER_MPH;
+    printf("bemf_bench wall_s=%.2f result=%s\n", (wall_us() - start)/1e6, bad ? "FAIL" : "ok");
+    return bad;
+}
+
+//---------------------------------------------------------------- pwm: loss-modelled PWM frequency
+
+//A drive cycle with the pwm_adapt parameter off (pwm_hz throughout) and on. The plant counts the switching and ripple
+//losses at the frequency on the LEDC shim; the duty the plant sees has to stay the 12 bit command at every resolution.
+#define PW_CRUISE_MPH 20.0
+#define PW_CLIMB_N 20.0
+#define PW_CRUISE_S 20.0
+#define PW_CLIMB_S 15.0
+#define PW_COAST_S 10.0
+
+typedef struct {
+    int adapt;
+    double switch_j, ripple_j;
+    double peak_A, trip_A;
+    double cruiseErr_mph;
+    double energy_j;
+    long checks, mismatches;
+    double worstLsb;
+    ctrl_pwmStatus_t pwm;
+    double launch_hz, cruise_hz, climb_hz;      //Frequency at the end of each phase
+    uint8_t fault;
+} pwmRun_t;
+
+//One PWM period, then the output duty against the command, to 1 LSB of the resolution on the LEDC
+static void pwmStep(pwmRun_t* r){
+    stepPwm();
+    if(ctrl_getOutputDuty() == 0 || ctrl_isInSafetyShutdown()){
+        return;
+    }
+    double lsb = 1.0/(double) (1u << host_ledcResolution);
+    double err = fabs(outputDuty() - ctrl_getOutputDuty()/4096.0)/lsb;
+    r->checks++;
+    if(err > 1.0) { r->mismatches++; }
+    if(err > r->worstLsb) { r->worstLsb = err; }
+}
+
+static int pwmDrive(void* ctx){
+    pwmRun_t* r = (pwmRun_t*) ctx;
+    double err = 0;
+    int n = 0;
+    uint64_t end;
+    startController(NULL);
+    ctrl_setParam(ctrl_paramFind("pwm_adapt"), (float) r->adapt);
+    runFor(0.05);
+    //Launch, then cruise on speed control, a climb, and a coast
+    ctrl_setThrottle(BM_LAUNCH_THROTTLE);
+    end = vt_us + 40000000;
+    while(vt_us < end && plant_speed_mph(&plant) < PW_CRUISE_MPH - 0.5){
+        pwmStep(r);
+    }
+    r->launch_hz = host_ledcFreq;
+    ctrl_setSpeedControl(PW_CRUISE_MPH);
+    end = vt_us + (uint64_t) (PW_CRUISE_S*1e6);
+    while(vt_us < end){
+        pwmStep(r);
+        if(vt_us % BASE_TICK_US == 0 && end - vt_us < 10000000){
+            err += fabs(plant_speed_mph(&plant) - PW_CRUISE_MPH);
+            n++;
+        }
+    }
+    r->cruiseErr_mph = n ? err/n : 0.0;
+    r->cruise_hz = host_ledcFreq;
+    plant.grade_n = PW_CLIMB_N;
+    end = vt_us + (uint64_t) (PW_CLIMB_S*1e6);
+    while(vt_us < end){
+        pwmStep(r);
+    }
+    r->climb_hz = host_ledcFreq;
+    plant.grade_n = 0;
+    ctrl_turnOffSpeedControl();
+    ctrl_setThrottle(0);
+    end = vt_us + (uint64_t) (PW_COAST_S*1e6);
+    while(vt_us < end){
+        pwmStep(r);
+    }
+    ctrl_getPwmStatus(&r->pwm);
+    r->switch_j = plant.switchLoss_j;
+    r->ripple_j = plant.rippleLoss_j;
+    r->peak_A = plant.peak_A;
+    r->trip_A = ctrl_params->overcurrent_A;
+    r->energy_j = plant.energy_j;
+    r->fault = ctrl_getErrorCode();
+    return 0;
+}
+
+static int benchPwm(void){
+    pwmRun_t* runs = (pwmRun_t*) sharedAlloc(2*sizeof(pwmRun_t));
+    int c, fail = 0;
+    int64_t start = wall_us();
+    for(c=0;c<2;c++){
+        runs[c].adapt = c;
+        fail |= runScenario(pwmDrive, &runs[c]);
+    }
+    for(c=0;c<2;c++){
+        const pwmRun_t* r = &runs[c];
+        printf("pwm_bench adapt=%d switch_J=%.1f ripple_J=%.1f total_J=%.1f model_J=%.1f peak_A=%.1f trip_A=%.1f changes=%lu\n", r->adapt,
+               r->switch_j, r->ripple_j, r->switch_j + r->ripple_j, r->pwm.loss_j, r->peak_A, r->trip_A, (unsigned long) r->pwm.changes);
+        printf("pwm_bench adapt=%d launch_hz=%.0f cruise_hz=%.0f climb_hz=%.0f cruise_err_mph=%.3f energy_kJ=%.2f duty_checks=%ld mismatches=%ld worst_lsb=%.2f fault=%s\n",
+               r->adapt, r->launch_hz, r->cruise_hz, r->climb_hz, r->cruiseErr_mph, r->energy_j/1000.0, r->checks, r->mismatches,
+               r->worstLsb, ctrl_getErrorName(r->fault));
+    }
+    double fixed = runs[0].switch_j + runs[0].ripple_j, adaptive = runs[1].switch_j + runs[1].ripple_j;
+    printf("pwm_bench saved_J=%.1f saved_pct=%.1f\n", fixed - adaptive, fixed > 0 ? (fixed - adaptive)/fixed*100.0 : 0.0);
+    //Less loss than the fixed frequency, the duty right at every resolution, the ripple peak under the trip, and no worse speed holding
+    fail |= adaptive >= fixed || runs[1].pwm.changes == 0;
+    for(c=0;c<2;c++){
+        fail |= runs[c].fault != 0 || runs[c].mismatches != 0 || runs[c].checks == 0 || runs[c].peak_A >= runs[c].trip_A;
+    }
+    fail |= runs[1].cruiseErr_mph > runs[0].cruiseErr_mph + 0.1;
+    printf("pwm_bench wall_s=%.2f result=%s\n", (wall_us() - start)/1e6, fail ? "FAIL" : "ok");
+    return fail;
+}
+
+//---------------------------------------------------------------- main
+
+static void usage(void){
+    fprintf(stderr, "usage: ctrl_bench torque [--laps n] [--burn-a A]\n"
+                    "       ctrl_bench speed\n"
+                    "       ctrl_bench tune\n"
+                    "       ctrl_bench param\n"
+                    "       ctrl_bench bemf [--noise V] [--spikes share] [--hall-lag us]\n"
+                    "       ctrl_bench pwm\n");
+}
+
+int main(int argc, char** argv){
+    int laps = 3;
+    int i;
+    if(argc < 2){
+        usage();
+        return 2;
+    }
+    for(i=2;i<argc;i++){
+        if(strcmp(argv[i], "--laps") == 0 && i + 1 < argc){
+            laps = atoi(argv[++i]);
+        }else if(strcmp(argv[i], "--burn-a") == 0 && i + 1 < argc){
+            tqBurn_A = atof(argv[++i]);
+        }else if(strcmp(argv[i], "--noise") == 0 && i + 1 < argc){
+            bmNoise_V = atof(argv[++i]);
+        }else if(strcmp(argv[i], "--spikes") == 0 && i + 1 < argc){
+            bmSpikes = atof(argv[++i]);
+        }else if(strcmp(argv[i], "--hall-lag") == 0 && i + 1 < argc){
+            bmHallLag_us = atof(argv[++i]);
+        }else{
+            usage();
+            return 2;
+        }
+    }
+    if(strcmp(argv[1], "torque") == 0){
+        return benchTorque(laps > 0 ? laps : 1);
+    }
+    if(strcmp(argv[1], "speed") == 0){
+        return benchSpeed();
+    }
+    if(strcmp(argv[1], "tune") == 0){
+        return benchTune();
+    }
+    if(strcmp(argv[1], "param") == 0){
+        return benchParam();
+    }
+    if(strcmp(argv[1], "bemf") == 0){
+        return benchBemf();
+    }
+    if(strcmp(argv[1], "pwm") == 0){
+        return benchPwm();
+    }
+    usage();
+    return 2;
+}
@@ -0,0 +1,512 @@
+//Host backends for itf_storage, see host_storage.h.
+//The writer task is the main caller. Besides the stats (read from the tool's main thread) only the
+//file slots and the RAM disk data are locked, for a reader (openRead/read) in another task.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "host_storage.h"
+
+#define HOST_STORAGE_FILES 8
+#define HOST_STORAGE_RAM_FILES 64
+#define HOST_STORAGE_NAME_LEN 16
+
+struct itf_storageFile {
+    int used;
+    int fd;                 //host_storageDir
+    int ram;                //host_storageRam: index into host_ramFiles
+    uint64_t pos;
+};
+
+typedef struct {
+    char name[HOST_STORAGE_NAME_LEN];
+    uint8_t* data;
+    uint64_t size, alloc;
+} host_ramFile_t;
+
+static struct itf_storageFile host_files[HOST_STORAGE_FILES];
+static host_ramFile_t host_ramFiles[HOST_STORAGE_RAM_FILES];
+static char host_dir[512] = ".";
+static int host_mounted = 0;
+static int host_mountsToFail = 0;
+
+static host_storageFaults_t host_faults;
+static host_storageStats_t host_stats;
+static pthread_mutex_t host_statsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t host_filesLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t host_ramLock = PTHREAD_MUTEX_INITIALIZER;   //RAM file data can move on a resize
+
+static int64_t host_now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+void host_storageSetFaults(const host_storageFaults_t* faults){
+    host_faults = *faults;
+    if(host_faults.seed == 0){
+        host_faults.seed = 1;
+    }
+}
+
+void host_storageGetStats(host_storageStats_t* stats){
+    pthread_mutex_lock(&host_statsLock);
+    *stats = host_stats;
+    pthread_mutex_unlock(&host_statsLock);
+}
+
+int host_storageOpenFiles(void){
+    int i, n = 0;
+    for(i=0;i<HOST_STORAGE_FILES;i++){
+        n += host_files[i].used;
+    }
+    return n;
+}
+
+//xorshift32, so a seed gives the same failures on every run
+static uint32_t host_random(void){
+    uint32_t x = host_faults.seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    host_faults.seed = x;
+    return x;
+}
+
+//Runs before every write: sleeps for the write time (and any stall) and decides if it fails.
+//A failed write takes the card away until it has been remounted mountFails+1 times.
+static int host_writeFault(int len){
+    int fail = 0;
+    int64_t us = host_faults.write_us + (int64_t) host_faults.perKB_us*len/1024;
+    pthread_mutex_lock(&host_statsLock);
+    host_stats.writes++;
+    if(host_faults.stallEvery > 0 && host_stats.writes % host_faults.stallEvery == 0){
+        us += host_faults.stall_ms*1000LL;
+        host_stats.stalls++;
+    }
+    if(host_faults.failEvery > 0 && host_stats.writes % host_faults.failEvery == 0){
+        fail = 1;
+    }
+    if(host_faults.failPpm > 0 && host_random() % 1000000 < (uint32_t) host_faults.failPpm){
+        fail = 1;
+    }
+    if(fail){
+        host_stats.failedWrites++;
+    }
+    pthread_mutex_unlock(&host_statsLock);
+    if(us > 0){
+        usleep((useconds_t) us);
+    }
+    if(fail){
+        host_mounted = 0;
+        host_mountsToFail = host_faults.mountFails;
+    }
+    return !fail;
+}
+
+static void host_writeDone(int len, int64_t start_us){
+    int64_t took = host_now_us() - start_us;
+    pthread_mutex_lock(&host_statsLock);
+    host_stats.bytes += len;
+    if(took > host_stats.writeMax_us){
+        host_stats.writeMax_us = took;
+    }
+    pthread_mutex_unlock(&host_statsLock);
+}
+
+static int host_mount(void){
+    pthread_mutex_lock(&host_statsLock);
+    host_stats.mounts++;
+    if(host_mountsToFail > 0){
+        host_mountsToFail--;
+        host_stats.failedMounts++;
+        pthread_mutex_unlock(&host_statsLock);
+        return 0;
+    }
+    pthread_mutex_unlock(&host_statsLock);
+    host_mounted = 1;
+    return 1;
+}
+
+static void host_unmount(void){
+    host_mounted = 0;
+}
+
+static int host_isMounted(void){
+    return host_mounted;
+}
+
+//The slot is taken here; the open gives it back with host_fileRelease if it fails
+static itf_storageFile_t* host_fileSlot(void){
+    int i;
+    pthread_mutex_lock(&host_filesLock);
+    for(i=0;i<HOST_STORAGE_FILES && host_files[i].used;i++);
+    if(i == HOST_STORAGE_FILES){
+        pthread_mutex_unlock(&host_filesLock);
+        return NULL;
+    }
+    memset(&host_files[i], 0, sizeof(host_files[i]));
+    host_files[i].fd = -1;
+    host_files[i].ram = -1;
+    host_files[i].used = 1;
+    pthread_mutex_unlock(&host_filesLock);
+    return &host_files[i];
+}
+
+static void host_fileRelease(itf_storageFile_t* f){
+    pthread_mutex_lock(&host_filesLock);
+    f->used = 0;
+    pthread_mutex_unlock(&host_filesLock);
+}
+
+static int host_fileClose(itf_storageFile_t* f){
+    int ok = 1;
+    if(f->fd >= 0){
+        ok = (close(f->fd) == 0);
+    }
+    host_fileRelease(f);
+    return ok;
+}
+
+//---------------------------------------------------------------- Directory backend
+
+int host_storageDirInit(const char* dir){
+    snprintf(host_dir, sizeof(host_dir), "%s", dir);
+    if(mkdir(host_dir, 0755) != 0 && errno != EEXIST){
+        return 0;
+    }
+    return 1;
+}
+
+static itf_storageFile_t* host_dirOpen(const char* name, int create){
+    char path[PATH_MAX];
+    itf_storageFile_t* f;
+    if(!host_mounted || (f = host_fileSlot()) == NULL){
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/%s", host_dir, name);
+    f->fd = open(path, O_RDWR | O_CREAT | (create ? O_TRUNC : 0), 0644);
+    if(f->fd < 0){
+        host_fileRelease(f);
+        return NULL;
+    }
+    return f;
+}
+
+static itf_storageFile_t* host_dirOpenRead(const char* name){
+    char path[PATH_MAX];
+    itf_storageFile_t* f;
+    if(!host_mounted || (f = host_fileSlot()) == NULL){
+        return NULL;
+    }
+    snprintf(path, sizeof(path), "%s/%s", host_dir, name);
+    f->fd = open(path, O_RDONLY);
+    if(f->fd < 0){
+        host_fileRelease(f);
+        return NULL;
+    }
+    return f;
+}
+
+static uint64_t host_dirSize(itf_storageFile_t* f){
+    struct stat sb;
+    return (fstat(f->fd, &sb) == 0) ? (uint64_t) sb.st_size : 0;
+}
+
+static int host_dirExpand(itf_storageFile_t* f, uint64_t bytes){
+    return ftruncate(f->fd, (off_t) bytes) == 0;
+}
+
+static int host_dirSeek(itf_storageFile_t* f, uint64_t pos){
+    f->pos = pos;
+    return lseek(f->fd, (off_t) pos, SEEK_SET) == (off_t) pos;
+}
+
+static int host_dirWrite(itf_storageFile_t* f, const void* data, int len){
+    int64_t start = host_now_us();
+    if(!host_mounted || !host_writeFault(len)){
+        return 0;
+    }
+    if(write(f->fd, data, len) != len){
+        return 0;
+    }
+    f->pos += len;
+    host_writeDone(len, start);
+    return 1;
+}
+
+static int host_dirRead(itf_storageFile_t* f, void* data, int len){
+    if(host_faults.read_us > 0){
+        usleep((useconds_t) host_faults.read_us);
+    }
+    if(!host_mounted || pread(f->fd, data, len, (off_t) f->pos) != len){
+        return 0;
+    }
+    f->pos += len;
+    return 1;
+}
+
+static int host_dirSync(itf_storageFile_t* f){
+    host_stats.syncs++;
+    return fdatasync(f->fd) == 0;
+}
+
+static int host_dirTruncate(itf_storageFile_t* f){
+    return ftruncate(f->fd, (off_t) f->pos) == 0;
+}
+
+static int host_dirList(itf_storageListFn fn, void* ctx){
+    DIR* d;
+    struct dirent* de;
+    struct stat sb;
+    char path[PATH_MAX];
+    if(!host_mounted || (d = opendir(host_dir)) == NULL){
+        return 0;
+    }
+    while((de = readdir(d)) != NULL){
+        snprintf(path, sizeof(path), "%s/%s", host_dir, de->d_name);
+        if(stat(path, &sb) == 0 && S_ISREG(sb.st_mode)){
+            fn(de->d_name, (uint64_t) sb.st_size, ctx);
+        }
+    }
+    closedir(d);
+    return 1;
+}
+
+static int host_dirRemove(const char* name){
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", host_dir, name);
+    return unlink(path) == 0;
+}
+
+const itf_storageOps_t host_storageDir = {
+    .name = "hostdir",
+    .mount = host_mount,
+    .unmount = host_unmount,
+    .mounted = host_isMounted,
+    .open = host_dirOpen,
+    .openRead = host_dirOpenRead,
+    .size = host_dirSize,
+    .expand = host_dirExpand,
+    .seek = host_dirSeek,
+    .write = host_dirWrite,
+    .read = host_dirRead,
+    .sync = host_dirSync,
+    .truncate = host_dirTruncate,
+    .close = host_fileClose,
+    .list = host_dirList,
+    .remove = host_dirRemove,
+};
+
+//---------------------------------------------------------------- RAM disk backend
+
+static int host_ramFind(const char* name){
+    int i;
+    for(i=0;i<HOST_STORAGE_RAM_FILES;i++){
+        if(host_ramFiles[i].name[0] != 0 && strcmp(host_ramFiles[i].name, name) == 0){
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int host_ramResize(host_ramFile_t* r, uint64_t size){
+    if(size > r->alloc){
+        uint64_t alloc = (r->alloc == 0) ? 64*1024 : r->alloc;
+        while(alloc < size){
+            alloc *= 2;
+        }
+        uint8_t* p = realloc(r->data, alloc);
+        if(p == NULL){
+            return 0;
+        }
+        r->data = p;
+        r->alloc = alloc;
+    }
+    if(size > r->size){
+        memset(r->data + r->size, 0, size - r->size);
+    }
+    r->size = size;
+    return 1;
+}
+
+void host_storageRamClear(void){
+    int i;
+    for(i=0;i<HOST_STORAGE_RAM_FILES;i++){
+        free(host_ramFiles[i].data);
+    }
+    memset(host_ramFiles, 0, sizeof(host_ramFiles));
+}
+
+int host_storageRamSave(const char* name, const char* path){
+    int i = host_ramFind(name);
+    FILE* out;
+    if(i < 0 || (out = fopen(path, "wb")) == NULL){
+        return 0;
+    }
+    int ok = fwrite(host_ramFiles[i].data, 1, host_ramFiles[i].size, out) == host_ramFiles[i].size;
+    return (fclose(out) == 0) && ok;
+}
+
+static itf_storageFile_t* host_ramOpen(const char* name, int create){
+    itf_storageFile_t* f;
+    int i;
+    if(!host_mounted || strlen(name) >= HOST_STORAGE_NAME_LEN || (f = host_fileSlot()) == NULL){
+        return NULL;
+    }
+    pthread_mutex_lock(&host_ramLock);
+    i = host_ramFind(name);
+    if(i < 0){
+        for(i=0;i<HOST_STORAGE_RAM_FILES && host_ramFiles[i].name[0] != 0;i++);
+        if(i == HOST_STORAGE_RAM_FILES){
+            pthread_mutex_unlock(&host_ramLock);
+            host_fileRelease(f);
+            return NULL;
+        }
+        strcpy(host_ramFiles[i].name, name);
+    }
+    if(create){
+        host_ramFiles[i].size = 0;
+    }
+    pthread_mutex_unlock(&host_ramLock);
+    f->ram = i;
+    return f;
+}
+
+static itf_storageFile_t* host_ramOpenRead(const char* name){
+    itf_storageFile_t* f;
+    if(!host_mounted || (f = host_fileSlot()) == NULL){
+        return NULL;
+    }
+    pthread_mutex_lock(&host_ramLock);
+    f->ram = host_ramFind(name);
+    pthread_mutex_unlock(&host_ramLock);
+    if(f->ram < 0){
+        host_fileRelease(f);
+        return NULL;
+    }
+    return f;
+}
+
+static uint64_t host_ramSize(itf_storageFile_t* f){
+    pthread_mutex_lock(&host_ramLock);
+    uint64_t size = host_ramFiles[f->ram].size;
+    pthread_mutex_unlock(&host_ramLock);
+    return size;
+}
+
+static int host_ramExpand(itf_storageFile_t* f, uint64_t bytes){
+    pthread_mutex_lock(&host_ramLock);
+    int ok = host_ramResize(&host_ramFiles[f->ram], bytes);
+    pthread_mutex_unlock(&host_ramLock);
+    return ok;
+}
+
+static int host_ramSeek(itf_storageFile_t* f, uint64_t pos){
+    f->pos = pos;
+    pthread_mutex_lock(&host_ramLock);
+    int ok = pos <= host_ramFiles[f->ram].size || host_ramResize(&host_ramFiles[f->ram], pos);
+    pthread_mutex_unlock(&host_ramLock);
+    return ok;
+}
+
+static int host_ramWrite(itf_storageFile_t* f, const void* data, int len){
+    host_ramFile_t* r = &host_ramFiles[f->ram];
+    int64_t start = host_now_us();
+    if(!host_mounted || !host_writeFault(len)){
+        return 0;
+    }
+    pthread_mutex_lock(&host_ramLock);
+    if(f->pos + len > r->size && !host_ramResize(r, f->pos + len)){
+        pthread_mutex_unlock(&host_ramLock);
+        return 0;
+    }
+    memcpy(r->data + f->pos, data, len);
+    pthread_mutex_unlock(&host_ramLock);
+    f->pos += len;
+    host_writeDone(len, start);
+    return 1;
+}
+
+static int host_ramRead(itf_storageFile_t* f, void* data, int len){
+    host_ramFile_t* r = &host_ramFiles[f->ram];
+    int ok = 0;
+    if(host_faults.read_us > 0){
+        usleep((useconds_t) host_faults.read_us);
+    }
+    pthread_mutex_lock(&host_ramLock);
+    if(host_mounted && f->pos + len <= r->size){
+        memcpy(data, r->data + f->pos, len);
+        ok = 1;
+    }
+    pthread_mutex_unlock(&host_ramLock);
+    if(ok){
+        f->pos += len;
+    }
+    return ok;
+}
+
+static int host_ramSync(itf_storageFile_t* f){
+    (void) f;
+    host_stats.syncs++;
+    return host_mounted;
+}
+
+static int host_ramTruncate(itf_storageFile_t* f){
+    pthread_mutex_lock(&host_ramLock);
+    host_ramFiles[f->ram].size = f->pos;
+    pthread_mutex_unlock(&host_ramLock);
+    return 1;
+}
+
+static int host_ramList(itf_storageListFn fn, void* ctx){
+    int i;
+    if(!host_mounted){
+        return 0;
+    }
+    for(i=0;i<HOST_STORAGE_RAM_FILES;i++){
+        if(host_ramFiles[i].name[0] != 0){
+            fn(host_ramFiles[i].name, host_ramFiles[i].size, ctx);
+        }
+    }
+    return 1;
+}
+
+static int host_ramRemove(const char* name){
+    pthread_mutex_lock(&host_ramLock);
+    int i = host_ramFind(name);
+    if(i >= 0){
+        free(host_ramFiles[i].data);
+        memset(&host_ramFiles[i], 0, sizeof(host_ramFiles[i]));
+    }
+    pthread_mutex_unlock(&host_ramLock);
+    return i >= 0;
+}
+
+const itf_storageOps_t host_storageRam = {
+    .name = "ramdisk",
+    .mount = host_mount,
+    .unmount = host_unmount,
+    .mounted = host_isMounted,
+    .open = host_ramOpen,
+    .openRead = host_ramOpenRead,
+    .size = host_ramSize,
+    .expand = host_ramExpand,
+    .seek = host_ramSeek,
+    .write = host_ramWrite,
+    .read = host_ramRead,
+    .sync = host_ramSync,
+    .truncate = host_ramTruncate,
+    .close = host_fileClose,
+    .list = host_ramList,
+    .remove = host_ramRemove,
+};
@@ -0,0 +1,43 @@
+//Host backends for itf_storage (main/itf_storage.h) so the real SD writer can run off target.
+//  host_storageDir  files in a directory on the host disk
+//  host_storageRam  files in memory, like a card that is never slower than the RAM
+//Both go through the same fault layer: per-write latency, periodic stalls (card garbage
+//collection), failing writes, mounts that fail for a while after an error, and read latency.
+#ifndef HOST_STORAGE_H_
+#define HOST_STORAGE_H_
+
+#include <stdint.h>
+#include "itf_storage.h"
+
+typedef struct {
+    int write_us;           //Fixed cost of every write
+    int perKB_us;           //Plus this per KB written
+    int stallEvery;         //Every Nth write stalls for stall_ms (0 = never)
+    int stall_ms;
+    int failEvery;          //Every Nth write fails (0 = never)
+    int failPpm;            //Random write failures, parts per million
+    int mountFails;         //Mounts that fail after a write error before the card comes back
+    int read_us;            //Cost of every read (openRead handles)
+    uint32_t seed;
+} host_storageFaults_t;
+
+typedef struct {
+    unsigned long writes, bytes, stalls, failedWrites, mounts, failedMounts, syncs;
+    int64_t writeMax_us;
+} host_storageStats_t;
+
+extern const itf_storageOps_t host_storageDir;
+extern const itf_storageOps_t host_storageRam;
+
+//The directory host_storageDir works in (created if missing, its parent must exist). Call before mounting.
+int host_storageDirInit(const char* dir);
+//Drops every file on the RAM disk
+void host_storageRamClear(void);
+//Copies a RAM disk file to path on the host. Returns 1 on success.
+int host_storageRamSave(const char* name, const char* path);
+
+void host_storageSetFaults(const host_storageFaults_t* faults);
+void host_storageGetStats(host_storageStats_t* stats);
+int host_storageOpenFiles(void);
+
+#endif
@@ -0,0 +1,1095 @@
+//Season scale log analyzer: memory maps S*.BIN log files (main/itf_log_codec.h) and old data.bin
+//files (the 0xBADFADE5 edge / 0xDEADBEEF long records), decodes them in parallel on every core and
+//writes CSV or one binary column per field, plus a summary line for every run.
+//
+//Work is cut into chunks: whole blocks for the container, and for data.bin byte ranges that each
+//start on a record marker. A window of chunks is decoded in parallel, then stitched in order on the
+//main thread (stale blocks dropped, data.bin's 32 bit clock unwrapped, energy and distance
+//integrated), formatted in parallel again and written, so memory stays bounded however big the input.
+//
+//Build from the repo root (the codec is C, so it's compiled separately):
+//  gcc -O2 -c -Imain main/itf_log_codec.c main/itf_crc.c
+//  g++ -O2 -std=c++17 -pthread -Imain tools/host/log_analyze.cpp itf_log_codec.o itf_crc.o -o log_analyze
+//
+//  ./log_analyze /sdcard_copy                 every S*.BIN (and data.bin) in a folder: run summary
+//  ./log_analyze S0004_00.BIN --csv race      race_edges.csv, race_long.csv, race_faults.csv, race_runs.csv
+//  ./log_analyze data.bin --columns cols      cols/<table>_<field>.<type> raw little endian arrays, cols/columns.txt
+//  ./log_analyze --bench [MB]                 throughput on generated files, per thread count and output
+//Runs: a session (all parts of S<session>_*.BIN), or in data.bin a stretch between reboots.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern "C" {
+#include "itf_log_codec.h"
+}
+
+//---------------------------------------------------------------- Decoded rows
+
+struct EdgeRow {
+    uint64_t t;                 //us since boot
+    uint32_t seg;               //Clock segment while decoding, run number after stitching
+    uint8_t hall;
+    uint8_t status;
+    int32_t cur[3];             //10 mA
+};
+
+struct LongRow {
+    uint64_t t;
+    uint32_t seg;
+    uint8_t status;
+    int32_t v[ITF_LOG_LONG_FIELDS];     //Scaled as in itf_log_codec.h (speed mph x100)
+};
+
+struct StatusRow {
+    uint64_t t;
+    uint32_t seg;
+    uint8_t status;             //(shutdown<<7) | error code
+};
+
+//A data block's rows, so blocks left over from an older file can be dropped after the decode
+struct BlockSpan {
+    uint32_t seq;
+    size_t edgeEnd, longEnd, statusEnd;
+};
+
+//data.bin only: where the raw 32 bit clock went backwards inside a chunk
+struct ClockSeg {
+    uint32_t firstRaw, lastRaw;
+};
+
+struct InputFile {
+    std::string path;
+    const uint8_t* data = nullptr;
+    uint64_t size = 0;
+    bool container = false;
+    uint32_t blockSize = 0;
+    uint64_t firstBlock = 0, endBlock = 0;  //Data blocks [firstBlock, endBlock)
+    int session = -1;                       //From the S<session>_<part>.BIN name
+};
+
+struct Chunk {
+    int file;
+    uint64_t begin, end;            //Blocks for the container, bytes for data.bin
+    std::vector<EdgeRow> edges;
+    std::vector<LongRow> longs;
+    std::vector<StatusRow> status;
+    std::vector<BlockSpan> blocks;
+    std::vector<ClockSeg> segs;
+    std::vector<double> energy;     //Per long row, cumulative J in the run (filled while stitching)
+    uint64_t goodBlocks = 0, damagedBlocks = 0, emptyBlocks = 0, staleBlocks = 0;
+    uint64_t raws = 0, skippedBytes = 0;
+    int lastStatus = -1;
+    std::string csv[3];
+};
+
+struct RunStats {
+    std::string source;
+    uint64_t start_us = 0, end_us = 0;
+    uint64_t edges = 0, longs = 0, faults = 0, shutdowns = 0, damaged = 0;
+    double energy_j = 0, miles = 0;
+    double maxSpeed = 0, maxPower = 0, maxPhase = 0, maxBat = 0, minVolts = 1e9, maxTemp = -1e9;
+    uint64_t lastLong_us = 0;
+    bool haveLong = false;
+    double lastPower = 0, lastSpeed = 0;
+    int lastStatus = 0;
+};
+
+static const uint32_t LEGACY_EDGE = 0xBADFADE5;
+static const uint32_t LEGACY_LONG = 0xDEADBEEF;
+static const int LEGACY_EDGE_LEN = 16;
+static const int LEGACY_LONG_LEN = 25;
+static const uint64_t MAX_INTEGRATE_GAP_US = 2000000;   //Longer gaps in the long records aren't integrated over
+static const uint32_t WRAP_SLACK = 120000000;          //A backwards jump this close to 2^32 is the clock wrapping
+
+static const char* longNames[ITF_LOG_LONG_FIELDS] = {
+    "speed_mph", "inst_power_w", "avg_power_w", "volts", "current_a", "temp_a", "temp_b", "temp_c", "throttle", "duty"
+};
+static const double longScale[ITF_LOG_LONG_FIELDS] = { 100, 10, 10, 100, 100, 100, 100, 100, 1, 1 };
+static const int longDecimals[ITF_LOG_LONG_FIELDS] = { 2, 1, 1, 2, 2, 2, 2, 2, 0, 0 };
+
+//---------------------------------------------------------------- Input
+
+static uint32_t rd32be(const uint8_t* p){
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint32_t rd32le(const uint8_t* p){
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int16_t rd16be(const uint8_t* p){
+    return (int16_t) (((uint16_t) p[0] << 8) | p[1]);
+}
+
+static bool openInput(const std::string& path, InputFile& in){
+    struct stat sb;
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0 || fstat(fd, &sb) != 0 || sb.st_size == 0){
+        if(fd >= 0) close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, (size_t) sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED){
+        return false;
+    }
+    madvise(p, (size_t) sb.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    in.path = path;
+    in.data = (const uint8_t*) p;
+    in.size = (uint64_t) sb.st_size;
+
+    itf_logFileInfo_t info;
+    int probe = (int) std::min<uint64_t>(in.size, 4096);
+    if(itf_logParseFileHeader(in.data, probe, &info) == 0 && info.blockSize >= 512 &&
+       itf_logParseFileHeader(in.data, (int) std::min<uint64_t>(in.size, info.blockSize), &info) == 0){
+        in.container = true;
+        in.blockSize = info.blockSize;
+        uint64_t blocks = in.size/in.blockSize;
+        in.firstBlock = 1;
+        in.endBlock = blocks;
+        //A closed file ends with the index, which also says where the data stopped
+        uint32_t stride, lastBlock;
+        if(blocks >= 2 && itf_logParseIndex(in.data + (blocks - 1)*in.blockSize, (int) in.blockSize, &stride, &lastBlock) >= 0){
+            in.endBlock = std::min<uint64_t>(blocks - 1, (uint64_t) lastBlock + 1);
+        }
+    }
+    const char* base = strrchr(path.c_str(), '/');
+    base = base ? base + 1 : path.c_str();
+    int s, part;
+    if(sscanf(base, "S%4d_%2d.BIN", &s, &part) == 2){
+        in.session = s;
+    }
+    return true;
+}
+
+//A folder is read as its S*.BIN files in name order, then data.bin
+static void addPath(const std::string& path, std::vector<std::string>& out){
+    struct stat sb;
+    if(stat(path.c_str(), &sb) != 0 || !S_ISDIR(sb.st_mode)){
+        out.push_back(path);
+        return;
+    }
+    std::vector<std::string> names;
+    DIR* d = opendir(path.c_str());
+    struct dirent* de;
+    while(d && (de = readdir(d)) != nullptr){
+        std::string n = de->d_name;
+        if((n.size() == 12 && n[0] == 'S' && n.compare(8, 4, ".BIN") == 0) || n == "data.bin" || n == "DATA.BIN"){
+            names.push_back(n);
+        }
+    }
+    if(d) closedir(d);
+    std::sort(names.begin(), names.end());
+    for(auto& n : names){
+        out.push_back(path + "/" + n);
+    }
+}
+
+//---------------------------------------------------------------- Decode (worker threads)
+
+struct BlockCtx {
+    Chunk* c;
+};
+
+static void noteStatus(Chunk& c, uint64_t t, uint32_t seg, uint8_t status){
+    if(c.lastStatus != status){
+        c.status.push_back({t, seg, status});
+        c.lastStatus = status;
+    }
+}
+
+static void onRecord(const itf_logRecord_t* r, void* ctx){
+    Chunk& c = *((BlockCtx*) ctx)->c;
+    switch(r->tag){
+    case ITF_LOG_TAG_EDGE: {
+        EdgeRow e;
+        e.t = r->time_us;
+        e.seg = 0;
+        e.hall = r->hall;
+        e.status = r->status;
+        memcpy(e.cur, r->cur, sizeof(e.cur));
+        c.edges.push_back(e);
+        noteStatus(c, r->time_us, 0, r->status);
+        break;
+    }
+    case ITF_LOG_TAG_LONG: {
+        LongRow l;
+        l.t = r->time_us;
+        l.seg = 0;
+        l.status = r->status;
+        memcpy(l.v, r->lng, sizeof(l.v));
+        c.longs.push_back(l);
+        noteStatus(c, r->time_us, 0, r->status);
+        break;
+    }
+    case ITF_LOG_TAG_STATE:
+        noteStatus(c, r->time_us, 0, r->status);
+        break;
+    case ITF_LOG_TAG_CMD:
+    case ITF_LOG_TAG_TRACE:
+        break;                  //Only tools/host/log_replay.c and trace_decode.c use these
+    default:
+        c.raws++;
+        break;
+    }
+}
+
+static void decodeContainer(const InputFile& in, Chunk& c){
+    BlockCtx ctx = { &c };
+    for(uint64_t b=c.begin;b<c.end;b++){
+        const uint8_t* block = in.data + b*in.blockSize;
+        if(memcmp(block, "ITFB", 4) != 0){
+            c.emptyBlocks++;            //Preallocated space past the end of the log
+            continue;
+        }
+        size_t e = c.edges.size(), l = c.longs.size(), s = c.status.size();
+        if(itf_logDecodeBlock(block, (int) in.blockSize, onRecord, &ctx) < 0){
+            //Keep nothing from a damaged block, even the records before the damage
+            c.edges.resize(e);
+            c.longs.resize(l);
+            c.status.resize(s);
+            c.damagedBlocks++;
+            continue;
+        }
+        c.goodBlocks++;
+        c.blocks.push_back({rd32le(block + 4), c.edges.size(), c.longs.size(), c.status.size()});
+    }
+}
+
+static int legacyLen(const uint8_t* p, const uint8_t* end){
+    if(end - p < 4){
+        return 0;
+    }
+    uint32_t m = rd32be(p);
+    if(m == LEGACY_EDGE && end - p >= LEGACY_EDGE_LEN) return LEGACY_EDGE_LEN;
+    if(m == LEGACY_LONG && end - p >= LEGACY_LONG_LEN) return LEGACY_LONG_LEN;
+    return 0;
+}
+
+//A marker counts as a record start if the record after it starts with a marker too (or the file ends)
+static bool legacyStart(const uint8_t* p, const uint8_t* fileEnd){
+    int n = legacyLen(p, fileEnd);
+    return n > 0 && (p + n == fileEnd || fileEnd - (p + n) < 4 || legacyLen(p + n, fileEnd) > 0);
+}
+
+//Records starting in [begin, end) of data.bin. The records run past end if they straddle it.
+static void decodeLegacy(const InputFile& in, Chunk& c){
+    const uint8_t* fileEnd = in.data + in.size;
+    const uint8_t* p = in.data + c.begin;
+    const uint8_t* end = in.data + c.end;
+    bool synced = (c.begin == 0) && legacyStart(p, fileEnd);
+    bool found = synced || c.begin == 0;   //Bytes before the first record belong to the chunk before
+    uint32_t seg = 0;
+    bool haveTime = false;
+
+    while(p < end){
+        if(!synced){
+            if(!legacyStart(p, fileEnd)){
+                p++;
+                c.skippedBytes += found;
+                continue;
+            }
+            synced = found = true;
+        }
+        int n = legacyLen(p, fileEnd);
+        if(n == 0){
+            synced = false;
+            continue;
+        }
+        uint32_t t = rd32be(p + n - 4);
+        if(!haveTime){
+            c.segs.push_back({t, t});
+            haveTime = true;
+        }else if(t < c.segs[seg].lastRaw){
+            c.segs.push_back({t, t});
+            seg++;
+        }
+        c.segs[seg].lastRaw = t;
+
+        uint8_t status;
+        if(n == LEGACY_EDGE_LEN){
+            EdgeRow e;
+            e.t = t;
+            e.seg = seg;
+            e.hall = p[4];
+            e.status = status = p[5];
+            //Phase A lost its sign bit in the old writer, B and C are sign and magnitude
+            e.cur[0] = ((int32_t) p[6] << 8) | p[7];
+            e.cur[1] = (((int32_t) (p[8] & 0x7F) << 8) | p[9]) * ((p[8] & 0x80) ? -1 : 1);
+            e.cur[2] = (((int32_t) (p[10] & 0x7F) << 8) | p[11]) * ((p[10] & 0x80) ? -1 : 1);
+            c.edges.push_back(e);
+        }else{
+            LongRow l;
+            l.t = t;
+            l.seg = seg;
+            l.v[ITF_LOG_LONG_SPEED] = p[4]*100;
+            l.v[ITF_LOG_LONG_INST_POWER] = rd16be(p + 5);
+            l.v[ITF_LOG_LONG_AVG_POWER] = rd16be(p + 7);
+            l.v[ITF_LOG_LONG_VOLTS] = rd16be(p + 9);
+            l.v[ITF_LOG_LONG_CURRENT] = rd16be(p + 11);
+            l.v[ITF_LOG_LONG_TEMP_A] = rd16be(p + 13);
+            l.v[ITF_LOG_LONG_TEMP_B] = rd16be(p + 15);
+            l.v[ITF_LOG_LONG_TEMP_C] = rd16be(p + 17);
+            l.status = status = p[19];
+            l.v[ITF_LOG_LONG_THROTTLE] = p[20] << 4;
+            l.v[ITF_LOG_LONG_DUTY] = 0;             //Not logged before schema 2
+            c.longs.push_back(l);
+        }
+        noteStatus(c, t, seg, status);
+        p += n;
+    }
+}
+
+static void decodeChunk(const std::vector<InputFile>& files, Chunk& c){
+    const InputFile& in = files[c.file];
+    if(in.container){
+        decodeContainer(in, c);
+    }else{
+        decodeLegacy(in, c);
+    }
+}
+
+//---------------------------------------------------------------- Stitching (main thread, in order)
+
+struct Stitcher {
+    std::vector<RunStats> runs;
+    int lastFile = -1;
+    int lastSession = -2;
+    //Container
+    bool haveSeq = false;
+    uint32_t lastSeq = 0;
+    //data.bin clock
+    bool haveRaw = false;
+    uint32_t lastRaw = 0;
+    uint64_t hi = 0;
+    int lastStatus = -1;
+    uint64_t staleBlocks = 0, damagedBlocks = 0, emptyBlocks = 0, goodBlocks = 0, raws = 0, skipped = 0;
+    uint64_t edges = 0, longs = 0;
+
+    void newRun(const InputFile& in){
+        RunStats r;
+        const char* base = strrchr(in.path.c_str(), '/');
+        r.source = base ? base + 1 : in.path;
+        runs.push_back(r);
+        haveRaw = false;
+        hi = 0;
+        lastStatus = -1;
+    }
+
+    //Drops the rows of blocks whose sequence number goes backwards (clusters reused from an older file)
+    void dropStale(Chunk& c){
+        size_t e0 = 0, l0 = 0, s0 = 0, e = 0, l = 0, s = 0;
+        bool any = false;
+        for(auto& b : c.blocks){
+            bool stale = haveSeq && b.seq < lastSeq;
+            if(stale){
+                staleBlocks++;
+                any = true;
+            }else{
+                lastSeq = b.seq;
+                haveSeq = true;
+                if(any){
+                    std::copy(c.edges.begin() + e0, c.edges.begin() + b.edgeEnd, c.edges.begin() + e);
+                    std::copy(c.longs.begin() + l0, c.longs.begin() + b.longEnd, c.longs.begin() + l);
+                    std::copy(c.status.begin() + s0, c.status.begin() + b.statusEnd, c.status.begin() + s);
+                }
+                e += b.edgeEnd - e0;
+                l += b.longEnd - l0;
+                s += b.statusEnd - s0;
+            }
+            e0 = b.edgeEnd;
+            l0 = b.longEnd;
+            s0 = b.statusEnd;
+        }
+        if(any){
+            c.edges.resize(e);
+            c.longs.resize(l);
+            c.status.resize(s);
+        }
+    }
+
+    void stitch(const std::vector<InputFile>& files, Chunk& c){
+        const InputFile& in = files[c.file];
+        if(c.file != lastFile){
+            if(!in.container || in.session < 0 || in.session != lastSession || runs.empty()){
+                newRun(in);
+            }
+            lastFile = c.file;
+            lastSession = in.session;
+            haveSeq = false;
+        }
+        goodBlocks += c.goodBlocks;
+        damagedBlocks += c.damagedBlocks;
+        emptyBlocks += c.emptyBlocks;
+        raws += c.raws;
+        skipped += c.skippedBytes;
+        runs.back().damaged += c.damagedBlocks;
+
+        //Work out which run and which 2^32 us wrap each clock segment of the chunk belongs to
+        std::vector<uint64_t> segHi;
+        std::vector<uint32_t> segRun;
+        if(in.container){
+            dropStale(c);
+            segHi.push_back(0);
+            segRun.push_back((uint32_t) runs.size() - 1);
+        }else{
+            for(auto& s : c.segs){
+                if(haveRaw && s.firstRaw < lastRaw){
+                    if(lastRaw >= UINT32_MAX - WRAP_SLACK && s.firstRaw < WRAP_SLACK){
+                        hi += 1ULL << 32;
+                    }else{
+                        newRun(in);         //Time went back: the board was reset
+                    }
+                }
+                segHi.push_back(hi);
+                segRun.push_back((uint32_t) runs.size() - 1);
+                lastRaw = s.lastRaw;
+                haveRaw = true;
+            }
+        }
+        for(auto& e : c.edges){
+            e.t += segHi[e.seg];
+            e.seg = segRun[e.seg];
+            RunStats& r = runs[e.seg];
+            for(int i=0;i<3;i++){
+                r.maxPhase = std::max(r.maxPhase, std::abs(e.cur[i])/100.0);
+            }
+            r.edges++;
+            note(r, e.t);
+        }
+        c.energy.resize(c.longs.size());
+        for(size_t i=0;i<c.longs.size();i++){
+            LongRow& l = c.longs[i];
+            l.t += segHi[l.seg];
+            l.seg = segRun[l.seg];
+            RunStats& r = runs[l.seg];
+            double speed = l.v[ITF_LOG_LONG_SPEED]/100.0, power = l.v[ITF_LOG_LONG_INST_POWER]/10.0;
+            if(r.haveLong && l.t > r.lastLong_us && l.t - r.lastLong_us <= MAX_INTEGRATE_GAP_US){
+                double dt = (l.t - r.lastLong_us)/1e6;
+                r.energy_j += 0.5*(power + r.lastPower)*dt;
+                r.miles += 0.5*(speed + r.lastSpeed)*dt/3600.0;
+            }
+            r.haveLong = true;
+            r.lastLong_us = l.t;
+            r.lastPower = power;
+            r.lastSpeed = speed;
+            r.maxSpeed = std::max(r.maxSpeed, speed);
+            r.maxPower = std::max(r.maxPower, power);
+            r.maxBat = std::max(r.maxBat, std::abs(l.v[ITF_LOG_LONG_CURRENT])/100.0);
+            if(l.v[ITF_LOG_LONG_VOLTS] > 0){
+                r.minVolts = std::min(r.minVolts, l.v[ITF_LOG_LONG_VOLTS]/100.0);
+            }
+            for(int k=ITF_LOG_LONG_TEMP_A;k<=ITF_LOG_LONG_TEMP_C;k++){
+                r.maxTemp = std::max(r.maxTemp, l.v[k]/100.0);
+            }
+            r.longs++;
+            c.energy[i] = r.energy_j;
+            note(r, l.t);
+        }
+        //Status changes: the first one of a chunk may only repeat the last of the one before
+        size_t keep = 0;
+        for(auto& s : c.status){
+            s.t += segHi[s.seg];
+            s.seg = segRun[s.seg];
+            RunStats& r = runs[s.seg];
+            if((int) s.status == lastStatus){
+                continue;
+            }
+            if((s.status & 0x7F) != 0 && (r.lastStatus & 0x7F) == 0){
+                r.faults++;
+            }
+            if((s.status & 0x80) && !(r.lastStatus & 0x80)){
+                r.shutdowns++;
+            }
+            r.lastStatus = s.status;
+            lastStatus = s.status;
+            c.status[keep++] = s;
+        }
+        c.status.resize(keep);
+        edges += c.edges.size();
+        longs += c.longs.size();
+    }
+
+    //Called after the record has been counted
+    static void note(RunStats& r, uint64_t t){
+        r.start_us = (r.edges + r.longs == 1) ? t : std::min(r.start_us, t);
+        r.end_us = std::max(r.end_us, t);
+    }
+};
+
+//---------------------------------------------------------------- Output
+
+//CSV is mostly fixed point numbers; printf would make it the slowest step by far.
+//Both append the number and a comma.
+static char* putUint(char* p, uint64_t v){
+    char tmp[24];
+    int n = 0;
+    do{
+        tmp[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    }while(v != 0);
+    while(n > 0){
+        *p++ = tmp[--n];
+    }
+    *p++ = ',';
+    return p;
+}
+
+//v in units of 10^-decimals
+static char* putFixed(char* p, int64_t v, int decimals){
+    static const int64_t pow10[7] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+    if(v < 0){
+        *p++ = '-';
+        v = -v;
+    }
+    if(decimals == 0){
+        return putUint(p, (uint64_t) v);
+    }
+    p = putUint(p, (uint64_t) (v/pow10[decimals]));
+    p[-1] = '.';
+    int64_t frac = v % pow10[decimals];
+    for(int d=decimals-1;d>=0;d--){
+        *p++ = (char) ('0' + (frac/pow10[d]) % 10);
+    }
+    *p++ = ',';
+    return p;
+}
+
+struct Output {
+    std::string csvPrefix, colDir;
+    FILE* csv[3] = { nullptr, nullptr, nullptr };
+    std::vector<FILE*> cols;
+    std::vector<std::string> colNames;
+    std::vector<uint64_t> colRows;
+    uint64_t bytesOut = 0;
+
+    bool open(){
+        static const char* tables[3] = { "edges", "long", "faults" };
+        static const char* heads[3] = {
+            "run,time_s,hall,status,cur_a,cur_b,cur_c\n",
+            nullptr,
+            "run,time_s,status,error,shutdown\n" };
+        if(!csvPrefix.empty()){
+            for(int i=0;i<3;i++){
+                std::string p = csvPrefix + "_" + tables[i] + ".csv";
+                if((csv[i] = fopen(p.c_str(), "w")) == nullptr){
+                    return false;
+                }
+                if(i == 1){
+                    fprintf(csv[i], "run,time_s,status");
+                    for(int k=0;k<ITF_LOG_LONG_FIELDS;k++){
+                        fprintf(csv[i], ",%s", longNames[k]);
+                    }
+                    fprintf(csv[i], ",energy_j\n");
+                }else{
+                    fputs(heads[i], csv[i]);
+                }
+            }
+        }
+        if(!colDir.empty()){
+            mkdir(colDir.c_str(), 0755);
+            addCol("edges_run.u32"); addCol("edges_time_us.u64"); addCol("edges_hall.u8"); addCol("edges_status.u8");
+            addCol("edges_cur_a.f32"); addCol("edges_cur_b.f32"); addCol("edges_cur_c.f32");
+            addCol("long_run.u32"); addCol("long_time_us.u64"); addCol("long_status.u8");
+            for(int k=0;k<ITF_LOG_LONG_FIELDS;k++){
+                addCol(std::string("long_") + longNames[k] + ".f32");
+            }
+            addCol("long_energy_j.f64");
+            addCol("faults_run.u32"); addCol("faults_time_us.u64"); addCol("faults_status.u8");
+            for(FILE* f : cols){
+                if(f == nullptr) return false;
+            }
+        }
+        return true;
+    }
+
+    void addCol(const std::string& name){
+        cols.push_back(fopen((colDir + "/" + name).c_str(), "wb"));
+        colNames.push_back(name);
+        colRows.push_back(0);
+    }
+
+    template<typename T> void putCol(int i, const std::vector<T>& v){
+        fwrite(v.data(), sizeof(T), v.size(), cols[i]);
+        colRows[i] += v.size();
+        bytesOut += v.size()*sizeof(T);
+    }
+
+    //Runs on the worker threads once the chunk has been stitched
+    static void formatCsv(Chunk& c){
+        char line[512];
+        for(auto& s : c.csv) s.clear();
+        c.csv[0].reserve(c.edges.size()*40);
+        c.csv[1].reserve(c.longs.size()*80);
+        for(auto& e : c.edges){
+            char* p = putUint(line, e.seg);
+            p = putFixed(p, (int64_t) e.t, 6);
+            p = putUint(p, e.hall);
+            p = putUint(p, e.status);
+            for(int i=0;i<3;i++){
+                p = putFixed(p, e.cur[i], 2);
+            }
+            p[-1] = '\n';
+            c.csv[0].append(line, p - line);
+        }
+        for(size_t i=0;i<c.longs.size();i++){
+            const LongRow& l = c.longs[i];
+            char* p = putUint(line, l.seg);
+            p = putFixed(p, (int64_t) l.t, 6);
+            p = putUint(p, l.status);
+            for(int k=0;k<ITF_LOG_LONG_FIELDS;k++){
+                p = putFixed(p, l.v[k], longDecimals[k]);
+            }
+            p = putFixed(p, llround(c.energy[i]*10), 1);
+            p[-1] = '\n';
+            c.csv[1].append(line, p - line);
+        }
+        for(auto& s : c.status){
+            int n = snprintf(line, sizeof(line), "%u,%.6f,%u,%u,%u\n", s.seg, s.t/1e6, s.status, s.status & 0x7F, s.status >> 7);
+            c.csv[2].append(line, n);
+        }
+    }
+
+    void write(Chunk& c){
+        for(int i=0;i<3;i++){
+            if(csv[i] != nullptr){
+                fwrite(c.csv[i].data(), 1, c.csv[i].size(), csv[i]);
+                bytesOut += c.csv[i].size();
+            }
+        }
+        if(cols.empty()){
+            return;
+        }
+        int k = 0;
+        std::vector<uint32_t> u32;
+        std::vector<uint64_t> u64;
+        std::vector<uint8_t> u8;
+        std::vector<float> f32;
+        auto gather = [&](auto& rows, auto get, auto& into){
+            into.clear();
+            for(auto& r : rows) into.push_back(get(r));
+        };
+        gather(c.edges, [](const EdgeRow& e){ return e.seg; }, u32); putCol(k++, u32);
+        gather(c.edges, [](const EdgeRow& e){ return e.t; }, u64); putCol(k++, u64);
+        gather(c.edges, [](const EdgeRow& e){ return e.hall; }, u8); putCol(k++, u8);
+        gather(c.edges, [](const EdgeRow& e){ return e.status; }, u8); putCol(k++, u8);
+        for(int p=0;p<3;p++){
+            gather(c.edges, [p](const EdgeRow& e){ return (float) (e.cur[p]/100.0); }, f32); putCol(k++, f32);
+        }
+        gather(c.longs, [](const LongRow& l){ return l.seg; }, u32); putCol(k++, u32);
+        gather(c.longs, [](const LongRow& l){ return l.t; }, u64); putCol(k++, u64);
+        gather(c.longs, [](const LongRow& l){ return l.status; }, u8); putCol(k++, u8);
+        for(int f=0;f<ITF_LOG_LONG_FIELDS;f++){
+            gather(c.longs, [f](const LongRow& l){ return (float) (l.v[f]/longScale[f]); }, f32); putCol(k++, f32);
+        }
+        putCol(k++, c.energy);
+        gather(c.status, [](const StatusRow& s){ return s.seg; }, u32); putCol(k++, u32);
+        gather(c.status, [](const StatusRow& s){ return s.t; }, u64); putCol(k++, u64);
+        gather(c.status, [](const StatusRow& s){ return s.status; }, u8); putCol(k++, u8);
+    }
+
+    void close(const std::vector<RunStats>& runs){
+        for(auto& f : csv){
+            if(f) fclose(f);
+        }
+        if(!csvPrefix.empty()){
+            FILE* f = fopen((csvPrefix + "_runs.csv").c_str(), "w");
+            if(f){
+                fprintf(f, "run,source,start_s,duration_s,edges,longs,miles,avg_mph,max_mph,energy_wh,avg_power_w,"
+                           "max_power_w,max_phase_a,max_battery_a,min_volts,max_temp,faults,shutdowns,damaged_blocks,mi_per_kwh\n");
+                for(size_t i=0;i<runs.size();i++){
+                    printRun(f, (int) i, runs[i], true);
+                }
+                fclose(f);
+            }
+        }
+        if(!cols.empty()){
+            FILE* m = fopen((colDir + "/columns.txt").c_str(), "w");
+            for(size_t i=0;i<cols.size();i++){
+                fclose(cols[i]);
+                if(m) fprintf(m, "%s %llu\n", colNames[i].c_str(), (unsigned long long) colRows[i]);
+            }
+            if(m) fclose(m);
+        }
+    }
+
+    static void printRun(FILE* f, int i, const RunStats& r, bool csvLine){
+        double dur = (r.end_us - r.start_us)/1e6;
+        double wh = r.energy_j/3600.0;
+        double avgMph = (dur > 0) ? r.miles/(dur/3600.0) : 0;
+        double avgW = (dur > 0) ? r.energy_j/dur : 0;
+        double eff = (wh > 0) ? r.miles/(wh/1000.0) : 0;
+        double minV = (r.minVolts < 1e8) ? r.minVolts : 0, maxT = (r.maxTemp > -1e8) ? r.maxTemp : 0;
+        if(csvLine){
+            fprintf(f, "%d,%s,%.3f,%.3f,%llu,%llu,%.4f,%.2f,%.2f,%.3f,%.1f,%.1f,%.2f,%.2f,%.2f,%.2f,%llu,%llu,%llu,%.1f\n",
+                    i, r.source.c_str(), r.start_us/1e6, dur, (unsigned long long) r.edges, (unsigned long long) r.longs,
+                    r.miles, avgMph, r.maxSpeed, wh, avgW, r.maxPower, r.maxPhase, r.maxBat, minV, maxT,
+                    (unsigned long long) r.faults, (unsigned long long) r.shutdowns, (unsigned long long) r.damaged, eff);
+        }else{
+            fprintf(f, "run=%d source=%s start_s=%.1f duration_s=%.1f edges=%llu longs=%llu miles=%.3f avg_mph=%.2f max_mph=%.2f "
+                       "energy_wh=%.2f avg_w=%.1f max_w=%.1f max_phase_a=%.2f max_bat_a=%.2f min_v=%.2f max_temp=%.1f "
+                       "faults=%llu shutdowns=%llu damaged=%llu mi_per_kwh=%.1f\n",
+                    i, r.source.c_str(), r.start_us/1e6, dur, (unsigned long long) r.edges, (unsigned long long) r.longs,
+                    r.miles, avgMph, r.maxSpeed, wh, avgW, r.maxPower, r.maxPhase, r.maxBat, minV, maxT,
+                    (unsigned long long) r.faults, (unsigned long long) r.shutdowns, (unsigned long long) r.damaged, eff);
+        }
+    }
+};
+
+//---------------------------------------------------------------- Driver
+
+struct Options {
+    int threads = 0;
+    uint64_t chunkBytes = 8ULL << 20;
+    bool quiet = false;
+};
+
+//Cuts every file into chunks of about chunkBytes, container chunks on block boundaries
+static std::vector<Chunk> planChunks(const std::vector<InputFile>& files, uint64_t chunkBytes){
+    std::vector<Chunk> plan;
+    for(int f=0;f<(int) files.size();f++){
+        const InputFile& in = files[f];
+        uint64_t step = in.container ? std::max<uint64_t>(1, chunkBytes/in.blockSize) : chunkBytes;
+        uint64_t first = in.container ? in.firstBlock : 0, end = in.container ? in.endBlock : in.size;
+        for(uint64_t b=first;b<end;b+=step){
+            Chunk c;
+            c.file = f;
+            c.begin = b;
+            c.end = std::min(end, b + step);
+            plan.push_back(std::move(c));
+        }
+    }
+    return plan;
+}
+
+template<typename Fn> static void parallelFor(int n, int threads, Fn fn){
+    std::atomic<int> next(0);
+    std::vector<std::thread> pool;
+    for(int t=0;t<std::min(n, threads);t++){
+        pool.emplace_back([&](){
+            int i;
+            while((i = next++) < n){
+                fn(i);
+            }
+        });
+    }
+    for(auto& th : pool){
+        th.join();
+    }
+}
+
+struct Result {
+    uint64_t inBytes = 0, records = 0, outBytes = 0;
+    double seconds = 0;
+};
+
+static Result analyze(const std::vector<InputFile>& files, Output& out, const Options& opt, Stitcher& st){
+    Result res;
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<Chunk> plan = planChunks(files, opt.chunkBytes);
+    bool csv = out.csv[0] != nullptr;
+    int window = opt.threads*2;
+    for(size_t w=0;w<plan.size();w+=window){
+        int n = (int) std::min<size_t>(window, plan.size() - w);
+        parallelFor(n, opt.threads, [&](int i){ decodeChunk(files, plan[w + i]); });
+        for(int i=0;i<n;i++){
+            st.stitch(files, plan[w + i]);
+        }
+        if(csv){
+            parallelFor(n, opt.threads, [&](int i){ Output::formatCsv(plan[w + i]); });
+        }
+        for(int i=0;i<n;i++){
+            Chunk& c = plan[w + i];
+            out.write(c);
+            res.records += c.edges.size() + c.longs.size();
+            c = Chunk();        //Give the rows back before the next window
+        }
+    }
+    for(auto& f : files){
+        res.inBytes += f.size;
+    }
+    res.outBytes = out.bytesOut;
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return res;
+}
+
+static void closeInputs(std::vector<InputFile>& files){
+    for(auto& f : files){
+        munmap((void*) f.data, f.size);
+    }
+    files.clear();
+}
+
+//---------------------------------------------------------------- Benchmark
+
+//Writes a closed S*.BIN like the board would for a steady drive: edges at 12 kHz, long records at 10 Hz
+static bool makeContainer(const char* path, uint64_t bytes, uint32_t blockSize){
+    FILE* f = fopen(path, "wb");
+    if(f == nullptr) return false;
+    std::vector<uint8_t> block(blockSize), index(blockSize);
+    itf_logEncodeFileHeader(block.data(), (int) blockSize, 0);
+    fwrite(block.data(), 1, blockSize, f);
+    itf_logIndexInit(index.data());
+    itf_logState_t st;
+    uint64_t t = 1000000, nextLong = t;
+    uint32_t seq = 0, blockNo = 1;
+    uint64_t i = 0;
+    static const uint8_t halls[6] = {1, 3, 2, 6, 4, 5};
+    while((uint64_t) blockNo*blockSize < bytes){
+        std::fill(block.begin(), block.end(), 0);
+        int used = itf_logEncodeBlockHeader(block.data(), &st, t, seq++);
+        while(used + ITF_LOG_LONG_MAX < (int) blockSize){
+            if(t >= nextLong){
+                itf_logLong_t r;
+                r.time_us = t;
+                r.status = (i % 200000 < 100) ? 3 : 0;
+                r.v[ITF_LOG_LONG_SPEED] = 1500 + (int32_t) (i % 400);
+                r.v[ITF_LOG_LONG_INST_POWER] = 4000 + (int32_t) (i % 1000);
+                r.v[ITF_LOG_LONG_AVG_POWER] = 4200;
+                r.v[ITF_LOG_LONG_VOLTS] = 4800 - (int32_t) (i % 300);
+                r.v[ITF_LOG_LONG_CURRENT] = 900 + (int32_t) (i % 50);
+                r.v[ITF_LOG_LONG_TEMP_A] = r.v[ITF_LOG_LONG_TEMP_B] = r.v[ITF_LOG_LONG_TEMP_C] = 9000 + (int32_t) (i % 700);
+                r.v[ITF_LOG_LONG_THROTTLE] = 2048;
+                r.v[ITF_LOG_LONG_DUTY] = 2100 + (int32_t) (i % 40);
+                used += itf_logEncodeLong(block.data() + used, &st, &r);
+                nextLong += 100000;
+            }else{
+                itf_logEdge_t e;
+                e.time_us = t;
+                e.hall = halls[i % 6];
+                e.status = (i % 200000 < 100) ? 3 : 0;
+                e.cur[0] = (int32_t) (i*37 % 2400) - 1200;
+                e.cur[1] = (int32_t) (i*53 % 2400) - 1200;
+                e.cur[2] = -e.cur[0] - e.cur[1];
+                used += itf_logEncodeEdge(block.data() + used, &st, &e);
+                t += 83;
+                i++;
+            }
+            itf_logFinishRecord(block.data(), &st, used);
+        }
+        itf_logSealBlock(block.data());
+        itf_logIndexAdd(index.data(), (int) blockSize, blockNo++, itf_logBlockBase(block.data()));
+        fwrite(block.data(), 1, blockSize, f);
+    }
+    int used = itf_logIndexSeal(index.data());
+    std::fill(index.begin() + used, index.end(), 0);
+    fwrite(index.data(), 1, blockSize, f);
+    return fclose(f) == 0;
+}
+
+//Same drive in the old data.bin format
+static bool makeLegacy(const char* path, uint64_t bytes){
+    FILE* f = fopen(path, "wb");
+    if(f == nullptr) return false;
+    std::vector<uint8_t> buf;
+    buf.reserve(1 << 20);
+    uint32_t t = 1000000, nextLong = t;
+    uint64_t written = 0, i = 0;
+    while(written < bytes){
+        uint8_t r[LEGACY_LONG_LEN];
+        int n;
+        if(t >= nextLong){
+            uint32_t m = LEGACY_LONG;
+            for(int k=0;k<4;k++) r[k] = (uint8_t) (m >> (24 - 8*k));
+            r[4] = 15;
+            int16_t vals[7] = { 4000, 4200, 4800, 900, 9000, 9100, 9200 };
+            for(int k=0;k<7;k++){
+                r[5 + 2*k] = (uint8_t) (vals[k] >> 8);
+                r[6 + 2*k] = (uint8_t) vals[k];
+            }
+            r[19] = 0;
+            r[20] = 128;
+            nextLong += 100000;
+            n = LEGACY_LONG_LEN;
+        }else{
+            uint32_t m = LEGACY_EDGE;
+            for(int k=0;k<4;k++) r[k] = (uint8_t) (m >> (24 - 8*k));
+            r[4] = (uint8_t) (1 + i % 6);
+            r[5] = 0;
+            for(int k=0;k<3;k++){
+                r[6 + 2*k] = (uint8_t) ((i*(k + 3)) >> 8 & 0x0F);
+                r[7 + 2*k] = (uint8_t) (i*(k + 3));
+            }
+            t += 83;
+            i++;
+            n = LEGACY_EDGE_LEN;
+        }
+        for(int k=0;k<4;k++) r[n - 4 + k] = (uint8_t) (t >> (24 - 8*k));
+        buf.insert(buf.end(), r, r + n);
+        if(buf.size() >= (1 << 20)){
+            fwrite(buf.data(), 1, buf.size(), f);
+            written += buf.size();
+            buf.clear();
+        }
+    }
+    fwrite(buf.data(), 1, buf.size(), f);
+    return fclose(f) == 0;
+}
+
+static volatile uint64_t scanSink;
+
+//Touches every cache line on all threads: the fastest the input can be read from the page cache
+static double scanRate(const InputFile& in, int threads){
+    auto t0 = std::chrono::steady_clock::now();
+    std::atomic<uint64_t> sum(0);
+    uint64_t part = (in.size + threads - 1)/threads;
+    parallelFor(threads, threads, [&](int i){
+        uint64_t s = 0, b = i*part, e = std::min(in.size, b + part);
+        for(uint64_t p=b;p<e;p+=64) s += in.data[p];
+        sum += s;
+    });
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    scanSink = sum;
+    return in.size/1e6/sec;
+}
+
+static int bench(uint64_t mb, int maxThreads){
+    const char* tmp = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    std::string dir = std::string(tmp) + "/log_analyze_bench";
+    mkdir(dir.c_str(), 0755);
+    std::string cpath = dir + "/S0001_00.BIN", lpath = dir + "/data.bin";
+    printf("generating %llu MB container and data.bin in %s\n", (unsigned long long) mb, dir.c_str());
+    if(!makeContainer(cpath.c_str(), mb << 20, 16*1024) || !makeLegacy(lpath.c_str(), mb << 20)){
+        fprintf(stderr, "can't write the bench files\n");
+        return 1;
+    }
+    //Files are read once before timing, so every pass runs from the page cache
+    for(const std::string* path : { &cpath, &lpath }){
+        std::vector<InputFile> files(1);
+        if(!openInput(*path, files[0])){
+            return 1;
+        }
+        const char* fmt = files[0].container ? "container" : "legacy";
+        scanRate(files[0], maxThreads);
+        printf("log_analyze_bench format=%s mode=scan threads=%d MBps=%.0f\n", fmt, maxThreads, scanRate(files[0], maxThreads));
+        std::vector<int> counts = { 1 };
+        for(int t=2;t<maxThreads;t*=2) counts.push_back(t);
+        if(maxThreads > 1) counts.push_back(maxThreads);
+        const char* modes[3] = { "summary", "columns", "csv" };
+        for(int m=0;m<3;m++){
+            for(int t : counts){
+                if(m > 0 && t != maxThreads) continue;
+                Options opt;
+                opt.threads = t;
+                Output out;
+                if(m == 1) out.colDir = dir + "/cols";
+                if(m == 2) out.csvPrefix = dir + "/bench";
+                if(!out.open()) return 1;
+                Stitcher st;
+                Result r = analyze(files, out, opt, st);
+                out.close(st.runs);
+                printf("log_analyze_bench format=%s mode=%s threads=%d MBps=%.0f Mrecords_per_s=%.2f records=%llu out_MB=%.0f\n",
+                       fmt, modes[m], t, r.inBytes/1e6/r.seconds, r.records/1e6/r.seconds,
+                       (unsigned long long) r.records, r.outBytes/1e6);
+            }
+        }
+        closeInputs(files);
+    }
+    //Several hundred MB of generated input and output, don't leave it behind
+    std::vector<std::string> junk;
+    DIR* d = opendir((dir + "/cols").c_str());
+    struct dirent* de;
+    while(d && (de = readdir(d)) != nullptr){
+        if(de->d_name[0] != '.') junk.push_back(dir + "/cols/" + de->d_name);
+    }
+    if(d) closedir(d);
+    for(const char* n : { "/S0001_00.BIN", "/data.bin", "/bench_edges.csv", "/bench_long.csv", "/bench_faults.csv", "/bench_runs.csv" }){
+        junk.push_back(dir + n);
+    }
+    for(auto& j : junk){
+        unlink(j.c_str());
+    }
+    rmdir((dir + "/cols").c_str());
+    rmdir(dir.c_str());
+    return 0;
+}
+
+static void usage(void){
+    fprintf(stderr, "log_analyze <file or folder>... [--csv prefix] [--columns dir] [--threads n] [--chunk-mb n] [--quiet]\n"
+                    "log_analyze --bench [MB] [--threads n]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv){
+    Options opt;
+    Output out;
+    std::vector<std::string> paths;
+    long benchMb = -1;
+    for(int i=1;i<argc;i++){
+        std::string a = argv[i];
+        if(a == "--bench"){
+            benchMb = (i + 1 < argc && argv[i + 1][0] != '-') ? atol(argv[++i]) : 256;
+        }else if(a == "--quiet"){
+            opt.quiet = true;
+        }else if(a[0] == '-' && i + 1 >= argc){
+            usage();
+        }else if(a == "--csv"){
+            out.csvPrefix = argv[++i];
+        }else if(a == "--columns"){
+            out.colDir = argv[++i];
+        }else if(a == "--threads"){
+            opt.threads = atoi(argv[++i]);
+        }else if(a == "--chunk-mb"){
+            opt.chunkBytes = (uint64_t) atol(argv[++i]) << 20;
+        }else if(a[0] == '-'){
+            usage();
+        }else{
+            addPath(a, paths);
+        }
+    }
+    if(opt.threads <= 0){
+        opt.threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    if(benchMb >= 0){
+        return bench(std::max(16L, benchMb), opt.threads);
+    }
+    if(paths.empty() || opt.chunkBytes == 0){
+        usage();
+    }
+
+    std::vector<InputFile> files;
+    for(auto& p : paths){
+        InputFile in;
+        if(!openInput(p, in)){
+            fprintf(stderr, "%s: can't read\n", p.c_str());
+            continue;
+        }
+        files.push_back(in);
+    }
+    if(files.empty() || !out.open()){
+        fprintf(stderr, "nothing to do\n");
+        return 1;
+    }
+    Stitcher st;
+    Result r = analyze(files, out, opt, st);
+    out.close(st.runs);
+    if(!opt.quiet){
+        for(size_t i=0;i<st.runs.size();i++){
+            Output::printRun(stdout, (int) i, st.runs[i], false);
+        }
+    }
+    fprintf(stderr, "files=%zu MB=%.1f seconds=%.3f MBps=%.0f threads=%d edges=%llu longs=%llu blocks=%llu damaged=%llu stale=%llu "
+                    "empty=%llu raw=%llu legacy_skipped_bytes=%llu\n",
+            files.size(), r.inBytes/1e6, r.seconds, r.inBytes/1e6/r.seconds, opt.threads,
+            (unsigned long long) st.edges, (unsigned long long) st.longs, (unsigned long long) st.goodBlocks,
+            (unsigned long long) st.damagedBlocks, (unsigned long long) st.staleBlocks, (unsigned long long) st.emptyBlocks,
+            (unsigned long long) st.raws, (unsigned long long) st.skipped);
+    closeInputs(files);
+    return 0;
+}
@@ -0,0 +1,340 @@
+//Reference decoder for the data.bin log container (main/itf_log_codec.h).
+//Build from the repo root:
+//  gcc -O2 -Imain -Itools/host main/itf_log_codec.c main/itf_crc.c tools/host/log_file.c
+//      tools/host/log_decode.c -o log_decode
+//
+//  ./log_decode data.bin                   CSV of every record on stdout, summary on stderr
+//  ./log_decode data.bin --from 12 --to 13 only minutes 12 to 13 of the run (seeks, doesn't scan)
+//  ./log_decode data.bin --schema          print the field schema stored in the file
+//  ./log_decode --bench [records]          round trip and container checks, then the codec
+//                                          benchmark (same numbers as "bench log" on the console)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "itf_log_codec.h"
+#include "log_file.h"
+
+#define BLOCK_SIZE (16*1024)
+
+typedef struct {
+    unsigned long edges, longs, states, raws;
+    uint64_t from_us, to_us;
+} counts_t;
+
+static void printRecord(const itf_logRecord_t* r, void* ctx){
+    counts_t* c = (counts_t*) ctx;
+    int i;
+    if(r->time_us < c->from_us || r->time_us > c->to_us){
+        return;
+    }
+    switch(r->tag){
+    case ITF_LOG_TAG_EDGE:
+        c->edges++;
+        printf("edge,%llu,%d,%d,%.2f,%.2f,%.2f\n", (unsigned long long) r->time_us, r->hall, r->status,
+               r->cur[0]/100.0, r->cur[1]/100.0, r->cur[2]/100.0);
+        break;
+    case ITF_LOG_TAG_LONG:
+        c->longs++;
+        printf("long,%llu,%d", (unsigned long long) r->time_us, r->status);
+        for(i=0;i<ITF_LOG_LONG_FIELDS;i++){
+            printf(",%ld", (long) r->lng[i]);
+        }
+        printf("\n");
+        break;
+    case ITF_LOG_TAG_STATE:
+        c->states++;
+        printf("status,%llu,%d\n", (unsigned long long) r->time_us, r->status);
+        break;
+    case ITF_LOG_TAG_CMD:
+        c->raws++;
+        printf("cmd,%llu,%c,%d,%ld\n", (unsigned long long) r->time_us, r->cmd, r->cmdResult, (long) r->cmdValue);
+        break;
+    case ITF_LOG_TAG_TRACE:
+        c->raws++;
+        printf("trace,%llu,%d", (unsigned long long) r->time_us, r->traceId);
+        for(i=0;i+4<=r->rawLen;i+=4){
+            printf(",%08lx", (unsigned long) (r->raw[i] | (r->raw[i+1] << 8) | (r->raw[i+2] << 16) | ((uint32_t) r->raw[i+3] << 24)));
+        }
+        printf("\n");
+        break;
+    default:
+        c->raws++;
+        printf("raw,%llu,\"%.*s\"\n", (unsigned long long) r->time_us, r->rawLen, (const char*) r->raw);
+        break;
+    }
+}
+
+static int decodeFile(const char* path, double fromMin, double toMin, int schemaOnly){
+    logFile_t lf;
+    counts_t c;
+    itf_logBlockInfo_t info;
+    unsigned long good = 0, damaged = 0, stale = 0;
+    int probes = 0;
+    uint32_t blockNo, lastSeq = 0;
+    int haveSeq = 0;
+
+    if(logFileOpen(&lf, path) != 0){
+        fprintf(stderr, "%s: no log file header (legacy files need the full decoder)\n", path);
+        return 1;
+    }
+    if(schemaOnly){
+        printf("block_size=%lu schema=%d open_us=%llu\n%.*s", (unsigned long) lf.blockSize, lf.info.schema,
+               (unsigned long long) lf.info.open_us, lf.info.schemaLen, lf.info.schemaText);
+        logFileClose(&lf);
+        return 0;
+    }
+    uint8_t* block = malloc(lf.blockSize);
+    memset(&c, 0, sizeof(c));
+    c.to_us = UINT64_MAX;
+
+    //Minutes count from the first block's base time
+    uint32_t first = 1;
+    while(first <= lf.lastData && logFileReadBlock(&lf, first, block, &info) != 1){
+        first++;
+    }
+    uint64_t t0 = (first <= lf.lastData) ? info.base_us : 0;
+    uint32_t start = first;
+    if(fromMin > 0){
+        c.from_us = t0 + (uint64_t) (fromMin*60e6);
+        start = logFileFindTime(&lf, c.from_us, &probes);
+    }
+    if(toMin > 0){
+        c.to_us = t0 + (uint64_t) (toMin*60e6);
+    }
+
+    printf("type,time_us,hall_or_status,...\n");
+    for(blockNo=start;blockNo<=lf.lastData;blockNo++){
+        int r = logFileReadBlock(&lf, blockNo, block, &info);
+        if(r == 0){
+            stale++;            //Preallocated space past the end of the log
+            continue;
+        }
+        if(r < 0){
+            damaged++;
+            continue;
+        }
+        //A block with an older sequence number is left over from a file that used these clusters before
+        if(haveSeq && info.seq < lastSeq){
+            stale++;
+            continue;
+        }
+        if(info.base_us > c.to_us){
+            break;
+        }
+        lastSeq = info.seq;
+        haveSeq = 1;
+        itf_logDecodeBlock(block, (int) lf.blockSize, printRecord, &c);
+        good++;
+    }
+    fprintf(stderr, "blocks=%lu good=%lu damaged=%lu stale=%lu indexed=%d seek_probes=%d edges=%lu longs=%lu status=%lu raw=%lu\n",
+            (unsigned long) lf.blocks, good, damaged, stale, lf.index != NULL, probes, c.edges, c.longs, c.states, c.raws);
+    free(block);
+    logFileClose(&lf);
+    return 0;
+}
+
+//Round trip: random records in, identical records out
+typedef struct {
+    itf_logRecord_t want[4096];
+    int n, pos, bad;
+} check_t;
+
+static void checkRecord(const itf_logRecord_t* r, void* ctx){
+    check_t* k = (check_t*) ctx;
+    const itf_logRecord_t* w = &k->want[k->pos++];
+    int same = r->tag == w->tag && r->time_us == w->time_us && r->status == w->status;
+    if(r->tag == ITF_LOG_TAG_EDGE){
+        same &= r->hall == w->hall && !memcmp(r->cur, w->cur, sizeof(r->cur));
+    }else if(r->tag == ITF_LOG_TAG_LONG){
+        same &= !memcmp(r->lng, w->lng, sizeof(r->lng));
+    }else if(r->tag == ITF_LOG_TAG_RAW){
+        same &= r->rawLen == w->rawLen && !memcmp(r->raw, w->raw, r->rawLen);
+    }else if(r->tag == ITF_LOG_TAG_TRACE){
+        same &= r->traceId == w->traceId && r->rawLen == w->rawLen && !memcmp(r->raw, w->raw, r->rawLen);
+    }
+    k->bad += !same;
+}
+
+static int roundTrip(void){
+    static uint8_t block[BLOCK_SIZE];
+    static check_t k;
+    static const char text[] = "ForceBufferTest \n";
+    static const uint32_t words[4] = {0x4226CCCD, 0xFFFFFFFF, 0, 0x80};    //Stored little endian
+    static const uint8_t wordBytes[16] = {0xCD,0xCC,0x26,0x42, 0xFF,0xFF,0xFF,0xFF, 0,0,0,0, 0x80,0,0,0};
+    itf_logState_t st;
+    uint64_t t = 1000000;
+    uint32_t seed = 1;
+    int used, i, round, bad = 0;
+    uint8_t status = 0;
+    int lastStatus;
+
+    for(round=0;round<20;round++){
+        memset(&k, 0, sizeof(k));
+        used = itf_logEncodeBlockHeader(block, &st, t, round);
+        lastStatus = -1;        //Every block opens with a status record
+        while(used + ITF_LOG_LONG_MAX < BLOCK_SIZE && k.n < 4000){
+            itf_logRecord_t* w = &k.want[k.n];
+            seed = seed*1103515245u + 12345u;
+            //Occasionally out of order, as with producers on both cores
+            t += (seed % 50 == 0) ? -(int64_t) (seed>>28) : (seed>>20) % 5000;
+            if(seed % 97 == 0){
+                status = (uint8_t) (seed>>24);
+            }
+            int noStatus = (seed % 31 != 0) && (seed % 53 == 0 || seed % 59 == 0);  //Raw and trace records
+            if(status != lastStatus && !noStatus){
+                lastStatus = status;
+                w->tag = ITF_LOG_TAG_STATE;         //Written ahead of the next edge/long record
+                w->time_us = t;
+                w->status = status;
+                k.n++;
+                w++;
+            }
+            w->time_us = t;
+            w->status = status;
+            if(seed % 31 == 0){
+                itf_logLong_t l;
+                l.time_us = t;
+                l.status = status;
+                for(i=0;i<ITF_LOG_LONG_FIELDS;i++){
+                    l.v[i] = (int32_t) (seed*(i+3)) >> (seed % 24);
+                }
+                w->tag = ITF_LOG_TAG_LONG;
+                memcpy(w->lng, l.v, sizeof(w->lng));
+                used += itf_logEncodeLong(block + used, &st, &l);
+                itf_logFinishRecord(block, &st, used);
+            }else if(seed % 53 == 0){
+                w->tag = ITF_LOG_TAG_RAW;
+                w->status = (lastStatus < 0) ? 0 : (uint8_t) lastStatus;   //Raw records don't carry status
+                w->raw = (const uint8_t*) text;
+                w->rawLen = (int) strlen(text);
+                used += itf_logEncodeRaw(block + used, &st, t, text, w->rawLen);
+                itf_logFinishRecord(block, &st, used);
+            }else if(seed % 59 == 0){
+                int n = (seed>>12) % 5;
+                w->tag = ITF_LOG_TAG_TRACE;
+                w->status = (lastStatus < 0) ? 0 : (uint8_t) lastStatus;
+                w->traceId = (uint16_t) (seed>>16);
+                w->raw = wordBytes;
+                w->rawLen = 4*n;
+                used += itf_logEncodeTrace(block + used, &st, t, w->traceId, words, n);
+                itf_logFinishRecord(block, &st, used);
+            }else{
+                itf_logEdge_t e;
+                static const uint8_t halls[8] = {1,3,2,6,4,5,7,0};
+                e.time_us = t;
+                e.status = status;
+                e.hall = halls[(seed>>5) & 7];
+                for(i=0;i<3;i++){
+                    e.cur[i] = (seed & 8) ? (int32_t) ((seed>>(i*7)) & 0xFF) - 128 : (int32_t) (seed*(i+1)) >> 8;
+                }
+                w->tag = ITF_LOG_TAG_EDGE;
+                w->hall = e.hall;
+                memcpy(w->cur, e.cur, sizeof(w->cur));
+                used += itf_logEncodeEdge(block + used, &st, &e);
+                itf_logFinishRecord(block, &st, used);
+            }
+            k.n++;
+        }
+        memset(block + used, 0, BLOCK_SIZE - used);
+        itf_logSealBlock(block);
+        int got = itf_logDecodeBlock(block, BLOCK_SIZE, checkRecord, &k);
+        if(got != k.n || k.bad){
+            printf("round_trip block=%d records=%d decoded=%d mismatched=%d\n", round, k.n, got, k.bad);
+            bad = 1;
+        }
+    }
+    printf("round_trip result=%s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+//Writes a closed file (header, blocks of 1 s each, index) with one damaged block and an unclosed
+//copy without the index, then checks that both decode around the damage and seek in few reads
+static int containerCheck(int blocks){
+    static uint8_t block[BLOCK_SIZE];
+    static uint8_t index[BLOCK_SIZE];
+    char path[] = "/tmp/log_decode_XXXXXX";
+    itf_logState_t st;
+    itf_logEdge_t e;
+    int fd = mkstemp(path);
+    int i, bad = 0;
+
+    memset(block, 0, sizeof(block));
+    itf_logEncodeFileHeader(block, BLOCK_SIZE, 0);
+    bad |= write(fd, block, BLOCK_SIZE) != BLOCK_SIZE;
+    itf_logIndexInit(index);
+    memset(&e, 0, sizeof(e));
+    for(i=1;i<=blocks;i++){
+        uint64_t t = (uint64_t) i*1000000;
+        memset(block, 0, sizeof(block));
+        int used = itf_logEncodeBlockHeader(block, &st, t, i);
+        for(e.time_us=t;e.time_us<t+1000000;e.time_us+=1000){
+            e.hall = (e.hall == 1) ? 3 : 1;
+            used += itf_logEncodeEdge(block + used, &st, &e);
+        }
+        itf_logFinishRecord(block, &st, used);
+        itf_logSealBlock(block);
+        itf_logIndexAdd(index, BLOCK_SIZE, i, t);
+        if(i == blocks/2){
+            block[100] ^= 0x40;     //One flipped bit
+        }
+        bad |= write(fd, block, BLOCK_SIZE) != BLOCK_SIZE;
+    }
+    int used = itf_logIndexSeal(index);
+    memset(index + used, 0, BLOCK_SIZE - used);
+    bad |= write(fd, index, BLOCK_SIZE) != BLOCK_SIZE;
+    close(fd);
+
+    int pass;
+    for(pass=0;pass<2;pass++){
+        logFile_t lf;
+        itf_logBlockInfo_t info;
+        int probes, damaged = 0, good = 0;
+        uint32_t b;
+        if(pass == 1){
+            bad |= truncate(path, (off_t) (blocks + 1)*BLOCK_SIZE) != 0;   //As if power was cut before close
+        }
+        if(logFileOpen(&lf, path) != 0){
+            printf("container open failed\n");
+            return 1;
+        }
+        for(b=1;b<=lf.lastData;b++){
+            int r = logFileReadBlock(&lf, b, block, &info);
+            good += (r == 1);
+            damaged += (r < 0);
+        }
+        uint32_t at = logFileFindTime(&lf, (uint64_t) (blocks/3)*1000000 + 500000, &probes);
+        uint32_t atBad = logFileFindTime(&lf, (uint64_t) (blocks/2)*1000000 + 500000, &probes);
+        printf("container %s blocks=%d good=%d damaged=%d seek_block=%lu seek_probes=%d seek_damaged=%lu\n",
+               (pass == 0) ? "closed" : "unclosed", blocks, good, damaged, (unsigned long) at, probes, (unsigned long) atBad);
+        bad |= good != blocks - 1 || damaged != 1 || at != (uint32_t) (blocks/3) || (atBad != (uint32_t) (blocks/2 - 1) && atBad != (uint32_t) (blocks/2));
+        bad |= (pass == 0) != (lf.index != NULL);
+        logFileClose(&lf);
+    }
+    unlink(path);
+    printf("container result=%s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
+
+int main(int argc, char** argv){
+    if(argc >= 2 && strcmp(argv[1], "--bench") == 0){
+        int bad = roundTrip();
+        bad |= containerCheck(600);
+        itf_logCodecBenchmark((argc >= 3) ? atoi(argv[2]) : 1000000);
+        return bad;
+    }
+    double fromMin = 0, toMin = 0;
+    int schemaOnly = 0, i;
+    for(i=2;i<argc;i++){
+        if(!strcmp(argv[i], "--from") && i+1 < argc) fromMin = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--to") && i+1 < argc) toMin = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--schema")) schemaOnly = 1;
+        else argc = 0;
+    }
+    if(argc < 2){
+        fprintf(stderr, "usage: %s data.bin [--from min] [--to min] [--schema] | --bench [records]\n", argv[0]);
+        return 2;
+    }
+    return decodeFile(argv[1], fromMin, toMin, schemaOnly);
+}
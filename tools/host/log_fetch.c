@@ -0,0 +1,588 @@
+//PC side of the log download ("log get", main/itf_log_xfer.c): pulls a log file off the board over
+//the PC link, acknowledging and NAKing frames, and reports the bytes/s it got.
+//
+//  --port: a real serial port (the board's UART0)
+//  --sim:  the firmware's PC link task, SD writer and reader task run in this process on the host
+//          shim, writing to a directory while the download runs. The wire is modelled on the
+//          peer's side: bytes are let through at the baud rate and can be corrupted or dropped,
+//          and acknowledgements lost. Above --sim-max-baud the link turns noisy, like a USB serial
+//          adapter past its limit, so --baud auto has something to back off from. The downloaded
+//          files are compared with what the writer put on the "card".
+//
+//Build from the repo root:
+//  gcc -O2 -Wall -Wno-format -pthread -Itools/host/shim -Itools/host -Imain -o log_fetch
+//      tools/host/log_fetch.c tools/host/host_storage.c tools/host/shim/host_hal.c
+//      main/itf_com_funcs.c main/itf_console.c main/itf_log_xfer.c main/itf_crc.c
+//      main/itf_sd_card_writer.c main/itf_sd_session.c main/itf_sd_ring.c main/itf_log_codec.c
+//      main/itf_log_policy.c main/ctrl_subsystem.c main/ctrl_speed_pi.c main/ctrl_autotune.c main/ctrl_params.c main/ctrl_sensorless.c main/ctrl_pwm.c
+//      main/itf_seven_seg.c main/itf_trace.c -lm
+//
+//  ./log_fetch --port /dev/ttyUSB0 --file S0003_00 --baud auto -o S0003_00.BIN
+//  ./log_fetch --sim --baud 921600 --corrupt-ppm 20 --drop-ppm 20 --ack-loss-pct 2
+//  ./log_fetch --sim --baud auto --sim-max-baud 1000000
+//Prints key=value lines. Exit status is 1 if a transfer failed or (--sim) a file differs.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "host_hal.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "itf_com_funcs.h"
+#include "itf_crc.h"
+#include "itf_log_codec.h"
+#include "itf_log_xfer.h"
+#include "itf_sd_card_writer.h"
+#include "itf_sd_ring.h"
+#include "itf_sd_session.h"
+#include "itf_master_defines.h"
+#include "host_storage.h"
+
+#define CONSOLE_BAUD 115200
+#define NAK_GAP_US 100000           //A hole is NAKed again after this long
+#define RX_TIMEOUT_US 3000000       //Give up after this long without a good frame
+
+static const int bauds[] = {3000000, 2000000, 1500000, 1000000, 921600, 460800, 230400, 115200};
+#define NUM_BAUDS ((int) (sizeof(bauds)/sizeof(bauds[0])))
+
+typedef struct {
+    int fd;
+    int tty;                    //Real port: baud changes go to termios
+    int baud;
+    //Wire model (--sim only)
+    int pace;
+    int64_t paceStart_us;
+    int64_t paced;
+    int corruptPpm, dropPpm, ackLossPct, maxBaud;
+    uint32_t seed;
+    unsigned long corrupted, dropped, acksLost;
+} link_t;
+
+typedef struct {
+    int ok;
+    uint32_t size, chunks;
+    unsigned long frames, badFrames, dupFrames, naks;
+    uint32_t devElapsed_us, devBps, devResent;
+    int baud;
+    double seconds;
+    char summary[512];          //The board's closing console line
+} fetch_t;
+
+static int64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+static uint32_t linkRandom(link_t* l){
+    l->seed ^= l->seed << 13;
+    l->seed ^= l->seed >> 17;
+    l->seed ^= l->seed << 5;
+    return l->seed;
+}
+
+static speed_t ttySpeed(int baud){
+    switch(baud){
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+        case 460800:  return B460800;
+        case 921600:  return B921600;
+        case 1000000: return B1000000;
+        case 1500000: return B1500000;
+        case 2000000: return B2000000;
+        case 3000000: return B3000000;
+    }
+    return 0;
+}
+
+static int linkSetBaud(link_t* l, int baud){
+    l->baud = baud;
+    l->paceStart_us = now_us();
+    l->paced = 0;
+    if(l->tty){
+        struct termios tio;
+        speed_t sp = ttySpeed(baud);
+        if(sp == 0 || tcgetattr(l->fd, &tio) != 0){
+            return 0;
+        }
+        cfsetispeed(&tio, sp);
+        cfsetospeed(&tio, sp);
+        return tcsetattr(l->fd, TCSADRAIN, &tio) == 0;
+    }
+    return 1;
+}
+
+//Like a read with a timeout, but in --sim mode no faster than the wire and through the fault model.
+//Past the simulated adapter's limit every byte has a 1% chance of being damaged.
+static int linkRead(link_t* l, uint8_t* buf, int max, int timeout_ms){
+    struct pollfd pfd = { l->fd, POLLIN, 0 };
+    int i, n, out;
+    if(l->pace){
+        int64_t now = now_us();
+        int64_t allowed = (now - l->paceStart_us)*l->baud/10000000 - l->paced;
+        if(allowed > 4096){
+            //An idle wire doesn't save up bandwidth (beyond what the adapter buffers)
+            l->paced += allowed - 4096;
+            allowed = 4096;
+        }
+        if(allowed <= 0){
+            usleep(1000);
+            return 0;
+        }
+        if(max > allowed){
+            max = (int) allowed;
+        }
+    }
+    if(poll(&pfd, 1, timeout_ms) <= 0 || (n = (int) read(l->fd, buf, max)) <= 0){
+        return 0;
+    }
+    l->paced += n;
+    if(!l->pace){
+        return n;
+    }
+    int corrupt = l->corruptPpm + ((l->maxBaud > 0 && l->baud > l->maxBaud) ? 10000 : 0);
+    for(i=0,out=0;i<n;i++){
+        if(l->dropPpm > 0 && linkRandom(l) % 1000000 < (uint32_t) l->dropPpm){
+            l->dropped++;
+            continue;
+        }
+        buf[out] = buf[i];
+        if(corrupt > 0 && linkRandom(l) % 1000000 < (uint32_t) corrupt){
+            buf[out] ^= 1 << (linkRandom(l) & 7);
+            l->corrupted++;
+        }
+        out++;
+    }
+    return out;
+}
+
+static void linkWrite(link_t* l, const void* data, int len){
+    if(write(l->fd, data, len) != len){
+        perror("write");
+    }
+}
+
+static void sendFrame(link_t* l, uint8_t type, uint32_t seq){
+    uint8_t f[ITF_XFER_OVERHEAD];
+    if(l->pace && l->ackLossPct > 0 && (int) (linkRandom(l) % 100) < l->ackLossPct){
+        l->acksLost++;
+        return;
+    }
+    linkWrite(l, f, itf_xferFrame(f, type, seq, NULL, 0));
+}
+
+//Reads console text until a line containing key, within timeout. Returns 1 with the line.
+static int readLine(link_t* l, const char* key, char* line, int lineLen, int timeout_ms){
+    int len = 0;
+    int64_t end = now_us() + timeout_ms*1000LL;
+    uint8_t c;
+    while(now_us() < end){
+        if(linkRead(l, &c, 1, 10) != 1){
+            continue;
+        }
+        if(c == '\r' || c == '\n'){
+            line[len] = '\0';
+            if(len > 0 && strstr(line, key) != NULL){
+                return 1;
+            }
+            len = 0;
+        }else if(len < lineLen - 1){
+            line[len++] = (char) c;
+        }
+    }
+    return 0;
+}
+
+static uint32_t lineValue(const char* line, const char* key){
+    const char* p = strstr(line, key);
+    return (p == NULL) ? 0 : (uint32_t) strtoul(p + strlen(key), NULL, 10);
+}
+
+static uint32_t get32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24); }
+
+//One "log get" at baud. Returns 1 on success, 0 if the link wasn't good enough at that baud
+//(a lower one may work), -1 if the board refused.
+static int fetch(link_t* l, const char* name, int baud, const char* outPath, fetch_t* r){
+    char line[512], cmd[64];
+    static uint8_t rx[1 << 16];
+    int rxLen = 0, i;
+    uint8_t* data = NULL;
+    uint8_t* have = NULL;
+    int64_t* nakAt = NULL;
+    uint32_t next = 0, chunk = 0;
+    int gotInfo = 0, gotEnd = 0, result = 0;
+
+    memset(r, 0, sizeof(*r));
+    r->baud = baud;
+    snprintf(cmd, sizeof(cmd), "log get %s %d\r\n", name, baud);
+    linkWrite(l, cmd, strlen(cmd));
+    if(!readLine(l, "cmd=log", line, sizeof(line), 2000)){
+        printf("fetch err=no_reply\n");
+        return -1;
+    }
+    if(strstr(line, "err=") != NULL){
+        printf("fetch reply=\"%s\"\n", line);
+        return -1;
+    }
+    r->size = lineValue(line, "size=");
+    chunk = lineValue(line, "chunk=");
+    if(chunk == 0 || chunk > 4096){
+        printf("fetch err=bad_reply reply=\"%s\"\n", line);
+        return -1;
+    }
+    r->chunks = (r->size + chunk - 1)/chunk;
+    data = calloc(1, r->size + 1);
+    have = calloc(1, r->chunks + 1);
+    nakAt = calloc(r->chunks + 1, sizeof(int64_t));
+
+    //The board switches once its reply is out
+    usleep(20000);
+    linkSetBaud(l, baud);
+    int64_t start = now_us(), lastReady = 0, heard = now_us();
+    while(!gotEnd){
+        int64_t now = now_us();
+        if(!gotInfo && now - lastReady > 50000){
+            sendFrame(l, ITF_XFER_READY, 0);
+            lastReady = now;
+        }
+        if(now - heard > (gotInfo ? RX_TIMEOUT_US : 1500000)){
+            break;
+        }
+        //A link that mangles more than one frame in five isn't worth staying on
+        if(r->badFrames >= 16 && r->badFrames*5 > r->frames){
+            sendFrame(l, ITF_XFER_ABORT, 0);
+            break;
+        }
+        int n = linkRead(l, rx + rxLen, (int) sizeof(rx) - rxLen, 5);
+        rxLen += n;
+        while(1){
+            itf_xferFrame_t f;
+            int used;
+            int k = itf_xferScan(rx, rxLen, (int) chunk + 32, &f, &used);
+            if(k == 0){
+                break;
+            }
+            if(k == -2){
+                r->badFrames++;
+            }
+            if(k > 0){
+                heard = now_us();
+                if(f.type == ITF_XFER_INFO){
+                    if(!gotInfo){
+                        start = heard;
+                    }
+                    gotInfo = 1;
+                }else if(f.type == ITF_XFER_DATA && f.seq < r->chunks){
+                    r->frames++;
+                    if(have[f.seq]){
+                        r->dupFrames++;
+                    }else if(f.len == ((f.seq + 1 < r->chunks) ? chunk : r->size - f.seq*chunk)){
+                        memcpy(data + (size_t) f.seq*chunk, f.payload, f.len);
+                        have[f.seq] = 1;
+                    }
+                    while(next < r->chunks && have[next]){
+                        next++;
+                    }
+                    //Everything between the first hole and this frame went missing on the way
+                    for(i=(int) next;i<(int) f.seq;i++){
+                        if(!have[i] && heard - nakAt[i] > NAK_GAP_US){
+                            sendFrame(l, ITF_XFER_NAK, i);
+                            nakAt[i] = heard;
+                            r->naks++;
+                        }
+                    }
+                    sendFrame(l, ITF_XFER_ACK, next);
+                }else if(f.type == ITF_XFER_END && f.len >= 16){
+                    r->devElapsed_us = get32(f.payload + 4);
+                    r->devBps = get32(f.payload + 8);
+                    r->devResent = get32(f.payload + 12);
+                    gotEnd = 1;
+                    sendFrame(l, ITF_XFER_ACK, r->chunks + 1);
+                }else if(f.type == ITF_XFER_ABORT){
+                    rxLen = 0;
+                    used = 0;
+                    break;
+                }
+            }
+            rxLen -= used;
+            memmove(rx, rx + used, rxLen);
+        }
+        if(rxLen == (int) sizeof(rx)){
+            rxLen = 0;
+        }
+    }
+    r->seconds = (now_us() - start)/1e6;
+    r->ok = gotEnd && next == r->chunks;
+    //If the last 'A' is lost the board sends the 'E' a few more times and then gives up on it,
+    //so its closing line can take a while
+    linkSetBaud(l, CONSOLE_BAUD);
+    if(readLine(l, "what=get", line, sizeof(line), 3000)){
+        snprintf(r->summary, sizeof(r->summary), "%s", line);
+    }
+    if(r->ok && outPath != NULL){
+        FILE* out = fopen(outPath, "wb");
+        if(out == NULL || fwrite(data, 1, r->size, out) != r->size){
+            r->ok = 0;
+        }
+        if(out != NULL){
+            fclose(out);
+        }
+    }
+    result = r->ok;
+    free(data);
+    free(have);
+    free(nakAt);
+    return result;
+}
+
+//Tries baud, or with baud 0 the fastest rate that works, falling back on a failed handshake or a
+//link that was too noisy
+static int fetchBest(link_t* l, const char* name, int baud, const char* outPath, fetch_t* r){
+    int i, k;
+    for(i=0;i<NUM_BAUDS;i++){
+        int b = (baud > 0) ? baud : bauds[i];
+        if(baud == 0 && l->tty && ttySpeed(b) == 0){
+            continue;
+        }
+        k = fetch(l, name, b, outPath, r);
+        printf("fetch name=%s baud=%d ok=%d bytes=%lu seconds=%.2f Bps=%.0f dev_Bps=%lu frames=%lu bad_frames=%lu dups=%lu naks=%lu dev_resent=%lu\n",
+               name, b, r->ok, (unsigned long) r->size, r->seconds, (r->ok && r->seconds > 0) ? r->size/r->seconds : 0.0,
+               (unsigned long) r->devBps, r->frames, r->badFrames, r->dupFrames, r->naks, (unsigned long) r->devResent);
+        if(r->summary[0] != '\0'){
+            printf("  board: %s\n", r->summary);
+        }
+        if(k != 0 || baud > 0){
+            return k > 0;
+        }
+    }
+    return 0;
+}
+
+//******************************* --sim: firmware on the host
+static volatile int simLogging = 1;
+static volatile unsigned long simLogged = 0, simOffered = 0;
+static int simEdgeRate = 12000;
+
+//Hall edges and 10 Hz long records at wall clock pace, like log_pipeline
+static void* simProducer(void* arg){
+    static const uint8_t seq[6] = {1, 3, 2, 6, 4, 5};
+    uint64_t i = 0, n = 0;
+    int64_t start = now_us();
+    uint64_t step = 1000000/simEdgeRate;
+    while(simLogging){
+        uint64_t t = i*step;
+        int64_t wait = start + (int64_t) t - now_us();
+        if(wait > 200){
+            usleep((useconds_t) wait);
+        }
+        itf_logEdge_t e;
+        memset(&e, 0, sizeof(e));
+        e.time_us = t;
+        e.hall = seq[i % 6];
+        e.cur[0] = (int32_t) (1200*sin(i*1.0472));
+        e.cur[1] = (int32_t) (1200*sin(i*1.0472 + 2.0944));
+        e.cur[2] = -e.cur[0] - e.cur[1];
+        simLogged += itf_logEdgeRecord(&e) > 0;
+        simOffered++;
+        if(t >= n*100000){
+            itf_logLong_t r;
+            int k;
+            memset(&r, 0, sizeof(r));
+            r.time_us = t;
+            for(k=0;k<ITF_LOG_LONG_FIELDS;k++){
+                r.v[k] = (int32_t) (1000*(k + 1) + (n*7 + k) % 50);
+            }
+            simLogged += itf_logLongRecord(&r) > 0;
+            simOffered++;
+            n++;
+        }
+        i++;
+    }
+    return NULL;
+}
+
+//Downloaded bytes must match the start of the file on the "card" (all of it once closed)
+static int simCompare(const char* dir, const char* name, const char* got, uint32_t size){
+    char path[600];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* a = fopen(path, "rb");
+    FILE* b = fopen(got, "rb");
+    int same = (a != NULL && b != NULL);
+    uint32_t i;
+    for(i=0;same && i<size;i++){
+        same = (fgetc(a) == fgetc(b));
+    }
+    if(a != NULL) { fclose(a); }
+    if(b != NULL) { fclose(b); }
+    return same;
+}
+
+static void clearDir(const char* dir){
+    DIR* d = opendir(dir);
+    struct dirent* de;
+    char path[600];
+    while(d != NULL && (de = readdir(d)) != NULL){
+        if(de->d_name[0] != '.'){
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+    }
+    if(d != NULL){
+        closedir(d);
+    }
+}
+
+static int runSim(link_t* l, int baud, const char* dir, double logSeconds, int write_us, int read_us){
+    host_storageFaults_t faults;
+    pthread_t producer;
+    fetch_t r;
+    char name[16], got[640];
+    int bad = 0, k;
+    itf_sdRingStats_t before, after;
+
+    memset(&faults, 0, sizeof(faults));
+    faults.write_us = write_us;
+    faults.read_us = read_us;
+    host_storageSetFaults(&faults);
+    if(!host_storageDirInit(dir)){
+        fprintf(stderr, "can't use %s\n", dir);
+        return 2;
+    }
+    clearDir(dir);
+    host_logLevel = -1;
+
+    //The board: writer task on the directory, PC link task on a PTY whose other end is ours
+    const char* pty = host_uartOpenPty(UART_NUM_0);
+    itf_initSDLogging(&host_storageDir);
+    xTaskCreate(itf_writeSD_task, "SDTask", 8192, NULL, configMAX_PRIORITIES-2, NULL);
+    xTaskCreate(PCComTask, "PCTask", 8192, NULL, configMAX_PRIORITIES-1, NULL);
+    l->fd = open(pty, O_RDWR | O_NOCTTY);
+    if(l->fd < 0){
+        perror(pty);
+        return 2;
+    }
+    l->pace = 1;
+    linkSetBaud(l, CONSOLE_BAUD);
+    pthread_create(&producer, NULL, simProducer, NULL);
+
+    //One finished part, then a second one that is still being written during its download
+    usleep((useconds_t) (logSeconds*1e6));
+    itf_sdRequest(ITF_SD_REQ_CLOSE);
+    int64_t until = now_us() + 10000000;
+    while((itf_sessionFileCount() < 1 || itf_sessionFileAt(0)->size == 0) && now_us() < until){
+        usleep(1000);
+    }
+    usleep((useconds_t) (logSeconds*1e6));
+
+    for(k=0;k<2;k++){
+        const itf_sessionFile_t* sf = itf_sessionFileAt(k);
+        if(sf == NULL){
+            printf("sim err=no_file part=%d\n", k);
+            bad = 1;
+            break;
+        }
+        snprintf(name, sizeof(name), "S%04u_%02u.BIN", sf->session, sf->part);
+        snprintf(got, sizeof(got), "%s/got_%s", dir, name);
+        itf_sdRingGetStats(&before);
+        int ok = fetchBest(l, name, baud, got, &r);
+        itf_sdRingGetStats(&after);
+        int same = ok && simCompare(dir, name, got, r.size);
+        double wire = r.baud/10.0*ITF_XFER_CHUNK/(ITF_XFER_CHUNK + ITF_XFER_OVERHEAD);
+        printf("sim file=%s live=%d ok=%d same=%d bytes=%lu Bps=%.0f wire_efficiency=%.2f log_drops_during=%lu corrupted=%lu dropped=%lu acks_lost=%lu\n",
+               name, k == 1, ok, same, (unsigned long) r.size, (ok && r.seconds > 0) ? r.size/r.seconds : 0.0,
+               (ok && r.seconds > 0) ? r.size/r.seconds/wire : 0.0,
+               (unsigned long) (after.recordsDropped - before.recordsDropped), l->corrupted, l->dropped, l->acksLost);
+        bad |= !same;
+        unlink(got);
+    }
+    simLogging = 0;
+    pthread_join(producer, NULL);
+    printf("sim records=%lu/%lu writer_bytes=%llu write_max_ms=%.1f result=%s\n", simLogged, simOffered,
+           (unsigned long long) itf_sdWriterStats.bytesWritten, itf_sdWriterStats.writeMax_us/1000.0, bad ? "FAIL" : "ok");
+    return bad;
+}
+
+static void usage(void){
+    fprintf(stderr, "usage: log_fetch --port DEV --file NAME [--baud N|auto] [-o OUT]\n"
+                    "       log_fetch --sim [--baud N|auto] [--dir DIR] [--log-seconds S] [--edge-rate N]\n"
+                    "                 [--corrupt-ppm N] [--drop-ppm N] [--ack-loss-pct N] [--sim-max-baud N]\n"
+                    "                 [--write-us N] [--read-us N] [--seed N]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv){
+    link_t l;
+    fetch_t r;
+    const char* port = NULL;
+    const char* file = NULL;
+    const char* outPath = NULL;
+    const char* dir = NULL;
+    int sim = 0, baud = ITF_XFER_DEFAULT_BAUD;
+    int write_us = 2000, read_us = 500;
+    double logSeconds = 3.0;
+    int i;
+
+    memset(&l, 0, sizeof(l));
+    l.seed = 1;
+    for(i=1;i<argc;i++){
+        const char* a = argv[i];
+        const char* v = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if(strcmp(a, "--sim") == 0)                      { sim = 1; continue; }
+        if(v == NULL)                                    { usage(); }
+        if(strcmp(a, "--port") == 0)                     { port = v; }
+        else if(strcmp(a, "--file") == 0)                { file = v; }
+        else if(strcmp(a, "-o") == 0)                    { outPath = v; }
+        else if(strcmp(a, "--baud") == 0)                { baud = strcmp(v, "auto") == 0 ? 0 : atoi(v); }
+        else if(strcmp(a, "--dir") == 0)                 { dir = v; }
+        else if(strcmp(a, "--log-seconds") == 0)         { logSeconds = atof(v); }
+        else if(strcmp(a, "--edge-rate") == 0)           { simEdgeRate = atoi(v); }
+        else if(strcmp(a, "--corrupt-ppm") == 0)         { l.corruptPpm = atoi(v); }
+        else if(strcmp(a, "--drop-ppm") == 0)            { l.dropPpm = atoi(v); }
+        else if(strcmp(a, "--ack-loss-pct") == 0)        { l.ackLossPct = atoi(v); }
+        else if(strcmp(a, "--sim-max-baud") == 0)        { l.maxBaud = atoi(v); }
+        else if(strcmp(a, "--write-us") == 0)            { write_us = atoi(v); }
+        else if(strcmp(a, "--read-us") == 0)             { read_us = atoi(v); }
+        else if(strcmp(a, "--seed") == 0)                { l.seed = (uint32_t) strtoul(v, NULL, 0) | 1; }
+        else                                             { usage(); }
+        i++;
+    }
+    if(sim){
+        char tmp[] = "/tmp/log_fetchXXXXXX";
+        if(dir == NULL && (dir = mkdtemp(tmp)) == NULL){
+            perror("mkdtemp");
+            return 2;
+        }
+        if(simEdgeRate <= 0 || logSeconds <= 0){
+            usage();
+        }
+        return runSim(&l, baud, dir, logSeconds, write_us, read_us);
+    }
+    if(port == NULL || file == NULL){
+        usage();
+    }
+
+    struct termios tio;
+    l.fd = open(port, O_RDWR | O_NOCTTY);
+    if(l.fd < 0 || tcgetattr(l.fd, &tio) != 0){
+        perror(port);
+        return 2;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(l.fd, TCSANOW, &tio);
+    l.tty = 1;
+    linkSetBaud(&l, CONSOLE_BAUD);
+    tcflush(l.fd, TCIOFLUSH);
+    return fetchBest(&l, file, baud, outPath, &r) ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "log_file.h"
+
+int logFileOpen(logFile_t* lf, const char* path){
+    struct stat sb;
+    memset(lf, 0, sizeof(*lf));
+    lf->fd = open(path, O_RDONLY);
+    if(lf->fd < 0 || fstat(lf->fd, &sb) != 0){
+        return -1;
+    }
+    lf->size = (uint64_t) sb.st_size;
+    //The header tells us the block size; it always fits in the smallest block we'd use
+    uint8_t first[4096];
+    ssize_t n = pread(lf->fd, first, sizeof(first), 0);
+    itf_logFileInfo_t probe;
+    if(n < 32 || itf_logParseFileHeader(first, (int) n, &probe) != 0 || probe.blockSize < 512){
+        close(lf->fd);
+        return -1;
+    }
+    lf->blockSize = probe.blockSize;
+    lf->header = malloc(lf->blockSize);
+    if(pread(lf->fd, lf->header, lf->blockSize, 0) != (ssize_t) lf->blockSize){
+        free(lf->header);
+        close(lf->fd);
+        return -1;
+    }
+    itf_logParseFileHeader(lf->header, (int) lf->blockSize, &lf->info);
+    lf->blocks = (uint32_t) (lf->size/lf->blockSize);
+    lf->lastData = (lf->blocks > 0) ? lf->blocks - 1 : 0;
+
+    //A closed file ends with the index
+    if(lf->blocks >= 2){
+        uint8_t* idx = malloc(lf->blockSize);
+        uint32_t lastBlock;
+        if(pread(lf->fd, idx, lf->blockSize, (off_t) (lf->blocks - 1)*lf->blockSize) == (ssize_t) lf->blockSize &&
+           (lf->indexEntries = itf_logParseIndex(idx, (int) lf->blockSize, &lf->indexStride, &lastBlock)) >= 0){
+            lf->index = idx;
+            lf->lastData = lf->blocks - 2;
+        }else{
+            lf->indexEntries = 0;
+            free(idx);
+        }
+    }
+    return 0;
+}
+
+void logFileClose(logFile_t* lf){
+    free(lf->header);
+    free(lf->index);
+    if(lf->fd >= 0){
+        close(lf->fd);
+    }
+    lf->fd = -1;
+}
+
+int logFileReadBlock(logFile_t* lf, uint32_t blockNo, uint8_t* buf, itf_logBlockInfo_t* info){
+    if(blockNo == 0 || blockNo > lf->lastData){
+        return 0;
+    }
+    if(pread(lf->fd, buf, lf->blockSize, (off_t) blockNo*lf->blockSize) != (ssize_t) lf->blockSize){
+        return 0;
+    }
+    return itf_logParseBlockHeader(buf, (int) lf->blockSize, info);
+}
+
+//Nearest good block at or after blockNo (up to limit), 0 if none
+static uint32_t logFileGoodFrom(logFile_t* lf, uint32_t blockNo, uint32_t limit, uint8_t* buf, itf_logBlockInfo_t* info, int* probes){
+    for(;blockNo <= limit;blockNo++){
+        (*probes)++;
+        if(logFileReadBlock(lf, blockNo, buf, info) == 1){
+            return blockNo;
+        }
+    }
+    return 0;
+}
+
+uint32_t logFileFindTime(logFile_t* lf, uint64_t time_us, int* probes){
+    uint8_t* buf = malloc(lf->blockSize);
+    itf_logBlockInfo_t info;
+    uint32_t lo = 1, hi = lf->lastData;
+    *probes = 0;
+
+    //The index narrows it to one stride; the block headers do the rest
+    if(lf->index != NULL && lf->indexEntries > 0){
+        int a = 0, b = lf->indexEntries - 1;
+        uint32_t blk;
+        uint64_t t;
+        itf_logIndexEntry(lf->index, 0, &blk, &t);
+        if(time_us >= t){
+            while(a < b){
+                int m = (a + b + 1)/2;
+                itf_logIndexEntry(lf->index, m, &blk, &t);
+                if(t <= time_us) a = m; else b = m - 1;
+            }
+            itf_logIndexEntry(lf->index, a, &lo, &t);
+            if(a + 1 < lf->indexEntries){
+                itf_logIndexEntry(lf->index, a + 1, &hi, &t);
+            }
+        }else{
+            hi = blk;
+        }
+    }
+    //Last block whose base time is <= time_us: its records may reach time_us
+    uint32_t found = lo;
+    while(lo <= hi){
+        uint32_t mid = lo + (hi - lo)/2;
+        uint32_t good = logFileGoodFrom(lf, mid, hi, buf, &info, probes);
+        if(good != 0 && info.base_us <= time_us){
+            found = good;
+            lo = good + 1;
+        }else{
+            hi = mid - 1;       //Nothing usable from mid up, or it starts too late
+        }
+    }
+    free(buf);
+    return found;
+}
@@ -0,0 +1,31 @@
+//Host side reader for the data.bin container (main/itf_log_codec.h): file header, block access
+//with CRC checks, and time lookup through the closing index or, if the file was never closed,
+//a binary search over the block headers.
+#ifndef LOG_FILE_H_
+#define LOG_FILE_H_
+
+#include <stdint.h>
+#include "itf_log_codec.h"
+
+typedef struct {
+    int fd;
+    uint64_t size;
+    uint32_t blockSize;
+    uint32_t blocks;            //Whole blocks in the file, header and index included
+    uint32_t lastData;          //Last block that may hold data
+    itf_logFileInfo_t info;
+    uint8_t* header;            //Block 0 (info.schemaText points into it)
+    uint8_t* index;             //Index block, NULL if the file wasn't closed
+    int indexEntries;
+    uint32_t indexStride;
+} logFile_t;
+
+//0 on success. Fails if the file header is missing or damaged.
+int logFileOpen(logFile_t* lf, const char* path);
+void logFileClose(logFile_t* lf);
+//Reads block blockNo into buf (blockSize bytes). Returns itf_logParseBlockHeader's result.
+int logFileReadBlock(logFile_t* lf, uint32_t blockNo, uint8_t* buf, itf_logBlockInfo_t* info);
+//First data block that can hold records at or after time_us. Damaged blocks are stepped over.
+uint32_t logFileFindTime(logFile_t* lf, uint64_t time_us, int* probes);
+
+#endif
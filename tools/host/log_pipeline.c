@@ -0,0 +1,310 @@
+//Runs the firmware's whole logging path on the host: records are encoded into the SD ring,
+//itf_writeSD_task (the real one, in a thread) writes them through itf_storage to a directory or
+//to the RAM disk from host_storage.c, with the latency, stalls and write errors asked for.
+//Reports throughput, drops and how the writer recovered, then decodes the files it wrote.
+//Timestamps come from the synthetic hall clock, so without drops the same options give the
+//same S0001_00.BIN on every backend and on every run.
+//
+//Build from the repo root:
+//  gcc -O2 -Wall -Wno-format -pthread -Itools/host/shim -Itools/host -Imain -o log_pipeline
+//      tools/host/log_pipeline.c tools/host/host_storage.c tools/host/log_file.c
+//      tools/host/shim/host_hal.c main/itf_sd_card_writer.c main/itf_sd_session.c
+//      main/itf_sd_ring.c main/itf_log_codec.c main/itf_log_policy.c main/itf_crc.c
+//      main/ctrl_subsystem.c main/ctrl_speed_pi.c main/ctrl_autotune.c main/ctrl_params.c main/ctrl_sensorless.c main/ctrl_pwm.c main/itf_seven_seg.c
+//      main/itf_trace.c -lm
+//
+//  ./log_pipeline --dir out                     write to ./out, print file CRCs
+//  ./log_pipeline --ram --write-us 800 --stall-every 10 --stall-ms 300 --fail-every 25
+//  ./log_pipeline --ram --save out2 --compare out   byte compare with an earlier run
+//Exit status is nonzero if the decoded records don't match what was logged (minus drops)
+//or a --compare file differs (only expected to match when neither run dropped anything).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <dirent.h>
+
+#include "host_hal.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "itf_sd_card_writer.h"
+#include "itf_sd_ring.h"
+#include "itf_sd_session.h"
+#include "itf_log_codec.h"
+#include "itf_crc.h"
+#include "host_storage.h"
+#include "log_file.h"
+
+static int edgeRate = 12000;        //Hall edges per second (about 2000 rpm on a 6 pole pair motor)
+static int longHz = 10;
+static double seconds = 5.0;
+static const char* dirPath = NULL;
+static const char* savePath = NULL;
+static const char* comparePath = NULL;
+static host_storageFaults_t faults;
+
+static int64_t now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+//Same record stream every run: a motor at a steady speed with ripple on the phase currents
+static void makeEdge(itf_logEdge_t* e, uint64_t i, uint64_t t_us){
+    static const uint8_t seq[6] = {1, 3, 2, 6, 4, 5};
+    e->time_us = t_us;
+    e->hall = seq[i % 6];
+    e->status = 0;
+    e->cur[0] = (int32_t) (1200*sin(i*1.0472));
+    e->cur[1] = (int32_t) (1200*sin(i*1.0472 + 2.0944));
+    e->cur[2] = -e->cur[0] - e->cur[1];
+}
+
+static void makeLong(itf_logLong_t* r, uint64_t i, uint64_t t_us){
+    int k;
+    r->time_us = t_us;
+    r->status = 0;
+    for(k=0;k<ITF_LOG_LONG_FIELDS;k++){
+        r->v[k] = (int32_t) (1000*(k + 1) + (i*7 + k) % 50);
+    }
+}
+
+typedef struct {
+    unsigned long edges, longs, other, badTime, damaged;
+    uint64_t last_us;
+} decoded_t;
+
+static void countRecord(const itf_logRecord_t* r, void* ctx){
+    decoded_t* d = (decoded_t*) ctx;
+    if(r->time_us < d->last_us){
+        d->badTime++;
+    }
+    d->last_us = r->time_us;
+    if(r->tag == ITF_LOG_TAG_EDGE){
+        d->edges++;
+    }else if(r->tag == ITF_LOG_TAG_LONG){
+        d->longs++;
+    }else{
+        d->other++;
+    }
+}
+
+static int decodeFile(const char* path, decoded_t* d){
+    logFile_t lf;
+    itf_logBlockInfo_t info;
+    uint32_t b;
+    if(logFileOpen(&lf, path) != 0){
+        return 0;
+    }
+    uint8_t* block = malloc(lf.blockSize);
+    for(b=1;b<=lf.lastData;b++){
+        int r = logFileReadBlock(&lf, b, block, &info);
+        if(r < 0){
+            d->damaged++;
+        }else if(r > 0){
+            itf_logDecodeBlock(block, (int) lf.blockSize, countRecord, d);
+        }
+    }
+    free(block);
+    logFileClose(&lf);
+    return 1;
+}
+
+static uint32_t fileCrc(const char* path, long* size){
+    uint8_t buf[65536];
+    size_t n;
+    uint32_t crc = 0;
+    FILE* f = fopen(path, "rb");
+    *size = -1;
+    if(f == NULL){
+        return 0;
+    }
+    *size = 0;
+    while((n = fread(buf, 1, sizeof(buf), f)) > 0){
+        crc = itf_crc32(crc, buf, n);
+        *size += (long) n;
+    }
+    fclose(f);
+    return crc;
+}
+
+//Earlier runs' log files would make this run a new session
+static void clearDir(const char* dir){
+    DIR* d = opendir(dir);
+    struct dirent* de;
+    char path[600];
+    if(d == NULL){
+        return;
+    }
+    while((de = readdir(d)) != NULL){
+        if((de->d_name[0] == 'S' && strstr(de->d_name, ".BIN") != NULL) || strcmp(de->d_name, "SESSIONS.CSV") == 0){
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+}
+
+static void usage(void){
+    fprintf(stderr, "log_pipeline [--dir path | --ram [--save path]] [--compare path] [--seconds s]\n"
+                    "             [--rate edges/s] [--long-hz n] [--write-us us] [--per-kb-us us]\n"
+                    "             [--stall-every n --stall-ms ms] [--fail-every n] [--fail-ppm n]\n"
+                    "             [--mount-fails n] [--seed n]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv){
+    int i, ram = 0;
+    for(i=1;i<argc;i++){
+        if(!strcmp(argv[i], "--ram")) ram = 1;
+        else if(i + 1 >= argc) usage();
+        else if(!strcmp(argv[i], "--dir")) dirPath = argv[++i];
+        else if(!strcmp(argv[i], "--save")) savePath = argv[++i];
+        else if(!strcmp(argv[i], "--compare")) comparePath = argv[++i];
+        else if(!strcmp(argv[i], "--seconds")) seconds = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--rate")) edgeRate = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--long-hz")) longHz = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--write-us")) faults.write_us = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--per-kb-us")) faults.perKB_us = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--stall-every")) faults.stallEvery = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--stall-ms")) faults.stall_ms = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--fail-every")) faults.failEvery = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--fail-ppm")) faults.failPpm = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--mount-fails")) faults.mountFails = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--seed")) faults.seed = (uint32_t) atoi(argv[++i]);
+        else usage();
+    }
+    if(!ram && dirPath == NULL){
+        dirPath = "log_pipeline_out";
+    }
+    if(edgeRate <= 0 || longHz <= 0 || seconds <= 0){
+        usage();
+    }
+
+    const itf_storageOps_t* backend = ram ? &host_storageRam : &host_storageDir;
+    if(!ram){
+        if(!host_storageDirInit(dirPath)){
+            fprintf(stderr, "can't use %s\n", dirPath);
+            return 2;
+        }
+        clearDir(dirPath);
+    }
+    host_storageSetFaults(&faults);
+    itf_initSDLogging(backend);
+    xTaskCreate(itf_writeSD_task, "itf_writeSD_task", 8192, NULL, 5, NULL);
+
+    //Producer: edges and long records in time order, paced to the wall clock
+    uint64_t edgeStep = 1000000/edgeRate, longStep = 1000000/longHz;
+    uint64_t end_us = (uint64_t) (seconds*1e6);
+    uint64_t tEdge = 0, tLong = 0, nEdge = 0, nLong = 0;
+    unsigned long loggedEdges = 0, loggedLongs = 0;
+    int64_t start = now_us();
+    while(tEdge < end_us || tLong < end_us){
+        uint64_t t = (tEdge <= tLong) ? tEdge : tLong;
+        int64_t wait = start + (int64_t) t - now_us();
+        if(wait > 200){
+            usleep((useconds_t) wait);
+        }
+        if(tEdge <= tLong){
+            itf_logEdge_t e;
+            makeEdge(&e, nEdge++, tEdge);
+            loggedEdges += itf_logEdgeRecord(&e) > 0;
+            tEdge += edgeStep;
+        }else{
+            itf_logLong_t r;
+            makeLong(&r, nLong++, tLong);
+            loggedLongs += itf_logLongRecord(&r) > 0;
+            tLong += longStep;
+        }
+    }
+    int64_t produced = now_us() - start;
+
+    //Close the file the way disarming does and wait for the index and SESSIONS.CSV
+    uint32_t wakeups = itf_sdWriterStats.wakeups;
+    itf_sdRequest(ITF_SD_REQ_CLOSE);
+    int64_t closeStart = now_us();
+    int closed = 0;
+    while(now_us() - closeStart < 60000000LL){
+        int n = itf_sessionFileCount();
+        if(itf_sdWriterStats.wakeups != wakeups && itf_sdRingPending() == 0 && host_storageOpenFiles() == 0 &&
+           n > 0 && itf_sessionFileAt(n - 1)->size > 0){
+            closed = 1;
+            break;
+        }
+        usleep(1000);
+    }
+    int64_t total = now_us() - start;
+
+    itf_sdRingStats_t rs;
+    host_storageStats_t hs;
+    itf_sdRingGetStats(&rs);
+    host_storageGetStats(&hs);
+    printf("log_pipeline backend=%s seconds=%.1f edges=%lu/%lu longs=%lu/%lu dropped=%lu\n",
+           backend->name, seconds, loggedEdges, (unsigned long) nEdge, loggedLongs, (unsigned long) nLong,
+           (unsigned long) rs.recordsDropped);
+    printf("  written=%llu bytes in %.2f s (%.1f KB/s) writes=%lu write_max_ms=%.1f ring_high_water=%lu/%d wait_max_ms=%.1f\n",
+           (unsigned long long) itf_sdWriterStats.bytesWritten, total/1e6,
+           itf_sdWriterStats.bytesWritten/1024.0/(total/1e6), hs.writes, hs.writeMax_us/1000.0,
+           (unsigned long) rs.pendingHighWater, itf_sdRingBlockCount(), rs.waitMax_us/1000.0);
+    printf("  stalls=%lu write_fails=%lu failed_mounts=%lu remounts=%lu open_fails=%lu mount_to_write_ms=%.1f closed=%d produce_s=%.2f\n",
+           hs.stalls, hs.failedWrites, hs.failedMounts, (unsigned long) itf_sdWriterStats.remounts,
+           (unsigned long) itf_sdWriterStats.openFails, itf_sdWriterStats.mountToFirstWrite_us/1000.0, closed, produced/1e6);
+    if(!closed){
+        printf("result=FAIL writer never closed the log\n");
+        return 1;
+    }
+
+    //Decode every part the run wrote (RAM disk files are saved first so the reader can open them)
+    const char* outDir = ram ? savePath : dirPath;
+    char tmpDir[] = "/tmp/log_pipelineXXXXXX";
+    if(outDir == NULL){
+        outDir = mkdtemp(tmpDir);
+    }else if(ram){
+        host_storageDirInit(outDir);
+        clearDir(outDir);
+    }
+    decoded_t d;
+    memset(&d, 0, sizeof(d));
+    int bad = 0;
+    for(i=0;i<itf_sessionFileCount();i++){
+        const itf_sessionFile_t* sf = itf_sessionFileAt(i);
+        char name[16], path[600], other[600];
+        long size, otherSize;
+        snprintf(name, sizeof(name), "S%04d_%02d.BIN", sf->session, sf->part);
+        snprintf(path, sizeof(path), "%s/%s", outDir, name);
+        if(ram){
+            host_storageRamSave(name, path);
+        }
+        if(!decodeFile(path, &d)){
+            printf("  %s: can't read\n", name);
+            bad = 1;
+            continue;
+        }
+        uint32_t crc = fileCrc(path, &size);
+        printf("  file=%s bytes=%ld crc32=%08lx", name, size, (unsigned long) crc);
+        if(comparePath != NULL){
+            snprintf(other, sizeof(other), "%s/%s", comparePath, name);
+            uint32_t otherCrc = fileCrc(other, &otherSize);
+            int same = (otherSize == size && otherCrc == crc);
+            printf(" compare=%s", same ? "same" : "DIFFERENT");
+            bad |= !same;
+        }
+        printf("\n");
+        if(ram && savePath == NULL){
+            unlink(path);
+        }
+    }
+    if(ram && savePath == NULL){
+        rmdir(tmpDir);
+    }
+    int match = (d.edges == loggedEdges && d.longs == loggedLongs && d.badTime == 0 && d.damaged == 0);
+    printf("  decoded edges=%lu longs=%lu other=%lu out_of_order=%lu damaged_blocks=%lu\n",
+           d.edges, d.longs, d.other, d.badTime, d.damaged);
+    printf("result=%s\n", (match && !bad) ? "ok" : "FAIL");
+    return (match && !bad) ? 0 : 1;
+}
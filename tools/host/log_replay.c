@@ -0,0 +1,878 @@
+//Replays a recorded log through the real control code on the host: the hall edges go through
+//ctrl_hall_isr (GPIO levels + host_gpioTriggerIsr), the 10 ms tick through ctrl_update_timer_cb and
+//the operational task, and the logged throttle/speed/direction commands through the ctrl_set*
+//functions, all in virtual time. After each tick that has a long record, the replayed speed
+//estimate, duty command and fault state are diffed against the recorded ones.
+//
+//Inputs: the parts of one session (S<session>_<part>.BIN, in order), or an old data.bin.
+//  schema 2/3 files  edges, long records (volts, temps, duty) and command records
+//  schema 1 files    no commands or duty: the throttle is taken from the long records
+//  data.bin          same, with whole mph and an 8 bit throttle; --run picks the boot to replay
+//Volts and temperatures are held between long records (they are only logged there), phase currents
+//between edges. Records written late by the logging policy's pre-trigger capture are put back in
+//time order, and edges the policy skipped are filled in from the hall sequence.
+//
+//  --synth writes a race through the real logging path (writer task, host directory backend) with
+//  a simple car model, every long record and every command logged. Replaying it must match exactly,
+//  which checks the harness itself; a changed estimator or controller then shows up as a diff.
+//
+//Build from the repo root:
+//  gcc -O2 -Wall -Wno-format -pthread -Itools/host/shim -Itools/host -Imain -o log_replay
+//      tools/host/log_replay.c tools/host/log_file.c tools/host/host_storage.c
+//      tools/host/shim/host_hal.c main/ctrl_subsystem.c main/ctrl_speed_pi.c main/ctrl_autotune.c main/ctrl_params.c main/ctrl_sensorless.c main/ctrl_pwm.c
+//      main/itf_seven_seg.c main/itf_log_policy.c main/itf_log_codec.c main/itf_crc.c main/itf_sd_card_writer.c
+//      main/itf_sd_session.c main/itf_sd_ring.c main/itf_trace.c -lm
+//
+//  ./log_replay S0002_00.BIN S0002_01.BIN          replay one session, print the diff summary
+//  ./log_replay data.bin --run 1 --show 20          second boot in an old log, first 20 diffs
+//  ./log_replay --synth race --minutes 35 [--fault-at s]    then ./log_replay race/S0001_00.BIN
+//Exit status is 1 if anything differs beyond --speed-tol (mph) / --duty-tol, 2 on bad input.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "host_hal.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "ctrl_subsystem.h"
+#include "itf_log_codec.h"
+#include "itf_log_policy.h"
+#include "itf_sd_card_writer.h"
+#include "itf_sd_ring.h"
+#include "itf_sd_session.h"
+#include "host_storage.h"
+#include "log_file.h"
+
+//Controller internals the harness drives directly (sensor inputs) or needs for stepping
+extern double ctrl_batVolt, ctrl_curA, ctrl_curB, ctrl_curC, ctrl_tempA, ctrl_tempB, ctrl_tempC;
+extern const uint8_t ctrl_output_table[7];
+extern const uint8_t ctrl_hall_input_table[6];
+extern esp_timer_handle_t ctrl_speed_control_timer;
+extern TaskHandle_t ctrl_operational_task_handle;
+
+#define TICK_US 10000               //ctrl_SPEED_CONTROL_UPDATE_PERIOD: safety checks, speed estimate, long records
+#define BASE_TICK_US 1000           //ctrl_SCHED_TICK_PERIOD: the operational task's timer, every tenth one is a TICK_US
+#define REORDER_US 1000000          //Longer than ITF_LOG_PRETRIG_MS, so pre-trigger records are back in order
+#define HALL_PIN_A 42
+#define HALL_PIN_B 41
+#define HALL_PIN_C 40
+
+static int64_t wall_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+//---------------------------------------------------------------- Virtual time and stepping
+
+static uint64_t vt_us = 0;
+static int64_t virtualTime(void) { return (int64_t) vt_us; }
+
+static uint64_t nextTick_us = 0;
+static unsigned long ticks = 0;
+static uint8_t gpioHall = 0;
+
+static void startController(uint64_t t_us, uint8_t hall, uint64_t phase_us){
+    vt_us = t_us;
+    host_timeSource_us = virtualTime;
+    host_timerManual = 1;
+    host_logLevel = -1;
+    host_gpioLevel[HALL_PIN_A] = hall & 1;
+    host_gpioLevel[HALL_PIN_B] = (hall >> 1) & 1;
+    host_gpioLevel[HALL_PIN_C] = (hall >> 2) & 1;
+    gpioHall = hall;
+    init_control_subsystem();
+    host_taskWaitIdle(ctrl_operational_task_handle);
+    //The timer starts now, so its tenth tick is one on the phase grid after t_us
+    nextTick_us = phase_us + ((t_us >= phase_us) ? ((t_us - phase_us)/TICK_US + 1)*TICK_US : 0) - (TICK_US - BASE_TICK_US);
+    while(nextTick_us <= t_us){
+        nextTick_us += TICK_US;
+    }
+}
+
+static void runTick(void){
+    vt_us = nextTick_us;
+    host_timerFire(ctrl_speed_control_timer);
+    host_taskWaitIdle(ctrl_operational_task_handle);
+    nextTick_us += BASE_TICK_US;
+    ticks++;
+}
+
+//Ticks due before t (and at t if inclusive)
+static void runTicksUntil(uint64_t t, int inclusive){
+    while(nextTick_us < t || (inclusive && nextTick_us == t)){
+        runTick();
+    }
+}
+
+//One hall edge as the ISR sees it: the currents sampled with it, then the pin change
+static void hallEdge(uint64_t t, uint8_t hall, const int32_t cur[3]){
+    uint8_t changed = (uint8_t) (hall ^ gpioHall);
+    vt_us = t;
+    ctrl_curA = cur[0]/100.0;
+    ctrl_curB = cur[1]/100.0;
+    ctrl_curC = cur[2]/100.0;
+    host_gpioLevel[HALL_PIN_A] = hall & 1;
+    host_gpioLevel[HALL_PIN_B] = (hall >> 1) & 1;
+    host_gpioLevel[HALL_PIN_C] = (hall >> 2) & 1;
+    gpioHall = hall;
+    host_gpioTriggerIsr((changed & 2) ? HALL_PIN_B : (changed & 4) ? HALL_PIN_C : HALL_PIN_A);
+}
+
+static uint8_t statusNow(void){
+    return (uint8_t) ((ctrl_isInSafetyShutdown() << 7) | ctrl_getErrorCode());
+}
+
+static int hallIndex(uint8_t hall){
+    int i;
+    for(i=0;i<6;i++){
+        if(ctrl_hall_input_table[i] == hall){
+            return i;
+        }
+    }
+    return -1;
+}
+
+//---------------------------------------------------------------- Recorded events
+
+enum { EV_EDGE, EV_LONG, EV_CMD };
+
+typedef struct {
+    uint64_t t;
+    uint64_t order;             //Position in the input, keeps records with the same time in file order
+    uint8_t kind;
+    uint8_t hall;
+    uint8_t status;
+    uint8_t cmd, result;
+    int32_t value;
+    int32_t cur[3];
+    int32_t v[ITF_LOG_LONG_FIELDS];
+} event_t;
+
+typedef struct {
+    int schema;                 //2: commands and duty logged, 1: container without them, 0: data.bin
+    int run;                    //data.bin boot to replay
+    //Reader state
+    uint64_t order;
+    uint32_t lastSeq;
+    int haveSeq;
+    unsigned long staleBlocks, damagedBlocks;
+    //Callback for every event, returns 0 to stop reading
+    int (*fn)(const event_t* ev, void* ctx);
+    void* ctx;
+    int stop;
+} reader_t;
+
+static void readerEmit(reader_t* rd, event_t* ev){
+    if(rd->stop){
+        return;
+    }
+    ev->order = rd->order++;
+    if(!rd->fn(ev, rd->ctx)){
+        rd->stop = 1;
+    }
+}
+
+static void onRecord(const itf_logRecord_t* r, void* ctx){
+    reader_t* rd = (reader_t*) ctx;
+    event_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.t = r->time_us;
+    ev.status = r->status;
+    if(r->tag == ITF_LOG_TAG_EDGE){
+        ev.kind = EV_EDGE;
+        ev.hall = r->hall;
+        memcpy(ev.cur, r->cur, sizeof(ev.cur));
+    }else if(r->tag == ITF_LOG_TAG_LONG){
+        ev.kind = EV_LONG;
+        memcpy(ev.v, r->lng, sizeof(ev.v));
+    }else if(r->tag == ITF_LOG_TAG_CMD){
+        ev.kind = EV_CMD;
+        ev.cmd = r->cmd;
+        ev.result = r->cmdResult;
+        ev.value = r->cmdValue;
+    }else{
+        return;                 //Status records repeat what edges and longs carry, raw ones aren't replayed
+    }
+    readerEmit(rd, &ev);
+}
+
+static int readContainer(reader_t* rd, const char* path){
+    logFile_t lf;
+    itf_logBlockInfo_t info;
+    uint32_t b;
+    if(logFileOpen(&lf, path) != 0){
+        return 0;
+    }
+    rd->schema = lf.info.schema;
+    uint8_t* block = malloc(lf.blockSize);
+    for(b=1;b<=lf.lastData && !rd->stop;b++){
+        int r = logFileReadBlock(&lf, b, block, &info);
+        if(r < 0){
+            rd->damagedBlocks++;
+        }else if(r > 0){
+            //Blocks rewritten after a card error come again with an old sequence number
+            if(rd->haveSeq && (int32_t) (info.seq - rd->lastSeq) <= 0){
+                rd->staleBlocks++;
+                continue;
+            }
+            rd->haveSeq = 1;
+            rd->lastSeq = info.seq;
+            rd->schema = info.schema;
+            if(itf_logDecodeBlock(block, (int) lf.blockSize, onRecord, rd) < 0){
+                rd->damagedBlocks++;
+            }
+        }
+    }
+    free(block);
+    logFileClose(&lf);
+    return 1;
+}
+
+//Old data.bin: 0xBADFADE5 edges (16 bytes) and 0xDEADBEEF long records (25 bytes), big endian,
+//32 bit microsecond time at the end. A backwards jump that isn't the clock wrapping is a reboot.
+static uint32_t rd32be(const uint8_t* p){
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static int legacyLen(const uint8_t* p, const uint8_t* end){
+    if(end - p < 4) return 0;
+    uint32_t m = rd32be(p);
+    if(m == 0xBADFADE5 && end - p >= 16) return 16;
+    if(m == 0xDEADBEEF && end - p >= 25) return 25;
+    return 0;
+}
+
+static int readLegacy(reader_t* rd, const uint8_t* data, size_t size){
+    const uint8_t* p = data;
+    const uint8_t* end = data + size;
+    uint64_t hi = 0;
+    uint32_t last = 0;
+    int run = 0, have = 0;
+    rd->schema = 0;
+    while(p < end && !rd->stop && run <= rd->run){
+        int n = legacyLen(p, end);
+        if(n == 0){
+            p++;                //Resync on the next marker
+            continue;
+        }
+        uint32_t t = rd32be(p + n - 4);
+        if(have && t < last){
+            if(last >= 0xF0000000u && t < 0x10000000u){
+                hi += 1ULL << 32;
+            }else{
+                run++;
+                hi = 0;
+            }
+        }
+        have = 1;
+        last = t;
+        if(run == rd->run){
+            event_t ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.t = hi + t;
+            if(n == 16){
+                ev.kind = EV_EDGE;
+                ev.hall = p[4];
+                ev.status = p[5];
+                //Phase A lost its sign bit in the old writer, B and C are sign and magnitude
+                ev.cur[0] = ((int32_t) p[6] << 8) | p[7];
+                ev.cur[1] = (((int32_t) (p[8] & 0x7F) << 8) | p[9]) * ((p[8] & 0x80) ? -1 : 1);
+                ev.cur[2] = (((int32_t) (p[10] & 0x7F) << 8) | p[11]) * ((p[10] & 0x80) ? -1 : 1);
+            }else{
+                ev.kind = EV_LONG;
+                ev.v[ITF_LOG_LONG_SPEED] = p[4]*100;
+                ev.v[ITF_LOG_LONG_VOLTS] = (int16_t) ((p[9] << 8) | p[10]);
+                ev.v[ITF_LOG_LONG_TEMP_A] = (int16_t) ((p[13] << 8) | p[14]);
+                ev.v[ITF_LOG_LONG_TEMP_B] = (int16_t) ((p[15] << 8) | p[16]);
+                ev.v[ITF_LOG_LONG_TEMP_C] = (int16_t) ((p[17] << 8) | p[18]);
+                ev.status = p[19];
+                ev.v[ITF_LOG_LONG_THROTTLE] = p[20] << 4;
+            }
+            readerEmit(rd, &ev);
+        }
+        p += n;
+    }
+    return 1;
+}
+
+//Reads every input in order. Returns 0 if one can't be read.
+static int readInputs(reader_t* rd, char** paths, int count){
+    int i;
+    rd->order = 0;
+    rd->haveSeq = 0;
+    rd->stop = 0;
+    rd->staleBlocks = rd->damagedBlocks = 0;
+    for(i=0;i<count && !rd->stop;i++){
+        char magic[8];
+        int fd = open(paths[i], O_RDONLY);
+        struct stat st;
+        if(fd < 0 || fstat(fd, &st) != 0){
+            fprintf(stderr, "can't open %s\n", paths[i]);
+            return 0;
+        }
+        if(st.st_size >= 8 && pread(fd, magic, 8, 0) == 8 && memcmp(magic, ITF_LOG_FILE_MAGIC, 8) == 0){
+            close(fd);
+            if(!readContainer(rd, paths[i])){
+                fprintf(stderr, "%s: bad file header\n", paths[i]);
+                return 0;
+            }
+        }else{
+            void* data = (st.st_size > 0) ? mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+            close(fd);
+            if(data == MAP_FAILED){
+                fprintf(stderr, "%s: empty or unreadable\n", paths[i]);
+                return 0;
+            }
+            madvise(data, (size_t) st.st_size, MADV_SEQUENTIAL);
+            readLegacy(rd, (const uint8_t*) data, (size_t) st.st_size);
+            munmap(data, (size_t) st.st_size);
+        }
+    }
+    return 1;
+}
+
+//---------------------------------------------------------------- Reorder window (min heap on time, then file order)
+
+typedef struct {
+    event_t* ev;
+    int count, cap;
+} heap_t;
+
+static int evBefore(const event_t* a, const event_t* b){
+    return (a->t != b->t) ? (a->t < b->t) : (a->order < b->order);
+}
+
+static void heapPush(heap_t* h, const event_t* ev){
+    int i;
+    if(h->count == h->cap){
+        h->cap = h->cap ? h->cap*2 : 4096;
+        h->ev = realloc(h->ev, (size_t) h->cap*sizeof(event_t));
+    }
+    i = h->count++;
+    while(i > 0 && evBefore(ev, &h->ev[(i - 1)/2])){
+        h->ev[i] = h->ev[(i - 1)/2];
+        i = (i - 1)/2;
+    }
+    h->ev[i] = *ev;
+}
+
+static void heapPop(heap_t* h, event_t* out){
+    event_t last = h->ev[--h->count];
+    int i = 0;
+    *out = h->ev[0];
+    while(1){
+        int c = 2*i + 1;
+        if(c >= h->count) break;
+        if(c + 1 < h->count && evBefore(&h->ev[c + 1], &h->ev[c])) c++;
+        if(!evBefore(&h->ev[c], &last)) break;
+        h->ev[i] = h->ev[c];
+        i = c;
+    }
+    if(h->count > 0){
+        h->ev[i] = last;
+    }
+}
+
+//---------------------------------------------------------------- Replay and diff
+
+typedef struct {
+    unsigned long compared, mismatches;
+    double maxErr, sumSq;
+} diff_t;
+
+typedef struct {
+    //Options
+    double speedTol_mph;
+    int dutyTol;
+    int show;
+    //Prescan
+    int havePhase;
+    uint64_t phase_us;
+    uint8_t firstHall;
+    int haveHall;
+    //Replay state
+    int started;
+    int schema;
+    heap_t heap;
+    uint64_t newest_us, done_us;
+    uint64_t lastEdge_us;
+    uint8_t lastHall;
+    int32_t lastCur[3];
+    int haveEdge;
+    uint64_t first_us, last_us;
+    //Counts
+    unsigned long edges, longs, cmds, filled, late, unmatchedLongs, shown;
+    diff_t speed, duty, status, cmdResult;
+    uint64_t recFault_us, repFault_us;
+    uint8_t recFault, repFault;
+} replay_t;
+
+static int prescan(const event_t* ev, void* ctx){
+    replay_t* rp = (replay_t*) ctx;
+    if(ev->kind == EV_EDGE && !rp->haveHall){
+        rp->firstHall = ev->hall;
+        rp->haveHall = 1;
+    }
+    if(ev->kind == EV_LONG && !rp->havePhase){
+        rp->phase_us = ev->t % TICK_US;
+        rp->havePhase = 1;
+    }
+    return !(rp->haveHall && rp->havePhase);
+}
+
+static void showDiff(replay_t* rp, uint64_t t, const char* what, double rec, double rep){
+    if(rp->shown++ < (unsigned long) rp->show){
+        printf("  diff t=%.3f s %s recorded=%g replayed=%g\n", (t - rp->first_us)/1e6, what, rec, rep);
+    }
+}
+
+static void compare(replay_t* rp, diff_t* d, uint64_t t, const char* what, double rec, double rep, double tol){
+    double err = fabs(rep - rec);
+    d->compared++;
+    d->sumSq += err*err;
+    if(err > d->maxErr){
+        d->maxErr = err;
+    }
+    if(err > tol){
+        d->mismatches++;
+        showDiff(rp, t, what, rec, rep);
+    }
+}
+
+static void noteFault(replay_t* rp, uint64_t t, uint8_t recorded){
+    uint8_t replayed = statusNow();
+    if(recorded != 0 && rp->recFault == 0){
+        rp->recFault = recorded;
+        rp->recFault_us = t;
+    }
+    if(replayed != 0 && rp->repFault == 0){
+        rp->repFault = replayed;
+        rp->repFault_us = t;
+    }
+    compare(rp, &rp->status, t, "status", recorded, replayed, 0);
+}
+
+static void replayEdge(replay_t* rp, const event_t* ev){
+    int prev = hallIndex(rp->lastHall), next = hallIndex(ev->hall);
+    //Edges the policy didn't log: the steps between the last logged hall state and this one, evenly spaced
+    if(rp->haveEdge && prev >= 0 && next >= 0){
+        int d = (next - prev + 6) % 6;
+        int dir = (d <= 3) ? 1 : -1;
+        int steps = (d <= 3) ? d : 6 - d;
+        int k;
+        for(k=1;k<steps;k++){
+            uint64_t t = rp->lastEdge_us + (ev->t - rp->lastEdge_us)*k/steps;
+            runTicksUntil(t, 1);
+            hallEdge(t, ctrl_hall_input_table[(prev + dir*k + 6) % 6], rp->lastCur);
+            rp->filled++;
+        }
+    }
+    runTicksUntil(ev->t, 1);
+    hallEdge(ev->t, ev->hall, ev->cur);
+    rp->lastEdge_us = ev->t;
+    rp->lastHall = ev->hall;
+    memcpy(rp->lastCur, ev->cur, sizeof(rp->lastCur));
+    rp->haveEdge = 1;
+    rp->edges++;
+    noteFault(rp, ev->t, ev->status);
+}
+
+static const char* commandResultName(uint8_t cmd){
+    switch(cmd){
+        case ITF_LOG_CMD_THROTTLE:      return "throttle_result";
+        case ITF_LOG_CMD_SPEED:         return "speed_result";
+        case ITF_LOG_CMD_THROTTLE_MODE: return "throttle_mode_result";
+        case ITF_LOG_CMD_AUTOTUNE:      return "autotune_result";
+        case ITF_LOG_CMD_SPEED_KP:      return "speed_kp_result";
+        case ITF_LOG_CMD_SPEED_KI:      return "speed_ki_result";
+        case ITF_LOG_CMD_PARAM:         return "param_result";
+        default:                        return "direction_result";
+    }
+}
+
+static void replayCommand(replay_t* rp, const event_t* ev){
+    uint8_t result = 0;
+    runTicksUntil(ev->t, 1);
+    vt_us = ev->t;
+    switch(ev->cmd){
+        case ITF_LOG_CMD_THROTTLE:  result = ctrl_setThrottle((uint16_t) ev->value); break;
+        case ITF_LOG_CMD_SPEED:     result = (ev->value == 0) ? ctrl_turnOffSpeedControl() : ctrl_setSpeedControl(ev->value/100.0f); break;
+        case ITF_LOG_CMD_DIRECTION: result = ctrl_setDirection((uint8_t) ev->value); break;
+        case ITF_LOG_CMD_THROTTLE_MODE: result = ctrl_setThrottleMode((uint8_t) ev->value); break;
+        case ITF_LOG_CMD_AUTOTUNE:  result = (ev->value < 0) ? ctrl_stopAutotune() : ctrl_startAutotune(ev->value/100.0f); break;
+        case ITF_LOG_CMD_SPEED_KP:  result = ctrl_setSpeedKp((uint8_t) (ev->value >> 24), (ev->value & 0xFFFFFF)/100.0f); break;
+        case ITF_LOG_CMD_SPEED_KI:  result = ctrl_setSpeedKi((uint8_t) (ev->value >> 24), (ev->value & 0xFFFFFF)/100.0f); break;
+        case ITF_LOG_CMD_PARAM:     result = ctrl_setParam((int) (ev->value >> 24), (ev->value & 0xFFFFFF)/100.0f); break;
+        default: return;
+    }
+    rp->cmds++;
+    compare(rp, &rp->cmdResult, ev->t, commandResultName(ev->cmd), ev->result, result, 0);
+}
+
+//A long record is sampled on a tick after the fault checks: its volts and temps go in before that
+//tick runs, the estimates it holds are compared after it.
+static void replayLong(replay_t* rp, const event_t* ev){
+    uint64_t tick = rp->phase_us + ((ev->t - rp->phase_us + TICK_US/2)/TICK_US)*TICK_US;
+    runTicksUntil(tick, 0);
+    ctrl_batVolt = ev->v[ITF_LOG_LONG_VOLTS]/100.0;
+    ctrl_tempA = ev->v[ITF_LOG_LONG_TEMP_A]/100.0;
+    ctrl_tempB = ev->v[ITF_LOG_LONG_TEMP_B]/100.0;
+    ctrl_tempC = ev->v[ITF_LOG_LONG_TEMP_C]/100.0;
+    if(rp->schema < 2 && (uint16_t) ev->v[ITF_LOG_LONG_THROTTLE] != (uint16_t) ctrl_getThrottle()){
+        vt_us = (tick > vt_us) ? tick : vt_us;
+        ctrl_setThrottle((uint16_t) ev->v[ITF_LOG_LONG_THROTTLE]);
+    }
+    if(nextTick_us != tick){
+        rp->unmatchedLongs++;       //Its tick already ran (an edge came in between), sensors are a tick late
+    }
+    runTicksUntil(tick, 1);
+    rp->longs++;
+
+    double speed = ctrl_getSpeed_mph();
+    if(rp->schema == 0){
+        compare(rp, &rp->speed, ev->t, "speed_mph", ev->v[ITF_LOG_LONG_SPEED]/100.0, (double) (uint8_t) speed, 0);
+    }else{
+        compare(rp, &rp->speed, ev->t, "speed_mph", ev->v[ITF_LOG_LONG_SPEED]/100.0, (int32_t) (speed*100)/100.0, rp->speedTol_mph);
+    }
+    if(rp->schema >= 2){
+        compare(rp, &rp->duty, ev->t, "duty", ev->v[ITF_LOG_LONG_DUTY], ctrl_getDutyCommand(), rp->dutyTol);
+    }
+    noteFault(rp, ev->t, ev->status);
+}
+
+static void replayEvent(replay_t* rp, const event_t* ev){
+    if(ev->t < rp->done_us){
+        rp->late++;             //Further out of order than the reorder window
+        return;
+    }
+    rp->done_us = ev->t;
+    rp->last_us = ev->t;
+    switch(ev->kind){
+        case EV_EDGE: replayEdge(rp, ev); break;
+        case EV_LONG: replayLong(rp, ev); break;
+        case EV_CMD:  replayCommand(rp, ev); break;
+    }
+}
+
+static int replayOnEvent(const event_t* ev, void* ctx){
+    replay_t* rp = (replay_t*) ctx;
+    event_t next;
+    if(!rp->started){
+        startController(ev->t, rp->haveHall ? rp->firstHall : ctrl_hall_input_table[0], rp->phase_us);
+        rp->lastHall = rp->firstHall;
+        rp->first_us = ev->t;
+        rp->started = 1;
+    }
+    heapPush(&rp->heap, ev);
+    if(ev->t > rp->newest_us){
+        rp->newest_us = ev->t;
+    }
+    while(rp->heap.count > 0 && rp->heap.ev[0].t + REORDER_US < rp->newest_us){
+        heapPop(&rp->heap, &next);
+        replayEvent(rp, &next);
+    }
+    return 1;
+}
+
+static void printDiff(const char* name, const diff_t* d, const char* unit){
+    printf("  %s: compared=%lu mismatches=%lu max_err=%.3f%s rms=%.4f%s\n", name, d->compared, d->mismatches,
+           d->maxErr, unit, d->compared ? sqrt(d->sumSq/d->compared) : 0.0, unit);
+}
+
+static int replay(char** paths, int count, int run, double speedTol, int dutyTol, int show){
+    static replay_t rp;
+    reader_t rd;
+    event_t ev;
+    memset(&rp, 0, sizeof(rp));
+    memset(&rd, 0, sizeof(rd));
+    rp.speedTol_mph = speedTol;
+    rp.dutyTol = dutyTol;
+    rp.show = show;
+    rd.run = run;
+
+    rd.fn = prescan;
+    rd.ctx = &rp;
+    if(!readInputs(&rd, paths, count)){
+        return 2;
+    }
+    if(!rp.havePhase){
+        printf("log_replay: no long records, nothing to compare\n");
+        return 2;
+    }
+    rp.schema = rd.schema;
+
+    //Logging goes to a ring nobody drains: the policy runs as on the car, the records are dropped
+    itf_initSDLogging(&host_storageRam);
+
+    int64_t start = wall_us();
+    rd.fn = replayOnEvent;
+    if(!readInputs(&rd, paths, count)){
+        return 2;
+    }
+    while(rp.heap.count > 0){
+        heapPop(&rp.heap, &ev);
+        replayEvent(&rp, &ev);
+    }
+    int64_t wall = wall_us() - start;
+    double span = (rp.last_us - rp.first_us)/1e6;
+
+    printf("log_replay schema=%d span=%.1f s edges=%lu filled_edges=%lu longs=%lu commands=%lu ticks=%lu\n",
+           rp.schema, span, rp.edges, rp.filled, rp.longs, rp.cmds, ticks);
+    printf("  late_records=%lu long_tick_late=%lu stale_blocks=%lu damaged_blocks=%lu\n",
+           rp.late, rp.unmatchedLongs, rd.staleBlocks, rd.damagedBlocks);
+    printf("  replay_s=%.2f speedup=%.0fx edges_per_s=%.0f\n", wall/1e6, span/(wall/1e6), rp.edges/(wall/1e6));
+    printDiff("speed", &rp.speed, " mph");
+    if(rp.schema >= 2){
+        printDiff("duty", &rp.duty, "");
+        printDiff("command_results", &rp.cmdResult, "");
+    }
+    printDiff("status", &rp.status, "");
+    printf("  first_fault recorded=%s@%.3f replayed=%s@%.3f\n",
+           ctrl_getErrorName(rp.recFault & 0x7F), rp.recFault ? (rp.recFault_us - rp.first_us)/1e6 : 0.0,
+           ctrl_getErrorName(rp.repFault & 0x7F), rp.repFault ? (rp.repFault_us - rp.first_us)/1e6 : 0.0);
+    int same = rp.speed.mismatches == 0 && rp.duty.mismatches == 0 && rp.status.mismatches == 0 && rp.cmdResult.mismatches == 0;
+    printf("result=%s\n", same ? "match" : "DIFF");
+    return same ? 0 : 1;
+}
+
+//---------------------------------------------------------------- Synthetic race (--synth)
+
+//Car and motor: six step, average phase voltage duty*Vbat, no regen
+#define CAR_MASS_KG 110.0
+#define CAR_CRR 0.004
+#define CAR_CDA_M2 0.12
+#define WHEEL_R_M 0.2413
+#define MOTOR_KE 0.74               //V s/rad at the wheel (hub motor)
+#define MOTOR_R_OHM 0.8
+#define BURN_CURRENT_A 22.0
+#define MPS_PER_MPH 0.44704
+
+typedef struct {
+    double v_mps;
+    double pos;                 //Commutations travelled (hall edges)
+    double current;
+    double tempA, tempB, tempC;
+    double usedAh;
+    int hallIdx;
+    double faultAt_s;
+} car_t;
+
+static double commutationsPerMeter(void){
+    //Distance per commutation: the wheel circumference over poles x phases (wheel_in and poles parameters)
+    return (46.0*3.0)/(3.141592*19.0*0.0254);
+}
+
+//Quantized to what the log keeps, so a replay sees the exact inputs the controller saw
+static double q100(double x) { return floor(x*100.0 + 0.5)/100.0; }
+
+static void carSensors(car_t* car, double t_s){
+    ctrl_batVolt = q100(50.4 - 0.06*car->current*ctrl_getDutyCommand()/4096.0 - car->usedAh*0.15);
+    ctrl_tempA = q100(car->tempA);
+    ctrl_tempB = q100(car->tempB);
+    ctrl_tempC = q100(car->tempC);
+    if(car->faultAt_s > 0 && t_s >= car->faultAt_s){
+        ctrl_tempA = 215.0;         //Sensor glitch: over the overheat threshold
+    }
+}
+
+//Phase current magnitudes (what the sensors read) for the high and low phase of the step after this edge
+static void carCurrents(const car_t* car, int32_t cur[3]){
+    uint8_t out = ctrl_output_table[(car->hallIdx + 1) % 6];
+    int32_t i = (int32_t) floor(car->current*100.0 + 0.5);
+    cur[0] = (out & 0x03) ? i : 0;
+    cur[1] = (out & 0x0C) ? i : 0;
+    cur[2] = (out & 0x30) ? i : 0;
+}
+
+//Advances the car by dt, firing a hall edge each time it crosses a commutation
+static void carStep(car_t* car, uint64_t t0, int dt_us){
+    double dt = dt_us/1e6;
+    double duty = (ctrl_isArmed() && !ctrl_isInSafetyShutdown()) ? ctrl_getDutyCommand()/4096.0 : 0.0;
+    double emf = MOTOR_KE*car->v_mps/WHEEL_R_M;
+    double i = (duty*ctrl_batVolt - emf)/MOTOR_R_OHM;
+    car->current = (i > 0) ? i : 0;
+    double force = MOTOR_KE*car->current/WHEEL_R_M - CAR_CRR*CAR_MASS_KG*9.81 - 0.5*1.2*CAR_CDA_M2*car->v_mps*car->v_mps;
+    double v0 = car->v_mps;
+    car->v_mps += force/CAR_MASS_KG*dt;
+    if(car->v_mps < 0){
+        car->v_mps = 0;
+    }
+    car->usedAh += car->current*duty*dt/3600.0;
+    car->tempA += (90.0 + car->current*car->current*0.12 - car->tempA)*dt/120.0;
+    car->tempB += (90.0 + car->current*car->current*0.11 - car->tempB)*dt/120.0;
+    car->tempC += (90.0 + car->current*car->current*0.13 - car->tempC)*dt/120.0;
+
+    double dpos = (v0 + car->v_mps)*0.5*dt*commutationsPerMeter();
+    double next = floor(car->pos) + 1;
+    while(car->pos + dpos >= next){
+        uint64_t t = t0 + (uint64_t) ((next - car->pos)/dpos*dt_us);
+        int32_t cur[3];
+        car->hallIdx = (car->hallIdx + 1) % 6;
+        carCurrents(car, cur);
+        runTicksUntil(t, 1);
+        hallEdge(t, ctrl_hall_input_table[car->hallIdx], cur);
+        next += 1;
+    }
+    car->pos += dpos;
+}
+
+//Burn and coast laps of 60 s: burn at about BURN_CURRENT_A for 20 s, then coast. Every third lap
+//holds 18 mph on speed control for 25 s instead.
+static void driver(car_t* car, double t_s, double end_s){
+    double lapT = fmod(t_s, 60.0);
+    int lap = (int) (t_s/60.0);
+    if(t_s >= end_s){
+        ctrl_setThrottle(0);
+        ctrl_setDirection(0);
+        return;
+    }
+    if(lap % 3 == 2){
+        if(lapT < 12.0){
+            lapT = 0;           //Burn up to speed first
+        }else if(lapT < 37.0){
+            ctrl_setSpeedControl(18.0f);
+            return;
+        }else{
+            ctrl_turnOffSpeedControl();
+            ctrl_setThrottle(0);
+            return;
+        }
+    }
+    if(lapT < 20.0){
+        double emf = MOTOR_KE*car->v_mps/WHEEL_R_M;
+        double duty = (emf + BURN_CURRENT_A*MOTOR_R_OHM)/ctrl_batVolt;
+        int throttle = (int) (duty*4096.0);
+        ctrl_setThrottle((uint16_t) ((throttle > 3600) ? 3600 : (throttle / 16)*16));
+    }else{
+        ctrl_setThrottle(0);
+    }
+}
+
+static void clearLogDir(const char* dir){
+    DIR* d = opendir(dir);
+    struct dirent* de;
+    char path[600];
+    if(d == NULL){
+        return;
+    }
+    while((de = readdir(d)) != NULL){
+        if((de->d_name[0] == 'S' && strstr(de->d_name, ".BIN") != NULL) || strcmp(de->d_name, "SESSIONS.CSV") == 0){
+            snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+}
+
+static int synth(const char* dir, double minutes, double faultAt_s){
+    car_t car;
+    itf_logStreamCfg_t every = { 0, 0, 0 };
+    uint64_t t, end_us = (uint64_t) (minutes*60e6), stop_us = end_us + 2000000;
+    int i;
+
+    if(!host_storageDirInit(dir)){
+        fprintf(stderr, "can't use %s\n", dir);
+        return 2;
+    }
+    clearLogDir(dir);
+    memset(&car, 0, sizeof(car));
+    car.tempA = car.tempB = car.tempC = 90.0;
+    car.faultAt_s = faultAt_s;
+
+    startController(0, ctrl_hall_input_table[0], 0);
+    itf_logPolicySetStream(ITF_LOG_STREAM_EDGE, &every);
+    itf_logPolicySetStream(ITF_LOG_STREAM_LONG, &every);
+    itf_initSDLogging(&host_storageDir);
+    xTaskCreate(itf_writeSD_task, "itf_writeSD_task", 8192, NULL, 5, NULL);
+
+    int64_t start = wall_us();
+    //Off the test presets: throttle control from zero, going forward
+    vt_us = 3000;
+    ctrl_turnOffSpeedControl();
+    ctrl_setThrottle(0);
+    ctrl_setDirection(1);
+    for(t=0;t<stop_us;t+=1000){
+        if(t % 100000 == 3000){
+            runTicksUntil(t, 1);
+            vt_us = t;
+            driver(&car, t/1e6, end_us/1e6);
+        }
+        if(t % TICK_US == 0){
+            runTicksUntil(t, 0);
+            carSensors(&car, t/1e6);
+            runTicksUntil(t, 1);
+        }
+        carStep(&car, t, 1000);
+        //Keep the ring from overflowing: the writer runs in real time
+        if(t % 100000 == 0){
+            while(itf_sdRingPending() > itf_sdRingBlockCount()/2){
+                usleep(200);
+            }
+        }
+    }
+    runTicksUntil(stop_us, 1);
+
+    itf_sdRequest(ITF_SD_REQ_CLOSE);
+    for(i=0;i<60000;i++){
+        int n = itf_sessionFileCount();
+        if(itf_sdRingPending() == 0 && host_storageOpenFiles() == 0 && n > 0 && itf_sessionFileAt(n - 1)->size > 0){
+            break;
+        }
+        usleep(1000);
+    }
+    itf_sdRingStats_t rs;
+    itf_sdRingGetStats(&rs);
+    printf("log_replay synth dir=%s minutes=%.1f ticks=%lu dropped=%lu wall_s=%.2f\n", dir, minutes, ticks,
+           (unsigned long) rs.recordsDropped, (wall_us() - start)/1e6);
+    for(i=0;i<itf_sessionFileCount();i++){
+        const itf_sessionFile_t* sf = itf_sessionFileAt(i);
+        printf("  S%04d_%02d.BIN bytes=%lu\n", sf->session, sf->part, (unsigned long) sf->size);
+    }
+    return rs.recordsDropped ? 1 : 0;
+}
+
+static void usage(void){
+    fprintf(stderr, "log_replay file... [--run n] [--speed-tol mph] [--duty-tol n] [--show n]\n"
+                    "log_replay --synth dir [--minutes m] [--fault-at s]\n");
+    exit(2);
+}
+
+int main(int argc, char** argv){
+    char* files[64];
+    int count = 0, run = 0, dutyTol = 0, show = 10, i;
+    double speedTol = 0.0, minutes = 35.0, faultAt = 0;
+    const char* synthDir = NULL;
+    for(i=1;i<argc;i++){
+        if(argv[i][0] != '-'){
+            if(count == 64) usage();
+            files[count++] = argv[i];
+        }
+        else if(i + 1 >= argc) usage();
+        else if(!strcmp(argv[i], "--run")) run = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--speed-tol")) speedTol = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--duty-tol")) dutyTol = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--show")) show = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "--synth")) synthDir = argv[++i];
+        else if(!strcmp(argv[i], "--minutes")) minutes = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--fault-at")) faultAt = atof(argv[++i]);
+        else usage();
+    }
+    if(synthDir != NULL){
+        return synth(synthDir, minutes, faultAt);
+    }
+    if(count == 0){
+        usage();
+    }
+    return replay(files, count, run, speedTol, dutyTol, show);
+}
@@ -0,0 +1,139 @@
+//Car, hub motor and battery for the host benches, see plant_sim.h.
+
+#include <math.h>
+#include <string.h>
+#include "plant_sim.h"
+
+#define PLANT_MPS_PER_MPH 0.44704
+
+//Phases driven high and low in each sector for forward torque (rows 1-5, 0 of ctrl_output_table): the hub motor's wiring
+static const int plant_secHigh[6] = {2, 2, 1, 1, 0, 0};
+static const int plant_secLow[6]  = {1, 0, 0, 2, 2, 1};
+
+//Trapezoidal back-EMF shape (+-1 on the flats) of each phase at a position in commutations: the two driven phases
+//are on their flats, the floating one ramps to where it is driven in the next sector
+static void plant_emfShape(double pos, double f[3]){
+    double s = floor(pos);
+    int sec = (((int) fmod(s, 6.0)) + 6) % 6, next = (sec + 1) % 6;
+    int fl = 3 - plant_secHigh[sec] - plant_secLow[sec];
+    f[plant_secHigh[sec]] = 1.0;
+    f[plant_secLow[sec]] = -1.0;
+    f[fl] = ((plant_secHigh[next] == fl) ? 1.0 : -1.0)*(2.0*(pos - s) - 1.0);
+}
+
+void plant_phaseEmf(const plant_t* p, double e[3]){
+    double half = 0.5*p->cfg.ke*p->v_mps/p->cfg.wheel_r_m;     //The pair's back-EMF is twice a phase's
+    int i;
+    plant_emfShape(p->pos, e);
+    for(i=0;i<3;i++){
+        e[i] *= half;
+    }
+}
+
+void plant_defaults(plant_cfg_t* cfg){
+    cfg->mass_kg = 110.0;
+    cfg->crr = 0.004;
+    cfg->cda_m2 = 0.12;
+    cfg->wheel_r_m = 0.2413;
+    cfg->ke = 0.74;
+    cfg->r_ohm = 0.8;
+    cfg->l_h = 0.0006;
+    cfg->vbat_full = 50.4;
+    cfg->rbat_ohm = 0.06;
+    cfg->sag_v_per_ah = 0.15;
+    cfg->drag_n = 0.0;
+    cfg->comPerMeter = (46.0*3.0)/(3.141592*19.0*0.0254);
+    cfg->sw_s = 100e-9;
+    cfg->gate_j = 0.72e-6;
+    cfg->qrr_c = 80e-9;
+}
+
+void plant_init(plant_t* p, const plant_cfg_t* cfg){
+    memset(p, 0, sizeof(*p));
+    if(cfg != NULL){
+        p->cfg = *cfg;
+    }else{
+        plant_defaults(&p->cfg);
+    }
+    p->vbat = p->cfg.vbat_full;
+}
+
+double plant_speed_mph(const plant_t* p){
+    return p->v_mps/PLANT_MPS_PER_MPH;
+}
+
+int plant_step(plant_t* p, double duty, double dt, double* edgeFrac){
+    const plant_cfg_t* c = &p->cfg;
+    if(duty < 0){
+        duty = 0;
+    }
+    if(duty > 1){
+        duty = 1;
+    }
+
+    //Winding current: exact first order step towards the steady state, clamped at zero (no regen)
+    p->emf = c->ke*p->v_mps/c->wheel_r_m;
+    p->kt = 1.0;
+    if(p->commModel){
+        double f[3];
+        plant_emfShape(p->pos, f);
+        p->kt = (p->hi >= 0 && p->lo >= 0 && p->hi != p->lo) ? 0.5*(f[p->hi] - f[p->lo]) : 0.0;
+    }
+    double vbatOpen = c->vbat_full - p->usedAh*c->sag_v_per_ah;
+    double vbat = vbatOpen - c->rbat_ohm*p->i_bus;
+    double iss = (duty*vbat - p->emf*p->kt)/c->r_ohm;
+    p->i_ph = iss + (p->i_ph - iss)*exp(-dt*c->r_ohm/c->l_h);
+    if(p->i_ph < 0 || (p->commModel && (p->hi < 0 || p->lo < 0))){
+        p->i_ph = 0;            //No current path with nothing driven
+    }
+    p->i_bus = p->i_ph*duty;
+    p->vbat = vbatOpen - c->rbat_ohm*p->i_bus;
+    p->usedAh += p->i_bus*dt/3600.0;
+    p->energy_j += p->i_bus*p->vbat*dt;
+    if(p->pwm_hz > 0){
+        //Each period switches the high side once; the ripple is the on time's rise, no more than twice the average
+        double ripple = p->vbat*duty*(1.0 - duty)/(c->l_h*p->pwm_hz);
+        if(ripple > 2.0*p->i_ph){
+            ripple = 2.0*p->i_ph;
+        }
+        if(duty > 0 && p->i_ph > 0){
+            p->switchLoss_j += (0.5*p->vbat*p->i_ph*c->sw_s + c->gate_j + c->qrr_c*p->vbat)*p->pwm_hz*dt;
+        }
+        p->rippleLoss_j += c->r_ohm*ripple*ripple/12.0*dt;
+        p->ripple_A = ripple;
+        if(p->i_ph + 0.5*ripple > p->peak_A){
+            p->peak_A = p->i_ph + 0.5*ripple;
+        }
+    }
+
+    //Car
+    double force = c->ke*p->kt*p->i_ph/c->wheel_r_m - p->grade_n;
+    if(p->v_mps > 0 || force > c->crr*c->mass_kg*9.81 + c->drag_n){
+        force -= c->crr*c->mass_kg*9.81 + c->drag_n + 0.5*1.2*c->cda_m2*p->v_mps*p->v_mps;
+    }else{
+        force = 0;
+    }
+    double v0 = p->v_mps;
+    p->v_mps += force/c->mass_kg*dt;
+    if(p->v_mps < 0){
+        p->v_mps = 0;
+    }
+    double dx = (v0 + p->v_mps)*0.5*dt;
+    p->dist_m += dx;
+    p->t_s += dt;
+
+    double dpos = dx*c->comPerMeter;
+    double next = floor(p->pos) + 1;
+    int edges = 0;
+    if(dpos > 0 && p->pos + dpos >= next){
+        if(edgeFrac != NULL){
+            *edgeFrac = (next - p->pos)/dpos;
+        }
+        while(p->pos + dpos >= next){
+            edges++;
+            next += 1;
+        }
+    }
+    p->pos += dpos;
+    return edges;
+}
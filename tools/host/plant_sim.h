@@ -0,0 +1,70 @@
+#ifndef PLANT_SIM_H_
+#define PLANT_SIM_H_
+
+#include <stdint.h>
+
+//Car, hub motor and battery for the host benches (ctrl_bench.c). Six step with an average phase voltage of
+//duty x battery volts, winding inductance, no regen (the body diodes block negative current), and a battery
+//with internal resistance that sags as charge is used. Positions are in commutations, so a hall edge is due
+//each time pos passes a whole number.
+//By default every sector is driven the way it should be. With commModel set, the torque and the back-EMF the winding
+//pair sees follow which phases the bench says are driven (hi/lo) against the rotor angle, with trapezoidal back-EMF,
+//so commutating early or late costs torque.
+
+typedef struct {
+    double mass_kg;
+    double crr;
+    double cda_m2;
+    double wheel_r_m;
+    double ke;                  //V s/rad at the wheel (hub motor), also N m/A
+    double r_ohm;               //Phase to phase, the two conducting phases in series
+    double l_h;
+    double vbat_full;
+    double rbat_ohm;
+    double sag_v_per_ah;
+    double drag_n;              //Constant drag at the wheel: bearings and the hub motor's no-load (iron) losses
+    double comPerMeter;         //Hall edges per meter (wheel_in and poles parameters)
+    double sw_s;                //High side rise plus fall time
+    double gate_j;              //Gate drive energy per on/off cycle
+    double qrr_c;               //Low side body diode reverse recovery charge
+} plant_cfg_t;
+
+typedef struct {
+    plant_cfg_t cfg;
+    double t_s;
+    double v_mps;
+    double pos;
+    double i_ph;                //Phase current (A)
+    double i_bus;               //Battery current (A), averaged over the PWM period
+    double vbat;
+    double emf;
+    double usedAh;
+    double energy_j;            //Taken from the battery
+    double dist_m;
+    double grade_n;             //Extra road load (N, positive uphill), for load steps
+    int hallIdx;                //Index into ctrl_hall_input_table, for the bench to keep
+    int commModel;
+    int hi, lo;                 //Phases (0-2 for A-C) driven high and low, -1 for none; commModel only
+    double kt;                  //Share of the torque constant the driven pair gets at this angle (1 when aligned)
+    double pwm_hz;              //PWM frequency, for the switching and ripple losses below (0: not counted)
+    double switchLoss_j;        //MOSFET switching, gate drive and reverse recovery
+    double rippleLoss_j;        //Copper loss of the current ripple about i_ph
+    double ripple_A;            //Ripple peak to peak at the last step
+    double peak_A;              //Largest i_ph plus half the ripple
+} plant_t;
+
+//Defaults match the --synth car in log_replay.c
+void plant_defaults(plant_cfg_t* cfg);
+void plant_init(plant_t* p, const plant_cfg_t* cfg);
+
+//Advances dt with the high side at duty (0-1). Returns the number of hall edges crossed; *edgeFrac gets the
+//fraction of dt at which the first one came (if any). Call with dt no longer than one PWM period.
+//The losses with pwm_hz set are bookkeeping only (they are small next to energy_j and don't change the car).
+int plant_step(plant_t* p, double duty, double dt, double* edgeFrac);
+
+double plant_speed_mph(const plant_t* p);
+
+//Back-EMF of each phase to the star point (A, B, C)
+void plant_phaseEmf(const plant_t* p, double e[3]);
+
+#endif
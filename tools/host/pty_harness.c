@@ -0,0 +1,370 @@
+//Runs the real comm stack (itf_com_funcs.c, itf_console.c) on Linux with UART0/UART1 backed by
+//pseudo-terminals, and plays the dashboard MCU on UART1 from a script at a set message rate.
+//Prints throughput, dropped frames and command latency as key=value lines.
+//
+//Build from the repo root:
+//  gcc -O2 -pthread -Itools/host/shim -Imain -o pty_harness tools/host/pty_harness.c
+//      tools/host/shim/host_hal.c tools/host/shim/host_sd_stub.c main/itf_com_funcs.c
+//      main/itf_console.c main/itf_log_xfer.c main/itf_crc.c main/itf_sd_ring.c main/itf_log_codec.c main/itf_log_policy.c main/ctrl_subsystem.c
+//      main/ctrl_speed_pi.c main/ctrl_autotune.c main/ctrl_params.c main/ctrl_sensorless.c main/ctrl_pwm.c main/itf_seven_seg.c main/itf_trace.c -lm
+//
+//  ./pty_harness --mode poll --rate 20 --seconds 10      request/reply (packets 0,2,3 + 4-7)
+//  ./pty_harness --mode sub --period 5 --seconds 10      telemetry subscription (packets 9/10)
+//  ./pty_harness --pc-rate 10                            also send "get all" lines on UART0
+//  ./pty_harness --serve                                 just print the PTY paths and keep running
+//Exit status is 1 if the drop percentage is above --max-drop-pct (default 100, i.e. never).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "host_hal.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "ctrl_subsystem.h"
+#include "itf_com_funcs.h"
+#include "itf_crc.h"
+#include "itf_master_defines.h"
+
+#define MAX_OUTSTANDING 256
+
+typedef struct {
+    int id;
+    int64_t sent_us;
+} outstanding_t;
+
+typedef struct {
+    uint64_t count;
+    int64_t total_us;
+    int64_t max_us;
+} latency_t;
+
+static struct {
+    const char* mode;
+    int rate;
+    int seconds;
+    int period;
+    int pcRate;
+    int timeout_ms;
+    double maxDropPct;
+} opt = { "poll", 20, 10, 5, 0, 500, 100.0 };
+
+static int mcuFd = -1;
+static int pcFd = -1;
+static volatile int running = 1;
+
+static pthread_mutex_t outLock = PTHREAD_MUTEX_INITIALIZER;
+static outstanding_t outstanding[MAX_OUTSTANDING];
+static int outHead = 0, outTail = 0;
+
+static uint64_t mcuTxBytes = 0, mcuRxBytes = 0;
+static uint64_t requests = 0, replies = 0, dropped = 0, badFrames = 0;
+static uint64_t tlmFrames = 0, tlmLate = 0, pcReplies = 0, pcRequests = 0;
+static latency_t replyLat, cmdLat, pcLat, tlmGap;
+static volatile int64_t pcSent_us = 0;
+
+static void latencyAdd(latency_t* l, int64_t us){
+    l->count++;
+    l->total_us += us;
+    if(us > l->max_us) { l->max_us = us; }
+}
+
+static void latencyPrint(const char* name, const latency_t* l){
+    printf("%s_count=%llu %s_avg_us=%lld %s_max_us=%lld\n", name, (unsigned long long) l->count,
+           name, (long long) (l->count ? l->total_us/(int64_t) l->count : 0), name, (long long) l->max_us);
+}
+
+static void sendWord(int message){
+    message = itf_addCRC(message);
+    uint8_t data[2] = { (uint8_t) (message>>8), (uint8_t) message };
+    if(write(mcuFd, data, 2) == 2){
+        mcuTxBytes += 2;
+    }
+}
+
+static void expireOutstanding(int64_t now){
+    pthread_mutex_lock(&outLock);
+    while(outTail != outHead && now - outstanding[outTail].sent_us > opt.timeout_ms*1000){
+        dropped++;
+        outTail = (outTail + 1) % MAX_OUTSTANDING;
+    }
+    pthread_mutex_unlock(&outLock);
+}
+
+//Matches a reply to the oldest outstanding request with the same packet ID
+static void matchReply(int id, int64_t now){
+    pthread_mutex_lock(&outLock);
+    int i;
+    for(i=outTail;i!=outHead;i=(i+1)%MAX_OUTSTANDING){
+        if(outstanding[i].id == id){
+            latencyAdd(&replyLat, now - outstanding[i].sent_us);
+            replies++;
+            //Anything older than the match never got an answer
+            while(outTail != i){
+                dropped++;
+                outTail = (outTail + 1) % MAX_OUTSTANDING;
+            }
+            outTail = (outTail + 1) % MAX_OUTSTANDING;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&outLock);
+}
+
+//Reads everything the controller sends on UART1
+static void* mcuReader(void* arg){
+    uint8_t buf[256];
+    uint8_t word[2];
+    int have = 0;
+    int frameWordsLeft = 0;
+    int64_t lastFrame_us = 0;
+    int sub = (strcmp(opt.mode, "sub") == 0);
+
+    while(running){
+        struct pollfd pfd = { mcuFd, POLLIN, 0 };
+        if(poll(&pfd, 1, 50) <= 0){
+            continue;
+        }
+        ssize_t n = read(mcuFd, buf, sizeof(buf));
+        if(n <= 0){
+            continue;
+        }
+        mcuRxBytes += (uint64_t) n;
+        int64_t now = host_monotonic_us();
+        int i;
+        for(i=0;i<n;i++){
+            word[have++] = buf[i];
+            if(have < 2){
+                continue;
+            }
+            have = 0;
+            int message = (word[0]<<8) | word[1];
+            if(itf_checkCRC(message) == -1){
+                badFrames++;
+                continue;
+            }
+            if(!sub){
+                matchReply(message>>12, now);
+            }else if(frameWordsLeft > 0){
+                frameWordsLeft--;
+            }else if((message>>12) == 11){
+                int mask = (message>>4) & 0xFF;
+                frameWordsLeft = __builtin_popcount(mask);
+                tlmFrames++;
+                if(lastFrame_us != 0){
+                    int64_t gap = now - lastFrame_us;
+                    latencyAdd(&tlmGap, gap);
+                    //Frames only go out on change, but never less often than the refresh interval
+                    if(gap > (ITF_TLM_REFRESH_PERIODS+1)*opt.period*10000) { tlmLate++; }
+                }
+                lastFrame_us = now;
+            }else{
+                badFrames++;
+            }
+        }
+    }
+    return NULL;
+}
+
+//Reads console replies on UART0 and times them against the last "get all"
+static void* pcReader(void* arg){
+    char line[1024];
+    int len = 0;
+    while(running){
+        struct pollfd pfd = { pcFd, POLLIN, 0 };
+        char c;
+        if(poll(&pfd, 1, 50) <= 0 || read(pcFd, &c, 1) != 1){
+            continue;
+        }
+        if(c == '\n'){
+            line[len] = '\0';
+            if(strncmp(line, "cmd=get", 7) == 0 && pcSent_us != 0){
+                latencyAdd(&pcLat, host_monotonic_us() - pcSent_us);
+                pcReplies++;
+                pcSent_us = 0;
+            }
+            len = 0;
+        }else if(len < (int) sizeof(line) - 1){
+            line[len++] = c;
+        }
+    }
+    return NULL;
+}
+
+//Waits (up to the timeout) for a set command to show up through the ctrl getters
+static void timeCommand(double (*get)(void), double want, int64_t sent_us){
+    while(host_monotonic_us() - sent_us < opt.timeout_ms*1000){
+        if(get() == want){
+            latencyAdd(&cmdLat, host_monotonic_us() - sent_us);
+            return;
+        }
+        usleep(200);
+    }
+    dropped++;
+}
+
+static double getDirection(void) { return ctrl_getDirection(); }
+
+static void runPollScript(int64_t end_us){
+    //Dashboard script: throttle, speed unlock, direction, then the four telemetry requests
+    static const int script[] = { 0x0000, 0x2000, 0x3010, 0x5000, 0x6000, 0x7000, 0x4000 };
+    int step = 0;
+    int throttle = 0;
+    int64_t interval = 1000000/opt.rate;
+    int64_t next = host_monotonic_us();
+
+    while(host_monotonic_us() < end_us){
+        int message = script[step % (int)(sizeof(script)/sizeof(script[0]))];
+        int id = message>>12;
+        int64_t now = host_monotonic_us();
+        if(id == 0){
+            throttle = (throttle + 16) & 0xFF;
+            message |= throttle<<4;
+        }
+        if(id >= 4 && id <= 7){
+            pthread_mutex_lock(&outLock);
+            if((outHead + 1) % MAX_OUTSTANDING != outTail){
+                outstanding[outHead].id = id;
+                outstanding[outHead].sent_us = now;
+                outHead = (outHead + 1) % MAX_OUTSTANDING;
+            }
+            pthread_mutex_unlock(&outLock);
+        }
+        requests++;
+        sendWord(message);
+        if(id == 0){
+            timeCommand(ctrl_getThrottle, (double) (throttle*16), now);
+        }else if(id == 3){
+            timeCommand(getDirection, 1.0, now);
+        }
+        step++;
+        expireOutstanding(host_monotonic_us());
+
+        next += interval;
+        int64_t wait = next - host_monotonic_us();
+        if(wait > 0) { usleep((useconds_t) wait); }
+    }
+}
+
+static void runSubScript(int64_t end_us){
+    int throttle = 0;
+    sendWord(0x2000);                       //unlock speed
+    sendWord(0xA000 | (opt.period<<4));     //push period
+    sendWord(0x9FF0);                       //subscribe to every field
+    requests += 3;
+    //Keep moving the throttle so there is always something to push
+    while(host_monotonic_us() < end_us){
+        throttle = (throttle + 16) & 0xFF;
+        int64_t now = host_monotonic_us();
+        sendWord(0x0000 | (throttle<<4));
+        requests++;
+        timeCommand(ctrl_getThrottle, (double) (throttle*16), now);
+        usleep((useconds_t) (1000000/opt.rate));
+    }
+    sendWord(0x9000);                       //unsubscribe
+}
+
+static void* pcWriter(void* arg){
+    int64_t interval = 1000000/opt.pcRate;
+    while(running){
+        if(pcSent_us == 0){
+            pcSent_us = host_monotonic_us();
+            if(write(pcFd, "get all\r", 8) == 8) { pcRequests++; }
+        }
+        usleep((useconds_t) interval);
+    }
+    return NULL;
+}
+
+static int openPeer(const char* path){
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if(fd < 0){
+        perror(path);
+        exit(2);
+    }
+    return fd;
+}
+
+int main(int argc, char** argv){
+    int serve = 0;
+    int i;
+    for(i=1;i<argc;i++){
+        if(strcmp(argv[i],"--mode") == 0 && i+1 < argc)              { opt.mode = argv[++i]; }
+        else if(strcmp(argv[i],"--rate") == 0 && i+1 < argc)         { opt.rate = atoi(argv[++i]); }
+        else if(strcmp(argv[i],"--seconds") == 0 && i+1 < argc)      { opt.seconds = atoi(argv[++i]); }
+        else if(strcmp(argv[i],"--period") == 0 && i+1 < argc)       { opt.period = atoi(argv[++i]); }
+        else if(strcmp(argv[i],"--pc-rate") == 0 && i+1 < argc)      { opt.pcRate = atoi(argv[++i]); }
+        else if(strcmp(argv[i],"--timeout-ms") == 0 && i+1 < argc)   { opt.timeout_ms = atoi(argv[++i]); }
+        else if(strcmp(argv[i],"--max-drop-pct") == 0 && i+1 < argc) { opt.maxDropPct = atof(argv[++i]); }
+        else if(strcmp(argv[i],"--serve") == 0)                      { serve = 1; }
+        else if(strcmp(argv[i],"-v") == 0)                           { host_logLevel = 2; }
+        else { fprintf(stderr, "unknown option %s\n", argv[i]); return 2; }
+    }
+    if(opt.rate < 1 || opt.period < 1 || opt.period > 255){
+        fprintf(stderr, "bad --rate/--period\n");
+        return 2;
+    }
+
+    const char* pcPath = host_uartOpenPty(UART_NUM_0);
+    const char* mcuPath = host_uartOpenPty(UART_NUM_1);
+    printf("pc_pty=%s mcu_pty=%s\n", pcPath, mcuPath);
+    fflush(stdout);
+
+    xTaskCreate(PCComTask, "PCTask", 1024*20, NULL, configMAX_PRIORITIES-1, NULL);
+    xTaskCreate(MCUComTask, "MCUTask", 1024*20, NULL, configMAX_PRIORITIES-1, NULL);
+    xTaskCreate(MCUTelemetryTask, "TlmTask", 1024*4, NULL, configMAX_PRIORITIES-1, NULL);
+    if(serve){
+        while(1) { pause(); }
+    }
+
+    mcuFd = openPeer(mcuPath);
+    pcFd = openPeer(pcPath);
+    pthread_t mcuRx, pcRx, pcTx;
+    pthread_create(&mcuRx, NULL, mcuReader, NULL);
+    pthread_create(&pcRx, NULL, pcReader, NULL);
+    if(opt.pcRate > 0){
+        pthread_create(&pcTx, NULL, pcWriter, NULL);
+    }
+
+    int64_t start = host_monotonic_us();
+    int64_t end = start + ((int64_t) opt.seconds)*1000000;
+    if(strcmp(opt.mode, "sub") == 0){
+        runSubScript(end);
+    }else{
+        runPollScript(end);
+    }
+    usleep((useconds_t) opt.timeout_ms*1000);
+    expireOutstanding(host_monotonic_us() + ((int64_t) opt.timeout_ms)*1000 + 1);
+    running = 0;
+    pthread_join(mcuRx, NULL);
+    pthread_join(pcRx, NULL);
+    if(opt.pcRate > 0){
+        pthread_join(pcTx, NULL);
+    }
+
+    double elapsed = (host_monotonic_us() - start)/1e6;
+    uint64_t expected = replies + cmdLat.count + dropped;
+    double dropPct = expected ? (100.0*dropped)/expected : 0.0;
+    printf("mode=%s rate=%d seconds=%.2f\n", opt.mode, opt.rate, elapsed);
+    printf("mcu_tx_bytes=%llu mcu_rx_bytes=%llu mcu_rx_Bps=%.1f mcu_tx_Bps=%.1f\n",
+           (unsigned long long) mcuTxBytes, (unsigned long long) mcuRxBytes, mcuRxBytes/elapsed, mcuTxBytes/elapsed);
+    printf("requests=%llu replies=%llu dropped=%llu drop_pct=%.2f bad_frames=%llu\n",
+           (unsigned long long) requests, (unsigned long long) replies, (unsigned long long) dropped, dropPct,
+           (unsigned long long) badFrames);
+    printf("tlm_frames=%llu tlm_late=%llu pc_requests=%llu pc_replies=%llu\n", (unsigned long long) tlmFrames,
+           (unsigned long long) tlmLate, (unsigned long long) pcRequests, (unsigned long long) pcReplies);
+    latencyPrint("reply_latency", &replyLat);
+    latencyPrint("cmd_latency", &cmdLat);
+    latencyPrint("pc_latency", &pcLat);
+    latencyPrint("tlm_gap", &tlmGap);
+    printf("fw_mcu_frames=%lu fw_mcu_crc_errors=%lu fw_tlm_frames=%lu fw_pc_lines=%lu fw_pc_errors=%lu\n",
+           (unsigned long) itf_comStats.mcuFrames, (unsigned long) itf_comStats.mcuCrcErrors,
+           (unsigned long) itf_comStats.tlmFrames, (unsigned long) itf_comStats.pcLines, (unsigned long) itf_comStats.pcErrors);
+    return (dropPct > opt.maxDropPct) ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+//Hammers the SD log ring (main/itf_sd_ring.c) from several producer threads while one writer
+//thread drains it, the same way the hall ISR, control task and itf_writeSD_task share it on target.
+//Every record carries its thread, sequence number and a checksum, and the writer re-parses each
+//block, so any torn, overlapping or reordered record is reported. Dropped records must show up
+//as gaps that add up exactly to the ring's drop counter.
+//
+//Build from the repo root:
+//  gcc -O2 -pthread -Itools/host/shim -Imain -o sd_ring_stress tools/host/sd_ring_stress.c
+//      main/itf_sd_ring.c tools/host/shim/host_hal.c
+//
+//  ./sd_ring_stress --threads 4 --records 200000     producers flat out (mostly a torn-record test)
+//  ./sd_ring_stress --rate 20000                     each producer paced to 20k records/s
+//  ./sd_ring_stress --rate 20000 --write-us 30000    slow card: 30 ms per block, expect drops
+//Exit status is nonzero if any record is corrupt or the counts don't add up.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "host_hal.h"
+#include "itf_sd_ring.h"
+
+#define MAX_THREADS 16
+#define BLOCK_SIZE (16*1024)
+#define REC_MIN 8
+#define REC_MAX 32
+
+//Record: len, thread, seq (4 bytes LE), filler, checksum of everything before it
+static uint8_t pool[8][BLOCK_SIZE];
+static int blocks = 4;
+static int threads = 4;
+static long recordsPerThread = 200000;
+static int writeUs = 0;
+static int rate = 0;
+static volatile int producersDone = 0;
+
+static uint32_t pushed[MAX_THREADS];
+static uint32_t dropped[MAX_THREADS];
+static uint32_t received[MAX_THREADS];
+static uint32_t nextSeq[MAX_THREADS];
+static uint32_t gaps = 0;
+static uint32_t corrupt = 0;
+static uint64_t bytesOut = 0;
+static int maxPending = 0;
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+static void* producer(void* arg){
+    int id = (int) (intptr_t) arg;
+    uint8_t rec[REC_MAX];
+    uint32_t seed = 0x1234567u*(id + 1);
+    uint32_t seq;
+    double start = nowSec();
+    for(seq=0;seq<recordsPerThread;seq++){
+        if(rate > 0 && (seq & 63) == 0){
+            double ahead = start + (double) seq/rate - nowSec();
+            if(ahead > 0){
+                usleep((useconds_t) (ahead*1e6));
+            }
+        }
+        seed = seed*1103515245u + 12345u;
+        int len = REC_MIN + (seed>>16)%(REC_MAX - REC_MIN + 1);
+        int i;
+        uint8_t sum = 0;
+        rec[0] = len;
+        rec[1] = id;
+        rec[2] = seq; rec[3] = seq>>8; rec[4] = seq>>16; rec[5] = seq>>24;
+        for(i=6;i<len-1;i++){
+            rec[i] = (uint8_t) (seq*7 + i);
+        }
+        for(i=0;i<len-1;i++){
+            sum += rec[i];
+        }
+        rec[len-1] = sum;
+        if(itf_sdRingPush(rec,len)){
+            pushed[id]++;
+        }else{
+            dropped[id]++;
+        }
+    }
+    return NULL;
+}
+
+static void checkBlock(const uint8_t* b, int len){
+    int pos = 0;
+    while(pos < len){
+        int rlen = b[pos];
+        if(rlen < REC_MIN || rlen > REC_MAX || pos + rlen > len){
+            corrupt++;
+            return;
+        }
+        const uint8_t* r = b + pos;
+        uint8_t sum = 0;
+        int i;
+        for(i=0;i<rlen-1;i++){
+            sum += r[i];
+        }
+        int id = r[1];
+        uint32_t seq = r[2] | (r[3]<<8) | (r[4]<<16) | ((uint32_t) r[5]<<24);
+        if(sum != r[rlen-1] || id >= threads || seq < nextSeq[id]){
+            corrupt++;
+        }else{
+            gaps += seq - nextSeq[id];
+            nextSeq[id] = seq + 1;
+            received[id]++;
+        }
+        pos += rlen;
+    }
+}
+
+static void* writer(void* arg){
+    (void) arg;
+    while(1){
+        int done = producersDone;
+        int len;
+        uint8_t* b;
+        int pending = itf_sdRingPending();
+        if(pending > maxPending){
+            maxPending = pending;
+        }
+        while((b = itf_sdRingPeek(&len)) != NULL){
+            checkBlock(b,len);
+            bytesOut += len;
+            if(writeUs > 0){
+                usleep(writeUs);
+            }
+            itf_sdRingRelease();
+        }
+        if(done){
+            itf_sdRingFlush();
+            if(itf_sdRingPending() == 0){
+                break;
+            }
+        }else{
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv){
+    int i;
+    for(i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--threads") && i+1 < argc) threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--records") && i+1 < argc) recordsPerThread = atol(argv[++i]);
+        else if(!strcmp(argv[i],"--blocks") && i+1 < argc) blocks = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--write-us") && i+1 < argc) writeUs = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--rate") && i+1 < argc) rate = atoi(argv[++i]);
+        else{
+            fprintf(stderr,"usage: %s [--threads N] [--records N] [--rate N] [--blocks N] [--write-us N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if(threads < 1 || threads > MAX_THREADS || blocks < 2 || blocks > 8){
+        fprintf(stderr,"threads 1-%d, blocks 2-8\n", MAX_THREADS);
+        return 2;
+    }
+    itf_sdRingInit(&pool[0][0], BLOCK_SIZE, blocks);
+
+    pthread_t w, p[MAX_THREADS];
+    double t0 = nowSec();
+    pthread_create(&w, NULL, writer, NULL);
+    for(i=0;i<threads;i++){
+        pthread_create(&p[i], NULL, producer, (void*) (intptr_t) i);
+    }
+    for(i=0;i<threads;i++){
+        pthread_join(p[i], NULL);
+    }
+    producersDone = 1;
+    pthread_join(w, NULL);
+    double secs = nowSec() - t0;
+
+    uint32_t totPushed = 0, totDropped = 0, totReceived = 0;
+    for(i=0;i<threads;i++){
+        totPushed += pushed[i];
+        totDropped += dropped[i];
+        totReceived += received[i];
+        //Records dropped after a thread's last delivered record never show up as a gap
+        gaps += recordsPerThread - nextSeq[i];
+    }
+    itf_sdRingStats_t st;
+    itf_sdRingGetStats(&st);
+
+    int bad = corrupt != 0 || totReceived != totPushed || gaps != totDropped || st.recordsDropped != totDropped
+              || st.recordsPushed != totPushed || st.blocksWritten != st.blocksFilled;
+    printf("threads=%d rate=%d blocks=%d write_us=%d records=%lu\n", threads, rate, blocks, writeUs, (unsigned long) threads*recordsPerThread);
+    printf("pushed=%lu received=%lu dropped=%lu gaps=%lu corrupt=%lu\n", (unsigned long) totPushed, (unsigned long) totReceived,
+           (unsigned long) totDropped, (unsigned long) gaps, (unsigned long) corrupt);
+    printf("ring_drops=%lu ring_drop_bytes=%lu blocks=%lu written=%lu pending_max=%lu\n", (unsigned long) st.recordsDropped,
+           (unsigned long) st.bytesDropped, (unsigned long) st.blocksFilled, (unsigned long) st.blocksWritten,
+           (unsigned long) st.pendingHighWater);
+    printf("seconds=%.3f records_per_s=%.0f MBps=%.2f result=%s\n", secs, totPushed/secs, bytesOut/secs/1e6, bad ? "FAIL" : "ok");
+    return bad;
+}
@@ -0,0 +1,130 @@
+//Feeds the SD log ring at a steady hall-edge logging rate while the "card" (a latency-injecting
+//write function handed to itf_sdRingDrain, through a bounce block like the PSRAM build uses)
+//stalls once for --stall-ms. Shows how deep the ring has to be to ride out card garbage
+//collection pauses without losing records.
+//
+//Build from the repo root:
+//  gcc -O2 -pthread -Itools/host/shim -Imain -o sd_stall_test tools/host/sd_stall_test.c
+//      main/itf_sd_ring.c tools/host/shim/host_hal.c
+//
+//  ./sd_stall_test                          internal ring (ITF_SD_RING_BLOCKS), then PSRAM depth
+//  ./sd_stall_test --blocks 16 --stall-ms 500
+//Without --blocks the exit status is nonzero if the PSRAM depth dropped anything.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "host_hal.h"
+#include "esp_timer.h"
+#include "itf_sd_ring.h"
+#include "itf_master_defines.h"
+
+static int rate = 6000;             //Records per second (hall edges plus the 10 Hz long records)
+static int recordLen = 16;
+static int writeUs = 3000;          //Normal time to write one block
+static int stallMs = 2000;
+static int stallAtMs = 1000;
+static int runMs = 5000;
+
+static int64_t startUs;
+static volatile int producing;
+static int stalled;
+
+static int64_t nowUs(void){
+    return esp_timer_get_time() - startUs;
+}
+
+static int slowCard(uint8_t* data, int len){
+    (void) data; (void) len;
+    if(!stalled && nowUs() >= stallAtMs*1000LL){
+        stalled = 1;
+        usleep(stallMs*1000);
+    }
+    usleep(writeUs);
+    return 1;
+}
+
+static void* producer(void* arg){
+    (void) arg;
+    uint8_t rec[64];
+    long n = 0;
+    memset(rec, 0xA5, sizeof(rec));
+    while(nowUs() < runMs*1000LL){
+        long due = (long) (nowUs()*rate/1000000);
+        while(n < due){
+            itf_sdRingPush(rec, recordLen);
+            n++;
+        }
+        usleep(1000);
+    }
+    producing = 0;
+    return NULL;
+}
+
+static int runOne(int blocks){
+    uint8_t* pool = malloc((size_t) blocks*ITF_SD_BLOCK_SIZE);
+    uint8_t* bounce = malloc(ITF_SD_BLOCK_SIZE);
+    pthread_t p;
+    itf_sdRingStats_t st;
+
+    itf_sdRingInit(pool, ITF_SD_BLOCK_SIZE, blocks);
+    stalled = 0;
+    producing = 1;
+    startUs = esp_timer_get_time();
+    pthread_create(&p, NULL, producer, NULL);
+    while(producing){
+        itf_sdRingDrain(slowCard, bounce);
+        usleep(10000);
+    }
+    pthread_join(p, NULL);
+    itf_sdRingFlush();
+    itf_sdRingDrain(slowCard, bounce);
+    itf_sdRingGetStats(&st);
+
+    double bytesPerSec = (double) rate*recordLen;
+    printf("blocks=%d ring_kb=%d rate=%d rec_bytes=%d stall_ms=%d\n", blocks, blocks*ITF_SD_BLOCK_SIZE/1024, rate, recordLen, stallMs);
+    printf("  records=%lu dropped=%lu drop_bytes=%lu pending_max=%lu\n", (unsigned long) st.recordsPushed,
+           (unsigned long) st.recordsDropped, (unsigned long) st.bytesDropped, (unsigned long) st.pendingHighWater);
+    printf("  wait_max_ms=%lld stall_survived_ms=%lld capacity_ms=%.0f\n", (long long) (st.waitMax_us/1000),
+           (long long) (st.waitMaxNoLoss_us/1000), (blocks - 1)*ITF_SD_BLOCK_SIZE/bytesPerSec*1000.0);
+    free(pool);
+    free(bounce);
+    return st.recordsDropped != 0;
+}
+
+int main(int argc, char** argv){
+    int blocks = 0;
+    int i;
+    for(i=1;i<argc;i++){
+        if(!strcmp(argv[i],"--blocks") && i+1 < argc) blocks = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--rate") && i+1 < argc) rate = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--record") && i+1 < argc) recordLen = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--write-us") && i+1 < argc) writeUs = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--stall-ms") && i+1 < argc) stallMs = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--stall-at-ms") && i+1 < argc) stallAtMs = atoi(argv[++i]);
+        else if(!strcmp(argv[i],"--run-ms") && i+1 < argc) runMs = atoi(argv[++i]);
+        else{
+            fprintf(stderr,"usage: %s [--blocks N] [--rate N] [--record N] [--write-us N] [--stall-ms N] [--stall-at-ms N] [--run-ms N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if(recordLen < 1 || recordLen > 64 || blocks < 0 || blocks > ITF_SD_RING_MAX_BLOCKS){
+        fprintf(stderr,"record 1-64 bytes, blocks up to %d\n", ITF_SD_RING_MAX_BLOCKS);
+        return 2;
+    }
+    if(runMs < stallAtMs + stallMs + 500){
+        runMs = stallAtMs + stallMs + 500;
+    }
+    if(blocks > 0){
+        runOne(blocks);
+        return 0;
+    }
+    runOne(ITF_SD_RING_BLOCKS);
+    int bad = runOne(ITF_SD_PSRAM_RING_BLOCKS);
+    printf("result=%s\n", bad ? "FAIL" : "ok");
+    return bad;
+}
@@ -0,0 +1,4 @@
+#ifndef HOST_ESP_ATTR_H_
+#define HOST_ESP_ATTR_H_
+#include "host_hal.h"
+#endif
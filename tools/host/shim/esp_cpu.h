@@ -0,0 +1,14 @@
+#ifndef HOST_ESP_CPU_H_
+#define HOST_ESP_CPU_H_
+#include <time.h>
+#include "host_hal.h"
+
+//No cycle counter to share between threads on the host: nanoseconds stand in for cycles
+typedef uint32_t esp_cpu_cycle_count_t;
+static inline esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (esp_cpu_cycle_count_t) ((uint64_t) ts.tv_sec*1000000000ull + ts.tv_nsec);
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef HOST_ESP_HEAP_CAPS_H_
+#define HOST_ESP_HEAP_CAPS_H_
+#include <stdlib.h>
+
+//One heap on the host; the capability bits are accepted and ignored
+#define MALLOC_CAP_DMA    (1<<3)
+#define MALLOC_CAP_SPIRAM (1<<10)
+#define MALLOC_CAP_8BIT   (1<<2)
+
+#define heap_caps_malloc(size, caps)     ((void) (caps), malloc(size))
+#define heap_caps_calloc(n, size, caps)  ((void) (caps), calloc(n, size))
+#define heap_caps_free(ptr)              free(ptr)
+
+#endif
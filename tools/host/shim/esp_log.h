@@ -0,0 +1,14 @@
+#ifndef HOST_ESP_LOG_H_
+#define HOST_ESP_LOG_H_
+#include "host_hal.h"
+
+typedef enum { ESP_LOG_NONE, ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO, ESP_LOG_DEBUG, ESP_LOG_VERBOSE } esp_log_level_t;
+
+#define ESP_LOGE(tag, fmt, ...) host_log(0, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) host_log(1, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) host_log(2, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) host_log(3, tag, fmt, ##__VA_ARGS__)
+#define ESP_LOG_BUFFER_HEXDUMP(tag, buf, len, level) do { (void)(tag); (void)(buf); (void)(len); (void)(level); } while(0)
+uint32_t esp_log_timestamp(void);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef HOST_ESP_TIMER_H_
+#define HOST_ESP_TIMER_H_
+#include "host_hal.h"
+
+typedef struct host_timer* esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef struct {
+    esp_timer_cb_t callback;
+    void* arg;
+    int dispatch_method;
+    const char* name;
+    bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+int64_t esp_timer_get_time(void);
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us);
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+//Host only: run a created timer's callback by hand (when the tool drives time itself). A one shot stops running.
+void host_timerFire(esp_timer_handle_t timer);
+//Host only: esp_timer_get_time() at which a started one shot is due, -1 if none is
+int64_t host_timerDue(esp_timer_handle_t timer);
+//Host only: set before starting timers to have no timer threads at all (only host_timerFire)
+extern int host_timerManual;
+
+#endif
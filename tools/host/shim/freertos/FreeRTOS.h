@@ -0,0 +1,37 @@
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+#include "host_hal.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  1
+#define pdFAIL  0
+#define portMAX_DELAY ((TickType_t) 0xFFFFFFFF)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+#define configMAX_PRIORITIES 25
+#define portYIELD_FROM_ISR(x) ((void)(x))
+#define tskNO_AFFINITY (-1)
+
+//Critical sections are one process-wide recursive mutex, like the single spinlock most callers use
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+void host_criticalEnter(void);
+void host_criticalExit(void);
+#define portENTER_CRITICAL(mux)      ((void) (mux), host_criticalEnter())
+#define portEXIT_CRITICAL(mux)       ((void) (mux), host_criticalExit())
+#define portENTER_CRITICAL_ISR(mux)  ((void) (mux), host_criticalEnter())
+#define portEXIT_CRITICAL_ISR(mux)   ((void) (mux), host_criticalExit())
+#define portENTER_CRITICAL_SAFE(mux) ((void) (mux), host_criticalEnter())
+#define portEXIT_CRITICAL_SAFE(mux)  ((void) (mux), host_criticalExit())
+#define taskENTER_CRITICAL(mux)      ((void) (mux), host_criticalEnter())
+#define taskEXIT_CRITICAL(mux)       ((void) (mux), host_criticalExit())
+BaseType_t xPortInIsrContext(void);
+void host_setIsrContext(int inIsr);             //Mark the calling thread as "in an ISR"
+
+#endif
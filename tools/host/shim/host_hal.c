@@ -0,0 +1,650 @@
+//Host (Linux) implementation of the ESP-IDF/FreeRTOS calls listed in host_hal.h and the shim headers.
+//Good enough to run the firmware tasks unmodified; it makes no attempt at priorities or core pinning.
+
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "host_hal.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+
+//******************************* Errors, logging, time
+const char* esp_err_to_name(esp_err_t err){
+    switch(err){
+        case ESP_OK:                return "ESP_OK";
+        case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        default:                    return "ESP_FAIL";
+    }
+}
+
+int host_logLevel = 0;
+
+void host_log(int level, const char* tag, const char* fmt, ...){
+    static const char levels[] = "EWIDV";
+    va_list args;
+    if(level > host_logLevel){
+        return;
+    }
+    va_start(args, fmt);
+    fprintf(stderr, "%c (%u) %s: ", levels[level], (unsigned) esp_log_timestamp(), tag);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+int64_t host_monotonic_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((int64_t) ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+int64_t (*host_timeSource_us)(void) = host_monotonic_us;
+
+int64_t esp_timer_get_time(void)       { return host_timeSource_us(); }
+uint32_t esp_log_timestamp(void)        { return (uint32_t) (host_timeSource_us()/1000); }
+TickType_t xTaskGetTickCount(void)      { return (TickType_t) (host_monotonic_us()/1000); }
+TickType_t xTaskGetTickCountFromISR(void) { return xTaskGetTickCount(); }
+
+static void host_sleep_us(int64_t us){
+    struct timespec ts;
+    if(us <= 0){
+        return;
+    }
+    ts.tv_sec = us/1000000;
+    ts.tv_nsec = (us%1000000)*1000;
+    while(nanosleep(&ts, &ts) != 0 && errno == EINTR) { }
+}
+
+//******************************* Critical sections
+static pthread_mutex_t host_critical;
+static pthread_once_t host_criticalOnce = PTHREAD_ONCE_INIT;
+static __thread int host_inIsr = 0;
+
+static void host_criticalInit(void){
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&host_critical, &attr);
+}
+
+void host_criticalEnter(void){
+    pthread_once(&host_criticalOnce, host_criticalInit);
+    pthread_mutex_lock(&host_critical);
+}
+
+void host_criticalExit(void){
+    pthread_mutex_unlock(&host_critical);
+}
+
+BaseType_t xPortInIsrContext(void)  { return host_inIsr; }
+void host_setIsrContext(int inIsr)  { host_inIsr = inIsr; }
+
+//******************************* Tasks and notifications
+struct host_task {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_cond_t idle;            //Signalled when the task blocks with nothing to do (host_taskWaitIdle)
+    uint32_t notifyValue;
+    int notifyPending;
+    int waiting;
+    TaskFunction_t fn;
+    void* arg;
+    const char* name;
+};
+
+static __thread struct host_task* host_currentTask = NULL;
+
+static struct host_task* host_taskAlloc(const char* name){
+    struct host_task* t = (struct host_task*) calloc(1, sizeof(*t));
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, &attr);
+    pthread_cond_init(&t->idle, NULL);
+    t->name = name;
+    return t;
+}
+
+static void* host_taskEntry(void* p){
+    struct host_task* t = (struct host_task*) p;
+    host_currentTask = t;
+    t->fn(t->arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* arg, UBaseType_t prio, TaskHandle_t* out){
+    struct host_task* t = host_taskAlloc(name);
+    t->fn = fn;
+    t->arg = arg;
+    if(out != NULL){
+        *out = t;
+    }
+    if(pthread_create(&t->thread, NULL, host_taskEntry, t) != 0){
+        return pdFAIL;
+    }
+    pthread_detach(t->thread);
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* arg, UBaseType_t prio, TaskHandle_t* out, BaseType_t core){
+    return xTaskCreate(fn, name, stack, arg, prio, out);
+}
+
+void vTaskDelete(TaskHandle_t task){
+    if(task == NULL || task == host_currentTask){
+        pthread_exit(NULL);
+    }
+    pthread_cancel(task->thread);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void){
+    if(host_currentTask == NULL){
+        host_currentTask = host_taskAlloc("host");
+        host_currentTask->thread = pthread_self();
+    }
+    return host_currentTask;
+}
+
+void vTaskDelay(TickType_t ticks){
+    host_sleep_us(((int64_t) ticks)*1000*portTICK_PERIOD_MS);
+}
+
+void vTaskDelayUntil(TickType_t* previousWake, TickType_t increment){
+    *previousWake += increment;
+    int32_t wait = (int32_t) (*previousWake - xTaskGetTickCount());
+    if(wait > 0){
+        vTaskDelay((TickType_t) wait);
+    }
+}
+
+//Waits on the task's own condition until it has a notification (byValue: a non-zero count,
+//otherwise any pending notification). Returns 0 on timeout.
+static int host_notifyWait(struct host_task* t, TickType_t ticks, int byValue){
+    struct timespec deadline;
+    if(ticks != portMAX_DELAY){
+        int64_t until = host_monotonic_us() + ((int64_t) ticks)*1000;
+        deadline.tv_sec = until/1000000;
+        deadline.tv_nsec = (until%1000000)*1000;
+    }
+    while(byValue ? (t->notifyValue == 0) : !t->notifyPending){
+        int timedOut = 0;
+        t->waiting = 1;
+        pthread_cond_broadcast(&t->idle);
+        if(ticks == portMAX_DELAY){
+            pthread_cond_wait(&t->cond, &t->lock);
+        }else{
+            timedOut = (pthread_cond_timedwait(&t->cond, &t->lock, &deadline) == ETIMEDOUT);
+        }
+        t->waiting = 0;
+        if(timedOut){
+            return byValue ? (t->notifyValue != 0) : t->notifyPending;
+        }
+    }
+    return 1;
+}
+
+void host_taskWaitIdle(TaskHandle_t task){
+    pthread_mutex_lock(&task->lock);
+    while(!task->waiting || task->notifyValue != 0 || task->notifyPending){
+        pthread_cond_wait(&task->idle, &task->lock);
+    }
+    pthread_mutex_unlock(&task->lock);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticks){
+    struct host_task* t = xTaskGetCurrentTaskHandle();
+    uint32_t value;
+    pthread_mutex_lock(&t->lock);
+    host_notifyWait(t, ticks, 1);
+    value = t->notifyValue;
+    if(value > 0){
+        t->notifyValue = clearOnExit ? 0 : value - 1;
+    }
+    t->notifyPending = 0;
+    pthread_mutex_unlock(&t->lock);
+    return value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action){
+    pthread_mutex_lock(&task->lock);
+    switch(action){
+        case eSetBits:                  task->notifyValue |= value; break;
+        case eIncrement:                task->notifyValue++; break;
+        case eSetValueWithOverwrite:    task->notifyValue = value; break;
+        case eSetValueWithoutOverwrite: if(!task->notifyPending) { task->notifyValue = value; } break;
+        default: break;
+    }
+    task->notifyPending = 1;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)    { return xTaskNotify(task, 0, eIncrement); }
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* woken){
+    xTaskNotify(task, 0, eIncrement);
+    if(woken != NULL) { *woken = pdTRUE; }
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t* woken){
+    if(woken != NULL) { *woken = pdTRUE; }
+    return xTaskNotify(task, value, action);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t ticks){
+    struct host_task* t = xTaskGetCurrentTaskHandle();
+    int got;
+    pthread_mutex_lock(&t->lock);
+    if(!t->notifyPending){
+        t->notifyValue &= ~clearOnEntry;
+    }
+    got = host_notifyWait(t, ticks, 0);
+    if(value != NULL){
+        *value = t->notifyValue;
+    }
+    if(got){
+        t->notifyValue &= ~clearOnExit;
+        t->notifyPending = 0;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return got ? pdTRUE : pdFALSE;
+}
+
+//******************************* esp_timer (periodic timers are threads, unless host_timerManual)
+struct host_timer {
+    esp_timer_create_args_t args;
+    uint64_t period_us;
+    volatile int running;
+    int oneShot;
+    int64_t due_us;
+    volatile uint32_t generation;   //Tells a one shot's thread it was stopped or restarted meanwhile
+    pthread_t thread;
+};
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out){
+    struct host_timer* t = (struct host_timer*) calloc(1, sizeof(*t));
+    t->args = *args;
+    *out = t;
+    return ESP_OK;
+}
+
+static void* host_timerOnceThread(void* p){
+    struct host_timer* t = (struct host_timer*) p;
+    uint32_t generation = t->generation;
+    host_setIsrContext(1);
+    host_sleep_us(t->due_us - esp_timer_get_time());
+    if(t->running && t->generation == generation){
+        t->running = 0;
+        t->args.callback(t->args.arg);
+    }
+    return NULL;
+}
+
+static void* host_timerThread(void* p){
+    struct host_timer* t = (struct host_timer*) p;
+    int64_t next = host_monotonic_us();
+    host_setIsrContext(1);
+    while(t->running){
+        next += t->period_us;
+        host_sleep_us(next - host_monotonic_us());
+        if(t->running){
+            t->args.callback(t->args.arg);
+        }
+    }
+    return NULL;
+}
+
+int host_timerManual = 0;
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us){
+    timer->period_us = period_us;
+    timer->running = 1;
+    if(host_timerManual){
+        return ESP_OK;
+    }
+    if(pthread_create(&timer->thread, NULL, host_timerThread, timer) != 0){
+        return ESP_FAIL;
+    }
+    pthread_detach(timer->thread);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us){
+    if(timer->running){
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->oneShot = 1;
+    timer->due_us = esp_timer_get_time() + (int64_t) timeout_us;
+    timer->generation++;
+    timer->running = 1;
+    if(host_timerManual){
+        return ESP_OK;
+    }
+    if(pthread_create(&timer->thread, NULL, host_timerOnceThread, timer) != 0){
+        timer->running = 0;
+        return ESP_FAIL;
+    }
+    pthread_detach(timer->thread);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer){
+    timer->running = 0;
+    timer->generation++;
+    return ESP_OK;
+}
+
+void host_timerFire(esp_timer_handle_t timer){
+    int wasIsr = host_inIsr;
+    host_inIsr = 1;
+    if(timer->oneShot){
+        timer->running = 0;
+    }
+    timer->args.callback(timer->args.arg);
+    host_inIsr = wasIsr;
+}
+
+int64_t host_timerDue(esp_timer_handle_t timer){
+    return (timer->oneShot && timer->running) ? timer->due_us : -1;
+}
+
+//******************************* UART over pseudo-terminals
+static int host_uartFd[UART_NUM_MAX] = {-1, -1, -1};
+static int host_uartSlaveFd[UART_NUM_MAX] = {-1, -1, -1};
+static int host_uartBaud[UART_NUM_MAX] = {0, 0, 0};
+static char host_uartSlavePath[UART_NUM_MAX][64];
+
+const char* host_uartOpenPty(int port){
+    struct termios tio;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if(fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0){
+        return NULL;
+    }
+    snprintf(host_uartSlavePath[port], sizeof(host_uartSlavePath[port]), "%s", ptsname(fd));
+    //Hold the slave open so reads on the master don't fail with EIO before the peer connects,
+    //and make it raw so binary frames pass through untouched
+    host_uartSlaveFd[port] = open(host_uartSlavePath[port], O_RDWR | O_NOCTTY);
+    if(host_uartSlaveFd[port] >= 0 && tcgetattr(host_uartSlaveFd[port], &tio) == 0){
+        cfmakeraw(&tio);
+        tcsetattr(host_uartSlaveFd[port], TCSANOW, &tio);
+    }
+    host_uartFd[port] = fd;
+    return host_uartSlavePath[port];
+}
+
+void host_uartSetFd(int port, int fd)  { host_uartFd[port] = fd; }
+int host_uartGetBaud(int port)         { return host_uartBaud[port]; }
+
+esp_err_t uart_driver_install(uart_port_t port, int rxBuf, int txBuf, int queueSize, void* queue, int flags){
+    if(host_uartFd[port] < 0 && host_uartOpenPty(port) == NULL){
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t port, const uart_config_t* config){
+    host_uartBaud[port] = config->baud_rate;
+    return ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t port, int tx, int rx, int rts, int cts)  { return ESP_OK; }
+esp_err_t uart_set_baudrate(uart_port_t port, uint32_t baud)                { host_uartBaud[port] = (int) baud; return ESP_OK; }
+esp_err_t uart_get_baudrate(uart_port_t port, uint32_t* baud)              { *baud = (uint32_t) host_uartBaud[port]; return ESP_OK; }
+esp_err_t uart_wait_tx_done(uart_port_t port, TickType_t ticks)             { return ESP_OK; }
+
+//Drops only what is already waiting (a plain read would block on an idle line)
+esp_err_t uart_flush_input(uart_port_t port){
+    uint8_t junk[256];
+    struct pollfd pfd = { host_uartFd[port], POLLIN, 0 };
+    while(poll(&pfd, 1, 0) > 0 && read(host_uartFd[port], junk, sizeof(junk)) > 0);
+    return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t port, size_t* size){
+    int n = 0;
+    ioctl(host_uartFd[port], FIONREAD, &n);
+    *size = (size_t) n;
+    return ESP_OK;
+}
+
+//Same contract as the IDF driver: returns once length bytes arrived or the timeout ran out
+int uart_read_bytes(uart_port_t port, void* buf, uint32_t length, TickType_t ticks){
+    uint8_t* p = (uint8_t*) buf;
+    uint32_t got = 0;
+    int64_t deadline = host_monotonic_us() + ((int64_t) ticks)*1000;
+    while(got < length){
+        int64_t left_ms = (deadline - host_monotonic_us())/1000;
+        struct pollfd pfd = { host_uartFd[port], POLLIN, 0 };
+        if(left_ms < 0){
+            left_ms = 0;
+        }
+        if(poll(&pfd, 1, (int) left_ms) <= 0){
+            break;
+        }
+        ssize_t n = read(host_uartFd[port], p + got, length - got);
+        if(n <= 0){
+            break;
+        }
+        got += (uint32_t) n;
+    }
+    return (int) got;
+}
+
+int uart_write_bytes(uart_port_t port, const void* src, size_t size){
+    const uint8_t* p = (const uint8_t*) src;
+    size_t done = 0;
+    while(done < size){
+        ssize_t n = write(host_uartFd[port], p + done, size - done);
+        if(n < 0){
+            if(errno == EINTR || errno == EAGAIN) { continue; }
+            return -1;
+        }
+        done += (size_t) n;
+    }
+    return (int) size;
+}
+
+//******************************* GPIO
+volatile int host_gpioLevel[HOST_GPIO_COUNT];
+static gpio_isr_t host_gpioIsr[HOST_GPIO_COUNT];
+static void* host_gpioIsrArg[HOST_GPIO_COUNT];
+
+esp_err_t gpio_config(const gpio_config_t* conf)                          { return ESP_OK; }
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode)            { return ESP_OK; }
+esp_err_t gpio_set_pull_mode(gpio_num_t pin, gpio_pull_mode_t pull)       { return ESP_OK; }
+esp_err_t gpio_pullup_en(gpio_num_t pin)                                  { return ESP_OK; }
+esp_err_t gpio_pulldown_dis(gpio_num_t pin)                               { return ESP_OK; }
+esp_err_t gpio_set_intr_type(gpio_num_t pin, gpio_int_type_t type)        { return ESP_OK; }
+esp_err_t gpio_intr_enable(gpio_num_t pin)                                { return ESP_OK; }
+esp_err_t gpio_install_isr_service(int flags)                             { return ESP_OK; }
+int gpio_get_level(gpio_num_t pin)                                        { return host_gpioLevel[pin]; }
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level)                  { host_gpioLevel[pin] = (level != 0); return ESP_OK; }
+
+esp_err_t gpio_isr_handler_add(gpio_num_t pin, gpio_isr_t handler, void* arg){
+    host_gpioIsr[pin] = handler;
+    host_gpioIsrArg[pin] = arg;
+    return ESP_OK;
+}
+
+void host_gpioTriggerIsr(int pin){
+    if(host_gpioIsr[pin] != NULL){
+        int wasIsr = host_inIsr;
+        host_inIsr = 1;
+        host_gpioIsr[pin](host_gpioIsrArg[pin]);
+        host_inIsr = wasIsr;
+    }
+}
+
+//******************************* LEDC
+volatile uint32_t host_ledcDuty[HOST_LEDC_CHANNELS];
+static uint32_t host_ledcPendingDuty[HOST_LEDC_CHANNELS];
+volatile uint32_t host_ledcFreq = 0;
+volatile int host_ledcResolution = 0;
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t* conf){
+    host_ledcFreq = conf->freq_hz;
+    host_ledcResolution = conf->duty_resolution;
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t* conf){
+    host_ledcDuty[conf->channel] = conf->duty;
+    host_ledcPendingDuty[conf->channel] = conf->duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t mode, ledc_channel_t channel, uint32_t duty)   { host_ledcPendingDuty[channel] = duty; return ESP_OK; }
+esp_err_t ledc_update_duty(ledc_mode_t mode, ledc_channel_t channel)               { host_ledcDuty[channel] = host_ledcPendingDuty[channel]; return ESP_OK; }
+esp_err_t ledc_set_freq(ledc_mode_t mode, ledc_timer_t timer, uint32_t freq_hz)    { host_ledcFreq = freq_hz; return ESP_OK; }
+uint32_t ledc_get_freq(ledc_mode_t mode, ledc_timer_t timer)                       { return host_ledcFreq; }
+//Divider is 10.8 fixed point from the 80 MHz APB clock, as on the part
+esp_err_t ledc_timer_set(ledc_mode_t mode, ledc_timer_t timer, uint32_t clock_divider, uint32_t duty_resolution, ledc_clk_src_t clk_src) {
+    if ((clock_divider < 256) || (duty_resolution > 14)) { return ESP_ERR_INVALID_ARG; }
+    host_ledcResolution = (int) duty_resolution;
+    host_ledcFreq = (uint32_t) (((80000000ULL << 8) + ((uint64_t) clock_divider << duty_resolution) / 2) / ((uint64_t) clock_divider << duty_resolution));
+    return ESP_OK;
+}
+
+//******************************* NVS
+#define HOST_NVS_ENTRIES 32
+#define HOST_NVS_NAME_MAX 16
+#define HOST_NVS_BLOB_MAX 512
+struct host_nvsEntry {
+    char ns[HOST_NVS_NAME_MAX];
+    char key[HOST_NVS_NAME_MAX];
+    uint32_t len;                   //0: free
+    uint8_t data[HOST_NVS_BLOB_MAX];
+};
+static struct host_nvsEntry host_nvs[HOST_NVS_ENTRIES];
+static char host_nvsNs[HOST_NVS_ENTRIES][HOST_NVS_NAME_MAX];    //Namespace per handle (handle = index + 1)
+static int host_nvsLoaded = 0;
+const char* host_nvsPath = NULL;
+
+static void host_nvsLoad(void){
+    FILE* f;
+    if(host_nvsLoaded){
+        return;
+    }
+    host_nvsLoaded = 1;
+    if(host_nvsPath != NULL && (f = fopen(host_nvsPath, "rb")) != NULL){
+        if(fread(host_nvs, sizeof(host_nvs), 1, f) != 1){
+            memset(host_nvs, 0, sizeof(host_nvs));
+        }
+        fclose(f);
+    }
+}
+
+static struct host_nvsEntry* host_nvsFind(nvs_handle_t handle, const char* key, int create){
+    int i, spare = -1;
+    if(handle == 0 || handle > HOST_NVS_ENTRIES || strlen(key) >= HOST_NVS_NAME_MAX){
+        return NULL;
+    }
+    for(i=0;i<HOST_NVS_ENTRIES;i++){
+        if(host_nvs[i].len == 0){
+            if(spare < 0) { spare = i; }
+        }else if(strcmp(host_nvs[i].ns, host_nvsNs[handle - 1]) == 0 && strcmp(host_nvs[i].key, key) == 0){
+            return &host_nvs[i];
+        }
+    }
+    if(!create || spare < 0){
+        return NULL;
+    }
+    strcpy(host_nvs[spare].ns, host_nvsNs[handle - 1]);
+    strcpy(host_nvs[spare].key, key);
+    return &host_nvs[spare];
+}
+
+esp_err_t nvs_flash_init(void)  { host_nvsLoad(); return ESP_OK; }
+esp_err_t nvs_flash_erase(void) { memset(host_nvs, 0, sizeof(host_nvs)); host_nvsLoaded = 1; return ESP_OK; }
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t mode, nvs_handle_t* out){
+    int i;
+    host_nvsLoad();
+    if(strlen(name) >= HOST_NVS_NAME_MAX){
+        return ESP_ERR_INVALID_ARG;
+    }
+    for(i=0;i<HOST_NVS_ENTRIES;i++){
+        if(host_nvsNs[i][0] == '\0' || strcmp(host_nvsNs[i], name) == 0){
+            strcpy(host_nvsNs[i], name);
+            *out = (nvs_handle_t) (i + 1);
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out, size_t* length){
+    struct host_nvsEntry* e = host_nvsFind(handle, key, 0);
+    if(e == NULL){
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if(out == NULL){
+        *length = e->len;
+        return ESP_OK;
+    }
+    if(*length < e->len){
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out, e->data, e->len);
+    *length = e->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length){
+    struct host_nvsEntry* e;
+    if(length == 0 || length > HOST_NVS_BLOB_MAX){
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    if((e = host_nvsFind(handle, key, 1)) == NULL){
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    memcpy(e->data, value, length);
+    e->len = (uint32_t) length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key){
+    struct host_nvsEntry* e = host_nvsFind(handle, key, 0);
+    if(e == NULL){
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    memset(e, 0, sizeof(*e));
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle){
+    FILE* f;
+    if(host_nvsPath != NULL){
+        if((f = fopen(host_nvsPath, "wb")) == NULL){
+            return ESP_FAIL;
+        }
+        fwrite(host_nvs, sizeof(host_nvs), 1, f);
+        fclose(f);
+    }
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle) { }
@@ -0,0 +1,60 @@
+//Host (Linux) stand-in for the parts of ESP-IDF and FreeRTOS the firmware uses.
+//Tasks are pthreads, ticks are milliseconds of CLOCK_MONOTONIC, UARTs are pseudo-terminals,
+//GPIO and LEDC are plain arrays the host tools can poke and read back.
+#ifndef HOST_HAL_H_
+#define HOST_HAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define DMA_ATTR
+
+typedef int esp_err_t;
+#define ESP_OK   0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM        0x101
+#define ESP_ERR_INVALID_ARG   0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_TIMEOUT       0x107
+#define ESP_ERR_NVS_NOT_FOUND         0x1102
+#define ESP_ERR_NVS_INVALID_LENGTH    0x110c
+#define ESP_ERR_NVS_NO_FREE_PAGES     0x110d
+#define ESP_ERR_NVS_NEW_VERSION_FOUND 0x1110
+const char* esp_err_to_name(esp_err_t err);
+
+#define ESP_ERROR_CHECK(x) do { esp_err_t err_rc_ = (x); if (err_rc_ != ESP_OK) { \
+        fprintf(stderr, "ESP_ERROR_CHECK failed: %d at %s:%d\n", err_rc_, __FILE__, __LINE__); abort(); } } while(0)
+
+//Logging: 0 = errors only, 1 = +warnings, 2 = +info. Default 0 so logging doesn't skew timing.
+extern int host_logLevel;
+void host_log(int level, const char* tag, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+//Time
+extern int64_t (*host_timeSource_us)(void);     //Replaces the wall clock (replay/accelerated time)
+int64_t host_monotonic_us(void);
+
+//UART backed by pseudo-terminals. Returns the slave path the peer should open.
+const char* host_uartOpenPty(int port);
+void host_uartSetFd(int port, int fd);
+int host_uartGetBaud(int port);
+
+//GPIO/LEDC state
+#define HOST_GPIO_COUNT 64
+extern volatile int host_gpioLevel[HOST_GPIO_COUNT];
+void host_gpioTriggerIsr(int pin);              //Runs the handler registered with gpio_isr_handler_add
+#define HOST_LEDC_CHANNELS 8
+extern volatile uint32_t host_ledcDuty[HOST_LEDC_CHANNELS];
+extern volatile uint32_t host_ledcFreq;
+extern volatile int host_ledcResolution;
+
+//NVS: kept in memory, and in this file when set (loaded on the first nvs_open, written on every nvs_commit),
+//so a second run of a host tool sees what the first one stored, like a reboot
+extern const char* host_nvsPath;
+
+#endif
@@ -0,0 +1,36 @@
+//Stands in for itf_sd_card_writer.c in host tools that only exercise the comm stack:
+//records are counted and thrown away.
+#include <stdio.h>
+#include <string.h>
+#include "host_hal.h"
+#include "ctrl_subsystem.h"
+#include "itf_sd_card_writer.h"
+#include "itf_sd_session.h"
+
+volatile uint32_t host_sdShortRecords = 0;
+volatile uint32_t host_sdLongRecords = 0;
+
+//Sizes are typical encoded sizes, so the logging policy's budgets and bandwidth look realistic
+void itf_captureShortData(itf_logEdge_t* e) { memset(e, 0, sizeof(*e)); e->time_us = ctrl_getTime(); }
+void itf_captureLongData(itf_logLong_t* r)  { memset(r, 0, sizeof(*r)); r->time_us = ctrl_getTime(); }
+int itf_logEdgeRecord(const itf_logEdge_t* e) { (void) e; host_sdShortRecords++; return 6; }
+int itf_logLongRecord(const itf_logLong_t* r) { (void) r; host_sdLongRecords++; return 20; }
+int itf_logCommandRecord(uint64_t time_us, uint8_t cmd, uint8_t result, int32_t value) { (void) time_us; (void) cmd; (void) result; (void) value; return 8; }
+int itf_addShortData(void)              { host_sdShortRecords++; return 6; }
+int itf_addLongData(void)               { host_sdLongRecords++; return 20; }
+int itf_addToSD(char *toStore,int length) { (void) toStore; return length; }
+int itf_addTraceToSD(uint64_t time_us, uint16_t id, const uint32_t* args, int n) { (void) time_us; (void) id; (void) args; return 8 + 4*n; }
+void itf_writeTestMessage(char *str)    { (void) str; }
+void itf_sdRequest(uint32_t what)       { (void) what; }
+
+itf_sdWriterStats_t itf_sdWriterStats;
+const itf_storageOps_t* itf_storage = NULL;     //"log get" answers err=no_card
+int itf_logLiveSize(const char* name, uint32_t* bytes) { (void) name; (void) bytes; return 0; }
+void itf_sdBenchmark(int totalBytes)    { (void) totalBytes; printf("sd_bench err=not_mounted\n"); }
+void itf_sdBenchTransfers(int totalBytes) { (void) totalBytes; printf("sd_xfer err=not_mounted\n"); }
+
+//No card on the host: empty directory cache
+int itf_sessionCurrent(uint16_t* session, uint8_t* part) { *session = 0; *part = 0; return 0; }
+int itf_sessionFileCount(void)          { return 0; }
+const itf_sessionFile_t* itf_sessionFileAt(int i) { (void) i; return NULL; }
+int64_t itf_sessionScanTime_us(void)    { return 0; }
@@ -0,0 +1,4 @@
+#ifndef HOST_SDKCONFIG_H_
+#define HOST_SDKCONFIG_H_
+//No menuconfig on the host: every CONFIG_ option the firmware tests is off
+#endif
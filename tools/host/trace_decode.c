@@ -0,0 +1,432 @@
+//Formats binary trace messages (main/itf_trace.h) with the string table from main/itf_trace_ids.h.
+//Build from the repo root:
+//  gcc -O2 -Wall -Wno-format -pthread -Itools/host/shim -Itools/host -Imain -o trace_decode
+//      tools/host/trace_decode.c tools/host/log_file.c tools/host/shim/host_hal.c
+//      tools/host/shim/host_sd_stub.c main/itf_trace.c main/itf_log_codec.c main/itf_crc.c
+//      main/itf_log_policy.c main/itf_sd_ring.c main/ctrl_subsystem.c main/ctrl_speed_pi.c main/ctrl_autotune.c
+//      main/ctrl_params.c main/ctrl_sensorless.c main/ctrl_pwm.c main/itf_seven_seg.c -lm
+//
+//  ./trace_decode S0003_00.BIN ...           trace records from session logs (SD sink)
+//  ./trace_decode --uart [capture.txt]       "trc ..." lines from a UART0 capture (stdin if no file),
+//                                            everything else passed through
+//  ./trace_decode --table > table.txt        the string table this build knows
+//  ./trace_decode --table-file table.txt ... decode with a saved table (logs from older firmware)
+//  ./trace_decode --bench [calls]            ring torture test, per-call cost, hall ISR time with
+//                                            and without a trace per edge
+//Messages come out like ESP_LOG printed them: "E (12345) CTRL: ERROR: BATTERY UNDERVOLTAGE (38.500000)"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "host_hal.h"
+#include "driver/gpio.h"
+#include "ctrl_subsystem.h"
+#include "itf_log_codec.h"
+#include "itf_trace.h"
+#include "log_file.h"
+
+#define MAX_IDS 1024
+#define LINE_MAX_LEN 512
+#define HALL_PIN_A 42
+#define HALL_PIN_B 41
+#define HALL_PIN_C 40
+
+typedef struct {
+    const char* name;
+    const char* tag;
+    char level;
+    const char* fmt;
+} traceDef_t;
+
+#define TRACE_ROW(name, tag, level, fmt) {#name, tag, level, fmt},
+static const traceDef_t builtinTable[] = { ITF_TRACE_TABLE(TRACE_ROW) };
+#undef TRACE_ROW
+
+static traceDef_t table[MAX_IDS];
+static int tableLen = 0;
+
+static void useBuiltinTable(void){
+    tableLen = (int) (sizeof(builtinTable)/sizeof(builtinTable[0]));
+    memcpy(table, builtinTable, sizeof(builtinTable));
+}
+
+//---------------------------------------------------------------- String table
+
+//Tabs and line ends inside a format are escaped, so one message is one line
+static void printEscaped(const char* s){
+    for(;*s;s++){
+        if(*s == '\t') fputs("\\t", stdout);
+        else if(*s == '\n') fputs("\\n", stdout);
+        else if(*s == '\\') fputs("\\\\", stdout);
+        else putchar(*s);
+    }
+}
+
+static void unescape(char* s){
+    char* out = s;
+    for(;*s;s++){
+        if(*s == '\\' && s[1] != '\0'){
+            s++;
+            *out++ = (*s == 't') ? '\t' : (*s == 'n') ? '\n' : *s;
+        }else{
+            *out++ = *s;
+        }
+    }
+    *out = '\0';
+}
+
+static void printTable(void){
+    int i;
+    for(i=0;i<tableLen;i++){
+        printf("%d\t%s\t%s\t%c\t", i, table[i].name, table[i].tag, table[i].level);
+        printEscaped(table[i].fmt);
+        printf("\n");
+    }
+}
+
+//Lines as printed by --table: id, name, tag, level, format
+static int loadTable(const char* path){
+    char line[LINE_MAX_LEN];
+    FILE* f = fopen(path, "r");
+    if(f == NULL){
+        perror(path);
+        return 0;
+    }
+    tableLen = 0;
+    while(fgets(line, sizeof(line), f) != NULL){
+        char* field[5];
+        int n = 0;
+        char* p = line;
+        line[strcspn(line, "\r\n")] = '\0';
+        while(n < 5){
+            field[n++] = p;
+            p = (n < 5) ? strchr(p, '\t') : NULL;
+            if(p == NULL) break;
+            *p++ = '\0';
+        }
+        int id = atoi(field[0]);
+        if(n < 5 || id < 0 || id >= MAX_IDS){
+            continue;
+        }
+        unescape(field[4]);
+        table[id].name = strdup(field[1]);
+        table[id].tag = strdup(field[2]);
+        table[id].level = field[3][0];
+        table[id].fmt = strdup(field[4]);
+        if(id >= tableLen) tableLen = id + 1;
+    }
+    fclose(f);
+    return 1;
+}
+
+//---------------------------------------------------------------- Formatting
+
+//One argument word per conversion, the way itf_trace_ids.h describes
+static int formatMessage(char* out, int size, uint16_t id, const uint32_t* args, int n){
+    int len = 0, used = 0;
+    const char* f;
+    if(id >= tableLen || table[id].fmt == NULL){
+        len = snprintf(out, size, "? (id %u)", (unsigned) id);
+        for(used=0;used<n && len < size;used++){
+            len += snprintf(out + len, size - len, " %08lx", (unsigned long) args[used]);
+        }
+        return len;
+    }
+    for(f=table[id].fmt;*f && len < size - 1;f++){
+        if(*f != '%'){
+            out[len++] = *f;
+            continue;
+        }
+        if(f[1] == '%'){
+            out[len++] = '%';
+            f++;
+            continue;
+        }
+        char spec[32];
+        int s = 0;
+        spec[s++] = *f++;
+        while(*f && strchr("-+ #0123456789.", *f) && s < (int) sizeof(spec) - 2){
+            spec[s++] = *f++;
+        }
+        while(*f && strchr("hlLqjzt", *f)){
+            f++;                //Length modifiers don't matter, every argument is one word
+        }
+        if(*f == '\0'){
+            break;
+        }
+        spec[s++] = *f;
+        spec[s] = '\0';
+        int room = size - len;
+        if(used >= n){
+            len += snprintf(out + len, room, "<?>");
+        }else if(strchr("diouxXc", *f)){
+            len += snprintf(out + len, room, spec, (*f == 'd' || *f == 'i' || *f == 'c') ? (int) (int32_t) args[used] : (unsigned) args[used]);
+            used++;
+        }else if(strchr("fFeEgGaA", *f)){
+            union { uint32_t u; float f; } v;
+            v.u = args[used++];
+            len += snprintf(out + len, room, spec, (double) v.f);
+        }else{
+            len += snprintf(out + len, room, "<%%%c?>", *f);
+            used++;
+        }
+    }
+    if(len >= size) len = size - 1;
+    out[len] = '\0';
+    return len;
+}
+
+static void printMessage(uint64_t time_us, uint16_t id, const uint32_t* args, int n){
+    char text[LINE_MAX_LEN];
+    formatMessage(text, sizeof(text), id, args, n);
+    if(id < tableLen && table[id].tag != NULL){
+        printf("%c (%llu) %s: %s\n", table[id].level, (unsigned long long) (time_us/1000), table[id].tag, text);
+    }else{
+        printf("? (%llu) %s\n", (unsigned long long) (time_us/1000), text);
+    }
+}
+
+//---------------------------------------------------------------- Inputs
+
+typedef struct {
+    unsigned long messages, unknown;
+} counts_t;
+
+static void traceRecord(const itf_logRecord_t* r, void* ctx){
+    counts_t* c = (counts_t*) ctx;
+    uint32_t args[ITF_TRACE_MAX_ARGS];
+    int n = 0, i;
+    if(r->tag != ITF_LOG_TAG_TRACE){
+        return;
+    }
+    for(i=0;i+4<=r->rawLen && n<ITF_TRACE_MAX_ARGS;i+=4){
+        args[n++] = r->raw[i] | (r->raw[i+1] << 8) | (r->raw[i+2] << 16) | ((uint32_t) r->raw[i+3] << 24);
+    }
+    c->messages++;
+    c->unknown += (r->traceId >= tableLen);
+    printMessage(r->time_us, r->traceId, args, n);
+}
+
+static int decodeFile(const char* path){
+    logFile_t lf;
+    counts_t c;
+    itf_logBlockInfo_t info;
+    uint32_t blockNo, lastSeq = 0;
+    int haveSeq = 0;
+
+    if(logFileOpen(&lf, path) != 0){
+        fprintf(stderr, "%s: no log file header\n", path);
+        return 1;
+    }
+    if(lf.info.schema < 3){
+        fprintf(stderr, "%s: schema %d, written before trace records existed\n", path, lf.info.schema);
+    }
+    uint8_t* block = malloc(lf.blockSize);
+    memset(&c, 0, sizeof(c));
+    for(blockNo=1;blockNo<=lf.lastData;blockNo++){
+        if(logFileReadBlock(&lf, blockNo, block, &info) != 1){
+            continue;
+        }
+        if(haveSeq && info.seq < lastSeq){
+            continue;           //Left over from a file that used these clusters before
+        }
+        lastSeq = info.seq;
+        haveSeq = 1;
+        itf_logDecodeBlock(block, (int) lf.blockSize, traceRecord, &c);
+    }
+    fprintf(stderr, "%s: messages=%lu unknown_ids=%lu\n", path, c.messages, c.unknown);
+    free(block);
+    logFileClose(&lf);
+    return 0;
+}
+
+//"trc <time_us> <id> <hex words>" as written by itf_traceFormatLine
+static int decodeUart(const char* path){
+    char line[LINE_MAX_LEN];
+    FILE* f = (path == NULL) ? stdin : fopen(path, "r");
+    unsigned long messages = 0;
+    if(f == NULL){
+        perror(path);
+        return 1;
+    }
+    while(fgets(line, sizeof(line), f) != NULL){
+        unsigned long long t;
+        unsigned id;
+        int pos;
+        const char* p = strstr(line, "trc ");
+        if(p == NULL || sscanf(p, "trc %llu %u%n", &t, &id, &pos) != 2){
+            fputs(line, stdout);
+            continue;
+        }
+        uint32_t args[ITF_TRACE_MAX_ARGS];
+        int n = 0, step;
+        unsigned long v;
+        p += pos;
+        while(n < ITF_TRACE_MAX_ARGS && sscanf(p, " %lx%n", &v, &step) == 1){
+            args[n++] = (uint32_t) v;
+            p += step;
+        }
+        printMessage(t, (uint16_t) id, args, n);
+        messages++;
+    }
+    if(f != stdin) fclose(f);
+    fprintf(stderr, "uart: messages=%lu\n", messages);
+    return 0;
+}
+
+//---------------------------------------------------------------- Bench
+
+#define BENCH_PRODUCERS 4
+#define BENCH_ISR_EDGES 200000
+
+static volatile int benchDone = 0;
+static int benchPerProducer = 0;
+
+//Each producer traces (producer, sequence, ~sequence), so torn or reordered slots show up
+static void* benchProducer(void* arg){
+    uint32_t who = (uint32_t) (uintptr_t) arg;
+    int i;
+    for(i=0;i<benchPerProducer;i++){
+        itf_tracePut(ITF_TRC_COM_MCU_CRC, 3, who, (uint32_t) i, ~(uint32_t) i, 0);
+        if((i & 31) == 31){
+            sched_yield();      //Give the drain a look in, or a single core host only tests the full ring
+        }
+    }
+    return NULL;
+}
+
+static int ringTorture(int perProducer){
+    pthread_t th[BENCH_PRODUCERS];
+    uint32_t last[BENCH_PRODUCERS];
+    itf_traceStats_t st;
+    itf_traceMsg_t m;
+    unsigned long got = 0, bad = 0;
+    int i, done = 0;
+
+    benchPerProducer = perProducer;
+    for(i=0;i<BENCH_PRODUCERS;i++){
+        last[i] = UINT32_MAX;
+        pthread_create(&th[i], NULL, benchProducer, (void*) (uintptr_t) i);
+    }
+    while(1){
+        while(itf_traceGet(&m)){
+            got++;
+            if(m.id != ITF_TRC_COM_MCU_CRC || m.n != 3 || m.args[0] >= BENCH_PRODUCERS || m.args[2] != ~m.args[1]){
+                bad++;
+                continue;
+            }
+            //Drops leave gaps, but one producer's messages never come out of order
+            if(last[m.args[0]] != UINT32_MAX && m.args[1] <= last[m.args[0]]){
+                bad++;
+            }
+            last[m.args[0]] = m.args[1];
+        }
+        if(done){
+            break;
+        }
+        itf_traceGetStats(&st);
+        if(st.put + st.dropped >= (uint32_t) (perProducer*BENCH_PRODUCERS)){
+            done = 1;           //One more pass for the last slots
+        }
+    }
+    for(i=0;i<BENCH_PRODUCERS;i++){
+        pthread_join(th[i], NULL);
+    }
+    itf_traceGetStats(&st);
+    int ok = (bad == 0 && got == st.put && st.put + st.dropped == (uint32_t) (perProducer*BENCH_PRODUCERS));
+    printf("trace_ring producers=%d messages=%d drained=%lu dropped=%lu bad=%lu result=%s\n", BENCH_PRODUCERS,
+           perProducer*BENCH_PRODUCERS, got, (unsigned long) st.dropped, bad, ok ? "ok" : "FAIL");
+    return !ok;
+}
+
+static void setHall(uint8_t hall){
+    host_gpioLevel[HALL_PIN_A] = hall & 1;
+    host_gpioLevel[HALL_PIN_B] = (hall >> 1) & 1;
+    host_gpioLevel[HALL_PIN_C] = (hall >> 2) & 1;
+}
+
+//Hall edges through the real ctrl_hall_isr, stepping the sequence one way and then the other:
+//one direction is all good commutations, the other is all skips and traces a message per edge
+static void isrBench(void){
+    static const uint8_t seq[6] = {1, 3, 2, 6, 4, 5};
+    ctrl_isrStats_t isr[2];
+    uint32_t traced[2];
+    itf_traceStats_t before, after;
+    int dir, i, k = 0;
+
+    host_timerManual = 1;
+    setHall(seq[0]);
+    init_control_subsystem();
+    itf_traceSetSinks(0);
+    for(dir=0;dir<2;dir++){
+        itf_traceDrain();
+        itf_traceGetStats(&before);
+        ctrl_resetHallIsrStats();
+        for(i=0;i<BENCH_ISR_EDGES;i++){
+            k = (dir == 0) ? (k + 1) % 6 : (k + 5) % 6;
+            setHall(seq[k]);
+            host_gpioTriggerIsr(HALL_PIN_A);
+            if((i & 63) == 63){
+                itf_traceDrain();
+            }
+        }
+        ctrl_getHallIsrStats(&isr[dir]);
+        itf_traceDrain();
+        itf_traceGetStats(&after);
+        traced[dir] = (after.put + after.dropped) - (before.put + before.dropped);
+    }
+    for(dir=0;dir<2;dir++){
+        printf("trace_isr direction=%d edges=%lu traced=%lu isr_avg_ns=%.0f isr_max_ns=%lu\n", dir,
+               (unsigned long) isr[dir].edges, (unsigned long) traced[dir],
+               ((double) isr[dir].cyclesTotal)/isr[dir].edges, (unsigned long) isr[dir].cyclesMax);
+    }
+}
+
+//---------------------------------------------------------------- Main
+
+int main(int argc, char** argv){
+    int i, bad = 0, files = 0, uart = 0;
+    const char* uartPath = NULL;
+    useBuiltinTable();
+    host_logLevel = -1;
+    if(argc >= 2 && strcmp(argv[1], "--bench") == 0){
+        int calls = (argc >= 3) ? atoi(argv[2]) : 1000000;
+        bad |= ringTorture(200000);
+        isrBench();
+        itf_traceBenchmark(calls);
+        return bad;
+    }
+    for(i=1;i<argc;i++){
+        if(!strcmp(argv[i], "--table")){
+            printTable();
+            return 0;
+        }else if(!strcmp(argv[i], "--table-file") && i+1 < argc){
+            if(!loadTable(argv[++i])) return 1;
+        }else if(!strcmp(argv[i], "--uart")){
+            uart = 1;
+            if(i+1 < argc && argv[i+1][0] != '-') uartPath = argv[++i];
+        }else if(argv[i][0] == '-'){
+            files = -1;
+            break;
+        }else{
+            files++;
+        }
+    }
+    if(files < 0 || (files == 0 && !uart)){
+        fprintf(stderr, "usage: %s [--table-file table.txt] S0001_00.BIN... | --uart [capture.txt] | --table | --bench [calls]\n", argv[0]);
+        return 2;
+    }
+    if(uart){
+        return decodeUart(uartPath);
+    }
+    for(i=1;i<argc;i++){
+        if(!strcmp(argv[i], "--table-file")){
+            i++;
+        }else{
+            bad |= decodeFile(argv[i]);
+        }
+    }
+    return bad;
+}